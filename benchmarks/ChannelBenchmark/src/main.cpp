@@ -0,0 +1,153 @@
+//          Copyright Jeremy Coulon 2012-2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+//==============
+//==  Plugin  ==
+//==============
+#include "Plugin/EventBus.h"
+#include "Plugin/PluginChannel.h"
+
+//===========
+//==  STD  ==
+//===========
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <stdint.h>
+
+namespace
+{
+    typedef std::chrono::steady_clock Clock;
+
+    double seconds(Clock::duration duration)
+    {
+        return std::chrono::duration<double>(duration).count();
+    }
+
+    // Stream messages from a producer thread to the calling thread, in batches
+    double channelThroughput(uint64_t messages, std::size_t batchSize)
+    {
+        Plugin::PluginChannel channel(sizeof(uint64_t), 4096);
+        Clock::time_point start = Clock::now();
+        std::thread producer([&channel, messages, batchSize]()
+        {
+            Plugin::ChannelWriter<uint64_t> writer(channel.descriptor());
+            std::vector<uint64_t> batch(batchSize);
+            uint64_t next = 0;
+            while (next < messages)
+            {
+                std::size_t n = static_cast<std::size_t>(std::min<uint64_t>(batchSize, messages - next));
+                for (std::size_t i = 0; i < n; ++i)
+                    batch[i] = next + i;
+                std::size_t pushed = writer.push(batch.data(), n);
+                next += pushed;
+                if (pushed == 0)
+                    std::this_thread::yield();
+            }
+        });
+
+        Plugin::ChannelReader<uint64_t> reader(channel.descriptor());
+        std::vector<uint64_t> batch(batchSize);
+        uint64_t received = 0;
+        uint64_t checksum = 0;
+        while (received < messages)
+        {
+            std::size_t n = reader.pop(batch.data(), batchSize);
+            for (std::size_t i = 0; i < n; ++i)
+                checksum += batch[i];
+            received += n;
+            if (n == 0)
+                std::this_thread::yield();
+        }
+        producer.join();
+        if (checksum != messages * (messages - 1) / 2)
+            std::cout << "Corrupted stream" << std::endl;
+        return messages / seconds(Clock::now() - start);
+    }
+
+    void countEvents(void* userData, const PluginEvent*, size_t count)
+    {
+        static_cast<std::atomic<uint64_t>*>(userData)->fetch_add(count, std::memory_order_relaxed);
+    }
+
+    // Same stream through the event bus, for comparison
+    double busThroughput(uint64_t messages)
+    {
+        const uint64_t topic = PLUGIN_TOPIC_ID("Benchmark.Stream");
+        Plugin::EventBus bus(1, 4096, sizeof(uint64_t));
+        std::atomic<uint64_t> received(0);
+        bus.subscribe(topic, &countEvents, &received);
+        Clock::time_point start = Clock::now();
+        std::thread producer([&bus, messages, topic]()
+        {
+            for (uint64_t i = 0; i < messages; ++i)
+                while (bus.publish(topic, &i, sizeof(i)) != Plugin::eventPublished)
+                    std::this_thread::yield();
+        });
+        while (received.load(std::memory_order_relaxed) < messages)
+            if (bus.dispatch(256) == 0)
+                std::this_thread::yield();
+        producer.join();
+        return messages / seconds(Clock::now() - start);
+    }
+
+    // One-way latency measured as half of a round trip through two channels
+    std::vector<long long> channelLatency(std::size_t iterations)
+    {
+        Plugin::PluginChannel ping(sizeof(uint64_t), 64);
+        Plugin::PluginChannel pong(sizeof(uint64_t), 64);
+        std::thread echo([&ping, &pong, iterations]()
+        {
+            Plugin::ChannelReader<uint64_t> reader(ping.descriptor());
+            Plugin::ChannelWriter<uint64_t> writer(pong.descriptor());
+            uint64_t value = 0;
+            for (std::size_t i = 0; i < iterations; ++i)
+            {
+                while (!reader.pop(value))
+                    std::this_thread::yield();
+                writer.push(value);
+            }
+        });
+
+        Plugin::ChannelWriter<uint64_t> writer(ping.descriptor());
+        Plugin::ChannelReader<uint64_t> reader(pong.descriptor());
+        std::vector<long long> samples(iterations);
+        uint64_t value = 0;
+        for (std::size_t i = 0; i < iterations; ++i)
+        {
+            Clock::time_point start = Clock::now();
+            writer.push(static_cast<uint64_t>(i));
+            while (!reader.pop(value))
+                std::this_thread::yield();
+            samples[i] = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count() / 2;
+        }
+        echo.join();
+        std::sort(samples.begin(), samples.end());
+        return samples;
+    }
+}
+
+// Measure the throughput and latency of plugin-to-plugin channels
+int main(int argc, char** argv)
+{
+    uint64_t messages = argc > 1 ? std::strtoull(argv[1], NULL, 10) : 10000000;
+    std::size_t iterations = argc > 2 ? std::strtoul(argv[2], NULL, 10) : 100000;
+
+    std::cout << "Channel, batch of 1  : " << channelThroughput(messages, 1) / 1e6 << " M messages/s" << std::endl;
+    std::cout << "Channel, batch of 64 : " << channelThroughput(messages, 64) / 1e6 << " M messages/s" << std::endl;
+    std::cout << "Event bus            : " << busThroughput(messages) / 1e6 << " M messages/s" << std::endl;
+
+    std::vector<long long> samples = channelLatency(iterations);
+    std::cout << "Channel latency      : p50 = " << samples[samples.size() / 2] << " ns"
+              << ", p99 = " << samples[samples.size() * 99 / 100] << " ns"
+              << ", max = " << samples.back() << " ns" << std::endl;
+    return 0;
+}
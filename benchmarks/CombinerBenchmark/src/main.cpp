@@ -0,0 +1,110 @@
+//          Copyright Jeremy Coulon 2012-2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+//==============
+//==  Plugin  ==
+//==============
+#include "Plugin/CallCombiner.h"
+
+//===========
+//==  STD  ==
+//===========
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <future>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <stdint.h>
+
+namespace
+{
+    typedef std::chrono::steady_clock Clock;
+
+    double seconds(Clock::duration duration)
+    {
+        return std::chrono::duration<double>(duration).count();
+    }
+
+    // Plugin that is not thread-safe, touching a few cache lines per call
+    class Histogram
+    {
+    public:
+        Histogram()
+            : buckets_(64, 0)
+        {
+            // Empty
+        }
+
+        uint64_t record(uint64_t value)
+        {
+            return ++buckets_[(value * 2654435761u) % buckets_.size()];
+        }
+
+    private:
+        std::vector<uint64_t> buckets_;
+    };
+
+    // Run f(thread, call) on several threads, and return the calls per second
+    template<class F>
+    double throughput(unsigned int threads, uint64_t calls, F f)
+    {
+        Clock::time_point start = Clock::now();
+        std::vector<std::thread> workers;
+        for (unsigned int t = 0; t < threads; ++t)
+        {
+            workers.push_back(std::thread([&f, t, calls]()
+            {
+                for (uint64_t i = 0; i < calls; ++i)
+                    f(t, i);
+            }));
+        }
+        for (std::size_t t = 0; t < workers.size(); ++t)
+            workers[t].join();
+        return threads * calls / seconds(Clock::now() - start);
+    }
+}
+
+// Compare serializing calls to a plugin with a mutex and with a call combiner
+int main(int argc, char** argv)
+{
+    unsigned int threads = argc > 1 ? std::atoi(argv[1]) : std::max(2u, std::thread::hardware_concurrency());
+    uint64_t calls = argc > 2 ? std::strtoull(argv[2], NULL, 10) : 1000000;
+
+    Histogram histogram;
+    std::mutex mutex;
+    double locked = throughput(threads, calls, [&histogram, &mutex](unsigned int, uint64_t i)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        histogram.record(i);
+    });
+
+    double posted = 0;
+    double futures = 0;
+    {
+        Plugin::CallCombiner<Histogram> combiner(&histogram);
+        posted = throughput(threads, calls, [&combiner](unsigned int, uint64_t i)
+        {
+            combiner.post([i](Histogram* h) { h->record(i); });
+        });
+        futures = throughput(threads, calls / 16, [&combiner](unsigned int, uint64_t i)
+        {
+            // Keep a few calls in flight, as a caller overlapping work with the plugin would
+            std::future<uint64_t> pending = combiner.call([i](Histogram* h) { return h->record(i); });
+            if (i % 16 == 15)
+                pending.get();
+        });
+        std::cout << "Calls per combining pass : " << static_cast<double>(combiner.getCallCount()) / combiner.getPassCount() << std::endl;
+    }
+
+    std::cout << threads << " threads" << std::endl;
+    std::cout << "Mutex                    : " << locked / 1e6 << " M calls/s" << std::endl;
+    std::cout << "Combiner, posted calls   : " << posted / 1e6 << " M calls/s" << std::endl;
+    std::cout << "Combiner, with futures   : " << futures / 1e6 << " M calls/s" << std::endl;
+    return 0;
+}
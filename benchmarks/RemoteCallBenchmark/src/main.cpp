@@ -0,0 +1,93 @@
+//          Copyright Jeremy Coulon 2012-2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+//==============
+//==  Plugin  ==
+//==============
+#include "Plugin/IPluginDescription.h"
+#include "Plugin/PluginLoader.h"
+#include "Plugin/RemotePlugin.h"
+
+//===========
+//==  STD  ==
+//===========
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace
+{
+    typedef std::chrono::steady_clock Clock;
+
+    // Print mean and percentiles of a set of durations in nanoseconds
+    void report(const std::string& title, std::vector<long long>& samples)
+    {
+        std::sort(samples.begin(), samples.end());
+        long long total = 0;
+        for (std::size_t i = 0; i < samples.size(); ++i)
+            total += samples[i];
+        std::cout << title
+                  << ": mean = " << total / static_cast<long long>(samples.size()) << " ns"
+                  << ", p50 = " << samples[samples.size() / 2] << " ns"
+                  << ", p99 = " << samples[samples.size() * 99 / 100] << " ns"
+                  << ", max = " << samples.back() << " ns" << std::endl;
+    }
+
+    template<class F>
+    std::vector<long long> measure(std::size_t iterations, F f)
+    {
+        std::vector<long long> samples(iterations);
+        for (std::size_t i = 0; i < iterations; ++i)
+        {
+            Clock::time_point start = Clock::now();
+            f();
+            samples[i] = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+        }
+        return samples;
+    }
+}
+
+// Compare the round-trip time of a call to an in-process plugin
+// and to the same plugin hosted in a separate process.
+int main(int argc, char** argv)
+{
+    if (argc < 3)
+    {
+        std::cout << "Usage: " << argv[0] << " ./path/myPlugin.<ext> ./path/PluginHost [iterations]" << std::endl;
+        return 0;
+    }
+    std::string pluginPath(argv[1]);
+    std::string hostPath(argv[2]);
+    std::size_t iterations = argc > 3 ? std::strtoul(argv[3], NULL, 10) : 100000;
+
+    Plugin::PluginLoader<Plugin::IPlugin> loader(pluginPath);
+    Plugin::IPlugin* plugin = loader.load() ? loader.getPluginInstance() : NULL;
+    if (!plugin)
+    {
+        std::cout << "Failed to load plugin = " << pluginPath << std::endl;
+        std::cout << "Reason = " << loader.getErrorMsg() << std::endl;
+        return 1;
+    }
+
+    Plugin::RemotePluginLoader<Plugin::IPlugin> remote(pluginPath, hostPath);
+    if (!remote.load())
+    {
+        std::cout << "Failed to start plugin host = " << hostPath << std::endl;
+        std::cout << "Reason = " << remote.getErrorMsg() << std::endl;
+        return 1;
+    }
+
+    // Both variants return the name by value, so that only the transport differs
+    std::string name;
+    std::vector<long long> local = measure(iterations, [&]() { name = plugin->iGetPluginName(); });
+    std::vector<long long> distant = measure(iterations, [&]() { name = remote.call(&Plugin::IPlugin::iGetPluginName); });
+
+    report("In-process     ", local);
+    report("Out-of-process ", distant);
+    return 0;
+}
@@ -0,0 +1,84 @@
+//          Copyright Jeremy Coulon 2012-2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+//==============
+//==  Plugin  ==
+//==============
+#include "Plugin/CallWatchdog.h"
+#include "Plugin/InterfaceDescription.h"
+#include "Plugin/PluginInterceptor.h"
+
+//===========
+//==  STD  ==
+//===========
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+
+#include <stdint.h>
+
+namespace
+{
+    typedef std::chrono::steady_clock Clock;
+
+    class ICounter
+    {
+    public:
+        virtual ~ICounter() {}
+        virtual uint64_t add(uint64_t value) = 0;
+    };
+
+    class Counter : public ICounter
+    {
+    public:
+        Counter()
+            : total_(0)
+        {
+            // Empty
+        }
+
+        virtual uint64_t add(uint64_t value)
+        {
+            return total_ += value;
+        }
+
+    private:
+        uint64_t total_;
+    };
+
+    // Run f(i) and return the nanoseconds per call
+    template<class F>
+    double nsPerCall(uint64_t calls, F f)
+    {
+        Clock::time_point start = Clock::now();
+        for (uint64_t i = 0; i < calls; ++i)
+            f(i);
+        return std::chrono::duration<double, std::nano>(Clock::now() - start).count() / calls;
+    }
+}
+
+PLUGIN_INTERFACE_DESCRIPTION(ICounter, (add))
+
+// Compare direct plugin calls with calls monitored by a watchdog
+int main(int argc, char** argv)
+{
+    uint64_t calls = argc > 1 ? std::strtoull(argv[1], NULL, 10) : 10000000;
+
+    Counter counter;
+    ICounter* plugin = &counter;
+    Plugin::CallWatchdog watchdog;
+    Plugin::WatchedPlugin<ICounter> watched(watchdog, "Counter", std::chrono::milliseconds(100), plugin);
+    Plugin::PluginInterceptor<ICounter> intercepted(plugin);
+
+    double direct = nsPerCall(calls, [plugin](uint64_t i) { plugin->add(i); });
+    double monitored = nsPerCall(calls, [&watched](uint64_t i) { watched.call(&ICounter::add, i); });
+    double recorded = nsPerCall(calls, [&intercepted](uint64_t i) { intercepted.call(&ICounter::add, i); });
+
+    std::cout << "Direct call              : " << direct << " ns" << std::endl;
+    std::cout << "Watched call             : " << monitored << " ns" << std::endl;
+    std::cout << "Latency interceptor call : " << recorded << " ns" << std::endl;
+    std::cout << "Total                    : " << counter.add(0) << std::endl;
+    return 0;
+}
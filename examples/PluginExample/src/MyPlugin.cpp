@@ -10,6 +10,9 @@
 // Define plugin factory. Must be in the global namespace.
 PLUGIN_FACTORY_DEFINITION( Example::MyPlugin )
 
+// Define the entry point receiving the host services. They are then available through globalHostServices.
+PLUGIN_HOST_SERVICES_DEFINITION()
+
 Example::MyPlugin::MyPlugin()
     : name_("Example")
     , version_(1, 3, 4, 2)
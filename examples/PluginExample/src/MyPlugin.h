@@ -9,6 +9,7 @@
 //==============
 #include "Plugin/IPlugin.h"
 #include "Plugin/PluginFactory.h"
+#include "Plugin/PluginHostServices.h"
 
 namespace Example
 {
@@ -39,4 +40,8 @@ namespace Example
 // This factory implements a Singleton design pattern. There will be only one instance of MyPlugin during execution of the program.
 // Declare plugin factory. Must be in the global namespace.
 PLUGIN_FACTORY_DECLARATION( Example::MyPlugin )
+
+// Optionally, call the macro PLUGIN_HOST_SERVICES_DECLARATION() to receive the services offered by the host,
+// such as the event bus. They are given to the plugin when it is loaded, before the facade is created.
+PLUGIN_HOST_SERVICES_DECLARATION()
 //]
@@ -0,0 +1,761 @@
+//          Copyright Jeremy Coulon 2012-2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+/** @file */
+
+#pragma once
+
+//==============
+//==  Plugin  ==
+//==============
+#include "Plugin/LibraryInfo.h"
+#include "Plugin/PluginLoader.h"
+#include "Plugin/UnaccountedScope.h"
+
+//=============
+//==  Boost  ==
+//=============
+#include <boost/noncopyable.hpp>
+
+//===========
+//==  STD  ==
+//===========
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <new>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+//=======================
+//==  OS Specific SDK  ==
+//=======================
+#ifdef __GLIBC__
+#include <execinfo.h>
+#endif
+
+/// Namespace of the Plugin library
+namespace Plugin
+{
+    /// Snapshot of the allocation counters of an account
+    struct AllocationStats
+    {
+        /// Bytes currently allocated
+        std::size_t liveBytes;
+        /// Highest value reached by liveBytes
+        std::size_t peakBytes;
+        /// Cumulative number of allocated bytes
+        std::size_t allocatedBytes;
+        /// Cumulative number of allocations
+        std::size_t allocations;
+        /// Cumulative number of deallocations
+        std::size_t deallocations;
+        /// Time of the snapshot in nanoseconds (steady clock)
+        long long timestamp;
+    };
+
+    /// Allocation rate in bytes per second between two snapshots of the same account
+    inline double allocationRate(const AllocationStats& before, const AllocationStats& after)
+    {
+        if (after.timestamp <= before.timestamp)
+            return 0.0;
+        return static_cast<double>(after.allocatedBytes - before.allocatedBytes) * 1e9
+             / static_cast<double>(after.timestamp - before.timestamp);
+    }
+
+    /// Allocation still owned by a plugin
+    struct OutstandingAllocation
+    {
+        /// Address of the allocated block
+        const void* address;
+        /// Size of the allocated block in bytes
+        std::size_t size;
+        /// Return addresses of the allocation call stack, innermost first
+        std::vector<void*> stack;
+    };
+
+    namespace detail
+    {
+        // Allocator bypassing operator new, so that leak tracking does not track itself
+        template<class U>
+        struct MallocAllocator
+        {
+            typedef U value_type;
+
+            MallocAllocator() {}
+            template<class V> MallocAllocator(const MallocAllocator<V>&) {}
+
+            U* allocate(std::size_t n)
+            {
+                void* res = std::malloc(n * sizeof(U));
+                if (!res)
+                    throw std::bad_alloc();
+                return static_cast<U*>(res);
+            }
+
+            void deallocate(U* ptr, std::size_t)
+            {
+                std::free(ptr);
+            }
+
+            template<class V> bool operator==(const MallocAllocator<V>&) const { return true; }
+            template<class V> bool operator!=(const MallocAllocator<V>&) const { return false; }
+        };
+
+        // Maximum depth of the recorded allocation stacks
+        static const unsigned int maxAllocationStackDepth = 32;
+
+        struct AllocationRecord
+        {
+            std::size_t size;
+            unsigned int depth;
+            void* stack[maxAllocationStackDepth];
+        };
+
+        typedef std::unordered_map<const void*, AllocationRecord,
+                                   std::hash<const void*>, std::equal_to<const void*>,
+                                   MallocAllocator<std::pair<const void* const, AllocationRecord> > > AllocationRecordMap;
+
+        // Number of counter shards of an account
+        static const unsigned int allocationShardCount = 32;
+
+        // Cumulative bytes a shard allocates between two updates of the peak
+        static const std::size_t allocationPeakPeriod = 64 * 1024;
+
+        // Counters of an account updated by a subset of the threads.
+        // Accounts are allocated with operator new, which does not honor alignas before C++17:
+        // padding shards to two cache lines keeps the counters of two shards on different lines.
+        struct AllocationShard
+        {
+            AllocationShard()
+                : allocatedBytes(0),
+                  freedBytes(0),
+                  allocations(0),
+                  deallocations(0)
+            {
+                // Empty
+            }
+
+            std::atomic<std::size_t> allocatedBytes;
+            std::atomic<std::size_t> freedBytes;
+            std::atomic<std::size_t> allocations;
+            std::atomic<std::size_t> deallocations;
+            char padding[128 - 4 * sizeof(std::atomic<std::size_t>)];
+        };
+
+        // Shard of the current thread, the same for every account.
+        // Threads are spread round robin, so that up to allocationShardCount threads never share a shard.
+        inline unsigned int allocationShardIndex()
+        {
+            static std::atomic<unsigned int> nextShard(0);
+            static thread_local unsigned int shard = allocationShardCount;
+            if (shard == allocationShardCount)
+                shard = nextShard.fetch_add(1, std::memory_order_relaxed) % allocationShardCount;
+            return shard;
+        }
+    }
+
+    /// Allocation counters attributed to one plugin
+    /**
+      * Accounts are obtained with allocationAccount() and live as long as the process,
+      * so that memory allocated by a plugin can be released at any time,
+      * even after the plugin has been unloaded.
+      * Counters are sharded by thread and merged by getStats(): an allocation
+      * is two relaxed atomic additions on a cache line no other thread writes,
+      * as long as there are at most 32 allocating threads.
+      * The peak is updated every 64 KiB allocated by a thread and at each getStats(),
+      * so shorter-lived peaks may be missed.
+      */
+    class AllocationAccount : private boost::noncopyable
+    {
+    public:
+        /// Constructor
+        explicit AllocationAccount(const std::string& name)
+            : name_(name),
+              peakBytes_(0),
+              leakTracking_(false),
+              stackDepth_(0)
+        {
+            // Empty
+        }
+
+        /// Get the account name
+        const std::string& getName() const
+        {
+            return name_;
+        }
+
+        /// Record an allocation
+        void recordAllocation(const void* ptr, std::size_t size)
+        {
+            detail::AllocationShard& shard = shards_[detail::allocationShardIndex()];
+            std::size_t allocated = shard.allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+            shard.allocations.fetch_add(1, std::memory_order_relaxed);
+            if ((allocated + size) / detail::allocationPeakPeriod != allocated / detail::allocationPeakPeriod)
+                updatePeak(mergeLiveBytes());
+            if (leakTracking_.load(std::memory_order_relaxed))
+                trackAllocation(ptr, size);
+        }
+
+        /// Record a deallocation
+        /**
+          * The deallocating thread may not be the allocating one: shards only balance once merged.
+          */
+        void recordDeallocation(const void* ptr, std::size_t size)
+        {
+            detail::AllocationShard& shard = shards_[detail::allocationShardIndex()];
+            shard.freedBytes.fetch_add(size, std::memory_order_relaxed);
+            shard.deallocations.fetch_add(1, std::memory_order_relaxed);
+            if (leakTracking_.load(std::memory_order_relaxed))
+                untrackAllocation(ptr);
+        }
+
+        /// Start recording every allocation with its call stack
+        /**
+          * This is a debugging facility: each allocation takes a lock
+          * and captures a stack, which is orders of magnitude slower
+          * than plain accounting. Only allocations made after this call are recorded.
+          * Call stacks are only captured on platforms providing backtrace().
+          * @param stackDepth Number of frames to record, at most 32
+          */
+        void enableLeakTracking(unsigned int stackDepth = 16)
+        {
+            std::lock_guard<std::mutex> lock(recordsMutex_);
+            stackDepth_ = stackDepth < detail::maxAllocationStackDepth ? stackDepth : detail::maxAllocationStackDepth;
+            leakTracking_.store(true, std::memory_order_relaxed);
+        }
+
+        /// Stop recording allocations and forget the recorded ones
+        void disableLeakTracking()
+        {
+            std::lock_guard<std::mutex> lock(recordsMutex_);
+            leakTracking_.store(false, std::memory_order_relaxed);
+            records_.clear();
+        }
+
+        /// Check if allocations are recorded
+        bool isLeakTrackingEnabled() const
+        {
+            return leakTracking_.load(std::memory_order_relaxed);
+        }
+
+        /// Get the recorded allocations that are not freed yet
+        /**
+          * Only meaningful when leak tracking is enabled.
+          * The result is sorted by address.
+          */
+        std::vector<OutstandingAllocation> getOutstandingAllocations() const
+        {
+            // The result must not be recorded while the records are locked
+            detail::UnaccountedScope unaccounted;
+            std::vector<OutstandingAllocation> res;
+            {
+                std::lock_guard<std::mutex> lock(recordsMutex_);
+                res.reserve(records_.size());
+                for (detail::AllocationRecordMap::const_iterator it = records_.begin(); it != records_.end(); ++it)
+                {
+                    OutstandingAllocation allocation;
+                    allocation.address = it->first;
+                    allocation.size = it->second.size;
+                    allocation.stack.assign(it->second.stack, it->second.stack + it->second.depth);
+                    res.push_back(allocation);
+                }
+            }
+            std::sort(res.begin(), res.end(), [](const OutstandingAllocation& a, const OutstandingAllocation& b) {
+                return a.address < b.address;
+            });
+            return res;
+        }
+
+        /// Count the pointer-sized words of each recorded allocation that point into a library
+        /**
+          * Blocks are read while the records are locked: the plugin cannot free them meanwhile.
+          * @param library Address ranges of the library
+          * @return Number of words pointing into the library, by block address. Blocks without any are omitted.
+          */
+        std::map<const void*, std::size_t> countLibraryPointers(const LibraryInfo& library) const
+        {
+            // The result must not be recorded while the records are locked
+            detail::UnaccountedScope unaccounted;
+            std::map<const void*, std::size_t> res;
+            std::lock_guard<std::mutex> lock(recordsMutex_);
+            for (detail::AllocationRecordMap::const_iterator it = records_.begin(); it != records_.end(); ++it)
+            {
+                // Blocks are aligned at least on pointer size
+                const std::size_t* words = static_cast<const std::size_t*>(it->first);
+                std::size_t count = 0;
+                for (std::size_t w = 0; w < it->second.size / sizeof(std::size_t); ++w)
+                    if (library.contains(words[w]))
+                        ++count;
+                if (count)
+                    res[it->first] = count;
+            }
+            return res;
+        }
+
+        /// Take a snapshot of the counters
+        AllocationStats getStats() const
+        {
+            AllocationStats res = AllocationStats();
+            std::size_t freedBytes = 0;
+            for (unsigned int i = 0; i < detail::allocationShardCount; ++i)
+            {
+                res.allocatedBytes += shards_[i].allocatedBytes.load(std::memory_order_relaxed);
+                freedBytes += shards_[i].freedBytes.load(std::memory_order_relaxed);
+                res.allocations += shards_[i].allocations.load(std::memory_order_relaxed);
+                res.deallocations += shards_[i].deallocations.load(std::memory_order_relaxed);
+            }
+            // Shards are not read at once: a block may be seen freed but not allocated
+            res.liveBytes = res.allocatedBytes > freedBytes ? res.allocatedBytes - freedBytes : 0;
+            res.peakBytes = updatePeak(res.liveBytes);
+            res.timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now().time_since_epoch()).count();
+            return res;
+        }
+
+    private:
+        std::size_t mergeLiveBytes() const
+        {
+            std::size_t allocatedBytes = 0;
+            std::size_t freedBytes = 0;
+            for (unsigned int i = 0; i < detail::allocationShardCount; ++i)
+            {
+                allocatedBytes += shards_[i].allocatedBytes.load(std::memory_order_relaxed);
+                freedBytes += shards_[i].freedBytes.load(std::memory_order_relaxed);
+            }
+            return allocatedBytes > freedBytes ? allocatedBytes - freedBytes : 0;
+        }
+
+        // Raise the peak to live if needed, and return the peak
+        std::size_t updatePeak(std::size_t live) const
+        {
+            std::size_t peak = peakBytes_.load(std::memory_order_relaxed);
+            while (live > peak && !peakBytes_.compare_exchange_weak(peak, live, std::memory_order_relaxed))
+            {
+                // Retry
+            }
+            return live > peak ? live : peak;
+        }
+
+        std::string name_;
+        detail::AllocationShard shards_[detail::allocationShardCount];
+        mutable std::atomic<std::size_t> peakBytes_;
+
+        void trackAllocation(const void* ptr, std::size_t size)
+        {
+            detail::AllocationRecord record;
+            record.size = size;
+            record.depth = 0;
+#ifdef __GLIBC__
+            // Skip trackAllocation() itself
+            void* frames[detail::maxAllocationStackDepth + 1];
+            int depth = backtrace(frames, static_cast<int>(stackDepth_) + 1);
+            for (int i = 1; i < depth; ++i)
+                record.stack[record.depth++] = frames[i];
+#endif
+            std::lock_guard<std::mutex> lock(recordsMutex_);
+            if (leakTracking_.load(std::memory_order_relaxed))
+                records_[ptr] = record;
+        }
+
+        void untrackAllocation(const void* ptr)
+        {
+            std::lock_guard<std::mutex> lock(recordsMutex_);
+            records_.erase(ptr);
+        }
+
+        std::atomic<bool> leakTracking_;
+        unsigned int stackDepth_;
+        detail::AllocationRecordMap records_;
+        mutable std::mutex recordsMutex_;
+    };
+
+    namespace detail
+    {
+        struct AllocationRegistry
+        {
+            std::mutex mutex;
+            std::map<std::string, AllocationAccount*> accounts;
+        };
+
+        // Accounts are intentionally never destroyed
+        inline AllocationRegistry& allocationRegistry()
+        {
+            static AllocationRegistry* registry = new AllocationRegistry;
+            return *registry;
+        }
+    }
+
+    /// Get the process-wide account of a plugin, creating it if necessary
+    inline AllocationAccount& allocationAccount(const std::string& name)
+    {
+        detail::AllocationRegistry& registry = detail::allocationRegistry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        AllocationAccount*& account = registry.accounts[name];
+        if (!account)
+            account = new AllocationAccount(name);
+        return *account;
+    }
+
+    /// Get every account created so far, sorted by name
+    inline std::vector<AllocationAccount*> allocationAccounts()
+    {
+        detail::AllocationRegistry& registry = detail::allocationRegistry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        std::vector<AllocationAccount*> res;
+        for (std::map<std::string, AllocationAccount*>::const_iterator it = registry.accounts.begin(); it != registry.accounts.end(); ++it)
+            res.push_back(it->second);
+        return res;
+    }
+
+    /// Get the account allocations are currently attributed to on this thread
+    /**
+      * @return NULL if no AllocationScope is active.
+      */
+    inline AllocationAccount* currentAllocationAccount()
+    {
+        return detail::currentAllocationAccount();
+    }
+
+    /// Attribute allocations of the current thread to an account
+    /**
+      * Scopes can be nested: the previous account is restored on destruction.
+      */
+    class AllocationScope : private boost::noncopyable
+    {
+    public:
+        /// Constructor
+        explicit AllocationScope(AllocationAccount& account)
+            : previous_(detail::currentAllocationAccount())
+        {
+            detail::currentAllocationAccount() = &account;
+        }
+
+        /// Destructor
+        ~AllocationScope()
+        {
+            detail::currentAllocationAccount() = previous_;
+        }
+
+    private:
+        AllocationAccount* previous_;
+    };
+
+    namespace detail
+    {
+        // Every tracked block is prefixed by this header.
+        // The union keeps the user block aligned as malloc() would.
+        union AllocationHeader
+        {
+            struct
+            {
+                AllocationAccount* account;
+                std::size_t size;
+            } info;
+            std::max_align_t alignment;
+        };
+
+        inline void* trackedAllocate(std::size_t size)
+        {
+            void* raw = NULL;
+            while (!(raw = std::malloc(sizeof(AllocationHeader) + size)))
+            {
+                std::new_handler handler = std::get_new_handler();
+                if (!handler)
+                    throw std::bad_alloc();
+                handler();
+            }
+            AllocationHeader* header = static_cast<AllocationHeader*>(raw);
+            header->info.account = currentAllocationAccount();
+            header->info.size = size;
+            if (header->info.account)
+                header->info.account->recordAllocation(header + 1, size);
+            return header + 1;
+        }
+
+        inline void trackedDeallocate(void* ptr)
+        {
+            if (!ptr)
+                return;
+            AllocationHeader* header = static_cast<AllocationHeader*>(ptr) - 1;
+            if (header->info.account)
+                header->info.account->recordDeallocation(ptr, header->info.size);
+            std::free(header);
+        }
+    }
+
+    /// Allocation still owned by a plugin after it has been unloaded
+    struct LeakedAllocation : OutstandingAllocation
+    {
+        /// Symbolized allocation call stack, innermost first
+        std::vector<std::string> frames;
+        /// Number of pointer-sized words of the block pointing into the library
+        /**
+          * A non zero value usually means that the block is an object whose vtable,
+          * or a function pointer, belonged to the unloaded library.
+          * Using such an object after unload() crashes.
+          */
+        std::size_t libraryPointers;
+    };
+
+    /// Allocations a plugin did not release before being unloaded
+    struct LeakReport
+    {
+        LeakReport()
+            : leakedBytes(0)
+        {
+            // Empty
+        }
+
+        /// Name of the plugin account
+        std::string plugin;
+        /// Total size of the leaked blocks in bytes
+        std::size_t leakedBytes;
+        /// Leaked blocks, sorted by address
+        std::vector<LeakedAllocation> allocations;
+    };
+
+    /// Build a report of the outstanding allocations of an account
+    /**
+      * Must be called while the library is still loaded,
+      * otherwise frames inside the library cannot be symbolized.
+      * @param account Account of the plugin, with leak tracking enabled
+      * @param library Address ranges of the plugin library
+      */
+    inline LeakReport makeLeakReport(const AllocationAccount& account, const LibraryInfo& library)
+    {
+        detail::UnaccountedScope unaccounted;
+        LeakReport res;
+        res.plugin = account.getName();
+        std::vector<OutstandingAllocation> outstanding = account.getOutstandingAllocations();
+        std::map<const void*, std::size_t> libraryPointers = account.countLibraryPointers(library);
+        res.allocations.reserve(outstanding.size());
+        for (std::size_t i = 0; i < outstanding.size(); ++i)
+        {
+            LeakedAllocation leak;
+            static_cast<OutstandingAllocation&>(leak) = outstanding[i];
+            res.leakedBytes += leak.size;
+
+            std::map<const void*, std::size_t>::const_iterator pointers = libraryPointers.find(leak.address);
+            leak.libraryPointers = pointers != libraryPointers.end() ? pointers->second : 0;
+
+#ifdef __GLIBC__
+            if (!leak.stack.empty())
+            {
+                char** symbols = backtrace_symbols(&leak.stack[0], static_cast<int>(leak.stack.size()));
+                if (symbols)
+                {
+                    leak.frames.assign(symbols, symbols + leak.stack.size());
+                    std::free(symbols);
+                }
+            }
+#endif
+            res.allocations.push_back(leak);
+        }
+        return res;
+    }
+
+    /// Write a human readable leak report
+    inline void writeLeakReport(std::ostream& os, const LeakReport& report)
+    {
+        os << "Plugin " << report.plugin << " leaked " << report.leakedBytes
+           << " bytes in " << report.allocations.size() << " allocations" << std::endl;
+        for (std::size_t i = 0; i < report.allocations.size(); ++i)
+        {
+            const LeakedAllocation& leak = report.allocations[i];
+            os << "  " << leak.size << " bytes at " << leak.address;
+            if (leak.libraryPointers)
+                os << " holding " << leak.libraryPointers << " pointers into the unloaded library";
+            os << std::endl;
+            for (std::size_t f = 0; f < leak.frames.size(); ++f)
+                os << "    #" << f << " " << leak.frames[f] << std::endl;
+        }
+    }
+
+    /// Loader whose plugin allocations are attributed to an account
+    /**
+      * Static constructors run by load(), the facade construction,
+      * calls made through call() and the facade destruction
+      * are all executed inside an AllocationScope on the plugin account.
+      * Allocations are only counted if the host used PLUGIN_ALLOCATION_TRACKING_DEFINITION().
+      * @tparam T Interface type of the concrete plugin
+      */
+    template<class T>
+    class AccountedPluginLoader : private boost::noncopyable
+    {
+    public:
+        /// Constructor
+        /**
+          * @param name Filename of the concrete plugin
+          * @param accountName Name of the account. Defaults to the plugin filename.
+          */
+        explicit AccountedPluginLoader(const std::string& name, const std::string& accountName = "")
+            : loader_(name),
+              account_(allocationAccount(accountName.empty() ? name : accountName)),
+              leakCheck_(false)
+        {
+            // Empty
+        }
+
+        /// Destructor
+        ~AccountedPluginLoader()
+        {
+            unload();
+        }
+
+        /// See PluginLoader::load()
+        bool load()
+        {
+            AllocationScope scope(account_);
+            return loader_.load();
+        }
+
+        /// See PluginLoader::unload()
+        /**
+          * When leak checking is enabled, the allocations the plugin still owns
+          * once its facade is destroyed and its library is unloaded
+          * are reported in getLeakReport().
+          */
+        bool unload()
+        {
+            if (!leakCheck_ || !loader_.isLoaded())
+            {
+                AllocationScope scope(account_);
+                return loader_.unload();
+            }
+
+            LibraryInfo library;
+#ifndef _WIN32
+            queryLibraryInfo(loader_.getNativeHandle(), library);
+#endif
+            {
+                AllocationScope scope(account_);
+                loader_.destroyPluginInstance();
+            }
+            // Symbolize while the library is still mapped
+            LeakReport report = makeLeakReport(account_, library);
+            bool res = false;
+            {
+                AllocationScope scope(account_);
+                res = loader_.unload();
+            }
+            // Static destructors run by unload() may have released some blocks
+            std::vector<OutstandingAllocation> outstanding = account_.getOutstandingAllocations();
+            leakReport_ = LeakReport();
+            leakReport_.plugin = report.plugin;
+            for (std::size_t i = 0; i < report.allocations.size(); ++i)
+            {
+                const LeakedAllocation& leak = report.allocations[i];
+                if (std::binary_search(outstanding.begin(), outstanding.end(), leak,
+                                       [](const OutstandingAllocation& a, const OutstandingAllocation& b) {
+                                           return a.address < b.address;
+                                       }))
+                {
+                    leakReport_.leakedBytes += leak.size;
+                    leakReport_.allocations.push_back(leak);
+                }
+            }
+            return res;
+        }
+
+        /// Enable or disable leak checking at unload()
+        /**
+          * Must be enabled before load() so that static constructors are tracked.
+          * See AllocationAccount::enableLeakTracking() for the cost of this mode.
+          */
+        void setLeakCheck(bool enabled)
+        {
+            leakCheck_ = enabled;
+            if (enabled)
+                account_.enableLeakTracking();
+            else
+                account_.disableLeakTracking();
+        }
+
+        /// Get the report of the last unload() made with leak checking enabled
+        const LeakReport& getLeakReport() const
+        {
+            return leakReport_;
+        }
+
+        /// See PluginLoader::isLoaded()
+        bool isLoaded() const
+        {
+            return loader_.isLoaded();
+        }
+
+        /// See PluginLoader::getPluginInstance()
+        T* getPluginInstance()
+        {
+            AllocationScope scope(account_);
+            return loader_.getPluginInstance();
+        }
+
+        /// Call a function on the plugin facade with allocations attributed to the plugin
+        /**
+          * @param f Callable taking a T* as argument
+          * @return The value returned by f
+          */
+        template<class F>
+        auto call(F f) -> decltype(f(static_cast<T*>(NULL)))
+        {
+            AllocationScope scope(account_);
+            return f(loader_.getPluginInstance());
+        }
+
+        /// See PluginLoader::getErrorMsg()
+        const std::string& getErrorMsg() const
+        {
+            return loader_.getErrorMsg();
+        }
+
+        /// Get the account of the plugin
+        AllocationAccount& getAccount() const
+        {
+            return account_;
+        }
+
+        /// Get the underlying loader
+        PluginLoader<T>& getLoader()
+        {
+            return loader_;
+        }
+
+    private:
+        PluginLoader<T> loader_;
+        AllocationAccount& account_;
+        bool leakCheck_;
+        LeakReport leakReport_;
+    };
+}
+
+/// Replace the global allocation functions to enable allocation accounting.
+/**
+  * Must be used exactly once, in a cpp file of the host executable, in the global namespace.
+  * Plugins then inherit the replacement through symbol interposition,
+  * so every operator new they call is attributed to the current AllocationScope.
+  * Memory obtained directly from malloc() is not accounted.
+  * The cost of an allocation is two thread-local reads and two relaxed atomic additions
+  * on a cache line of the current thread.
+  */
+#define PLUGIN_ALLOCATION_TRACKING_DEFINITION()                                                     \
+void* operator new(std::size_t size) { return Plugin::detail::trackedAllocate(size); }             \
+void* operator new[](std::size_t size) { return Plugin::detail::trackedAllocate(size); }           \
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept                                \
+{ try { return Plugin::detail::trackedAllocate(size); } catch (...) { return NULL; } }              \
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept                              \
+{ try { return Plugin::detail::trackedAllocate(size); } catch (...) { return NULL; } }              \
+void operator delete(void* ptr) noexcept { Plugin::detail::trackedDeallocate(ptr); }                \
+void operator delete[](void* ptr) noexcept { Plugin::detail::trackedDeallocate(ptr); }              \
+void operator delete(void* ptr, const std::nothrow_t&) noexcept { Plugin::detail::trackedDeallocate(ptr); }   \
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept { Plugin::detail::trackedDeallocate(ptr); } \
+void operator delete(void* ptr, std::size_t) noexcept { Plugin::detail::trackedDeallocate(ptr); }   \
+void operator delete[](void* ptr, std::size_t) noexcept { Plugin::detail::trackedDeallocate(ptr); }
@@ -0,0 +1,292 @@
+//          Copyright Jeremy Coulon 2012-2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+/** @file */
+
+#pragma once
+
+//=============
+//==  Boost  ==
+//=============
+#include <boost/noncopyable.hpp>
+
+//===========
+//==  STD  ==
+//===========
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <stdint.h>
+
+//=======================
+//==  OS Specific SDK  ==
+//=======================
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+/// Namespace of the Plugin library
+namespace Plugin
+{
+    namespace detail
+    {
+        // Call queued by CallCombiner
+        template<class T>
+        struct CombinedCommand
+        {
+            virtual ~CombinedCommand() {}
+            virtual void run(T* plugin) = 0;
+        };
+
+        template<class T, class R, class F>
+        struct CombinedCall : CombinedCommand<T>
+        {
+            explicit CombinedCall(const F& f)
+                : function(f)
+            {
+                // Empty
+            }
+
+            virtual void run(T* plugin)
+            {
+                try
+                {
+                    promise.set_value(function(plugin));
+                }
+                catch (...)
+                {
+                    promise.set_exception(std::current_exception());
+                }
+            }
+
+            F function;
+            std::promise<R> promise;
+        };
+
+        template<class T, class F>
+        struct CombinedCall<T, void, F> : CombinedCommand<T>
+        {
+            explicit CombinedCall(const F& f)
+                : function(f)
+            {
+                // Empty
+            }
+
+            virtual void run(T* plugin)
+            {
+                try
+                {
+                    function(plugin);
+                    promise.set_value();
+                }
+                catch (...)
+                {
+                    promise.set_exception(std::current_exception());
+                }
+            }
+
+            F function;
+            std::promise<void> promise;
+        };
+
+        // Call without result. Exceptions are swallowed.
+        template<class T, class F>
+        struct PostedCall : CombinedCommand<T>
+        {
+            explicit PostedCall(const F& f)
+                : function(f)
+            {
+                // Empty
+            }
+
+            virtual void run(T* plugin)
+            {
+                try
+                {
+                    function(plugin);
+                }
+                catch (...)
+                {
+                    // Nobody to report to
+                }
+            }
+
+            F function;
+        };
+
+        // Index of the calling thread among the threads using a combiner
+        inline std::size_t combinerThreadIndex()
+        {
+            static std::atomic<std::size_t> next(0);
+            static thread_local std::size_t index = next.fetch_add(1, std::memory_order_relaxed);
+            return index;
+        }
+    }
+
+    /// Serialize calls from many threads to a plugin that is not thread-safe, by flat combining
+    /**
+      * Callers queue their calls in one of several buffers, picked by CPU, so that they
+      * rarely contend on a same lock. The first caller finding no other combiner becomes
+      * the combiner: it runs every queued call in batches, its own and those of the other
+      * threads, which get their results through futures. The plugin is thus only called by one
+      * thread at a time, and stays hot in its cache, while the other callers return immediately.
+      *
+      * A combiner keeps running calls until the buffers are empty, so its own call may
+      * return later than with a mutex under sustained load.
+      * @tparam T Interface of the plugin
+      */
+    template<class T>
+    class CallCombiner : private boost::noncopyable
+    {
+        struct Lane
+        {
+            std::mutex mutex;
+            std::vector<detail::CombinedCommand<T>*> commands;
+            // Keep lanes on separate cache lines
+            char padding[64];
+        };
+
+    public:
+        /// Constructor
+        /**
+          * @param plugin Plugin to call. Must outlive the combiner.
+          * @param lanes Number of buffers. Zero means one per hardware thread.
+          */
+        explicit CallCombiner(T* plugin, std::size_t lanes = 0)
+            : plugin_(plugin),
+              pending_(0),
+              combining_(false),
+              calls_(0),
+              passes_(0)
+        {
+            if (lanes == 0)
+                lanes = std::max(1u, std::thread::hardware_concurrency());
+            for (std::size_t i = 0; i < lanes; ++i)
+                lanes_.push_back(std::unique_ptr<Lane>(new Lane));
+        }
+
+        /// Destructor. Run the calls still queued.
+        /**
+          * No call must be made concurrently.
+          */
+        ~CallCombiner()
+        {
+            combine();
+        }
+
+        /// Call the plugin
+        /**
+          * @param f Function called with the plugin, as f(plugin)
+          * @return Result of f, or the exception it threw
+          */
+        template<class F>
+        auto call(F f) -> std::future<decltype(f(static_cast<T*>(NULL)))>
+        {
+            typedef decltype(f(static_cast<T*>(NULL))) R;
+            detail::CombinedCall<T, R, F>* command = new detail::CombinedCall<T, R, F>(f);
+            std::future<R> res = command->promise.get_future();
+            enqueue(command);
+            return res;
+        }
+
+        /// Call the plugin without waiting for the result
+        /**
+          * Cheaper than call(): no future is created. Exceptions thrown by f are ignored.
+          * @param f Function called with the plugin, as f(plugin)
+          */
+        template<class F>
+        void post(F f)
+        {
+            enqueue(new detail::PostedCall<T, F>(f));
+        }
+
+        /// Get the number of calls run
+        uint64_t getCallCount() const
+        {
+            return calls_.load(std::memory_order_relaxed);
+        }
+
+        /// Get the number of passes over the buffers. Calls per pass measure the batching.
+        uint64_t getPassCount() const
+        {
+            return passes_.load(std::memory_order_relaxed);
+        }
+
+    private:
+        void enqueue(detail::CombinedCommand<T>* command)
+        {
+            Lane& lane = *lanes_[laneIndex()];
+            {
+                std::lock_guard<std::mutex> lock(lane.mutex);
+                lane.commands.push_back(command);
+            }
+            // Counted after queued: a combiner may run it first, leaving the count briefly negative
+            pending_.fetch_add(1, std::memory_order_seq_cst);
+            combine();
+        }
+
+        std::size_t laneIndex() const
+        {
+#ifdef __linux__
+            int cpu = sched_getcpu();
+            if (cpu >= 0)
+                return static_cast<std::size_t>(cpu) % lanes_.size();
+#endif
+            return detail::combinerThreadIndex() % lanes_.size();
+        }
+
+        void combine()
+        {
+            std::vector<detail::CombinedCommand<T>*> batch;
+            while (!combining_.exchange(true, std::memory_order_seq_cst))
+            {
+                while (pending_.load(std::memory_order_seq_cst) > 0)
+                {
+                    for (std::size_t i = 0; i < lanes_.size(); ++i)
+                    {
+                        {
+                            std::lock_guard<std::mutex> lock(lanes_[i]->mutex);
+                            if (lanes_[i]->commands.empty())
+                                continue;
+                            batch.swap(lanes_[i]->commands);
+                        }
+                        for (std::size_t j = 0; j < batch.size(); ++j)
+                        {
+                            batch[j]->run(plugin_);
+                            delete batch[j];
+                        }
+                        calls_.fetch_add(batch.size(), std::memory_order_relaxed);
+                        pending_.fetch_sub(static_cast<long long>(batch.size()), std::memory_order_seq_cst);
+                        batch.clear();
+                    }
+                    passes_.fetch_add(1, std::memory_order_relaxed);
+                }
+                combining_.store(false, std::memory_order_seq_cst);
+                // A call queued while releasing would otherwise wait for the next caller
+                if (pending_.load(std::memory_order_seq_cst) <= 0)
+                    break;
+            }
+        }
+
+        // Plugin called by the combiner
+        T* plugin_;
+        // Call buffers
+        std::vector<std::unique_ptr<Lane> > lanes_;
+        // Number of queued calls
+        std::atomic<long long> pending_;
+        // Whether a thread is combining
+        std::atomic<bool> combining_;
+        // Counters
+        std::atomic<uint64_t> calls_;
+        std::atomic<uint64_t> passes_;
+    };
+}
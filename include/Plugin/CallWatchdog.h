@@ -0,0 +1,511 @@
+//          Copyright Jeremy Coulon 2012-2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+/** @file */
+
+#pragma once
+
+//==============
+//==  Plugin  ==
+//==============
+#include "Plugin/InterfaceDescription.h"
+#include "Plugin/PluginInterceptor.h"
+
+//=============
+//==  Boost  ==
+//=============
+#include <boost/noncopyable.hpp>
+
+//===========
+//==  STD  ==
+//===========
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <stdint.h>
+
+//=======================
+//==  OS Specific SDK  ==
+//=======================
+#ifdef __linux__
+#include <errno.h>
+#include <execinfo.h>
+#include <pthread.h>
+#include <signal.h>
+#endif
+
+#ifndef PLUGIN_WATCHDOG_SIGNAL
+/// Signal sent by CallWatchdog to the threads of slow calls to capture their stack. Define it before including the header to change it.
+# define PLUGIN_WATCHDOG_SIGNAL SIGUSR2
+#endif
+
+/// Namespace of the Plugin library
+namespace Plugin
+{
+    /// Slow call found by a CallWatchdog
+    struct SlowCallReport
+    {
+        /// Name of the plugin, as given to WatchedPlugin
+        std::string pluginName;
+        /// Name of the method, from InterfaceDescription. Empty if it is not described.
+        std::string methodName;
+        /// Duration of the call when it was found, in nanoseconds.
+        /// Measured from the first scan that saw the call, so it may be short by up to one scan period.
+        uint64_t elapsedNs;
+        /// Threshold of the plugin, in nanoseconds
+        uint64_t thresholdNs;
+        /// Stack of the calling thread, innermost frame first. Empty if it could not be captured.
+        std::vector<std::string> stack;
+    };
+
+    namespace detail
+    {
+        enum { watchdogMaxFrames = 64 };
+
+        enum StackCaptureState
+        {
+            captureIdle,
+            captureRequested,
+            captureRunning,
+            captureDone
+        };
+
+        // Stack of a thread, captured by the thread itself in the signal handler.
+        // Trivial, so that the thread local instance needs no initialization.
+        struct StackCapture
+        {
+            std::atomic<int> state;
+            int depth;
+            void* frames[watchdogMaxFrames];
+        };
+
+        inline StackCapture& threadStackCapture()
+        {
+            static thread_local StackCapture capture;
+            return capture;
+        }
+
+        // Call in progress on a thread, written by the thread and read by the monitor
+        struct WatchdogSlot
+        {
+            WatchdogSlot()
+                : current(0),
+                  plugin(NULL),
+                  method(NULL),
+                  threshold(0),
+                  calls(0),
+                  seen(0),
+                  seenAt(0),
+                  reported(0),
+                  capture(&threadStackCapture())
+            {
+#ifdef __linux__
+                thread = pthread_self();
+#endif
+            }
+
+            // ID of the call in progress. Zero when idle, or while the other fields change.
+            std::atomic<uint64_t> current;
+            std::atomic<const char*> plugin;
+            std::atomic<const char*> method;
+            std::atomic<uint64_t> threshold;
+            // Number of calls. Only used by the thread.
+            uint64_t calls;
+            // Call seen by the last scan, when it was first seen, and last reported call.
+            // Only used by the monitor.
+            uint64_t seen;
+            uint64_t seenAt;
+            uint64_t reported;
+            StackCapture* capture;
+#ifdef __linux__
+            pthread_t thread;
+#endif
+            // Keep slots on separate cache lines
+            char padding[64];
+        };
+
+        inline uint64_t watchdogNow()
+        {
+            return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count());
+        }
+
+#ifdef __linux__
+        inline void watchdogSignalHandler(int)
+        {
+            StackCapture& capture = threadStackCapture();
+            int expected = captureRequested;
+            if (!capture.state.compare_exchange_strong(expected, captureRunning, std::memory_order_acquire))
+                return;
+            int savedErrno = errno;
+            capture.depth = backtrace(capture.frames, watchdogMaxFrames);
+            capture.state.store(captureDone, std::memory_order_release);
+            errno = savedErrno;
+        }
+
+        // Install the signal handler once per process. False if the signal is used by someone else.
+        inline bool installWatchdogSignalHandler()
+        {
+            static std::mutex mutex;
+            static bool installed = false;
+            std::lock_guard<std::mutex> lock(mutex);
+            if (installed)
+                return true;
+            // backtrace() loads libgcc on its first call, which is not safe in a signal handler
+            void* frame = NULL;
+            backtrace(&frame, 1);
+            struct sigaction previous;
+            if (sigaction(PLUGIN_WATCHDOG_SIGNAL, NULL, &previous) != 0)
+                return false;
+            if ((previous.sa_flags & SA_SIGINFO) || (previous.sa_handler != SIG_DFL && previous.sa_handler != SIG_IGN))
+                return false;
+            struct sigaction action;
+            action.sa_handler = &watchdogSignalHandler;
+            sigemptyset(&action.sa_mask);
+            action.sa_flags = SA_RESTART;
+            installed = sigaction(PLUGIN_WATCHDOG_SIGNAL, &action, NULL) == 0;
+            return installed;
+        }
+
+        // Only one capture at a time in the process
+        inline std::mutex& watchdogCaptureMutex()
+        {
+            static std::mutex mutex;
+            return mutex;
+        }
+#endif
+    }
+
+    /// Watchdog reporting plugin calls that run for too long
+    /**
+      * Calls made through a WatchedPlugin, or inside a CallWatchdog::Scope, publish an ID
+      * in a slot of the calling thread. A monitor thread scans the slots periodically,
+      * and times each call from the first scan that sees it.
+      * When a call exceeds the threshold of its plugin, the monitor sends PLUGIN_WATCHDOG_SIGNAL
+      * to the calling thread, which captures its own stack, and the call is reported once
+      * with the plugin name, the method name and the stack.
+      *
+      * Watching a call costs a few stores to a slot that no other thread writes,
+      * without reading the clock: a few nanoseconds. Durations are known within one scan period.
+      * When a nested call returns, the enclosing call is timed again from the next scan. Stacks are only captured on Linux, and only if the signal
+      * has no other handler. Each thread that made calls keeps its slot until the watchdog is destroyed.
+      */
+    class CallWatchdog : private boost::noncopyable
+    {
+    public:
+        /// Receives the slow calls, on the monitor thread
+        typedef std::function<void (const SlowCallReport&)> ReportSink;
+
+        /// Call in progress on the current thread
+        class Scope : private boost::noncopyable
+        {
+        public:
+            /// Constructor
+            /**
+              * @param watchdog Watchdog monitoring the call
+              * @param plugin Name of the plugin. Must outlive the call.
+              * @param method Name of the method. Must outlive the call.
+              * @param thresholdNs The call is reported once it runs for longer, in nanoseconds
+              */
+            Scope(CallWatchdog& watchdog, const char* plugin, const char* method, uint64_t thresholdNs)
+                : slot_(watchdog.localSlot()),
+                  previousCall_(slot_.current.load(std::memory_order_relaxed)),
+                  previousPlugin_(slot_.plugin.load(std::memory_order_relaxed)),
+                  previousMethod_(slot_.method.load(std::memory_order_relaxed)),
+                  previousThreshold_(slot_.threshold.load(std::memory_order_relaxed))
+            {
+                publish(plugin, method, thresholdNs, ++slot_.calls);
+            }
+
+            /// Destructor. Restore the enclosing watched call, if any.
+            ~Scope()
+            {
+                if (previousCall_)
+                    publish(previousPlugin_, previousMethod_, previousThreshold_, previousCall_);
+                else
+                    slot_.current.store(0, std::memory_order_release);
+            }
+
+        private:
+            void publish(const char* plugin, const char* method, uint64_t thresholdNs, uint64_t call)
+            {
+                // The monitor ignores the fields while the ID is zero
+                slot_.current.store(0, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_release);
+                slot_.plugin.store(plugin, std::memory_order_relaxed);
+                slot_.method.store(method, std::memory_order_relaxed);
+                slot_.threshold.store(thresholdNs, std::memory_order_relaxed);
+                slot_.current.store(call, std::memory_order_release);
+            }
+
+            detail::WatchdogSlot& slot_;
+            uint64_t previousCall_;
+            const char* previousPlugin_;
+            const char* previousMethod_;
+            uint64_t previousThreshold_;
+        };
+
+        /// Constructor. Starts the monitor thread.
+        /**
+          * @param period Delay between two scans of the slots. Slow calls are found at most this late.
+          */
+        explicit CallWatchdog(std::chrono::nanoseconds period = std::chrono::milliseconds(10))
+            : period_(period),
+              stop_(false),
+              reports_(0),
+              captureEnabled_(false)
+        {
+#ifdef __linux__
+            captureEnabled_ = detail::installWatchdogSignalHandler();
+#endif
+            monitor_ = std::thread(&CallWatchdog::monitor, this);
+        }
+
+        /// Destructor. Stops the monitor thread.
+        ~CallWatchdog()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stop_ = true;
+            }
+            wakeUp_.notify_all();
+            monitor_.join();
+        }
+
+        /// Set the receiver of the slow calls
+        /**
+          * @param sink Called on the monitor thread. By default, reports are written to std::cerr.
+          */
+        void setReportSink(const ReportSink& sink)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            sink_ = sink;
+        }
+
+        /// Check whether stacks of slow calls are captured
+        bool isStackCaptureEnabled() const
+        {
+            return captureEnabled_;
+        }
+
+        /// Get the number of slow calls reported
+        uint64_t getReportCount() const
+        {
+            return reports_.load(std::memory_order_relaxed);
+        }
+
+        /// Get the number of threads that made watched calls
+        std::size_t getThreadCount() const
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return slots_.size();
+        }
+
+        /// Write a report as text
+        static void writeReport(std::ostream& os, const SlowCallReport& report)
+        {
+            os << "Slow plugin call: " << report.pluginName << "::"
+               << (report.methodName.empty() ? "(other)" : report.methodName)
+               << " running for " << report.elapsedNs / 1000000 << " ms"
+               << " (threshold " << report.thresholdNs / 1000000 << " ms)" << std::endl;
+            for (std::size_t i = 0; i < report.stack.size(); ++i)
+                os << "    #" << i << " " << report.stack[i] << std::endl;
+        }
+
+    private:
+        detail::WatchdogSlot& localSlot()
+        {
+            if (void* slot = detail::findThreadShard(id_))
+                return *static_cast<detail::WatchdogSlot*>(slot);
+            std::lock_guard<std::mutex> lock(mutex_);
+            slots_.push_back(std::unique_ptr<detail::WatchdogSlot>(new detail::WatchdogSlot));
+            detail::addThreadShard(id_, slots_.back().get());
+            return *slots_.back();
+        }
+
+        void monitor()
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            while (!wakeUp_.wait_for(lock, period_, [this]() { return stop_; }))
+            {
+                std::vector<detail::WatchdogSlot*> slots;
+                for (std::size_t i = 0; i < slots_.size(); ++i)
+                    slots.push_back(slots_[i].get());
+                ReportSink sink = sink_;
+                lock.unlock();
+                for (std::size_t i = 0; i < slots.size(); ++i)
+                    check(*slots[i], sink);
+                lock.lock();
+            }
+        }
+
+        void check(detail::WatchdogSlot& slot, const ReportSink& sink)
+        {
+            uint64_t call = slot.current.load(std::memory_order_acquire);
+            const char* plugin = slot.plugin.load(std::memory_order_relaxed);
+            const char* method = slot.method.load(std::memory_order_relaxed);
+            uint64_t threshold = slot.threshold.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (call == 0 || slot.current.load(std::memory_order_relaxed) != call)
+                return;
+            uint64_t now = detail::watchdogNow();
+            if (call != slot.seen)
+            {
+                slot.seen = call;
+                slot.seenAt = now;
+                return;
+            }
+            if (call == slot.reported || now - slot.seenAt <= threshold)
+                return;
+
+            SlowCallReport report;
+            report.pluginName = plugin ? plugin : "";
+            report.methodName = method ? method : "";
+            report.elapsedNs = now - slot.seenAt;
+            report.thresholdNs = threshold;
+            if (captureEnabled_)
+                captureStack(slot, call, report.stack);
+            slot.reported = call;
+            reports_.fetch_add(1, std::memory_order_relaxed);
+            if (sink)
+                sink(report);
+            else
+                writeReport(std::cerr, report);
+        }
+
+        void captureStack(detail::WatchdogSlot& slot, uint64_t call, std::vector<std::string>& stack)
+        {
+#ifdef __linux__
+            std::lock_guard<std::mutex> lock(detail::watchdogCaptureMutex());
+            detail::StackCapture& capture = *slot.capture;
+            capture.state.store(detail::captureRequested, std::memory_order_release);
+            if (pthread_kill(slot.thread, PLUGIN_WATCHDOG_SIGNAL) != 0)
+            {
+                capture.state.store(detail::captureIdle, std::memory_order_relaxed);
+                return;
+            }
+            std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(100);
+            while (capture.state.load(std::memory_order_acquire) != detail::captureDone)
+            {
+                if (std::chrono::steady_clock::now() > deadline)
+                {
+                    // The signal may be blocked: give up, unless the handler already started
+                    int expected = detail::captureRequested;
+                    if (capture.state.compare_exchange_strong(expected, detail::captureIdle))
+                        return;
+                }
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+            // The stack is only meaningful if the thread is still in the same call
+            if (slot.current.load(std::memory_order_acquire) == call)
+            {
+                char** symbols = backtrace_symbols(capture.frames, capture.depth);
+                // Skip the signal handler
+                for (int i = 1; i < capture.depth; ++i)
+                    stack.push_back(symbols ? std::string(symbols[i]) : std::string());
+                std::free(symbols);
+            }
+            capture.state.store(detail::captureIdle, std::memory_order_release);
+#else
+            (void)slot;
+            (void)call;
+            (void)stack;
+#endif
+        }
+
+        // Key of the slots in the thread local caches
+        detail::RecorderId id_;
+        std::chrono::nanoseconds period_;
+        // Slot of each thread
+        std::vector<std::unique_ptr<detail::WatchdogSlot> > slots_;
+        bool stop_;
+        ReportSink sink_;
+        std::atomic<uint64_t> reports_;
+        bool captureEnabled_;
+        mutable std::mutex mutex_;
+        std::condition_variable wakeUp_;
+        std::thread monitor_;
+    };
+
+    /// Plugin whose calls are monitored by a CallWatchdog
+    /**
+      * @code
+      * Plugin::CallWatchdog watchdog;
+      * Plugin::WatchedPlugin<IMyInterface> plugin(watchdog, "MyPlugin", std::chrono::milliseconds(50), loader.getPluginInstance());
+      * plugin.call(&IMyInterface::compute, 42);
+      * @endcode
+      * @tparam T Interface type of the concrete plugin. It must be described with PLUGIN_INTERFACE_DESCRIPTION.
+      */
+    template<class T>
+    class WatchedPlugin : private boost::noncopyable
+    {
+    public:
+        /// Constructor
+        /**
+          * @param watchdog Watchdog monitoring the calls. Must outlive this object.
+          * @param name Name of the plugin in the reports
+          * @param threshold Calls running for longer are reported
+          * @param plugin Plugin facade, typically from PluginLoader::getPluginInstance()
+          */
+        template<class Rep, class Period>
+        WatchedPlugin(CallWatchdog& watchdog, const std::string& name, const std::chrono::duration<Rep, Period>& threshold, T* plugin = NULL)
+            : watchdog_(watchdog),
+              name_(name),
+              threshold_(std::chrono::duration_cast<std::chrono::nanoseconds>(threshold).count()),
+              plugin_(plugin)
+        {
+            // Empty
+        }
+
+        /// Change the threshold of the plugin
+        template<class Rep, class Period>
+        void setThreshold(const std::chrono::duration<Rep, Period>& threshold)
+        {
+            threshold_.store(std::chrono::duration_cast<std::chrono::nanoseconds>(threshold).count(), std::memory_order_relaxed);
+        }
+
+        /// Change the watched plugin
+        void setPlugin(T* plugin)
+        {
+            plugin_ = plugin;
+        }
+
+        /// Get the watched plugin
+        T* get() const
+        {
+            return plugin_;
+        }
+
+        /// Call a method of the plugin
+        /**
+          * @param pmf Pointer to a member function of T
+          * @param args Arguments of the method
+          * @return The value returned by the plugin
+          */
+        template<class Pmf, class... A>
+        typename MethodTraits<Pmf>::result_type call(Pmf pmf, A&&... args)
+        {
+            CallWatchdog::Scope scope(watchdog_, name_.c_str(), methodName<T>(methodIndex<T>(pmf)),
+                                      threshold_.load(std::memory_order_relaxed));
+            return (plugin_->*pmf)(std::forward<A>(args)...);
+        }
+
+    private:
+        CallWatchdog& watchdog_;
+        std::string name_;
+        std::atomic<uint64_t> threshold_;
+        T* plugin_;
+    };
+}
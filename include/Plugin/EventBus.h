@@ -0,0 +1,675 @@
+//          Copyright Jeremy Coulon 2012-2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+/** @file */
+
+#pragma once
+
+//==============
+//==  Plugin  ==
+//==============
+#include "Plugin/PluginHostServices.h"
+#include "Plugin/SharedMemoryRing.h"
+
+//=============
+//==  Boost  ==
+//=============
+#include <boost/noncopyable.hpp>
+
+//===========
+//==  STD  ==
+//===========
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include <stdint.h>
+
+/// Compile-time ID of an event topic, from its name
+#define PLUGIN_TOPIC_ID(name) PLUGIN_SERVICE_ID(name)
+
+/// Service ID of the event bus, see PluginHostServices
+#define PLUGIN_EVENT_BUS_SERVICE PLUGIN_SERVICE_ID("Plugin.EventBus")
+
+extern "C"
+{
+    /// Event delivered to a subscriber
+    struct PluginEvent
+    {
+        /// Topic of the event
+        uint64_t topic;
+        /// Payload. Only valid during the call to the handler.
+        const void* data;
+        /// Size of the payload in bytes
+        uint32_t size;
+    };
+
+    /// Subscriber callback, receiving a batch of events of one topic
+    typedef void (*PluginEventHandler)(void* userData, const PluginEvent* events, size_t count);
+
+    /// C interface of the event bus, offered to plugins through the host services
+    struct PluginEventBusApi
+    {
+        /// Size of this structure, for forward compatibility
+        uint32_t size;
+        /// Version of this structure
+        uint32_t version;
+        /// Opaque bus data given back to each function
+        void* context;
+        /// Publish an event without blocking. Returns a Plugin::EventStatus.
+        int (*publish)(void* context, uint64_t topic, const void* data, uint32_t size);
+        /// Subscribe to a topic. Returns the subscription ID, zero on failure.
+        uint64_t (*subscribe)(void* context, uint64_t topic, PluginEventHandler handler, void* userData);
+        /// Cancel a subscription. Returns non-zero on success.
+        int (*unsubscribe)(void* context, uint64_t subscription);
+    };
+}
+
+/// Namespace of the Plugin library
+namespace Plugin
+{
+    /// Result of a publication
+    enum EventStatus
+    {
+        eventPublished = 0,     ///< The event is queued
+        eventQueueFull = 1,     ///< The topic queue is full: retry later or drop the event
+        eventTooLarge = 2,      ///< The payload is larger than the maximum event size of the topic
+        eventTopicLimit = 3     ///< The topic does not exist and no more topics can be created
+    };
+
+    /// Counters of a topic
+    struct TopicStats
+    {
+        /// Number of events queued
+        uint64_t published;
+        /// Number of publications rejected because the queue was full
+        uint64_t rejected;
+        /// Number of events delivered, each counted once whatever the number of subscribers
+        uint64_t delivered;
+        /// Number of batches delivered
+        uint64_t batches;
+    };
+
+    namespace detail
+    {
+        // Bounded multi-producer multi-consumer queue of fixed-size cells, after Dmitry Vyukov.
+        // Each cell carries a sequence number telling whether it is free or full for a given lap.
+        class EventQueue : private boost::noncopyable
+        {
+            struct Cell
+            {
+                std::atomic<std::size_t> sequence;
+                uint32_t size;
+            };
+
+        public:
+            EventQueue(std::size_t capacity, std::size_t maxEventSize)
+                : maxEventSize_(maxEventSize)
+            {
+                std::size_t rounded = 1;
+                while (rounded < capacity)
+                    rounded <<= 1;
+                mask_ = rounded - 1;
+                stride_ = (sizeof(Cell) + maxEventSize + 63) & ~static_cast<std::size_t>(63);
+                storage_.reset(new char[rounded * stride_ + 64]);
+                base_ = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(storage_.get()) + 63) & ~static_cast<uintptr_t>(63));
+                for (std::size_t i = 0; i < rounded; ++i)
+                    new (cell(i)) Cell();
+                for (std::size_t i = 0; i < rounded; ++i)
+                    cell(i)->sequence.store(i, std::memory_order_relaxed);
+                head_.store(0, std::memory_order_relaxed);
+                tail_.store(0, std::memory_order_relaxed);
+            }
+
+            bool push(const void* data, uint32_t size)
+            {
+                std::size_t pos = tail_.load(std::memory_order_relaxed);
+                Cell* c;
+                while (true)
+                {
+                    c = cell(pos & mask_);
+                    std::size_t sequence = c->sequence.load(std::memory_order_acquire);
+                    intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+                    if (diff == 0)
+                    {
+                        if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                            break;
+                    }
+                    else if (diff < 0)
+                        return false;
+                    else
+                        pos = tail_.load(std::memory_order_relaxed);
+                }
+                c->size = size;
+                std::memcpy(payload(c), data, size);
+                c->sequence.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+
+            // Append the payload of the oldest event to buffer
+            bool pop(std::vector<char>& buffer, uint32_t& size)
+            {
+                std::size_t pos = head_.load(std::memory_order_relaxed);
+                Cell* c;
+                while (true)
+                {
+                    c = cell(pos & mask_);
+                    std::size_t sequence = c->sequence.load(std::memory_order_acquire);
+                    intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos + 1);
+                    if (diff == 0)
+                    {
+                        if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                            break;
+                    }
+                    else if (diff < 0)
+                        return false;
+                    else
+                        pos = head_.load(std::memory_order_relaxed);
+                }
+                size = c->size;
+                const char* data = payload(c);
+                buffer.insert(buffer.end(), data, data + size);
+                c->sequence.store(pos + mask_ + 1, std::memory_order_release);
+                return true;
+            }
+
+            std::size_t maxEventSize() const
+            {
+                return maxEventSize_;
+            }
+
+            std::size_t capacity() const
+            {
+                return mask_ + 1;
+            }
+
+        private:
+            Cell* cell(std::size_t index) const
+            {
+                return reinterpret_cast<Cell*>(base_ + index * stride_);
+            }
+
+            static char* payload(Cell* c)
+            {
+                return reinterpret_cast<char*>(c) + sizeof(Cell);
+            }
+
+            // Producers and consumers contend on different cache lines
+            std::atomic<std::size_t> tail_;
+            char tailPadding_[64 - sizeof(std::atomic<std::size_t>)];
+            std::atomic<std::size_t> head_;
+            char headPadding_[64 - sizeof(std::atomic<std::size_t>)];
+            std::size_t mask_;
+            std::size_t stride_;
+            std::size_t maxEventSize_;
+            char* base_;
+            std::unique_ptr<char[]> storage_;
+        };
+    }
+
+    /// In-process publish/subscribe bus between plugins
+    /**
+      * Topics are identified by 64-bit IDs, computed at compile time from their names
+      * with PLUGIN_TOPIC_ID. A topic is created on first use with the default settings,
+      * or beforehand with createTopic().
+      *
+      * Publishing copies the event into a bounded lock-free queue of the topic and never blocks:
+      * when the queue is full, the publication is rejected (backpressure)
+      * and the publisher decides whether to retry or drop.
+      * dispatch(), called by host threads or by the thread started with startDispatcher(),
+      * drains the queues and delivers events to the subscribers by batches.
+      * Several threads may dispatch concurrently; events of one topic are then
+      * delivered in order within a batch, but batches may be delivered out of order.
+      *
+      * Plugins reach the bus through the host services, see api() and EventBusClient.
+      * A handler must not subscribe nor unsubscribe to its own topic.
+      * Once unsubscribe() returns, the handler is not running and will not be called again,
+      * so the plugin owning it can be unloaded.
+      */
+    class EventBus : private boost::noncopyable
+    {
+        struct Subscription
+        {
+            uint64_t id;
+            PluginEventHandler handler;
+            void* userData;
+        };
+
+        struct Topic
+        {
+            Topic(uint64_t topicId, std::size_t capacity, std::size_t maxEventSize)
+                : id(topicId),
+                  queue(capacity, maxEventSize),
+                  published(0),
+                  rejected(0),
+                  delivered(0),
+                  batches(0)
+            {
+                // Empty
+            }
+
+            uint64_t id;
+            detail::EventQueue queue;
+            std::atomic<uint64_t> published;
+            std::atomic<uint64_t> rejected;
+            std::atomic<uint64_t> delivered;
+            std::atomic<uint64_t> batches;
+            // Held while delivering, so that unsubscribe() waits for running handlers
+            std::mutex subscriptionsMutex;
+            std::vector<Subscription> subscriptions;
+        };
+
+    public:
+        /// Constructor
+        /**
+          * @param maxTopics Maximum number of topics
+          * @param defaultCapacity Queue capacity, in events, of topics created on first use
+          * @param defaultMaxEventSize Maximum event size, in bytes, of topics created on first use
+          */
+        explicit EventBus(std::size_t maxTopics = 256,
+                          std::size_t defaultCapacity = 1024,
+                          std::size_t defaultMaxEventSize = 256)
+            : defaultCapacity_(defaultCapacity),
+              defaultMaxEventSize_(defaultMaxEventSize),
+              topicCount_(0),
+              maxTopics_(maxTopics),
+              nextSubscription_(1),
+              dispatching_(false)
+        {
+            std::size_t slots = 1;
+            while (slots < 2 * maxTopics)
+                slots <<= 1;
+            slotMask_ = slots - 1;
+            slots_.reset(new std::atomic<Topic*>[slots]);
+            for (std::size_t i = 0; i < slots; ++i)
+                slots_[i].store(NULL, std::memory_order_relaxed);
+
+            api_.size = sizeof(PluginEventBusApi);
+            api_.version = 1;
+            api_.context = this;
+            api_.publish = &EventBus::publishThunk;
+            api_.subscribe = &EventBus::subscribeThunk;
+            api_.unsubscribe = &EventBus::unsubscribeThunk;
+        }
+
+        /// Destructor. Stop the dispatcher thread.
+        ~EventBus()
+        {
+            stopDispatcher();
+            for (std::size_t i = 0; i <= slotMask_; ++i)
+                delete slots_[i].load(std::memory_order_relaxed);
+        }
+
+        /// Create a topic with specific settings
+        /**
+          * @param topic ID of the topic, see PLUGIN_TOPIC_ID
+          * @param capacity Queue capacity in events, rounded up to a power of two
+          * @param maxEventSize Maximum event size in bytes
+          * @return False if the topic already exists or the topic limit is reached. True otherwise.
+          */
+        bool createTopic(uint64_t topic, std::size_t capacity, std::size_t maxEventSize)
+        {
+            bool created = false;
+            return findOrCreate(topic, capacity, maxEventSize, created) && created;
+        }
+
+        /// Publish an event without blocking
+        /**
+          * @param topic ID of the topic, see PLUGIN_TOPIC_ID
+          * @param data Payload, copied into the queue
+          * @param size Size of the payload in bytes
+          * @return eventPublished on success
+          */
+        EventStatus publish(uint64_t topic, const void* data, uint32_t size)
+        {
+            bool created = false;
+            Topic* t = findOrCreate(topic, defaultCapacity_, defaultMaxEventSize_, created);
+            if (!t)
+                return eventTopicLimit;
+            if (size > t->queue.maxEventSize())
+                return eventTooLarge;
+            if (!t->queue.push(data, size))
+            {
+                t->rejected.fetch_add(1, std::memory_order_relaxed);
+                return eventQueueFull;
+            }
+            t->published.fetch_add(1, std::memory_order_relaxed);
+            return eventPublished;
+        }
+
+        /// Publish an event, waiting for room in the queue up to a timeout
+        /**
+          * Rejections while waiting are counted in TopicStats::rejected.
+          */
+        template<class Rep, class Period>
+        EventStatus publish(uint64_t topic, const void* data, uint32_t size,
+                            const std::chrono::duration<Rep, Period>& timeout)
+        {
+            std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + timeout;
+            unsigned int attempts = 0;
+            while (true)
+            {
+                EventStatus res = publish(topic, data, size);
+                if (res != eventQueueFull || std::chrono::steady_clock::now() >= deadline)
+                    return res;
+                if (++attempts < 64)
+                    detail::cpuRelax();
+                else
+                    std::this_thread::yield();
+            }
+        }
+
+        /// Subscribe to a topic
+        /**
+          * @param topic ID of the topic, see PLUGIN_TOPIC_ID
+          * @param handler Called with batches of events of the topic
+          * @param userData Given back to the handler
+          * @return Subscription ID, zero if the topic limit is reached
+          */
+        uint64_t subscribe(uint64_t topic, PluginEventHandler handler, void* userData)
+        {
+            bool created = false;
+            Topic* t = findOrCreate(topic, defaultCapacity_, defaultMaxEventSize_, created);
+            if (!t || !handler)
+                return 0;
+            Subscription subscription;
+            subscription.id = nextSubscription_.fetch_add(1, std::memory_order_relaxed);
+            subscription.handler = handler;
+            subscription.userData = userData;
+            {
+                std::lock_guard<std::mutex> lock(t->subscriptionsMutex);
+                t->subscriptions.push_back(subscription);
+            }
+            std::lock_guard<std::mutex> lock(mutex_);
+            subscriptionTopics_[subscription.id] = t;
+            return subscription.id;
+        }
+
+        /// Cancel a subscription
+        /**
+          * Waits for the handler if it is running.
+          * @return False if the subscription does not exist. True otherwise.
+          */
+        bool unsubscribe(uint64_t subscription)
+        {
+            Topic* t = NULL;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                std::map<uint64_t, Topic*>::iterator it = subscriptionTopics_.find(subscription);
+                if (it == subscriptionTopics_.end())
+                    return false;
+                t = it->second;
+                subscriptionTopics_.erase(it);
+            }
+            std::lock_guard<std::mutex> lock(t->subscriptionsMutex);
+            for (std::size_t i = 0; i < t->subscriptions.size(); ++i)
+            {
+                if (t->subscriptions[i].id == subscription)
+                {
+                    t->subscriptions.erase(t->subscriptions.begin() + i);
+                    break;
+                }
+            }
+            return true;
+        }
+
+        /// Deliver queued events
+        /**
+          * @param maxBatch Maximum number of events per batch, and per topic during this call
+          * @return Number of events taken from the queues
+          */
+        std::size_t dispatch(std::size_t maxBatch = 64)
+        {
+            std::vector<char> buffer;
+            std::vector<uint32_t> sizes;
+            std::vector<PluginEvent> events;
+            std::size_t res = 0;
+            for (std::size_t i = 0; i <= slotMask_; ++i)
+            {
+                Topic* t = slots_[i].load(std::memory_order_acquire);
+                if (!t)
+                    continue;
+                buffer.clear();
+                sizes.clear();
+                uint32_t size = 0;
+                while (sizes.size() < maxBatch && t->queue.pop(buffer, size))
+                    sizes.push_back(size);
+                if (sizes.empty())
+                    continue;
+
+                // Point into the buffer once it stopped growing
+                events.resize(sizes.size());
+                std::size_t offset = 0;
+                for (std::size_t j = 0; j < sizes.size(); ++j)
+                {
+                    events[j].topic = t->id;
+                    events[j].data = buffer.data() + offset;
+                    events[j].size = sizes[j];
+                    offset += sizes[j];
+                }
+                {
+                    std::lock_guard<std::mutex> lock(t->subscriptionsMutex);
+                    for (std::size_t j = 0; j < t->subscriptions.size(); ++j)
+                        t->subscriptions[j].handler(t->subscriptions[j].userData, events.data(), events.size());
+                }
+                t->delivered.fetch_add(sizes.size(), std::memory_order_relaxed);
+                t->batches.fetch_add(1, std::memory_order_relaxed);
+                res += sizes.size();
+            }
+            return res;
+        }
+
+        /// Start a thread calling dispatch() until stopDispatcher()
+        /**
+          * When idle, the thread backs off up to one millisecond between polls.
+          */
+        void startDispatcher(std::size_t maxBatch = 64)
+        {
+            if (dispatching_.exchange(true))
+                return;
+            dispatcher_ = std::thread([this, maxBatch]()
+            {
+                unsigned int idle = 0;
+                while (dispatching_.load(std::memory_order_relaxed))
+                {
+                    if (dispatch(maxBatch) != 0)
+                        idle = 0;
+                    else if (++idle < 64)
+                        std::this_thread::yield();
+                    else
+                        std::this_thread::sleep_for(std::chrono::microseconds(std::min(idle, 1000u)));
+                }
+                // Deliver what was published before the stop
+                while (dispatch(maxBatch) != 0)
+                    continue;
+            });
+        }
+
+        /// Stop the thread started with startDispatcher()
+        void stopDispatcher()
+        {
+            if (!dispatching_.exchange(false))
+                return;
+            dispatcher_.join();
+        }
+
+        /// Get the counters of a topic
+        /**
+          * @return False if the topic does not exist. True otherwise.
+          */
+        bool getStats(uint64_t topic, TopicStats& stats) const
+        {
+            const Topic* t = find(topic);
+            if (!t)
+                return false;
+            stats.published = t->published.load(std::memory_order_relaxed);
+            stats.rejected = t->rejected.load(std::memory_order_relaxed);
+            stats.delivered = t->delivered.load(std::memory_order_relaxed);
+            stats.batches = t->batches.load(std::memory_order_relaxed);
+            return true;
+        }
+
+        /// Get the IDs of every topic
+        std::vector<uint64_t> getTopics() const
+        {
+            std::vector<uint64_t> res;
+            for (std::size_t i = 0; i <= slotMask_; ++i)
+                if (const Topic* t = slots_[i].load(std::memory_order_acquire))
+                    res.push_back(t->id);
+            return res;
+        }
+
+        /// Get the C interface given to plugins
+        /**
+          * Offer it to plugins with HostServices::add(PLUGIN_EVENT_BUS_SERVICE, bus.api()).
+          */
+        const PluginEventBusApi* api() const
+        {
+            return &api_;
+        }
+
+    private:
+        const Topic* find(uint64_t topic) const
+        {
+            for (std::size_t i = 0; i <= slotMask_; ++i)
+            {
+                const Topic* t = slots_[(topic + i) & slotMask_].load(std::memory_order_acquire);
+                if (!t)
+                    return NULL;
+                if (t->id == topic)
+                    return t;
+            }
+            return NULL;
+        }
+
+        // Lock-free lookup in an open addressing table. Topics are never removed.
+        Topic* findOrCreate(uint64_t topic, std::size_t capacity, std::size_t maxEventSize, bool& created)
+        {
+            std::unique_ptr<Topic> candidate;
+            for (std::size_t i = 0; i <= slotMask_; ++i)
+            {
+                std::atomic<Topic*>& slot = slots_[(topic + i) & slotMask_];
+                Topic* t = slot.load(std::memory_order_acquire);
+                while (!t)
+                {
+                    if (topicCount_.fetch_add(1, std::memory_order_relaxed) >= maxTopics_)
+                    {
+                        topicCount_.fetch_sub(1, std::memory_order_relaxed);
+                        return NULL;
+                    }
+                    if (!candidate)
+                        candidate.reset(new Topic(topic, capacity, maxEventSize));
+                    if (slot.compare_exchange_strong(t, candidate.get(), std::memory_order_acq_rel))
+                    {
+                        created = true;
+                        return candidate.release();
+                    }
+                    // Another thread took the slot: t now holds its topic
+                    topicCount_.fetch_sub(1, std::memory_order_relaxed);
+                }
+                if (t->id == topic)
+                    return t;
+            }
+            return NULL;
+        }
+
+        static int publishThunk(void* context, uint64_t topic, const void* data, uint32_t size)
+        {
+            return static_cast<EventBus*>(context)->publish(topic, data, size);
+        }
+
+        static uint64_t subscribeThunk(void* context, uint64_t topic, PluginEventHandler handler, void* userData)
+        {
+            return static_cast<EventBus*>(context)->subscribe(topic, handler, userData);
+        }
+
+        static int unsubscribeThunk(void* context, uint64_t subscription)
+        {
+            return static_cast<EventBus*>(context)->unsubscribe(subscription) ? 1 : 0;
+        }
+
+        // Settings of topics created on first use
+        std::size_t defaultCapacity_;
+        std::size_t defaultMaxEventSize_;
+        // Open addressing table of topics, indexed by topic ID
+        std::unique_ptr<std::atomic<Topic*>[]> slots_;
+        std::size_t slotMask_;
+        std::atomic<std::size_t> topicCount_;
+        std::size_t maxTopics_;
+        // Topic of each subscription
+        std::map<uint64_t, Topic*> subscriptionTopics_;
+        std::atomic<uint64_t> nextSubscription_;
+        // Protects subscriptionTopics_
+        std::mutex mutex_;
+        // Dispatcher thread
+        std::atomic<bool> dispatching_;
+        std::thread dispatcher_;
+        // C interface
+        PluginEventBusApi api_;
+    };
+
+    /// Plugin side access to the event bus of the host
+    /**
+      * Wraps the C interface found in the host services.
+      */
+    class EventBusClient
+    {
+    public:
+        /// Constructor
+        /**
+          * @param services Host services, typically globalHostServices in a plugin
+          */
+        explicit EventBusClient(const PluginHostServices* services)
+            : api_(getHostService<PluginEventBusApi>(services, PLUGIN_EVENT_BUS_SERVICE))
+        {
+            // Empty
+        }
+
+        /// Check whether the host offers an event bus
+        bool isAvailable() const
+        {
+            return api_ != NULL;
+        }
+
+        /// Publish raw bytes without blocking
+        EventStatus publish(uint64_t topic, const void* data, uint32_t size) const
+        {
+            return static_cast<EventStatus>(api_->publish(api_->context, topic, data, size));
+        }
+
+        /// Publish a trivially copyable value without blocking
+        template<class E>
+        EventStatus publish(uint64_t topic, const E& event) const
+        {
+            static_assert(std::is_trivially_copyable<E>::value, "Events must be trivially copyable");
+            return publish(topic, &event, static_cast<uint32_t>(sizeof(E)));
+        }
+
+        /// Subscribe to a topic. Returns the subscription ID, zero on failure.
+        uint64_t subscribe(uint64_t topic, PluginEventHandler handler, void* userData) const
+        {
+            return api_->subscribe(api_->context, topic, handler, userData);
+        }
+
+        /// Cancel a subscription
+        bool unsubscribe(uint64_t subscription) const
+        {
+            return api_->unsubscribe(api_->context, subscription) != 0;
+        }
+
+    private:
+        // C interface of the bus. NULL if not offered.
+        const PluginEventBusApi* api_;
+    };
+}
@@ -0,0 +1,18 @@
+//          Copyright Jeremy Coulon 2012-2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+/** @file */
+
+#pragma once
+
+//==============
+//==  Plugin  ==
+//==============
+#include "Plugin/IPlugin.h"
+#include "Plugin/InterfaceDescription.h"
+
+// Description of Plugin::IPlugin.
+// iGetPluginVersion() is not described because Vers::Version has no Serializer.
+PLUGIN_INTERFACE_DESCRIPTION(Plugin::IPlugin, (iGetPluginName))
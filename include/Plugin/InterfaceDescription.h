@@ -0,0 +1,186 @@
+//          Copyright Jeremy Coulon 2012-2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+/** @file */
+
+#pragma once
+
+//=============
+//==  Boost  ==
+//=============
+#include <boost/preprocessor/seq/enum.hpp>
+#include <boost/preprocessor/seq/size.hpp>
+#include <boost/preprocessor/seq/transform.hpp>
+#include <boost/preprocessor/stringize.hpp>
+
+//===========
+//==  STD  ==
+//===========
+#include <cstddef>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+/// Namespace of the Plugin library
+namespace Plugin
+{
+    /// Description of the methods of a plugin interface
+    /**
+      * This template is not defined. It is specialized for an interface
+      * with the macro PLUGIN_INTERFACE_DESCRIPTION(T, METHODS).
+      * A specialization provides:
+      * - interface_type: the described interface
+      * - methodCount: the number of described methods
+      * - methods(): a std::tuple of pointers to the described member functions
+      * - methodNames(): an array of the method names
+      * @tparam T Interface type of the concrete plugin
+      */
+    template<class T>
+    struct InterfaceDescription;
+
+    /// Compile-time information about a pointer to member function
+    template<class Pmf>
+    struct MethodTraits;
+
+    /// Specialization for non const member functions
+    template<class C, class R, class... A>
+    struct MethodTraits<R (C::*)(A...)>
+    {
+        /// Class declaring the method
+        typedef C class_type;
+        /// Return type as declared
+        typedef R result_type;
+        /// Return type as transferred by value
+        typedef typename std::decay<R>::type value_type;
+        /// Parameter types as transferred by value
+        typedef std::tuple<typename std::decay<A>::type...> arguments_type;
+        /// Number of parameters
+        enum { arity = sizeof...(A) };
+    };
+
+    /// Specialization for const member functions
+    template<class C, class R, class... A>
+    struct MethodTraits<R (C::*)(A...) const> : MethodTraits<R (C::*)(A...)>
+    {
+        // Empty
+    };
+
+    namespace detail
+    {
+        // Minimal C++11 replacement for std::index_sequence
+        template<std::size_t... I>
+        struct IndexSequence
+        {
+            // Empty
+        };
+
+        template<std::size_t N, std::size_t... I>
+        struct MakeIndexSequence : MakeIndexSequence<N - 1, N - 1, I...>
+        {
+            // Empty
+        };
+
+        template<std::size_t... I>
+        struct MakeIndexSequence<0, I...>
+        {
+            typedef IndexSequence<I...> type;
+        };
+
+        // Compare a method pointer against the I-th described method, if they share the same type
+        template<class Pmf, class Candidate>
+        struct MethodMatcher
+        {
+            static bool match(Pmf, Candidate)
+            {
+                return false;
+            }
+        };
+
+        template<class Pmf>
+        struct MethodMatcher<Pmf, Pmf>
+        {
+            static bool match(Pmf pmf, Pmf candidate)
+            {
+                return pmf == candidate;
+            }
+        };
+
+        template<std::size_t I, class Tuple, class Pmf>
+        std::size_t findMethod(const Tuple&, Pmf, std::true_type)
+        {
+            return I;
+        }
+
+        template<std::size_t I, class Tuple, class Pmf>
+        std::size_t findMethod(const Tuple& methods, Pmf pmf, std::false_type)
+        {
+            typedef typename std::tuple_element<I, Tuple>::type Candidate;
+            if (MethodMatcher<Pmf, Candidate>::match(pmf, std::get<I>(methods)))
+                return I;
+            return findMethod<I + 1>(methods, pmf, std::integral_constant<bool, I + 1 == std::tuple_size<Tuple>::value>());
+        }
+    }
+
+    /// Get the index of a method in the description of its interface
+    /**
+      * @param pmf Pointer to a described member function of T
+      * @return The index of the method, or InterfaceDescription<T>::methodCount if it is not described.
+      */
+    template<class T, class Pmf>
+    std::size_t methodIndex(Pmf pmf)
+    {
+        return detail::findMethod<0>(InterfaceDescription<T>::methods(), pmf, std::false_type());
+    }
+
+    /// Get the name of a described method
+    template<class T>
+    const char* methodName(std::size_t index)
+    {
+        return index < InterfaceDescription<T>::methodCount ? InterfaceDescription<T>::methodNames()[index] : "";
+    }
+}
+
+//==================================
+//==  Implementation details only  ==
+//==================================
+#define PLUGIN_INTERFACE_DESCRIPTION_POINTER(s, T, method) &T::method
+#define PLUGIN_INTERFACE_DESCRIPTION_NAME(s, T, method) BOOST_PP_STRINGIZE(method)
+
+/// Describe the methods of a plugin interface.
+/**
+  * Must be used in the global namespace, usually next to the interface declaration,
+  * so that the host and the plugins share the same description.
+  * Only the described methods can be called through the utilities
+  * that rely on a description (remote hosts, interceptors...).
+  * Overloaded methods cannot be described.
+  * @param T Interface type. It must not contain commas.
+  * @param METHODS Boost.Preprocessor sequence of method names, e.g. (foo)(bar)
+  */
+#define PLUGIN_INTERFACE_DESCRIPTION(T, METHODS)                                                          \
+namespace Plugin                                                                                          \
+{                                                                                                         \
+    template<>                                                                                            \
+    struct InterfaceDescription< T >                                                                      \
+    {                                                                                                     \
+        typedef T interface_type;                                                                         \
+        enum { methodCount = BOOST_PP_SEQ_SIZE(METHODS) };                                                \
+        static const char* interfaceName()                                                                \
+        {                                                                                                 \
+            return BOOST_PP_STRINGIZE(T);                                                                 \
+        }                                                                                                 \
+        static auto methods()                                                                             \
+            -> decltype(std::make_tuple(BOOST_PP_SEQ_ENUM(BOOST_PP_SEQ_TRANSFORM(PLUGIN_INTERFACE_DESCRIPTION_POINTER, T, METHODS)))) \
+        {                                                                                                 \
+            return std::make_tuple(BOOST_PP_SEQ_ENUM(BOOST_PP_SEQ_TRANSFORM(PLUGIN_INTERFACE_DESCRIPTION_POINTER, T, METHODS))); \
+        }                                                                                                 \
+        static const char* const* methodNames()                                                           \
+        {                                                                                                 \
+            static const char* const names[] = {                                                          \
+                BOOST_PP_SEQ_ENUM(BOOST_PP_SEQ_TRANSFORM(PLUGIN_INTERFACE_DESCRIPTION_NAME, T, METHODS))  \
+            };                                                                                            \
+            return names;                                                                                 \
+        }                                                                                                 \
+    };                                                                                                    \
+}
@@ -0,0 +1,236 @@
+//          Copyright Jeremy Coulon 2012-2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+/** @file */
+
+#pragma once
+
+//===========
+//==  STD  ==
+//===========
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+#include <stdint.h>
+
+/// Namespace of the Plugin library
+namespace Plugin
+{
+    namespace detail
+    {
+        // Index of the highest bit set. Value must not be zero.
+        inline unsigned int highestBit(uint64_t value)
+        {
+#if defined(__GNUC__)
+            return 63 - __builtin_clzll(value);
+#else
+            unsigned int res = 0;
+            while (value >>= 1)
+                ++res;
+            return res;
+#endif
+        }
+    }
+
+    class SharedLatencyHistogram;
+
+    /// Histogram of durations with logarithmic buckets, in the style of HdrHistogram
+    /**
+      * Each power of two is split in 16 linear buckets, so any value is known within 6.25%,
+      * from one nanosecond to the full 64-bit range, with a fixed number of buckets.
+      */
+    class LatencyHistogram
+    {
+    public:
+        /// Number of linear buckets per power of two, as a power of two
+        static const unsigned int subBucketBits = 4;
+        /// Number of buckets
+        static const std::size_t bucketCount = (64 - subBucketBits + 1) << subBucketBits;
+
+        /// Constructor
+        LatencyHistogram()
+            : buckets_(bucketCount, 0),
+              count_(0),
+              sum_(0),
+              max_(0)
+        {
+            // Empty
+        }
+
+        /// Index of the bucket of a value
+        static std::size_t bucketIndex(uint64_t value)
+        {
+            const uint64_t subBuckets = 1u << subBucketBits;
+            if (value < subBuckets)
+                return static_cast<std::size_t>(value);
+            unsigned int exponent = detail::highestBit(value);
+            uint64_t sub = (value >> (exponent - subBucketBits)) & (subBuckets - 1);
+            return static_cast<std::size_t>(((exponent - subBucketBits + 1) << subBucketBits) + sub);
+        }
+
+        /// Lowest value of a bucket
+        static uint64_t bucketLowerBound(std::size_t index)
+        {
+            const uint64_t subBuckets = 1u << subBucketBits;
+            if (index < subBuckets)
+                return index;
+            unsigned int exponent = static_cast<unsigned int>(index >> subBucketBits) + subBucketBits - 1;
+            return (subBuckets + (index & (subBuckets - 1))) << (exponent - subBucketBits);
+        }
+
+        /// Highest value of a bucket
+        static uint64_t bucketUpperBound(std::size_t index)
+        {
+            return index + 1 < bucketCount ? bucketLowerBound(index + 1) - 1 : ~uint64_t(0);
+        }
+
+        /// Record a value
+        void record(uint64_t value)
+        {
+            ++buckets_[bucketIndex(value)];
+            ++count_;
+            sum_ += value;
+            max_ = std::max(max_, value);
+        }
+
+        /// Record a value several times
+        void record(uint64_t value, uint64_t count)
+        {
+            buckets_[bucketIndex(value)] += count;
+            count_ += count;
+            sum_ += value * count;
+            max_ = std::max(max_, value);
+        }
+
+        /// Add the values of another histogram
+        void merge(const LatencyHistogram& other)
+        {
+            for (std::size_t i = 0; i < bucketCount; ++i)
+                buckets_[i] += other.buckets_[i];
+            count_ += other.count_;
+            sum_ += other.sum_;
+            max_ = std::max(max_, other.max_);
+        }
+
+        /// Forget every value
+        void reset()
+        {
+            std::fill(buckets_.begin(), buckets_.end(), 0);
+            count_ = 0;
+            sum_ = 0;
+            max_ = 0;
+        }
+
+        /// Get the number of values
+        uint64_t getCount() const
+        {
+            return count_;
+        }
+
+        /// Get the sum of the values
+        uint64_t getSum() const
+        {
+            return sum_;
+        }
+
+        /// Get the highest value
+        uint64_t getMax() const
+        {
+            return max_;
+        }
+
+        /// Get the mean of the values. Zero if there is none.
+        double getMean() const
+        {
+            return count_ ? static_cast<double>(sum_) / count_ : 0.0;
+        }
+
+        /// Get a percentile
+        /**
+          * @param percentile Between 0 and 100
+          * @return Highest value of the bucket holding the percentile, bounded by the maximum. Zero if there is no value.
+          */
+        uint64_t getPercentile(double percentile) const
+        {
+            if (count_ == 0)
+                return 0;
+            uint64_t rank = static_cast<uint64_t>(percentile / 100.0 * count_ + 0.5);
+            rank = std::min(std::max<uint64_t>(rank, 1), count_);
+            uint64_t seen = 0;
+            for (std::size_t i = 0; i < bucketCount; ++i)
+            {
+                seen += buckets_[i];
+                if (seen >= rank)
+                    return std::min(bucketUpperBound(i), max_);
+            }
+            return max_;
+        }
+
+        /// Get the number of values of a bucket
+        uint64_t getBucket(std::size_t index) const
+        {
+            return buckets_[index];
+        }
+
+    private:
+        friend class SharedLatencyHistogram;
+
+        // Number of values per bucket
+        std::vector<uint64_t> buckets_;
+        // Summary
+        uint64_t count_;
+        uint64_t sum_;
+        uint64_t max_;
+    };
+
+    /// LatencyHistogram written by one thread and read by others
+    /**
+      * The writer only does plain loads and stores, without atomic read-modify-write,
+      * so recording costs about as much as in a LatencyHistogram.
+      * Readers may see a value in its bucket before it is added to the sum.
+      */
+    class SharedLatencyHistogram
+    {
+    public:
+        /// Constructor
+        SharedLatencyHistogram()
+            : buckets_(LatencyHistogram::bucketCount),
+              sum_(0),
+              max_(0)
+        {
+            // Empty
+        }
+
+        /// Record a value. Only one thread may record.
+        void record(uint64_t value)
+        {
+            std::atomic<uint64_t>& bucket = buckets_[LatencyHistogram::bucketIndex(value)];
+            bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            sum_.store(sum_.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+            if (value > max_.load(std::memory_order_relaxed))
+                max_.store(value, std::memory_order_relaxed);
+        }
+
+        /// Add the values recorded so far to a histogram. Any thread may merge.
+        void mergeInto(LatencyHistogram& histogram) const
+        {
+            for (std::size_t i = 0; i < LatencyHistogram::bucketCount; ++i)
+            {
+                uint64_t count = buckets_[i].load(std::memory_order_relaxed);
+                histogram.buckets_[i] += count;
+                histogram.count_ += count;
+            }
+            histogram.sum_ += sum_.load(std::memory_order_relaxed);
+            histogram.max_ = std::max(histogram.max_, max_.load(std::memory_order_relaxed));
+        }
+
+    private:
+        std::vector<std::atomic<uint64_t> > buckets_;
+        std::atomic<uint64_t> sum_;
+        std::atomic<uint64_t> max_;
+    };
+}
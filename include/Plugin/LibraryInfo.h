@@ -0,0 +1,248 @@
+//          Copyright Jeremy Coulon 2012-2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+/** @file */
+
+#pragma once
+
+//===========
+//==  STD  ==
+//===========
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+//=======================
+//==  OS Specific SDK  ==
+//=======================
+#ifndef _WIN32
+#include <dlfcn.h>
+#include <link.h>
+#endif
+
+/// Namespace of the Plugin library
+namespace Plugin
+{
+    /// Address range of one loadable segment (PT_LOAD) of a library
+    struct LibrarySegment
+    {
+        /// First address of the segment
+        std::size_t begin;
+        /// One past the last address of the segment
+        std::size_t end;
+        /// ELF segment flags (PF_R, PF_W, PF_X)
+        unsigned int flags;
+    };
+
+    /// Description of a library mapped in the current process
+    struct LibraryInfo
+    {
+        LibraryInfo()
+            : base(0)
+        {
+            // Empty
+        }
+
+        /// Lowest mapped address of the library
+        std::size_t begin() const
+        {
+            std::size_t res = 0;
+            for (std::size_t i = 0; i < segments.size(); ++i)
+                if (i == 0 || segments[i].begin < res)
+                    res = segments[i].begin;
+            return res;
+        }
+
+        /// One past the highest mapped address of the library
+        std::size_t end() const
+        {
+            std::size_t res = 0;
+            for (std::size_t i = 0; i < segments.size(); ++i)
+                if (segments[i].end > res)
+                    res = segments[i].end;
+            return res;
+        }
+
+        /// Check if an address belongs to one of the library segments
+        bool contains(std::size_t address) const
+        {
+            for (std::size_t i = 0; i < segments.size(); ++i)
+                if (address >= segments[i].begin && address < segments[i].end)
+                    return true;
+            return false;
+        }
+
+        /// Path of the library as seen by the dynamic linker
+        std::string path;
+        /// Load bias of the library
+        std::size_t base;
+        /// GNU build ID of the library, in hexadecimal. Empty if it has none.
+        std::string buildId;
+        /// Loadable segments of the library
+        std::vector<LibrarySegment> segments;
+    };
+
+    /// Resident memory of one mapping of the current process
+    struct MappingUsage
+    {
+        /// First address of the mapping
+        std::size_t begin;
+        /// One past the last address of the mapping
+        std::size_t end;
+        /// Resident set size of the mapping in bytes
+        std::size_t rss;
+    };
+
+#ifndef _WIN32
+    namespace detail
+    {
+        // Read the GNU build ID from the note segments of a mapped module
+        inline std::string readBuildId(const struct dl_phdr_info* info)
+        {
+            static const char hex[] = "0123456789abcdef";
+            for (int i = 0; i < info->dlpi_phnum; ++i)
+            {
+                const ElfW(Phdr)& phdr = info->dlpi_phdr[i];
+                if (phdr.p_type != PT_NOTE)
+                    continue;
+                std::size_t align = phdr.p_align == 8 ? 8 : 4;
+                const char* note = reinterpret_cast<const char*>(info->dlpi_addr + phdr.p_vaddr);
+                const char* end = note + phdr.p_memsz;
+                while (note + sizeof(ElfW(Nhdr)) <= end)
+                {
+                    const ElfW(Nhdr)* header = reinterpret_cast<const ElfW(Nhdr)*>(note);
+                    const char* name = note + sizeof(ElfW(Nhdr));
+                    const unsigned char* desc = reinterpret_cast<const unsigned char*>(name + ((header->n_namesz + align - 1) & ~(align - 1)));
+                    if (header->n_type == NT_GNU_BUILD_ID && header->n_namesz == 4 && std::memcmp(name, "GNU", 4) == 0)
+                    {
+                        std::string res;
+                        for (std::size_t b = 0; b < header->n_descsz; ++b)
+                        {
+                            res += hex[desc[b] >> 4];
+                            res += hex[desc[b] & 0xf];
+                        }
+                        return res;
+                    }
+                    note = reinterpret_cast<const char*>(desc) + ((header->n_descsz + align - 1) & ~(align - 1));
+                }
+            }
+            return std::string();
+        }
+
+        // dl_iterate_phdr() callback matching the library by its load bias
+        inline int collectSegments(struct dl_phdr_info* info, std::size_t, void* data)
+        {
+            LibraryInfo* lib = static_cast<LibraryInfo*>(data);
+            if (info->dlpi_addr != lib->base || !info->dlpi_name || lib->path != info->dlpi_name)
+                return 0;
+            for (int i = 0; i < info->dlpi_phnum; ++i)
+            {
+                const ElfW(Phdr)& phdr = info->dlpi_phdr[i];
+                if (phdr.p_type != PT_LOAD)
+                    continue;
+                LibrarySegment segment;
+                segment.begin = info->dlpi_addr + phdr.p_vaddr;
+                segment.end = segment.begin + phdr.p_memsz;
+                segment.flags = phdr.p_flags;
+                lib->segments.push_back(segment);
+            }
+            lib->buildId = readBuildId(info);
+            return 1;
+        }
+    }
+
+    /// Describe a library loaded with dlopen()
+    /**
+      * @param handle Handle returned by dlopen()
+      * @param info Receives the library description
+      * @return True on success. False otherwise.
+      */
+    inline bool queryLibraryInfo(void* handle, LibraryInfo& info)
+    {
+        info = LibraryInfo();
+        struct link_map* map = NULL;
+        if (!handle || dlinfo(handle, RTLD_DI_LINKMAP, &map) != 0 || !map)
+            return false;
+        info.path = map->l_name ? map->l_name : "";
+        info.base = map->l_addr;
+        dl_iterate_phdr(&detail::collectSegments, &info);
+        return !info.segments.empty();
+    }
+#endif
+
+    /// Read the resident size of every mapping of the current process
+    /**
+      * This parses /proc/self/smaps and is therefore only available on Linux.
+      * It is a rather expensive operation, so callers should read the mappings
+      * once and then attribute them to as many libraries as they need.
+      * @param mappings Receives one entry per mapping
+      * @return True on success. False otherwise.
+      */
+    inline bool readMappingUsage(std::vector<MappingUsage>& mappings)
+    {
+        mappings.clear();
+#ifdef __linux__
+        std::ifstream smaps("/proc/self/smaps");
+        if (!smaps)
+            return false;
+        std::string line;
+        while (std::getline(smaps, line))
+        {
+            if (line.compare(0, 4, "Rss:") == 0)
+            {
+                if (mappings.empty())
+                    continue;
+                std::istringstream iss(line.substr(4));
+                std::size_t kiloBytes = 0;
+                iss >> kiloBytes;
+                mappings.back().rss = kiloBytes * 1024;
+                continue;
+            }
+            // Mapping headers look like "7f12a000-7f12b000 r-xp ..."
+            std::string::size_type dash = line.find('-');
+            std::string::size_type space = line.find(' ');
+            if (dash == std::string::npos || space == std::string::npos || dash > space)
+                continue;
+            if (line.find(':') < dash)
+                continue;
+            MappingUsage usage;
+            usage.begin = std::strtoull(line.substr(0, dash).c_str(), NULL, 16);
+            usage.end = std::strtoull(line.substr(dash + 1, space - dash - 1).c_str(), NULL, 16);
+            usage.rss = 0;
+            mappings.push_back(usage);
+        }
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    /// Compute the resident size of a library
+    /**
+      * @param info Library description
+      * @param mappings Result of readMappingUsage()
+      * @return Resident bytes of the mappings overlapping the library segments.
+      */
+    inline std::size_t residentBytes(const LibraryInfo& info, const std::vector<MappingUsage>& mappings)
+    {
+        std::size_t res = 0;
+        for (std::size_t i = 0; i < mappings.size(); ++i)
+        {
+            for (std::size_t j = 0; j < info.segments.size(); ++j)
+            {
+                if (mappings[i].begin < info.segments[j].end && info.segments[j].begin < mappings[i].end)
+                {
+                    res += mappings[i].rss;
+                    break;
+                }
+            }
+        }
+        return res;
+    }
+}
@@ -0,0 +1,395 @@
+//          Copyright Jeremy Coulon 2012-2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+/** @file */
+
+#pragma once
+
+//==============
+//==  Plugin  ==
+//==============
+#include "Plugin/LibraryInfo.h"
+#include "Plugin/UnaccountedScope.h"
+
+//=============
+//==  Boost  ==
+//=============
+#include <boost/noncopyable.hpp>
+
+//===========
+//==  STD  ==
+//===========
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+//=======================
+//==  OS Specific SDK  ==
+//=======================
+#ifndef _WIN32
+#include <cxxabi.h>
+#include <link.h>
+#include <unistd.h>
+#endif
+
+/// Namespace of the Plugin library
+namespace Plugin
+{
+    /// One load of a plugin library
+    struct LoadRecord
+    {
+        LoadRecord()
+            : generation(0),
+              loadTimeNs(0),
+              unloadTimeNs(0),
+              handle(NULL)
+        {
+            // Empty
+        }
+
+        /// Number of the load in the process, from 1
+        uint64_t generation;
+        /// Name given to the loader
+        std::string name;
+        /// Path, build ID, load bias and segments of the library
+        LibraryInfo library;
+        /// Load time, in nanoseconds since the epoch
+        uint64_t loadTimeNs;
+        /// Unload time, in nanoseconds since the epoch. Zero while loaded.
+        uint64_t unloadTimeNs;
+        /// Library handle while loaded. NULL once unloaded.
+        const void* handle;
+    };
+
+    /// Function symbol of an ELF file
+    struct ElfSymbol
+    {
+        /// Address of the symbol in the file, before relocation
+        std::size_t address;
+        /// Size of the function in bytes
+        std::size_t size;
+        /// Mangled name
+        std::string name;
+    };
+
+#ifndef _WIN32
+    /// Read the function symbols of an ELF file of the native class
+    /**
+      * Uses the full symbol table when the file is not stripped, the dynamic one otherwise.
+      * @param path Path of the file
+      * @param symbols Receives the functions with a size
+      * @return True on success. False otherwise.
+      */
+    inline bool readFunctionSymbols(const std::string& path, std::vector<ElfSymbol>& symbols)
+    {
+        symbols.clear();
+        std::ifstream file(path.c_str(), std::ios::binary);
+        ElfW(Ehdr) header;
+        if (!file.read(reinterpret_cast<char*>(&header), sizeof(header))
+            || std::memcmp(header.e_ident, ELFMAG, SELFMAG) != 0
+            || header.e_ident[EI_CLASS] != (sizeof(void*) == 8 ? ELFCLASS64 : ELFCLASS32)
+            || header.e_shentsize != sizeof(ElfW(Shdr)))
+            return false;
+        std::vector<ElfW(Shdr)> sections(header.e_shnum);
+        file.seekg(header.e_shoff);
+        if (sections.empty() || !file.read(reinterpret_cast<char*>(&sections[0]), sections.size() * sizeof(ElfW(Shdr))))
+            return false;
+        const ElfW(Shdr)* table = NULL;
+        for (std::size_t i = 0; i < sections.size(); ++i)
+            if (sections[i].sh_type == SHT_SYMTAB || (sections[i].sh_type == SHT_DYNSYM && !table))
+                table = &sections[i];
+        if (!table || table->sh_link >= sections.size() || table->sh_entsize != sizeof(ElfW(Sym)))
+            return false;
+        const ElfW(Shdr)& strings = sections[table->sh_link];
+        std::vector<ElfW(Sym)> entries(table->sh_size / sizeof(ElfW(Sym)));
+        std::vector<char> names(strings.sh_size + 1, 0);
+        file.seekg(table->sh_offset);
+        if (!entries.empty() && !file.read(reinterpret_cast<char*>(&entries[0]), entries.size() * sizeof(ElfW(Sym))))
+            return false;
+        file.seekg(strings.sh_offset);
+        if (strings.sh_size && !file.read(&names[0], strings.sh_size))
+            return false;
+        for (std::size_t i = 0; i < entries.size(); ++i)
+        {
+            const ElfW(Sym)& entry = entries[i];
+            // ELF32_ST_TYPE() and ELF64_ST_TYPE() are the same
+            if (ELF32_ST_TYPE(entry.st_info) != STT_FUNC || entry.st_size == 0 || entry.st_shndx == SHN_UNDEF || entry.st_name >= strings.sh_size)
+                continue;
+            ElfSymbol symbol;
+            symbol.address = entry.st_value;
+            symbol.size = entry.st_size;
+            symbol.name = &names[entry.st_name];
+            symbols.push_back(symbol);
+        }
+        return true;
+    }
+#endif
+
+    /// History of the plugin libraries loaded in the process
+    /**
+      * PluginLoader records each load and unload here, with the path, build ID and address range
+      * of the library, so that addresses collected by profilers or crash handlers can still be
+      * attributed after the library is unloaded, or replaced by a newer build at the same address.
+      *
+      * The history can also be written in the perf map format, /tmp/perf-PID.map by default,
+      * which perf reads to name addresses outside of the libraries it knows about.
+      * Each loaded generation adds its functions there, and its unnamed code as one entry.
+      * Addresses reused by a later generation appear twice: the history tells which one applied.
+      * The history is never charged to the allocation account of a plugin.
+      */
+    class LoadHistory : private boost::noncopyable
+    {
+    public:
+        /// Get the history of the process
+        static LoadHistory& instance()
+        {
+            static LoadHistory history;
+            return history;
+        }
+
+        /// Record a load
+        /**
+          * @param name Name given to the loader
+          * @param library Description of the loaded library
+          * @param handle Library handle, to match the unload
+          * @return Generation of the load
+          */
+        uint64_t recordLoad(const std::string& name, const LibraryInfo& library, const void* handle)
+        {
+            // The record outlives the plugin: never charge it to its allocation account
+            detail::UnaccountedScope unaccounted;
+            std::lock_guard<std::mutex> lock(mutex_);
+            LoadRecord record;
+            record.generation = ++generations_;
+            record.name = name;
+            record.library = library;
+            record.loadTimeNs = now();
+            record.handle = handle;
+            records_.push_back(record);
+            trim();
+            if (!perfMapPath_.empty())
+            {
+                std::ofstream file(perfMapPath_.c_str(), std::ios::app);
+                writePerfMap(file, records_.back());
+            }
+            return record.generation;
+        }
+
+        /// Record an unload
+        /**
+          * @param handle Handle given to recordLoad()
+          */
+        void recordUnload(const void* handle)
+        {
+            detail::UnaccountedScope unaccounted;
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (std::deque<LoadRecord>::iterator it = records_.begin(); it != records_.end(); ++it)
+            {
+                if (it->handle == handle && it->unloadTimeNs == 0)
+                {
+                    it->unloadTimeNs = now();
+                    it->handle = NULL;
+                    break;
+                }
+            }
+            trim();
+        }
+
+        /// Get the records, oldest first
+        std::vector<LoadRecord> getRecords() const
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return std::vector<LoadRecord>(records_.begin(), records_.end());
+        }
+
+        /// Find the library that held an address at a given time
+        /**
+          * @param address Address in the process
+          * @param timeNs Time, in nanoseconds since the epoch
+          * @param record Receives the record of the library
+          * @return False if no recorded library held the address at that time
+          */
+        bool find(std::size_t address, uint64_t timeNs, LoadRecord& record) const
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (std::deque<LoadRecord>::const_reverse_iterator it = records_.rbegin(); it != records_.rend(); ++it)
+            {
+                if (it->loadTimeNs <= timeNs && (it->unloadTimeNs == 0 || timeNs < it->unloadTimeNs) && it->library.contains(address))
+                {
+                    record = *it;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        /// Write the history, one load per line
+        /**
+          * Columns are: generation, load time, unload time (0 while loaded), address range, load bias,
+          * build ID ("-" if none), path and name given to the loader.
+          */
+        void writeHistory(std::ostream& os) const
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            os << "# generation load_ns unload_ns begin-end base build_id path name" << std::endl;
+            for (std::deque<LoadRecord>::const_iterator it = records_.begin(); it != records_.end(); ++it)
+            {
+                os << it->generation << " " << it->loadTimeNs << " " << it->unloadTimeNs
+                   << std::hex << " " << it->library.begin() << "-" << it->library.end() << " " << it->library.base << std::dec
+                   << " " << (it->library.buildId.empty() ? "-" : it->library.buildId)
+                   << " " << it->library.path << " " << it->name << std::endl;
+            }
+        }
+
+        /// Set the maximum number of records
+        /**
+          * Beyond it, the oldest unloaded libraries are forgotten. Loaded ones are always kept.
+          */
+        void setCapacity(std::size_t capacity)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            capacity_ = capacity;
+            trim();
+        }
+
+        /// Write the perf map entries of every recorded load, and of the next ones
+        /**
+          * @param path Path of the perf map file, /tmp/perf-PID.map if empty. The file is replaced.
+          * @return True on success. False otherwise.
+          */
+        bool enablePerfMap(const std::string& path = "")
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            std::string target = path;
+#ifndef _WIN32
+            if (target.empty())
+            {
+                std::ostringstream oss;
+                oss << "/tmp/perf-" << getpid() << ".map";
+                target = oss.str();
+            }
+#endif
+            std::ofstream file(target.c_str(), std::ios::trunc);
+            if (target.empty() || !file)
+                return false;
+            for (std::deque<LoadRecord>::const_iterator it = records_.begin(); it != records_.end(); ++it)
+                writePerfMap(file, *it);
+            perfMapPath_ = target;
+            return true;
+        }
+
+        /// Stop writing perf map entries. The file is kept.
+        void disablePerfMap()
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            perfMapPath_.clear();
+        }
+
+        /// Get the path of the perf map file. Empty if disabled.
+        std::string getPerfMapPath() const
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return perfMapPath_;
+        }
+
+    private:
+        LoadHistory()
+            : generations_(0),
+              capacity_(4096)
+        {
+            // Empty
+        }
+
+        static uint64_t now()
+        {
+            return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count());
+        }
+
+        void trim()
+        {
+            for (std::deque<LoadRecord>::iterator it = records_.begin(); records_.size() > capacity_ && it != records_.end(); )
+            {
+                if (it->unloadTimeNs != 0)
+                    it = records_.erase(it);
+                else
+                    ++it;
+            }
+        }
+
+        // Write "start size name" lines covering the executable segments of a load
+        static void writePerfMap(std::ostream& os, const LoadRecord& record)
+        {
+            const LibraryInfo& library = record.library;
+            std::string module = library.path.substr(library.path.find_last_of('/') + 1);
+            std::ostringstream suffix;
+            suffix << " [" << module << " gen " << record.generation << "]";
+            std::vector<ElfSymbol> symbols;
+#ifndef _WIN32
+            readFunctionSymbols(library.path, symbols);
+#endif
+            std::sort(symbols.begin(), symbols.end(), [](const ElfSymbol& a, const ElfSymbol& b) { return a.address < b.address; });
+            os << std::hex;
+            for (std::size_t s = 0; s < library.segments.size(); ++s)
+            {
+                const LibrarySegment& segment = library.segments[s];
+#ifndef _WIN32
+                if (!(segment.flags & PF_X))
+                    continue;
+#endif
+                std::size_t cursor = segment.begin;
+                for (std::size_t i = 0; i < symbols.size(); ++i)
+                {
+                    std::size_t begin = library.base + symbols[i].address;
+                    std::size_t end = std::min(begin + symbols[i].size, segment.end);
+                    // Outside of the segment, or an alias of a function already written
+                    if (begin < cursor || begin >= segment.end)
+                        continue;
+                    if (begin > cursor)
+                        os << cursor << " " << begin - cursor << " " << module << suffix.str() << std::endl;
+                    os << begin << " " << end - begin << " " << demangle(symbols[i].name) << suffix.str() << std::endl;
+                    cursor = end;
+                }
+                if (cursor < segment.end)
+                    os << cursor << " " << segment.end - cursor << " " << module << suffix.str() << std::endl;
+            }
+            os << std::dec;
+        }
+
+        static std::string demangle(const std::string& name)
+        {
+#ifndef _WIN32
+            int status = 0;
+            char* demangled = abi::__cxa_demangle(name.c_str(), NULL, NULL, &status);
+            if (status == 0 && demangled)
+            {
+                std::string res = demangled;
+                std::free(demangled);
+                return res;
+            }
+            std::free(demangled);
+#endif
+            return name;
+        }
+
+        mutable std::mutex mutex_;
+        std::deque<LoadRecord> records_;
+        uint64_t generations_;
+        std::size_t capacity_;
+        // Empty when disabled
+        std::string perfMapPath_;
+    };
+}
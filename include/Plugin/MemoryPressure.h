@@ -0,0 +1,122 @@
+//          Copyright Jeremy Coulon 2012-2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+/** @file */
+
+#pragma once
+
+//===========
+//==  STD  ==
+//===========
+#include <fstream>
+#include <sstream>
+#include <string>
+
+/// Namespace of the Plugin library
+namespace Plugin
+{
+    /// Snapshot of the memory pressure signals of the system
+    /**
+      * Values are read from the Linux Pressure Stall Information file
+      * (/proc/pressure/memory) and from the cgroup v2 memory.events file.
+      * Fields that could not be read are left to zero.
+      */
+    struct MemoryPressure
+    {
+        MemoryPressure()
+            : someAvg10(0.0),
+              fullAvg10(0.0),
+              highEvents(0),
+              maxEvents(0),
+              oomEvents(0)
+        {
+            // Empty
+        }
+
+        /// Percentage of time at least one task stalled on memory (last 10s)
+        double someAvg10;
+        /// Percentage of time all tasks stalled on memory (last 10s)
+        double fullAvg10;
+        /// Number of times the cgroup went over its memory.high limit
+        unsigned long long highEvents;
+        /// Number of times the cgroup hit its memory.max limit
+        unsigned long long maxEvents;
+        /// Number of OOM kills in the cgroup
+        unsigned long long oomEvents;
+    };
+
+    namespace detail
+    {
+        // Parse a PSI line such as "some avg10=0.00 avg60=0.00 avg300=0.00 total=0"
+        inline double parsePsiAvg10(const std::string& line)
+        {
+            std::string::size_type pos = line.find("avg10=");
+            if (pos == std::string::npos)
+                return 0.0;
+            std::istringstream iss(line.substr(pos + 6));
+            double value = 0.0;
+            iss >> value;
+            return value;
+        }
+
+        // Find the memory.events file of the cgroup of the current process
+        inline std::string findCgroupMemoryEvents()
+        {
+            std::ifstream cgroup("/proc/self/cgroup");
+            std::string line;
+            while (std::getline(cgroup, line))
+            {
+                // cgroup v2 entries look like "0::/path/to/group"
+                if (line.compare(0, 3, "0::") == 0)
+                    return "/sys/fs/cgroup" + line.substr(3) + "/memory.events";
+            }
+            return "/sys/fs/cgroup/memory.events";
+        }
+    }
+
+    /// Read the current memory pressure
+    /**
+      * @param pressure Receives the memory pressure signals
+      * @param psiPath Path of the PSI file
+      * @param eventsPath Path of the cgroup memory.events file.
+      *        If empty, the cgroup of the current process is used.
+      * @return True if at least one of the sources could be read. False otherwise.
+      */
+    inline bool readMemoryPressure(MemoryPressure& pressure,
+                                   const std::string& psiPath = "/proc/pressure/memory",
+                                   const std::string& eventsPath = "")
+    {
+        pressure = MemoryPressure();
+        bool res = false;
+        std::string line;
+
+        std::ifstream psi(psiPath.c_str());
+        while (std::getline(psi, line))
+        {
+            res = true;
+            if (line.compare(0, 5, "some ") == 0)
+                pressure.someAvg10 = detail::parsePsiAvg10(line);
+            else if (line.compare(0, 5, "full ") == 0)
+                pressure.fullAvg10 = detail::parsePsiAvg10(line);
+        }
+
+        std::ifstream events(eventsPath.empty() ? detail::findCgroupMemoryEvents().c_str() : eventsPath.c_str());
+        while (std::getline(events, line))
+        {
+            res = true;
+            std::istringstream iss(line);
+            std::string key;
+            unsigned long long value = 0;
+            iss >> key >> value;
+            if (key == "high")
+                pressure.highEvents = value;
+            else if (key == "max")
+                pressure.maxEvents = value;
+            else if (key == "oom_kill")
+                pressure.oomEvents = value;
+        }
+        return res;
+    }
+}
@@ -0,0 +1,330 @@
+//          Copyright Jeremy Coulon 2012-2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+/** @file */
+
+#pragma once
+
+//==============
+//==  Plugin  ==
+//==============
+#include "Plugin/LibraryInfo.h"
+#include "Plugin/UnaccountedScope.h"
+
+//=============
+//==  Boost  ==
+//=============
+#include <boost/noncopyable.hpp>
+
+//===========
+//==  STD  ==
+//===========
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <stdint.h>
+
+//=======================
+//==  OS Specific SDK  ==
+//=======================
+#ifndef _WIN32
+#include <link.h>
+#include <unistd.h>
+#endif
+
+/// Namespace of the Plugin library
+namespace Plugin
+{
+    /// Code address range of a module
+    struct ModuleRange
+    {
+        /// First address of the range
+        std::size_t begin;
+        /// One past the last address of the range
+        std::size_t end;
+        /// ID of the module, see ModuleTracker::getModule()
+        uint32_t module;
+    };
+
+    /// Executable segments of the modules mapped at one time
+    /**
+      * A snapshot never changes once published, so it can be searched from a signal handler.
+      */
+    class ModuleSnapshot : private boost::noncopyable
+    {
+    public:
+        /// Constructor
+        ModuleSnapshot(uint64_t generation, std::vector<ModuleRange>& ranges)
+            : generation_(generation)
+        {
+            ranges_.swap(ranges);
+            std::sort(ranges_.begin(), ranges_.end(), [](const ModuleRange& a, const ModuleRange& b) { return a.begin < b.begin; });
+            for (std::size_t i = 0; i < ranges_.size(); ++i)
+                if (std::find(modules_.begin(), modules_.end(), ranges_[i].module) == modules_.end())
+                    modules_.push_back(ranges_[i].module);
+        }
+
+        /// Find the module of a code address. Async-signal-safe.
+        /**
+          * @return The module ID, or zero if the address is in no executable segment
+          */
+        uint32_t findModule(std::size_t address) const
+        {
+            std::size_t low = 0;
+            std::size_t high = ranges_.size();
+            while (low < high)
+            {
+                std::size_t middle = low + (high - low) / 2;
+                if (address < ranges_[middle].begin)
+                    high = middle;
+                else if (address >= ranges_[middle].end)
+                    low = middle + 1;
+                else
+                    return ranges_[middle].module;
+            }
+            return 0;
+        }
+
+        /// Check whether a module is mapped in this snapshot
+        bool contains(uint32_t module) const
+        {
+            return std::find(modules_.begin(), modules_.end(), module) != modules_.end();
+        }
+
+        /// Get the IDs of the mapped modules
+        const std::vector<uint32_t>& getModules() const
+        {
+            return modules_;
+        }
+
+        /// Get the number of refreshes before this snapshot
+        uint64_t getGeneration() const
+        {
+            return generation_;
+        }
+
+    private:
+        uint64_t generation_;
+        // Sorted by address
+        std::vector<ModuleRange> ranges_;
+        std::vector<uint32_t> modules_;
+    };
+
+    /// Tracker of the modules (executable and libraries) mapped in the process
+    /**
+      * While tracking is enabled, PluginLoader refreshes the snapshot after each load and unload,
+      * so that addresses can be attributed to plugins from a signal handler.
+      * Modules keep their ID, and their description stays available after they are unloaded,
+      * so that addresses collected earlier can still be named.
+      * Replaced snapshots are freed by a later refresh(), or when tracking stops,
+      * once no reader holds one: concurrent readers must use acquire() and release().
+      */
+    class ModuleTracker : private boost::noncopyable
+    {
+    public:
+        /// Get the tracker of the process
+        static ModuleTracker& instance()
+        {
+            static ModuleTracker tracker;
+            return tracker;
+        }
+
+        /// Enable tracking, and refresh the snapshot. Calls may be nested.
+        void startTracking()
+        {
+            users_.fetch_add(1);
+            refresh();
+        }
+
+        /// Disable tracking, once every startTracking() is matched
+        void stopTracking()
+        {
+            if (users_.fetch_sub(1) != 1)
+                return;
+            std::lock_guard<std::mutex> lock(mutex_);
+            reclaim();
+        }
+
+        /// Check whether tracking is enabled
+        bool isTracking() const
+        {
+            return users_.load(std::memory_order_relaxed) > 0;
+        }
+
+        /// Publish a new snapshot of the mapped modules
+        void refresh()
+        {
+            // Snapshots outlive the plugins loading them: never charge them to an allocation account
+            detail::UnaccountedScope unaccounted;
+            std::lock_guard<std::mutex> lock(mutex_);
+            std::vector<ModuleRange> ranges;
+#ifndef _WIN32
+            std::vector<LibraryInfo> libraries;
+            dl_iterate_phdr(&ModuleTracker::collect, &libraries);
+            for (std::size_t i = 0; i < libraries.size(); ++i)
+            {
+                LibraryInfo& library = libraries[i];
+                if (library.path.empty())
+                    library.path = executablePath();
+                uint32_t id = moduleId(library);
+                for (std::size_t s = 0; s < library.segments.size(); ++s)
+                {
+                    if (!(library.segments[s].flags & PF_X))
+                        continue;
+                    ModuleRange range;
+                    range.begin = library.segments[s].begin;
+                    range.end = library.segments[s].end;
+                    range.module = id;
+                    ranges.push_back(range);
+                }
+            }
+#endif
+            if (latest_)
+                retired_.push_back(std::move(latest_));
+            latest_.reset(new ModuleSnapshot(generation_++, ranges));
+            current_.store(latest_.get());
+            reclaim();
+        }
+
+        /// Get the latest snapshot. Async-signal-safe.
+        /**
+          * The snapshot may be freed by the next refresh(): threads that can run concurrently
+          * with loads and unloads must use acquire() instead.
+          * @return NULL if the modules were never tracked
+          */
+        const ModuleSnapshot* current() const
+        {
+            return current_.load(std::memory_order_acquire);
+        }
+
+        /// Get the latest snapshot, and keep every snapshot alive until release(). Async-signal-safe.
+        /**
+          * @return NULL if the modules were never tracked. release() must be called anyway.
+          */
+        const ModuleSnapshot* acquire()
+        {
+            readers_.fetch_add(1);
+            return current_.load();
+        }
+
+        /// Release the snapshot returned by acquire(). Async-signal-safe.
+        void release()
+        {
+            readers_.fetch_sub(1);
+        }
+
+        /// Get the number of replaced snapshots not freed yet
+        std::size_t getRetiredCount() const
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return retired_.size();
+        }
+
+        /// Get the description of a module, even if it was unloaded since
+        /**
+          * @param id Module ID, from a snapshot
+          * @param info Receives the description
+          * @return False if the ID is unknown
+          */
+        bool getModule(uint32_t id, LibraryInfo& info) const
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (id == 0 || id > modules_.size())
+                return false;
+            info = modules_[id - 1];
+            return true;
+        }
+
+    private:
+        ModuleTracker()
+            : users_(0),
+              readers_(0),
+              current_(NULL),
+              generation_(0)
+        {
+            // Empty
+        }
+
+        // Free the replaced snapshots if no reader can see them. Called with mutex_ held.
+        void reclaim()
+        {
+            // A reader counted after this load reads current_ after it was stored
+            if (readers_.load() == 0)
+                retired_.clear();
+        }
+
+#ifndef _WIN32
+        static int collect(struct dl_phdr_info* info, std::size_t, void* data)
+        {
+            LibraryInfo library;
+            library.path = info->dlpi_name ? info->dlpi_name : "";
+            library.base = info->dlpi_addr;
+            for (int i = 0; i < info->dlpi_phnum; ++i)
+            {
+                const ElfW(Phdr)& phdr = info->dlpi_phdr[i];
+                if (phdr.p_type != PT_LOAD)
+                    continue;
+                LibrarySegment segment;
+                segment.begin = info->dlpi_addr + phdr.p_vaddr;
+                segment.end = segment.begin + phdr.p_memsz;
+                segment.flags = phdr.p_flags;
+                library.segments.push_back(segment);
+            }
+            library.buildId = detail::readBuildId(info);
+            static_cast<std::vector<LibraryInfo>*>(data)->push_back(library);
+            return 0;
+        }
+
+        static std::string executablePath()
+        {
+            char buffer[4096];
+            ssize_t size = readlink("/proc/self/exe", buffer, sizeof(buffer) - 1);
+            return size > 0 ? std::string(buffer, size) : std::string("[executable]");
+        }
+#endif
+
+        // Same ID for a same build of a library mapped at a same address
+        uint32_t moduleId(const LibraryInfo& library)
+        {
+            std::pair<std::string, std::size_t> key(library.path + "@" + library.buildId, library.begin());
+            std::map<std::pair<std::string, std::size_t>, uint32_t>::const_iterator it = ids_.find(key);
+            if (it != ids_.end())
+                return it->second;
+            modules_.push_back(library);
+            uint32_t id = static_cast<uint32_t>(modules_.size());
+            ids_[key] = id;
+            return id;
+        }
+
+        std::atomic<int> users_;
+        // Number of acquire() not released yet
+        std::atomic<int> readers_;
+        std::atomic<const ModuleSnapshot*> current_;
+        mutable std::mutex mutex_;
+        // Snapshot published in current_
+        std::unique_ptr<ModuleSnapshot> latest_;
+        // Snapshots replaced while a reader could still use them
+        std::vector<std::unique_ptr<ModuleSnapshot> > retired_;
+        uint64_t generation_;
+        // Every module seen, by ID minus one
+        std::vector<LibraryInfo> modules_;
+        std::map<std::pair<std::string, std::size_t>, uint32_t> ids_;
+    };
+
+    /// Refresh the module snapshot if modules are tracked. Called by PluginLoader after each load and unload.
+    inline void notifyModulesChanged()
+    {
+        ModuleTracker& tracker = ModuleTracker::instance();
+        if (tracker.isTracking())
+            tracker.refresh();
+    }
+}
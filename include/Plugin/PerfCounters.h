@@ -0,0 +1,464 @@
+//          Copyright Jeremy Coulon 2012-2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+/** @file */
+
+#pragma once
+
+//==============
+//==  Plugin  ==
+//==============
+#include "Plugin/InterfaceDescription.h"
+#include "Plugin/PluginInterceptor.h"
+
+//=============
+//==  Boost  ==
+//=============
+#include <boost/noncopyable.hpp>
+
+//===========
+//==  STD  ==
+//===========
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+#include <stdint.h>
+
+//=======================
+//==  OS Specific SDK  ==
+//=======================
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+/// Namespace of the Plugin library
+namespace Plugin
+{
+    /// Hardware events counted by a PerfCounterGroup
+    enum PerfEvent
+    {
+        perfCycles,
+        perfInstructions,
+        perfCacheMisses,
+        perfBranchMisses,
+        perfEventCount
+    };
+
+    /// Name of a hardware event
+    inline const char* perfEventName(PerfEvent event)
+    {
+        static const char* const names[perfEventCount] = { "cycles", "instructions", "cache-misses", "branch-misses" };
+        return names[event];
+    }
+
+    /// Values of the hardware events at one time
+    struct PerfSample
+    {
+        uint64_t values[perfEventCount];
+    };
+
+    /// Hardware counters of the calling thread, read from user space
+    /**
+      * The events are opened as one group with perf_event_open(), for the calling thread
+      * and in user mode only, so that it works with the default perf_event_paranoid setting.
+      * On x86, the counters are read with the rdpmc instruction when the kernel allows it,
+      * which costs a few tens of cycles. Otherwise they are read with a system call.
+      * When the events cannot be opened, for instance in a container or a virtual machine
+      * without a PMU, isAvailable() is false. Multiplexing with other users of the PMU is not corrected.
+      * A group must only be read by the thread that created it.
+      */
+    class PerfCounterGroup : private boost::noncopyable
+    {
+    public:
+        /// Constructor. Opens the events for the calling thread.
+        PerfCounterGroup()
+            : available_(false),
+              userRead_(false)
+        {
+            for (int i = 0; i < perfEventCount; ++i)
+            {
+                fds_[i] = -1;
+                pages_[i] = NULL;
+            }
+#ifdef __linux__
+            static const uint64_t configs[perfEventCount] =
+            {
+                PERF_COUNT_HW_CPU_CYCLES,
+                PERF_COUNT_HW_INSTRUCTIONS,
+                PERF_COUNT_HW_CACHE_MISSES,
+                PERF_COUNT_HW_BRANCH_MISSES
+            };
+            for (int i = 0; i < perfEventCount; ++i)
+            {
+                struct perf_event_attr attr;
+                std::memset(&attr, 0, sizeof(attr));
+                attr.type = PERF_TYPE_HARDWARE;
+                attr.size = sizeof(attr);
+                attr.config = configs[i];
+                attr.exclude_kernel = 1;
+                attr.exclude_hv = 1;
+                attr.read_format = PERF_FORMAT_GROUP;
+                fds_[i] = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, i == 0 ? -1 : fds_[0], 0));
+                if (fds_[i] < 0)
+                {
+                    close();
+                    return;
+                }
+            }
+            available_ = true;
+#if defined(__x86_64__) || defined(__i386__)
+            userRead_ = true;
+            long pageSize = sysconf(_SC_PAGESIZE);
+            for (int i = 0; i < perfEventCount; ++i)
+            {
+                void* page = mmap(NULL, pageSize, PROT_READ, MAP_SHARED, fds_[i], 0);
+                if (page == MAP_FAILED)
+                {
+                    userRead_ = false;
+                    continue;
+                }
+                pages_[i] = static_cast<perf_event_mmap_page*>(page);
+                if (!pages_[i]->cap_user_rdpmc)
+                    userRead_ = false;
+            }
+#endif
+#endif
+        }
+
+        /// Destructor
+        ~PerfCounterGroup()
+        {
+            close();
+        }
+
+        /// Check whether the events could be opened
+        bool isAvailable() const
+        {
+            return available_;
+        }
+
+        /// Check whether the counters are read without system call
+        bool isUserRead() const
+        {
+            return userRead_;
+        }
+
+        /// Read the counters
+        /**
+          * @return False if the counters are unavailable or could not be read
+          */
+        bool read(PerfSample& sample) const
+        {
+            if (!available_)
+                return false;
+#if defined(__linux__) && (defined(__x86_64__) || defined(__i386__))
+            if (userRead_)
+            {
+                bool ok = true;
+                for (int i = 0; i < perfEventCount && ok; ++i)
+                    ok = readPage(pages_[i], sample.values[i]);
+                if (ok)
+                    return true;
+            }
+#endif
+#ifdef __linux__
+            uint64_t buffer[1 + perfEventCount];
+            if (::read(fds_[0], buffer, sizeof(buffer)) != static_cast<ssize_t>(sizeof(buffer)) || buffer[0] != perfEventCount)
+                return false;
+            for (int i = 0; i < perfEventCount; ++i)
+                sample.values[i] = buffer[1 + i];
+            return true;
+#else
+            (void)sample;
+            return false;
+#endif
+        }
+
+    private:
+#ifdef __linux__
+        typedef perf_event_mmap_page Page;
+#else
+        typedef void Page;
+#endif
+
+#if defined(__linux__) && (defined(__x86_64__) || defined(__i386__))
+        // Read a counter with rdpmc, following the protocol of perf_event_mmap_page
+        static bool readPage(const volatile Page* page, uint64_t& value)
+        {
+            uint32_t sequence;
+            do
+            {
+                sequence = page->lock;
+                __asm__ __volatile__("" ::: "memory");
+                uint32_t index = page->index;
+                if (!page->cap_user_rdpmc || index == 0)
+                    return false;
+                int64_t count = page->offset;
+                uint32_t low;
+                uint32_t high;
+                __asm__ __volatile__("rdpmc" : "=a"(low), "=d"(high) : "c"(index - 1));
+                unsigned int shift = 64 - page->pmc_width;
+                int64_t pmc = static_cast<int64_t>((static_cast<uint64_t>(high) << 32 | low) << shift) >> shift;
+                value = static_cast<uint64_t>(count + pmc);
+                __asm__ __volatile__("" ::: "memory");
+            } while (page->lock != sequence);
+            return true;
+        }
+#endif
+
+        void close()
+        {
+#ifdef __linux__
+            long pageSize = sysconf(_SC_PAGESIZE);
+            for (int i = perfEventCount - 1; i >= 0; --i)
+            {
+                if (pages_[i])
+                    munmap(pages_[i], pageSize);
+                if (fds_[i] >= 0)
+                    ::close(fds_[i]);
+                pages_[i] = NULL;
+                fds_[i] = -1;
+            }
+#endif
+            available_ = false;
+            userRead_ = false;
+        }
+
+        int fds_[perfEventCount];
+        Page* pages_[perfEventCount];
+        bool available_;
+        bool userRead_;
+    };
+
+    /// Totals of the calls to a method
+    struct CallCounters
+    {
+        CallCounters()
+            : calls(0),
+              wallNs(0),
+              countedCalls(0)
+        {
+            for (int i = 0; i < perfEventCount; ++i)
+                events[i] = 0;
+        }
+
+        /// Number of calls
+        uint64_t calls;
+        /// Total duration of the calls, in nanoseconds
+        uint64_t wallNs;
+        /// Number of calls with hardware counts. Zero when counters are unavailable.
+        uint64_t countedCalls;
+        /// Total of each PerfEvent over the counted calls
+        uint64_t events[perfEventCount];
+
+        /// Get the mean of an event per counted call. Zero if no call was counted.
+        double getMean(PerfEvent event) const
+        {
+            return countedCalls ? static_cast<double>(events[event]) / countedCalls : 0.0;
+        }
+    };
+
+    /// Interception policy counting hardware events of each method, with PerfCounterGroup
+    /**
+      * Each thread opens its counters on its first call and records in a shard of its own.
+      * When the counters are unavailable, only the number and duration of the calls are recorded.
+      * Counts include the cost of reading the counters, a few tens of instructions.
+      * Each thread that made calls keeps its counters open until the recorder is destroyed.
+      */
+    struct CounterInterception
+    {
+        /// Recorder of the calls
+        template<class T>
+        class Recorder : private boost::noncopyable
+        {
+            // Written by one thread, read by any
+            struct SharedCounters
+            {
+                SharedCounters()
+                    : calls(0),
+                      wallNs(0),
+                      countedCalls(0)
+                {
+                    for (int i = 0; i < perfEventCount; ++i)
+                        events[i].store(0, std::memory_order_relaxed);
+                }
+
+                static void add(std::atomic<uint64_t>& total, uint64_t value)
+                {
+                    total.store(total.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+                }
+
+                std::atomic<uint64_t> calls;
+                std::atomic<uint64_t> wallNs;
+                std::atomic<uint64_t> countedCalls;
+                std::atomic<uint64_t> events[perfEventCount];
+            };
+
+            struct Shard
+            {
+                Shard()
+                    : counters(InterfaceDescription<T>::methodCount + 1)
+                {
+                    // Empty
+                }
+
+                PerfCounterGroup group;
+                // One total per described method, plus one for the others
+                std::vector<SharedCounters> counters;
+            };
+
+        public:
+            /// Call in progress
+            class Scope
+            {
+            public:
+                /// Constructor
+                template<class Pmf>
+                Scope(Recorder& recorder, Pmf pmf)
+                    : shard_(recorder.localShard()),
+                      index_(methodIndex<T>(pmf)),
+                      start_(std::chrono::steady_clock::now())
+                {
+                    // Read last, so that the counts exclude the bookkeeping above
+                    counted_ = shard_.group.read(begin_);
+                }
+
+                /// Destructor. Record the counts of the call, even if it threw.
+                ~Scope()
+                {
+                    PerfSample end;
+                    bool counted = counted_ && shard_.group.read(end);
+                    std::chrono::steady_clock::duration elapsed = std::chrono::steady_clock::now() - start_;
+                    SharedCounters& counters = shard_.counters[index_];
+                    SharedCounters::add(counters.calls, 1);
+                    SharedCounters::add(counters.wallNs, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+                    if (counted)
+                    {
+                        SharedCounters::add(counters.countedCalls, 1);
+                        for (int i = 0; i < perfEventCount; ++i)
+                            SharedCounters::add(counters.events[i], end.values[i] - begin_.values[i]);
+                    }
+                }
+
+            private:
+                Shard& shard_;
+                std::size_t index_;
+                std::chrono::steady_clock::time_point start_;
+                PerfSample begin_;
+                bool counted_;
+            };
+
+            /// Constructor
+            Recorder()
+            {
+                // Empty
+            }
+
+            /// Merge the shards of every thread
+            /**
+              * @return One total per method of InterfaceDescription<T>, plus a last one
+              *         for the methods that are not described
+              */
+            std::vector<CallCounters> merge() const
+            {
+                std::vector<CallCounters> res(InterfaceDescription<T>::methodCount + 1);
+                std::lock_guard<std::mutex> lock(mutex_);
+                for (std::size_t s = 0; s < shards_.size(); ++s)
+                    for (std::size_t m = 0; m < res.size(); ++m)
+                        addTo(shards_[s]->counters[m], res[m]);
+                return res;
+            }
+
+            /// Get the merged totals of a method
+            /**
+              * @param pmf Pointer to a member function of T
+              */
+            template<class Pmf>
+            CallCounters getCounters(Pmf pmf) const
+            {
+                CallCounters res;
+                std::size_t index = methodIndex<T>(pmf);
+                std::lock_guard<std::mutex> lock(mutex_);
+                for (std::size_t s = 0; s < shards_.size(); ++s)
+                    addTo(shards_[s]->counters[index], res);
+                return res;
+            }
+
+            /// Write the means per call of each called method
+            /**
+              * Without hardware counts, only the number of calls and the mean duration are written.
+              */
+            void writeReport(std::ostream& os) const
+            {
+                std::vector<CallCounters> counters = merge();
+                for (std::size_t m = 0; m < counters.size(); ++m)
+                {
+                    const CallCounters& c = counters[m];
+                    if (c.calls == 0)
+                        continue;
+                    os << (m < InterfaceDescription<T>::methodCount ? methodName<T>(m) : "(other)")
+                       << " calls=" << c.calls
+                       << " ns=" << static_cast<double>(c.wallNs) / c.calls;
+                    if (c.countedCalls)
+                    {
+                        for (int i = 0; i < perfEventCount; ++i)
+                            os << " " << perfEventName(static_cast<PerfEvent>(i)) << "=" << c.getMean(static_cast<PerfEvent>(i));
+                        if (c.events[perfCycles])
+                            os << " ipc=" << static_cast<double>(c.events[perfInstructions]) / c.events[perfCycles];
+                    }
+                    else
+                    {
+                        os << " (no hardware counters)";
+                    }
+                    os << std::endl;
+                }
+            }
+
+            /// Get the number of threads that made calls
+            std::size_t getShardCount() const
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                return shards_.size();
+            }
+
+        private:
+            static void addTo(const SharedCounters& shared, CallCounters& res)
+            {
+                res.calls += shared.calls.load(std::memory_order_relaxed);
+                res.wallNs += shared.wallNs.load(std::memory_order_relaxed);
+                res.countedCalls += shared.countedCalls.load(std::memory_order_relaxed);
+                for (int i = 0; i < perfEventCount; ++i)
+                    res.events[i] += shared.events[i].load(std::memory_order_relaxed);
+            }
+
+            Shard& localShard()
+            {
+                if (void* shard = detail::findThreadShard(id_))
+                    return *static_cast<Shard*>(shard);
+                // Opened by the thread itself: the events count the calling thread only
+                std::unique_ptr<Shard> shard(new Shard);
+                std::lock_guard<std::mutex> lock(mutex_);
+                shards_.push_back(std::move(shard));
+                detail::addThreadShard(id_, shards_.back().get());
+                return *shards_.back();
+            }
+
+            // Key of the shards in the thread local caches
+            detail::RecorderId id_;
+            // Shard of each thread
+            std::vector<std::unique_ptr<Shard> > shards_;
+            mutable std::mutex mutex_;
+        };
+    };
+}
@@ -0,0 +1,580 @@
+//          Copyright Jeremy Coulon 2012-2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+/** @file */
+
+#pragma once
+
+//==============
+//==  Plugin  ==
+//==============
+#include "Plugin/PluginLoader.h"
+#include "Plugin/WorkStealingPool.h"
+
+//=============
+//==  Boost  ==
+//=============
+#include <boost/noncopyable.hpp>
+
+//===========
+//==  STD  ==
+//===========
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <stdint.h>
+
+/// Namespace of the Plugin library
+namespace Plugin
+{
+    /// Interface of the plugins that can be chained in a Pipeline
+    /**
+      * @tparam Item Type of the items flowing through the pipeline
+      */
+    template<class Item>
+    class IPipelineStage
+    {
+    public:
+        /// Destructor
+        virtual ~IPipelineStage()
+        {
+            // Empty
+        }
+
+        /// Process a batch of items in place
+        /**
+          * A stage may modify, remove or add items. An empty batch is not forwarded.
+          * If it throws, the batch is dropped, the error is reported by Pipeline::getErrorMsg(),
+          * and the stage goes on with the next batch.
+          * Calls are never concurrent for a given stage.
+          * @param batch Items received from the previous stage, forwarded to the next one
+          */
+        virtual void iProcess(std::vector<Item>& batch) = 0;
+    };
+
+    /// Counters of a pipeline stage
+    struct StageStats
+    {
+        /// Number of items received
+        uint64_t itemsIn;
+        /// Number of items forwarded
+        uint64_t itemsOut;
+        /// Number of batches processed
+        uint64_t batches;
+        /// Time spent in iProcess(), in nanoseconds
+        uint64_t busyNs;
+        /// Number of batches waiting in the input queue of the stage
+        std::size_t queueDepth;
+        /// Highest number of batches ever waiting in the input queue
+        std::size_t maxQueueDepth;
+    };
+
+    /// Chain of plugins processing batches of items
+    /**
+      * Each stage has a bounded input queue of batches. A stage only takes a batch
+      * when the queue of the next stage has room, and push() blocks while the queue
+      * of the first stage is full, so a slow stage slows down the whole pipeline
+      * instead of accumulating items (backpressure).
+      *
+      * Stages run either on a dedicated thread each, or as tasks of a shared
+      * WorkStealingPool. In both cases a stage processes one batch at a time, in order.
+      *
+      * push(), flush() and close() must be called by a single thread.
+      * A batch whose processing throws is dropped: see getFailedBatchCount() and getErrorMsg().
+      * @tparam Item Type of the items flowing through the pipeline
+      */
+    template<class Item>
+    class Pipeline : private boost::noncopyable
+    {
+        typedef std::vector<Item> Batch;
+
+        struct Stage
+        {
+            Stage()
+                : plugin(NULL),
+                  closed(false),
+                  running(false),
+                  finished(false),
+                  itemsIn(0),
+                  itemsOut(0),
+                  batches(0),
+                  busyNs(0),
+                  maxQueueDepth(0)
+            {
+                // Empty
+            }
+
+            std::unique_ptr<PluginLoader<IPipelineStage<Item> > > loader;
+            IPipelineStage<Item>* plugin;
+            std::string name;
+            // Input queue
+            std::mutex mutex;
+            std::condition_variable notEmpty;
+            std::condition_variable notFull;
+            std::deque<Batch> queue;
+            bool closed;
+            // Whether a pool task is processing this stage
+            std::atomic<bool> running;
+            bool finished;
+            // Counters
+            std::atomic<uint64_t> itemsIn;
+            std::atomic<uint64_t> itemsOut;
+            std::atomic<uint64_t> batches;
+            std::atomic<uint64_t> busyNs;
+            std::size_t maxQueueDepth;
+        };
+
+    public:
+        /// Function receiving the batches leaving the last stage
+        typedef std::function<void (Batch&)> Sink;
+
+        /// Constructor
+        /**
+          * @param batchSize Number of items grouped by push() before entering the first stage
+          * @param queueCapacity Maximum number of batches waiting in front of each stage
+          */
+        explicit Pipeline(std::size_t batchSize = 64, std::size_t queueCapacity = 4)
+            : batchSize_(batchSize == 0 ? 1 : batchSize),
+              queueCapacity_(queueCapacity == 0 ? 1 : queueCapacity),
+              pool_(NULL),
+              started_(false),
+              done_(false),
+              tasks_(0),
+              failedBatches_(0)
+        {
+            // Empty
+        }
+
+        /// Destructor. Close the pipeline and wait for the stages.
+        ~Pipeline()
+        {
+            if (started_)
+            {
+                close();
+                wait();
+            }
+        }
+
+        /// Append a stage implemented by a plugin
+        /**
+          * The plugin is loaded and instantiated now. Must be called before start().
+          * @param name Filename of the concrete plugin
+          * @return True on success. False otherwise.
+          */
+        bool addStage(const std::string& name)
+        {
+            std::unique_ptr<PluginLoader<IPipelineStage<Item> > > loader(new PluginLoader<IPipelineStage<Item> >(name));
+            IPipelineStage<Item>* plugin = loader->load() ? loader->getPluginInstance() : NULL;
+            if (!plugin)
+            {
+                std::lock_guard<std::mutex> lock(doneMutex_);
+                errorMsg_ = name + ": " + loader->getErrorMsg();
+                return false;
+            }
+            Stage& stage = append(plugin, name);
+            stage.loader = std::move(loader);
+            return true;
+        }
+
+        /// Append a stage implemented by the host
+        /**
+          * Must be called before start().
+          * @param stage Stage, which must outlive the pipeline
+          * @param name Name reported in error messages
+          */
+        void addStage(IPipelineStage<Item>* stage, const std::string& name)
+        {
+            append(stage, name);
+        }
+
+        /// Set the function receiving the output of the last stage
+        /**
+          * Called by the thread running the last stage. Must be set before start().
+          */
+        void setSink(const Sink& sink)
+        {
+            sink_ = sink;
+        }
+
+        /// Start the stages
+        /**
+          * @param pool Pool running the stages, or NULL to give each stage its own thread.
+          *        The pool must outlive the pipeline.
+          * @return False if the pipeline has no stage or is already started. True otherwise.
+          */
+        bool start(WorkStealingPool* pool = NULL)
+        {
+            if (started_ || stages_.empty())
+                return false;
+            started_ = true;
+            pool_ = pool;
+            if (!pool_)
+            {
+                for (std::size_t i = 0; i < stages_.size(); ++i)
+                    threads_.push_back(std::thread(&Pipeline::runThread, this, i));
+            }
+            return true;
+        }
+
+        /// Send an item into the pipeline
+        /**
+          * Items are grouped by batches before entering the first stage.
+          * Items pushed before start() wait for it.
+          * Blocks while the first stage has too many batches waiting.
+          */
+        void push(const Item& item)
+        {
+            pending_.push_back(item);
+            if (pending_.size() >= batchSize_)
+                flush();
+        }
+
+        /// Send the items grouped so far, even if the batch is not full
+        void flush()
+        {
+            if (!started_ || pending_.empty())
+                return;
+            Batch batch;
+            batch.swap(pending_);
+            pending_.reserve(batchSize_);
+            Stage& first = *stages_.front();
+            {
+                std::unique_lock<std::mutex> lock(first.mutex);
+                first.notFull.wait(lock, [&]() { return first.queue.size() < queueCapacity_; });
+                enqueue(first, batch);
+            }
+            first.notEmpty.notify_one();
+            if (pool_)
+                schedule(0);
+        }
+
+        /// Send the remaining items and signal the end of the input
+        void close()
+        {
+            if (!started_)
+                return;
+            flush();
+            Stage& first = *stages_.front();
+            {
+                std::lock_guard<std::mutex> lock(first.mutex);
+                first.closed = true;
+            }
+            first.notEmpty.notify_all();
+            if (pool_)
+                schedule(0);
+        }
+
+        /// Wait until every item sent before close() left the last stage
+        void wait()
+        {
+            if (!started_)
+                return;
+            {
+                // Pool tasks scheduled before the end may still be queued: they must not outlive the pipeline
+                std::unique_lock<std::mutex> lock(doneMutex_);
+                doneCondition_.wait(lock, [this]() { return done_ && tasks_ == 0; });
+            }
+            for (std::size_t i = 0; i < threads_.size(); ++i)
+                threads_[i].join();
+            threads_.clear();
+        }
+
+        /// Get the number of stages
+        std::size_t size() const
+        {
+            return stages_.size();
+        }
+
+        /// Get the counters of a stage
+        StageStats getStageStats(std::size_t index) const
+        {
+            Stage& stage = *stages_[index];
+            StageStats stats;
+            stats.itemsIn = stage.itemsIn.load(std::memory_order_relaxed);
+            stats.itemsOut = stage.itemsOut.load(std::memory_order_relaxed);
+            stats.batches = stage.batches.load(std::memory_order_relaxed);
+            stats.busyNs = stage.busyNs.load(std::memory_order_relaxed);
+            std::lock_guard<std::mutex> lock(stage.mutex);
+            stats.queueDepth = stage.queue.size();
+            stats.maxQueueDepth = stage.maxQueueDepth;
+            return stats;
+        }
+
+        /// Get the name of a stage
+        const std::string& getStageName(std::size_t index) const
+        {
+            return stages_[index]->name;
+        }
+
+        /// Get the number of batches dropped because their processing threw
+        std::size_t getFailedBatchCount() const
+        {
+            std::lock_guard<std::mutex> lock(doneMutex_);
+            return failedBatches_;
+        }
+
+        /// Get error message of the last failed addStage(), or of the last batch whose processing threw
+        std::string getErrorMsg() const
+        {
+            std::lock_guard<std::mutex> lock(doneMutex_);
+            return errorMsg_;
+        }
+
+    private:
+        Stage& append(IPipelineStage<Item>* plugin, const std::string& name)
+        {
+            stages_.push_back(std::unique_ptr<Stage>(new Stage));
+            stages_.back()->plugin = plugin;
+            stages_.back()->name = name;
+            return *stages_.back();
+        }
+
+        // Must be called with the stage mutex held
+        void enqueue(Stage& stage, Batch& batch)
+        {
+            stage.itemsIn.fetch_add(batch.size(), std::memory_order_relaxed);
+            stage.queue.push_back(Batch());
+            stage.queue.back().swap(batch);
+            if (stage.queue.size() > stage.maxQueueDepth)
+                stage.maxQueueDepth = stage.queue.size();
+        }
+
+        void process(Stage& stage, Batch& batch)
+        {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            try
+            {
+                stage.plugin->iProcess(batch);
+            }
+            catch (const std::exception& e)
+            {
+                fail(stage, e.what());
+                batch.clear();
+            }
+            catch (...)
+            {
+                fail(stage, "unknown exception");
+                batch.clear();
+            }
+            stage.busyNs.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count(), std::memory_order_relaxed);
+            stage.batches.fetch_add(1, std::memory_order_relaxed);
+            stage.itemsOut.fetch_add(batch.size(), std::memory_order_relaxed);
+        }
+
+        // Report a batch dropped by a stage
+        void fail(const Stage& stage, const std::string& what)
+        {
+            std::lock_guard<std::mutex> lock(doneMutex_);
+            errorMsg_ = stage.name + ": " + what;
+            ++failedBatches_;
+        }
+
+        void finish()
+        {
+            {
+                std::lock_guard<std::mutex> lock(doneMutex_);
+                done_ = true;
+            }
+            doneCondition_.notify_all();
+        }
+
+        // Dedicated thread of a stage: block on the input queue, then on the output queue
+        void runThread(std::size_t index)
+        {
+            Stage& stage = *stages_[index];
+            Stage* next = index + 1 < stages_.size() ? stages_[index + 1].get() : NULL;
+            while (true)
+            {
+                Batch batch;
+                {
+                    std::unique_lock<std::mutex> lock(stage.mutex);
+                    stage.notEmpty.wait(lock, [&]() { return !stage.queue.empty() || stage.closed; });
+                    if (stage.queue.empty())
+                        break;
+                    batch.swap(stage.queue.front());
+                    stage.queue.pop_front();
+                }
+                stage.notFull.notify_one();
+                process(stage, batch);
+                if (batch.empty())
+                    continue;
+                if (!next)
+                {
+                    if (sink_)
+                        sink_(batch);
+                    continue;
+                }
+                {
+                    std::unique_lock<std::mutex> lock(next->mutex);
+                    next->notFull.wait(lock, [&]() { return next->queue.size() < queueCapacity_; });
+                    enqueue(*next, batch);
+                }
+                next->notEmpty.notify_one();
+            }
+            if (next)
+            {
+                {
+                    std::lock_guard<std::mutex> lock(next->mutex);
+                    next->closed = true;
+                }
+                next->notEmpty.notify_all();
+            }
+            else
+                finish();
+        }
+
+        // Make sure a pool task is processing the stage
+        void schedule(std::size_t index)
+        {
+            if (stages_[index]->running.exchange(true))
+                return;
+            {
+                std::lock_guard<std::mutex> lock(doneMutex_);
+                ++tasks_;
+            }
+            pool_->submit([this, index]() { runTask(index); });
+        }
+
+        // Pool task of a stage. The pipeline may be destroyed as soon as it is counted done.
+        void runTask(std::size_t index)
+        {
+            // The pool swallows exceptions: the stage would never be rescheduled, and wait() would hang
+            bool failed = false;
+            try
+            {
+                processStage(index);
+            }
+            catch (const std::exception& e)
+            {
+                fail(*stages_[index], e.what());
+                failed = true;
+            }
+            catch (...)
+            {
+                fail(*stages_[index], "unknown exception");
+                failed = true;
+            }
+            if (failed)
+            {
+                // The batch in progress is lost. The stage goes on with the next ones.
+                stages_[index]->running.store(false);
+                schedule(index);
+            }
+            std::lock_guard<std::mutex> lock(doneMutex_);
+            --tasks_;
+            doneCondition_.notify_all();
+        }
+
+        // Process the batches of a stage while there is room downstream.
+        // The stage downstream reschedules it when it makes room.
+        void processStage(std::size_t index)
+        {
+            Stage& stage = *stages_[index];
+            Stage* next = index + 1 < stages_.size() ? stages_[index + 1].get() : NULL;
+            while (true)
+            {
+                Batch batch;
+                bool hasBatch = false;
+                bool end = false;
+                {
+                    // Both locks are held until running is cleared, so that a batch queued here
+                    // or a room made downstream in the meantime reschedules this stage
+                    std::lock_guard<std::mutex> lock(stage.mutex);
+                    std::unique_lock<std::mutex> nextLock;
+                    if (next)
+                        nextLock = std::unique_lock<std::mutex>(next->mutex);
+                    // This stage is the only producer of the next queue, so room stays available
+                    bool room = !next || next->queue.size() < queueCapacity_;
+                    if (room && !stage.queue.empty())
+                    {
+                        batch.swap(stage.queue.front());
+                        stage.queue.pop_front();
+                        hasBatch = true;
+                    }
+                    else if (stage.queue.empty() && stage.closed && !stage.finished)
+                    {
+                        stage.finished = true;
+                        end = true;
+                    }
+                    if (!hasBatch)
+                        stage.running.store(false);
+                }
+
+                if (!hasBatch)
+                {
+                    if (end)
+                    {
+                        if (!next)
+                        {
+                            finish();
+                            return;
+                        }
+                        {
+                            std::lock_guard<std::mutex> lock(next->mutex);
+                            next->closed = true;
+                        }
+                        schedule(index + 1);
+                    }
+                    return;
+                }
+
+                stage.notFull.notify_one();
+                // Room was made: let the previous stage go on
+                if (index > 0)
+                    schedule(index - 1);
+                process(stage, batch);
+                if (batch.empty())
+                    continue;
+                if (!next)
+                {
+                    if (sink_)
+                        sink_(batch);
+                    continue;
+                }
+                {
+                    std::lock_guard<std::mutex> lock(next->mutex);
+                    enqueue(*next, batch);
+                }
+                schedule(index + 1);
+            }
+        }
+
+        // Batching and queue settings
+        std::size_t batchSize_;
+        std::size_t queueCapacity_;
+        // Stages, in order
+        std::vector<std::unique_ptr<Stage> > stages_;
+        // Output of the last stage
+        Sink sink_;
+        // Items grouped by push()
+        Batch pending_;
+        // Pool running the stages. NULL when each stage has its own thread.
+        WorkStealingPool* pool_;
+        std::vector<std::thread> threads_;
+        bool started_;
+        // End of the processing. Also protects errorMsg_ and failedBatches_.
+        mutable std::mutex doneMutex_;
+        std::condition_variable doneCondition_;
+        bool done_;
+        // Number of pool tasks submitted and not completed
+        std::size_t tasks_;
+        // Error message
+        std::string errorMsg_;
+        // Batches dropped because their processing threw
+        std::size_t failedBatches_;
+    };
+}
@@ -0,0 +1,413 @@
+//          Copyright Jeremy Coulon 2012-2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+/** @file */
+
+#pragma once
+
+//==============
+//==  Plugin  ==
+//==============
+#include "Plugin/LibraryInfo.h"
+#include "Plugin/MemoryPressure.h"
+#include "Plugin/PluginLoader.h"
+
+//=============
+//==  Boost  ==
+//=============
+#include <boost/noncopyable.hpp>
+
+//===========
+//==  STD  ==
+//===========
+#include <atomic>
+#include <cstddef>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/// Namespace of the Plugin library
+namespace Plugin
+{
+    /// Memory-budgeted cache of loaded plugins
+    /**
+      * Plugins are loaded on first use and stay loaded until the cache
+      * needs to reclaim memory. The footprint of a plugin is the resident size
+      * of the library segments, as reported by /proc/self/smaps.
+      * When the total footprint exceeds the budget, or when the system reports
+      * memory pressure, least recently used plugins are unloaded.
+      * A plugin is never unloaded while a Handle on it is alive.
+      * On platforms without /proc/self/smaps the footprint is always zero
+      * and only memory pressure can trigger evictions.
+      * @tparam T Interface type of the concrete plugins
+      */
+    template<class T>
+    class PluginCache : private boost::noncopyable
+    {
+        struct Entry
+        {
+            explicit Entry(const std::string& name)
+                : loader(name),
+                  refs(0),
+                  footprint(0)
+            {
+                // Empty
+            }
+
+            PluginLoader<T> loader;
+            std::atomic<int> refs;
+            std::size_t footprint;
+            LibraryInfo library;
+            typename std::list<Entry*>::iterator lru;
+        };
+
+    public:
+        /// Reference to a cached plugin
+        /**
+          * As long as a handle exists, the plugin it refers to cannot be evicted.
+          * Handles must not outlive the cache that created them.
+          */
+        class Handle
+        {
+        public:
+            /// Construct an empty handle
+            Handle()
+                : entry_(NULL),
+                  plugin_(NULL)
+            {
+                // Empty
+            }
+
+            /// Copy constructor
+            Handle(const Handle& other)
+                : entry_(other.entry_),
+                  plugin_(other.plugin_)
+            {
+                if (entry_)
+                    entry_->refs.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            /// Assignment operator
+            Handle& operator=(Handle other)
+            {
+                std::swap(entry_, other.entry_);
+                std::swap(plugin_, other.plugin_);
+                return *this;
+            }
+
+            /// Destructor
+            ~Handle()
+            {
+                if (entry_)
+                    entry_->refs.fetch_sub(1, std::memory_order_release);
+            }
+
+            /// Get a pointer to the plugin interface
+            T* get() const
+            {
+                return plugin_;
+            }
+
+            /// Access the plugin interface
+            T* operator->() const
+            {
+                return plugin_;
+            }
+
+            /// Check if the handle refers to a plugin
+            explicit operator bool() const
+            {
+                return plugin_ != NULL;
+            }
+
+        private:
+            friend class PluginCache;
+
+            explicit Handle(Entry* entry)
+                : entry_(entry),
+                  plugin_(entry->loader.getPluginInstance())
+            {
+                entry_->refs.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            Entry* entry_;
+            T* plugin_;
+        };
+
+        /// Constructor
+        /**
+          * @param budget Maximum total footprint in bytes. Zero means unlimited.
+          */
+        explicit PluginCache(std::size_t budget = 0)
+            : budget_(budget),
+              pressureThreshold_(10.0),
+              pressureRatio_(0.5),
+              psiPath_("/proc/pressure/memory")
+        {
+            readMemoryPressure(lastPressure_, psiPath_, eventsPath_);
+        }
+
+        /// Destructor
+        /**
+          * Unloads every cached plugin.
+          * No handle may be alive at this point.
+          */
+        ~PluginCache()
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            lru_.clear();
+            entries_.clear();
+        }
+
+        /// Get a plugin, loading it if necessary
+        /**
+          * The plugin becomes the most recently used one.
+          * If loading it makes the cache exceed its budget,
+          * idle plugins are evicted.
+          * @param name Filename of the concrete plugin
+          * @return A valid handle on success. An empty handle otherwise.
+          */
+        Handle acquire(const std::string& name)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            typename EntryMap::iterator it = entries_.find(name);
+            if (it != entries_.end())
+            {
+                Entry* entry = it->second.get();
+                lru_.splice(lru_.begin(), lru_, entry->lru);
+                return Handle(entry);
+            }
+
+            std::unique_ptr<Entry> entry(new Entry(name));
+            if (!entry->loader.load())
+            {
+                errorMsg_ = entry->loader.getErrorMsg();
+                return Handle();
+            }
+            if (!entry->loader.getPluginInstance())
+            {
+                errorMsg_ = entry->loader.getErrorMsg();
+                return Handle();
+            }
+#ifndef _WIN32
+            queryLibraryInfo(entry->loader.getNativeHandle(), entry->library);
+#endif
+            std::vector<MappingUsage> mappings;
+            readMappingUsage(mappings);
+            entry->footprint = residentBytes(entry->library, mappings);
+
+            Entry* raw = entry.get();
+            lru_.push_front(raw);
+            raw->lru = lru_.begin();
+            entries_[name].reset(entry.release());
+
+            Handle res(raw);
+            if (budget_ != 0)
+                evictLocked(budget_);
+            return res;
+        }
+
+        /// Evict idle plugins until the footprint fits into a target
+        /**
+          * Plugins are evicted from the least recently used to the most recently used.
+          * Plugins in use are skipped, so the target may not be reached.
+          * @param target Footprint to reach in bytes
+          * @return Number of evicted plugins
+          */
+        std::size_t evict(std::size_t target)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            refreshFootprintsLocked();
+            return evictLocked(target);
+        }
+
+        /// React to memory pressure
+        /**
+          * Reads the PSI file and the cgroup memory.events file.
+          * If the PSI "some" average exceeds the pressure threshold,
+          * or if the cgroup reported new high/max/oom events since the previous call,
+          * idle plugins are evicted until the footprint shrinks by the pressure ratio.
+          * Otherwise the budget is enforced using fresh footprints.
+          * This method is meant to be called periodically by the host.
+          * @return Number of evicted plugins
+          */
+        std::size_t checkMemoryPressure()
+        {
+            std::string psiPath;
+            std::string eventsPath;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                psiPath = psiPath_;
+                eventsPath = eventsPath_;
+            }
+            // Files are read without holding the lock
+            MemoryPressure pressure;
+            readMemoryPressure(pressure, psiPath, eventsPath);
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            bool pressured = pressure.someAvg10 >= pressureThreshold_
+                          || pressure.highEvents > lastPressure_.highEvents
+                          || pressure.maxEvents > lastPressure_.maxEvents
+                          || pressure.oomEvents > lastPressure_.oomEvents;
+            lastPressure_ = pressure;
+
+            std::size_t footprint = refreshFootprintsLocked();
+            if (pressured)
+                return evictLocked(static_cast<std::size_t>(footprint * pressureRatio_));
+            if (budget_ != 0)
+                return evictLocked(budget_);
+            return 0;
+        }
+
+        /// Get the total footprint of the cached plugins in bytes
+        /**
+          * This is the value measured at load time or during the last refresh.
+          */
+        std::size_t getFootprint() const
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return footprintLocked();
+        }
+
+        /// Measure again the footprint of every cached plugin
+        /**
+          * @return The total footprint in bytes
+          */
+        std::size_t refreshFootprints()
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return refreshFootprintsLocked();
+        }
+
+        /// Get the budget in bytes. Zero means unlimited.
+        std::size_t getBudget() const
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return budget_;
+        }
+
+        /// Set the budget in bytes. Zero means unlimited.
+        void setBudget(std::size_t budget)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            budget_ = budget;
+        }
+
+        /// Configure the reaction to memory pressure
+        /**
+          * @param threshold PSI "some avg10" percentage above which the system is considered under pressure
+          * @param ratio Fraction of the current footprint to keep when under pressure
+          */
+        void setPressurePolicy(double threshold, double ratio)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            pressureThreshold_ = threshold;
+            pressureRatio_ = ratio;
+        }
+
+        /// Configure where memory pressure signals are read from
+        /**
+          * @param psiPath Path of the PSI file
+          * @param eventsPath Path of the cgroup memory.events file.
+          *        If empty, the cgroup of the current process is used.
+          */
+        void setPressureSources(const std::string& psiPath, const std::string& eventsPath = "")
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            psiPath_ = psiPath;
+            eventsPath_ = eventsPath;
+            readMemoryPressure(lastPressure_, psiPath_, eventsPath_);
+        }
+
+        /// Get the number of cached plugins
+        std::size_t size() const
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return entries_.size();
+        }
+
+        /// Check if a plugin is currently cached
+        bool isCached(const std::string& name) const
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return entries_.find(name) != entries_.end();
+        }
+
+        /// Get error message of the last failed acquire()
+        std::string getErrorMsg() const
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return errorMsg_;
+        }
+
+    private:
+        typedef std::map<std::string, std::unique_ptr<Entry> > EntryMap;
+
+        std::size_t footprintLocked() const
+        {
+            std::size_t res = 0;
+            for (typename EntryMap::const_iterator it = entries_.begin(); it != entries_.end(); ++it)
+                res += it->second->footprint;
+            return res;
+        }
+
+        std::size_t refreshFootprintsLocked()
+        {
+            std::vector<MappingUsage> mappings;
+            if (!readMappingUsage(mappings))
+                return footprintLocked();
+            std::size_t res = 0;
+            for (typename EntryMap::iterator it = entries_.begin(); it != entries_.end(); ++it)
+            {
+                it->second->footprint = residentBytes(it->second->library, mappings);
+                res += it->second->footprint;
+            }
+            return res;
+        }
+
+        std::size_t evictLocked(std::size_t target)
+        {
+            std::size_t footprint = footprintLocked();
+            std::size_t evicted = 0;
+            typename std::list<Entry*>::iterator it = lru_.end();
+            while (footprint > target && it != lru_.begin())
+            {
+                Entry* entry = *--it;
+                if (entry->refs.load(std::memory_order_acquire) != 0)
+                    continue;
+                footprint -= entry->footprint;
+                it = lru_.erase(it);
+                std::string name = entry->loader.getPluginName();
+                entries_.erase(name);
+                ++evicted;
+            }
+            return evicted;
+        }
+
+        // Cached plugins by name
+        EntryMap entries_;
+        // Cached plugins from most recently used to least recently used
+        std::list<Entry*> lru_;
+        // Maximum total footprint in bytes
+        std::size_t budget_;
+        // PSI threshold in percent
+        double pressureThreshold_;
+        // Fraction of the footprint to keep under pressure
+        double pressureRatio_;
+        // Path of the PSI file
+        std::string psiPath_;
+        // Path of the cgroup memory.events file
+        std::string eventsPath_;
+        // Memory pressure read during the previous check
+        MemoryPressure lastPressure_;
+        // Error message of the last failed acquire()
+        std::string errorMsg_;
+        // Protects everything above
+        mutable std::mutex mutex_;
+    };
+}
@@ -0,0 +1,411 @@
+//          Copyright Jeremy Coulon 2012-2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+/** @file */
+
+#pragma once
+
+//==============
+//==  Plugin  ==
+//==============
+#include "Plugin/PluginHostServices.h"
+
+//=============
+//==  Boost  ==
+//=============
+#include <boost/noncopyable.hpp>
+
+//===========
+//==  STD  ==
+//===========
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <type_traits>
+
+#include <stdint.h>
+
+/// Service ID of the channel hub, see PluginHostServices
+#define PLUGIN_CHANNEL_SERVICE PLUGIN_SERVICE_ID("Plugin.Channels")
+
+/// Magic number of a PluginChannelDescriptor
+#define PLUGIN_CHANNEL_MAGIC 0x504c4348u // "PLCH"
+
+extern "C"
+{
+    /// Indexes of a channel. Each index has its own cache line.
+    struct PluginChannelControl
+    {
+        /// Number of elements ever pushed, only written by the producer
+        std::atomic<uint64_t> tail;
+        char tailPadding[64 - sizeof(std::atomic<uint64_t>)];
+        /// Number of elements ever popped, only written by the consumer
+        std::atomic<uint64_t> head;
+        char headPadding[64 - sizeof(std::atomic<uint64_t>)];
+    };
+
+    /// ABI-stable description of a single producer, single consumer channel
+    /**
+      * Both endpoints only rely on this layout, so plugins built separately,
+      * or against another version of this library, can share a channel.
+      */
+    struct PluginChannelDescriptor
+    {
+        /// PLUGIN_CHANNEL_MAGIC
+        uint32_t magic;
+        /// Version of this structure
+        uint32_t version;
+        /// Size of an element in bytes
+        uint32_t elementSize;
+        /// Number of elements, a power of two
+        uint32_t capacity;
+        /// Indexes
+        PluginChannelControl* control;
+        /// Elements
+        void* data;
+    };
+
+    /// C interface of the channel hub, offered to plugins through the host services
+    struct PluginChannelHubApi
+    {
+        /// Size of this structure, for forward compatibility
+        uint32_t size;
+        /// Version of this structure
+        uint32_t version;
+        /// Opaque hub data given back to each function
+        void* context;
+        /// Get the channel connected to a port. Returns NULL if the port is not connected.
+        const PluginChannelDescriptor* (*getChannel)(void* context, uint64_t port);
+    };
+}
+
+static_assert(sizeof(PluginChannelControl) == 128, "PluginChannelControl layout must not change");
+static_assert(sizeof(std::atomic<uint64_t>) == sizeof(uint64_t), "Channel indexes must be plain 64-bit words");
+
+/// Namespace of the Plugin library
+namespace Plugin
+{
+    /// Memory of a channel, owned by the host
+    /**
+      * Hand the descriptor to exactly one ChannelWriter and one ChannelReader.
+      */
+    class PluginChannel : private boost::noncopyable
+    {
+    public:
+        /// Constructor
+        /**
+          * @param elementSize Size of an element in bytes
+          * @param capacity Number of elements, rounded up to a power of two
+          */
+        PluginChannel(std::size_t elementSize, std::size_t capacity)
+        {
+            std::size_t rounded = 1;
+            while (rounded < capacity)
+                rounded <<= 1;
+            // One extra cache line to align the control block, one to keep the elements off it
+            storage_.reset(new char[sizeof(PluginChannelControl) + rounded * elementSize + 128]);
+            char* base = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(storage_.get()) + 63) & ~static_cast<uintptr_t>(63));
+            PluginChannelControl* control = new (base) PluginChannelControl();
+            control->tail.store(0, std::memory_order_relaxed);
+            control->head.store(0, std::memory_order_relaxed);
+
+            descriptor_.magic = PLUGIN_CHANNEL_MAGIC;
+            descriptor_.version = 1;
+            descriptor_.elementSize = static_cast<uint32_t>(elementSize);
+            descriptor_.capacity = static_cast<uint32_t>(rounded);
+            descriptor_.control = control;
+            descriptor_.data = base + sizeof(PluginChannelControl);
+        }
+
+        /// Get the descriptor given to the endpoints
+        const PluginChannelDescriptor* descriptor() const
+        {
+            return &descriptor_;
+        }
+
+    private:
+        // Descriptor of the memory below
+        PluginChannelDescriptor descriptor_;
+        // Control block followed by the elements
+        std::unique_ptr<char[]> storage_;
+    };
+
+    /// Producer endpoint of a channel
+    /**
+      * Every operation completes in a bounded number of steps (wait-free):
+      * when the channel is full, push() returns what fitted instead of waiting.
+      * Must be used by a single thread at a time.
+      * @tparam T Type of the elements, trivially copyable, of the size declared by the channel
+      */
+    template<class T>
+    class ChannelWriter
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "Channel elements must be trivially copyable");
+
+    public:
+        /// Constructor
+        /**
+          * @param descriptor Channel descriptor, possibly NULL
+          */
+        explicit ChannelWriter(const PluginChannelDescriptor* descriptor = NULL)
+            : descriptor_(NULL),
+              elements_(NULL),
+              mask_(0),
+              tail_(0),
+              cachedHead_(0)
+        {
+            attach(descriptor);
+        }
+
+        /// Attach the writer to a channel
+        /**
+          * @return False if the descriptor is NULL or does not describe a channel of T. True otherwise.
+          */
+        bool attach(const PluginChannelDescriptor* descriptor)
+        {
+            descriptor_ = NULL;
+            if (!descriptor || descriptor->magic != PLUGIN_CHANNEL_MAGIC || descriptor->elementSize != sizeof(T))
+                return false;
+            descriptor_ = descriptor;
+            elements_ = static_cast<T*>(descriptor->data);
+            mask_ = descriptor->capacity - 1;
+            tail_ = descriptor->control->tail.load(std::memory_order_relaxed);
+            cachedHead_ = descriptor->control->head.load(std::memory_order_acquire);
+            return true;
+        }
+
+        /// Check whether the writer is attached to a channel
+        bool isValid() const
+        {
+            return descriptor_ != NULL;
+        }
+
+        /// Push as many elements as fit
+        /**
+          * @param items Elements to push
+          * @param count Number of elements
+          * @return Number of elements pushed, from the beginning of items
+          */
+        std::size_t push(const T* items, std::size_t count)
+        {
+            std::size_t capacity = mask_ + 1;
+            if (tail_ - cachedHead_ + count > capacity)
+                cachedHead_ = descriptor_->control->head.load(std::memory_order_acquire);
+            std::size_t n = std::min<std::size_t>(count, capacity - static_cast<std::size_t>(tail_ - cachedHead_));
+            if (n == 0)
+                return 0;
+            std::size_t first = static_cast<std::size_t>(tail_) & mask_;
+            std::size_t chunk = std::min(n, capacity - first);
+            std::memcpy(elements_ + first, items, chunk * sizeof(T));
+            std::memcpy(elements_, items + chunk, (n - chunk) * sizeof(T));
+            tail_ += n;
+            descriptor_->control->tail.store(tail_, std::memory_order_release);
+            return n;
+        }
+
+        /// Push one element
+        /**
+          * @return False if the channel is full. True otherwise.
+          */
+        bool push(const T& item)
+        {
+            return push(&item, 1) == 1;
+        }
+
+    private:
+        // Channel
+        const PluginChannelDescriptor* descriptor_;
+        T* elements_;
+        std::size_t mask_;
+        // Local copy of the tail index, only written here
+        uint64_t tail_;
+        // Last head index read, refreshed only when the channel looks full
+        uint64_t cachedHead_;
+    };
+
+    /// Consumer endpoint of a channel
+    /**
+      * Every operation completes in a bounded number of steps (wait-free).
+      * Must be used by a single thread at a time.
+      * @tparam T Type of the elements, trivially copyable, of the size declared by the channel
+      */
+    template<class T>
+    class ChannelReader
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "Channel elements must be trivially copyable");
+
+    public:
+        /// Constructor
+        /**
+          * @param descriptor Channel descriptor, possibly NULL
+          */
+        explicit ChannelReader(const PluginChannelDescriptor* descriptor = NULL)
+            : descriptor_(NULL),
+              elements_(NULL),
+              mask_(0),
+              head_(0),
+              cachedTail_(0)
+        {
+            attach(descriptor);
+        }
+
+        /// Attach the reader to a channel
+        /**
+          * @return False if the descriptor is NULL or does not describe a channel of T. True otherwise.
+          */
+        bool attach(const PluginChannelDescriptor* descriptor)
+        {
+            descriptor_ = NULL;
+            if (!descriptor || descriptor->magic != PLUGIN_CHANNEL_MAGIC || descriptor->elementSize != sizeof(T))
+                return false;
+            descriptor_ = descriptor;
+            elements_ = static_cast<const T*>(descriptor->data);
+            mask_ = descriptor->capacity - 1;
+            head_ = descriptor->control->head.load(std::memory_order_relaxed);
+            cachedTail_ = descriptor->control->tail.load(std::memory_order_acquire);
+            return true;
+        }
+
+        /// Check whether the reader is attached to a channel
+        bool isValid() const
+        {
+            return descriptor_ != NULL;
+        }
+
+        /// Pop the available elements, up to a maximum
+        /**
+          * @param items Receives the elements
+          * @param maxCount Maximum number of elements
+          * @return Number of elements popped
+          */
+        std::size_t pop(T* items, std::size_t maxCount)
+        {
+            if (cachedTail_ - head_ < maxCount)
+                cachedTail_ = descriptor_->control->tail.load(std::memory_order_acquire);
+            std::size_t n = std::min<std::size_t>(maxCount, static_cast<std::size_t>(cachedTail_ - head_));
+            if (n == 0)
+                return 0;
+            std::size_t capacity = mask_ + 1;
+            std::size_t first = static_cast<std::size_t>(head_) & mask_;
+            std::size_t chunk = std::min(n, capacity - first);
+            std::memcpy(items, elements_ + first, chunk * sizeof(T));
+            std::memcpy(items + chunk, elements_, (n - chunk) * sizeof(T));
+            head_ += n;
+            descriptor_->control->head.store(head_, std::memory_order_release);
+            return n;
+        }
+
+        /// Pop one element
+        /**
+          * @return False if the channel is empty. True otherwise.
+          */
+        bool pop(T& item)
+        {
+            return pop(&item, 1) == 1;
+        }
+
+        /// Get the number of elements waiting in the channel
+        std::size_t size() const
+        {
+            return static_cast<std::size_t>(descriptor_->control->tail.load(std::memory_order_acquire) - head_);
+        }
+
+    private:
+        // Channel
+        const PluginChannelDescriptor* descriptor_;
+        const T* elements_;
+        std::size_t mask_;
+        // Local copy of the head index, only written here
+        uint64_t head_;
+        // Last tail index read, refreshed only when the channel looks empty
+        uint64_t cachedTail_;
+    };
+
+    /// Host side wiring of plugin ports with channels
+    /**
+      * Plugins name their input and output ports with PLUGIN_SERVICE_ID and look up
+      * the channel connected to them through the host services, see getPluginChannel().
+      * Once both plugins hold the descriptor, data flows without any host mediation.
+      * Connect ports before handing the services to the plugins.
+      */
+    class ChannelHub : private boost::noncopyable
+    {
+    public:
+        /// Constructor
+        ChannelHub()
+        {
+            api_.size = sizeof(PluginChannelHubApi);
+            api_.version = 1;
+            api_.context = this;
+            api_.getChannel = &ChannelHub::getChannelThunk;
+        }
+
+        /// Connect an output port to an input port with a new channel
+        /**
+          * @param output ID of the port of the producer plugin
+          * @param input ID of the port of the consumer plugin
+          * @param elementSize Size of an element in bytes
+          * @param capacity Number of elements
+          * @return False if either port is already connected. True otherwise.
+          */
+        bool connect(uint64_t output, uint64_t input, std::size_t elementSize, std::size_t capacity)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (output == input || ports_.count(output) || ports_.count(input))
+                return false;
+            std::shared_ptr<PluginChannel> channel = std::make_shared<PluginChannel>(elementSize, capacity);
+            ports_[output] = channel;
+            ports_[input] = channel;
+            return true;
+        }
+
+        /// Get the channel connected to a port. NULL if not connected.
+        const PluginChannelDescriptor* getChannel(uint64_t port) const
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            std::map<uint64_t, std::shared_ptr<PluginChannel> >::const_iterator it = ports_.find(port);
+            return it == ports_.end() ? NULL : it->second->descriptor();
+        }
+
+        /// Get the C interface given to plugins
+        /**
+          * Offer it to plugins with HostServices::add(PLUGIN_CHANNEL_SERVICE, hub.api()).
+          */
+        const PluginChannelHubApi* api() const
+        {
+            return &api_;
+        }
+
+    private:
+        static const PluginChannelDescriptor* getChannelThunk(void* context, uint64_t port)
+        {
+            return static_cast<const ChannelHub*>(context)->getChannel(port);
+        }
+
+        // Channels by port, each channel being shared by its two ports
+        std::map<uint64_t, std::shared_ptr<PluginChannel> > ports_;
+        // Protects ports_
+        mutable std::mutex mutex_;
+        // C interface
+        PluginChannelHubApi api_;
+    };
+
+    /// Get, from a plugin, the channel connected to one of its ports
+    /**
+      * @param services Host services, typically globalHostServices in a plugin
+      * @param port ID of the port, see PLUGIN_SERVICE_ID
+      * @return NULL if the host has no channel hub or the port is not connected
+      */
+    inline const PluginChannelDescriptor* getPluginChannel(const PluginHostServices* services, uint64_t port)
+    {
+        const PluginChannelHubApi* hub = getHostService<PluginChannelHubApi>(services, PLUGIN_CHANNEL_SERVICE);
+        return hub ? hub->getChannel(hub->context, port) : NULL;
+    }
+}
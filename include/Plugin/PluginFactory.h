@@ -18,6 +18,12 @@
 /// Function name of the Plugin factory to destroy Facade instance
 #define PLUGIN_FACTORY_DESTROY "destroyPluginFacade"
 
+/// Function name of the Plugin factory to create an independent Facade instance
+#define PLUGIN_FACTORY_NEW "newPluginFacade"
+
+/// Function name of the Plugin factory to destroy an instance created by PLUGIN_FACTORY_NEW
+#define PLUGIN_FACTORY_DELETE "deletePluginFacade"
+
 /// Declare fonctions to create and destroy your plugin facade.
 /**
   * Must be used in a header file, in the global namespace.
@@ -29,12 +35,16 @@ extern "C"                                          \
 {                                                   \
 PLUGIN_API T* createPluginFacade();                 \
 PLUGIN_API void destroyPluginFacade();              \
+PLUGIN_API T* newPluginFacade();                    \
+PLUGIN_API void deletePluginFacade(T* instance);    \
 }
 
 /// Defines fonctions to create and destroy your plugin facade.
 /**
   * Must be used in a cpp file.
   * Your plugin facade will behave as a singleton.
+  * Independent instances are also available, for loaders with an instance policy
+  * other than SingletonInstance.
   * @param T It is the concrete type of your plugin facade.
   *        T is not required to be in the global namespace.
   */
@@ -53,4 +63,12 @@ void destroyPluginFacade()              \
         delete globalInstance;          \
         globalInstance = NULL;          \
     }                                   \
+}                                       \
+T* newPluginFacade()                    \
+{                                       \
+    return new T();                     \
+}                                       \
+void deletePluginFacade(T* instance)    \
+{                                       \
+    delete instance;                    \
 }
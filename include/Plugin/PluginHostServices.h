@@ -0,0 +1,282 @@
+//          Copyright Jeremy Coulon 2012-2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+/** @file */
+
+#pragma once
+
+//==============
+//==  Plugin  ==
+//==============
+#include "Plugin/ExportAPI.h"
+
+//=============
+//==  Boost  ==
+//=============
+#include <boost/noncopyable.hpp>
+
+//===========
+//==  STD  ==
+//===========
+#include <atomic>
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <stdint.h>
+
+/// Function name of the optional plugin entry point receiving the host services
+#define PLUGIN_HOST_SERVICES_ATTACH "attachPluginHostServices"
+
+extern "C"
+{
+    /// Slot of the perfect-hash table of PluginHostServices
+    struct PluginServiceSlot
+    {
+        /// ID of the service. Zero if the slot is empty.
+        uint64_t id;
+        /// Service
+        const void* service;
+    };
+
+    /// Services offered by the host to its plugins
+    /**
+      * This is a C structure so that plugins built with another compiler,
+      * or against another version of this library, can use it.
+      * Services are looked up by ID, see PLUGIN_SERVICE_ID.
+      *
+      * Since version 2, the services are also laid out in a perfect-hash table:
+      * the service with a given ID can only be in slot Plugin::serviceSlot(id, seed, slotMask),
+      * so a lookup is one probe and one comparison, without calling into the host.
+      */
+    struct PluginHostServices
+    {
+        /// Size of this structure, for forward compatibility
+        uint32_t size;
+        /// Version of this structure
+        uint32_t version;
+        /// Opaque host data given back to getService
+        void* context;
+        /// Get a service by ID. Returns NULL if the host does not offer it.
+        const void* (*getService)(void* context, uint64_t id);
+        /// Number of slots minus one. The number of slots is a power of two. Since version 2.
+        uint32_t slotMask;
+        /// Seed of the hash placing the services without collision. Since version 2.
+        uint32_t seed;
+        /// Slots. Since version 2.
+        const PluginServiceSlot* slots;
+    };
+}
+
+/// Compile-time ID of a service, or of any other named entity, from its name
+#define PLUGIN_SERVICE_ID(name) (std::integral_constant<uint64_t, ::Plugin::hashName(name)>::value)
+
+/// Get a service offered to the plugin, caching it on first use
+/**
+  * Must be used in a function of a plugin, after the host services were attached,
+  * that is not from a static constructor. The lookup is done once per call site.
+  * @param Type Type of the service
+  * @param id ID of the service, see PLUGIN_SERVICE_ID
+  */
+#define PLUGIN_HOST_SERVICE(Type, id)                                                           \
+([&]() -> const Type*                                                                           \
+{                                                                                               \
+    static const Type* const cachedService = ::Plugin::getHostService<Type>(globalHostServices, id); \
+    return cachedService;                                                                       \
+}())
+
+/// Declare the function receiving the host services, and the global pointer globalHostServices.
+/**
+  * Optional. Must be used in a header file, in the global namespace,
+  * next to PLUGIN_FACTORY_DECLARATION, so that every cpp file of the plugin can use PLUGIN_HOST_SERVICE.
+  */
+#define PLUGIN_HOST_SERVICES_DECLARATION()                                      \
+extern "C"                                                                      \
+{                                                                               \
+PLUGIN_API void attachPluginHostServices(const PluginHostServices* services);   \
+}                                                                               \
+extern const PluginHostServices* globalHostServices;
+
+/// Define the function receiving the host services.
+/**
+  * Must be used in a cpp file, next to PLUGIN_FACTORY_DEFINITION.
+  * The services are then available through the global pointer globalHostServices,
+  * before the plugin facade is created. It is NULL if the host offers no service.
+  */
+#define PLUGIN_HOST_SERVICES_DEFINITION()                                       \
+const PluginHostServices* globalHostServices = NULL;                            \
+void attachPluginHostServices(const PluginHostServices* services)               \
+{                                                                               \
+    globalHostServices = services;                                              \
+}
+
+/// Namespace of the Plugin library
+namespace Plugin
+{
+    /// FNV-1a hash of a name, usable at compile time
+    constexpr uint64_t hashName(const char* name, uint64_t hash = 14695981039346656037ULL)
+    {
+        return *name ? hashName(name + 1, (hash ^ static_cast<unsigned char>(*name)) * 1099511628211ULL) : hash;
+    }
+
+    /// Slot of a service in the perfect-hash table of PluginHostServices
+    /**
+      * Part of the C interface: plugins and hosts must compute the same slot.
+      */
+    inline uint32_t serviceSlot(uint64_t id, uint32_t seed, uint32_t slotMask)
+    {
+        uint64_t h = (id ^ seed) * 0x9E3779B97F4A7C15ULL;
+        return static_cast<uint32_t>(h >> 32) & slotMask;
+    }
+
+    /// Get a service offered by the host
+    /**
+      * @tparam S Type of the service
+      * @param services Host services, possibly NULL
+      * @param id ID of the service, see PLUGIN_SERVICE_ID
+      * @return NULL if the host does not offer the service
+      */
+    template<class S>
+    const S* getHostService(const PluginHostServices* services, uint64_t id)
+    {
+        if (!services)
+            return NULL;
+        if (services->version >= 2 && services->size >= sizeof(PluginHostServices) && services->slots)
+        {
+            const PluginServiceSlot& slot = services->slots[serviceSlot(id, services->seed, services->slotMask)];
+            return slot.id == id ? static_cast<const S*>(slot.service) : NULL;
+        }
+        if (!services->getService)
+            return NULL;
+        return static_cast<const S*>(services->getService(services->context, id));
+    }
+
+    /// Host side table of services
+    /**
+      * Services must be added before plugins are loaded: lookups are not synchronized with add(),
+      * which rebuilds the perfect-hash table.
+      * The table must outlive the plugins it is given to.
+      */
+    class HostServices : private boost::noncopyable
+    {
+    public:
+        /// Constructor
+        HostServices()
+        {
+            table_.size = sizeof(PluginHostServices);
+            table_.version = 2;
+            table_.context = this;
+            table_.getService = &HostServices::lookup;
+            rebuild();
+        }
+
+        /// Offer a service
+        /**
+          * @param id ID of the service, see PLUGIN_SERVICE_ID
+          * @param service Service, typically a C structure of function pointers
+          */
+        void add(uint64_t id, const void* service)
+        {
+            for (std::size_t i = 0; i < services_.size(); ++i)
+            {
+                if (services_[i].first == id)
+                {
+                    services_[i].second = service;
+                    rebuild();
+                    return;
+                }
+            }
+            services_.push_back(std::make_pair(id, service));
+            rebuild();
+        }
+
+        /// Get a service. NULL if it is not offered.
+        const void* get(uint64_t id) const
+        {
+            const PluginServiceSlot& slot = slots_[serviceSlot(id, table_.seed, table_.slotMask)];
+            return slot.id == id ? slot.service : NULL;
+        }
+
+        /// Get the number of slots of the perfect-hash table
+        std::size_t getSlotCount() const
+        {
+            return slots_.size();
+        }
+
+        /// Get the table given to the plugins
+        const PluginHostServices* table() const
+        {
+            return &table_;
+        }
+
+    private:
+        static const void* lookup(void* context, uint64_t id)
+        {
+            return static_cast<const HostServices*>(context)->get(id);
+        }
+
+        // Find a seed placing every service in its own slot, growing the table when needed
+        void rebuild()
+        {
+            std::size_t slotCount = 1;
+            while (slotCount < 2 * services_.size())
+                slotCount *= 2;
+            for (uint32_t seed = 0; ; ++seed)
+            {
+                // Tables at most half full almost always succeed within a few seeds
+                if (seed != 0 && seed % 64 == 0)
+                    slotCount *= 2;
+                std::vector<PluginServiceSlot> slots(slotCount);
+                bool placed = true;
+                for (std::size_t i = 0; i < services_.size() && placed; ++i)
+                {
+                    PluginServiceSlot& slot = slots[serviceSlot(services_[i].first, seed, static_cast<uint32_t>(slotCount - 1))];
+                    placed = slot.id == 0 && slot.service == NULL;
+                    slot.id = services_[i].first;
+                    slot.service = services_[i].second;
+                }
+                if (!placed)
+                    continue;
+                slots_.swap(slots);
+                table_.slotMask = static_cast<uint32_t>(slotCount - 1);
+                table_.seed = seed;
+                table_.slots = &slots_[0];
+                return;
+            }
+        }
+
+        // C view given to the plugins
+        PluginHostServices table_;
+        // Services by ID, in insertion order
+        std::vector<std::pair<uint64_t, const void*> > services_;
+        // Perfect-hash table of the services
+        std::vector<PluginServiceSlot> slots_;
+    };
+
+    namespace detail
+    {
+        inline std::atomic<const PluginHostServices*>& defaultHostServices()
+        {
+            static std::atomic<const PluginHostServices*> services(NULL);
+            return services;
+        }
+    }
+
+    /// Set the services given to plugins by every PluginLoader without services of its own
+    /**
+      * @param services Host services, or NULL to give none
+      */
+    inline void setDefaultHostServices(const PluginHostServices* services)
+    {
+        detail::defaultHostServices().store(services);
+    }
+
+    /// Get the services given to plugins by default
+    inline const PluginHostServices* getDefaultHostServices()
+    {
+        return detail::defaultHostServices().load();
+    }
+}
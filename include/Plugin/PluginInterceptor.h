@@ -0,0 +1,362 @@
+//          Copyright Jeremy Coulon 2012-2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+/** @file */
+
+#pragma once
+
+//==============
+//==  Plugin  ==
+//==============
+#include "Plugin/InterfaceDescription.h"
+#include "Plugin/LatencyHistogram.h"
+
+//=============
+//==  Boost  ==
+//=============
+#include <boost/noncopyable.hpp>
+
+//===========
+//==  STD  ==
+//===========
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <set>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <stdint.h>
+
+/// Namespace of the Plugin library
+namespace Plugin
+{
+    namespace detail
+    {
+        // Recorders alive, so that thread local caches can forget the others
+        struct RecorderRegistry
+        {
+            RecorderRegistry()
+                : next(1),
+                  destroyed(0)
+            {
+                // Empty
+            }
+
+            std::mutex mutex;
+            std::set<uint64_t> live;
+            uint64_t next;
+            // Number of recorders destroyed, to know when caches have entries to forget
+            std::atomic<uint64_t> destroyed;
+        };
+
+        inline RecorderRegistry& recorderRegistry()
+        {
+            static RecorderRegistry registry;
+            return registry;
+        }
+
+        // Unique ID of a recorder, never reused, to key thread local caches
+        class RecorderId : private boost::noncopyable
+        {
+        public:
+            RecorderId()
+            {
+                RecorderRegistry& registry = recorderRegistry();
+                std::lock_guard<std::mutex> lock(registry.mutex);
+                id_ = registry.next++;
+                registry.live.insert(id_);
+            }
+
+            ~RecorderId()
+            {
+                RecorderRegistry& registry = recorderRegistry();
+                std::lock_guard<std::mutex> lock(registry.mutex);
+                registry.live.erase(id_);
+                registry.destroyed.fetch_add(1, std::memory_order_release);
+            }
+
+            uint64_t get() const
+            {
+                return id_;
+            }
+
+        private:
+            uint64_t id_;
+        };
+
+        // Shards of the calling thread, by recorder ID
+        struct ThreadShards
+        {
+            ThreadShards()
+                : destroyed(0)
+            {
+                // Empty
+            }
+
+            std::vector<std::pair<uint64_t, void*> > entries;
+            // Recorders destroyed when entries were last purged
+            uint64_t destroyed;
+        };
+
+        inline ThreadShards& threadShards()
+        {
+            static thread_local ThreadShards shards;
+            return shards;
+        }
+
+        // Get the shard of the calling thread for a recorder. NULL if the thread has none yet.
+        inline void* findThreadShard(const RecorderId& id)
+        {
+            std::vector<std::pair<uint64_t, void*> >& entries = threadShards().entries;
+            for (std::size_t i = 0; i < entries.size(); ++i)
+                if (entries[i].first == id.get())
+                    return entries[i].second;
+            return NULL;
+        }
+
+        // Remember the shard of the calling thread for a recorder.
+        // Shards of the recorders destroyed since are forgotten first, so that
+        // each thread only keeps the entries of live recorders.
+        inline void addThreadShard(const RecorderId& id, void* shard)
+        {
+            ThreadShards& shards = threadShards();
+            RecorderRegistry& registry = recorderRegistry();
+            uint64_t destroyed = registry.destroyed.load(std::memory_order_acquire);
+            if (destroyed != shards.destroyed)
+            {
+                std::lock_guard<std::mutex> lock(registry.mutex);
+                std::size_t kept = 0;
+                for (std::size_t i = 0; i < shards.entries.size(); ++i)
+                    if (registry.live.count(shards.entries[i].first))
+                        shards.entries[kept++] = shards.entries[i];
+                shards.entries.resize(kept);
+                shards.destroyed = destroyed;
+            }
+            shards.entries.push_back(std::make_pair(id.get(), shard));
+        }
+    }
+
+    /// Interception policy doing nothing: the interceptor is a plain pointer to the plugin
+    struct NoInterception
+    {
+        /// Recorder of the calls
+        template<class T>
+        class Recorder
+        {
+        public:
+            /// Call in progress
+            class Scope
+            {
+            public:
+                /// Constructor
+                template<class Pmf>
+                Scope(Recorder&, Pmf)
+                {
+                    // Empty
+                }
+            };
+        };
+    };
+
+    /// Interception policy recording the latency of each method in a LatencyHistogram
+    /**
+      * Each thread records in a shard of its own, without contention.
+      * Shards are merged when histograms are read, typically periodically by a reporter.
+      */
+    struct LatencyInterception
+    {
+        /// Recorder of the calls
+        template<class T>
+        class Recorder : private boost::noncopyable
+        {
+            struct Shard
+            {
+                Shard()
+                    : histograms(InterfaceDescription<T>::methodCount + 1)
+                {
+                    // Empty
+                }
+
+                // One histogram per described method, plus one for the others
+                std::vector<SharedLatencyHistogram> histograms;
+            };
+
+        public:
+            /// Call in progress
+            class Scope
+            {
+            public:
+                /// Constructor
+                template<class Pmf>
+                Scope(Recorder& recorder, Pmf pmf)
+                    : recorder_(recorder),
+                      index_(methodIndex<T>(pmf)),
+                      start_(std::chrono::steady_clock::now())
+                {
+                    // Empty
+                }
+
+                /// Destructor. Record the duration of the call, even if it threw.
+                ~Scope()
+                {
+                    std::chrono::steady_clock::duration elapsed = std::chrono::steady_clock::now() - start_;
+                    recorder_.record(index_, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+                }
+
+            private:
+                Recorder& recorder_;
+                std::size_t index_;
+                std::chrono::steady_clock::time_point start_;
+            };
+
+            /// Constructor
+            Recorder()
+            {
+                // Empty
+            }
+
+            /// Merge the shards of every thread
+            /**
+              * @return One histogram per method of InterfaceDescription<T>, plus a last one
+              *         for the methods that are not described
+              */
+            std::vector<LatencyHistogram> merge() const
+            {
+                std::vector<LatencyHistogram> res(InterfaceDescription<T>::methodCount + 1);
+                std::lock_guard<std::mutex> lock(mutex_);
+                for (std::size_t s = 0; s < shards_.size(); ++s)
+                    for (std::size_t m = 0; m < res.size(); ++m)
+                        shards_[s]->histograms[m].mergeInto(res[m]);
+                return res;
+            }
+
+            /// Get the merged histogram of a method
+            /**
+              * @param pmf Pointer to a member function of T
+              */
+            template<class Pmf>
+            LatencyHistogram getHistogram(Pmf pmf) const
+            {
+                LatencyHistogram res;
+                std::size_t index = methodIndex<T>(pmf);
+                std::lock_guard<std::mutex> lock(mutex_);
+                for (std::size_t s = 0; s < shards_.size(); ++s)
+                    shards_[s]->histograms[index].mergeInto(res);
+                return res;
+            }
+
+            /// Write the count and percentiles of each called method, in nanoseconds
+            void writeReport(std::ostream& os) const
+            {
+                std::vector<LatencyHistogram> histograms = merge();
+                for (std::size_t m = 0; m < histograms.size(); ++m)
+                {
+                    const LatencyHistogram& h = histograms[m];
+                    if (h.getCount() == 0)
+                        continue;
+                    os << (m < InterfaceDescription<T>::methodCount ? methodName<T>(m) : "(other)")
+                       << " count=" << h.getCount()
+                       << " mean=" << static_cast<uint64_t>(h.getMean())
+                       << " p50=" << h.getPercentile(50)
+                       << " p99=" << h.getPercentile(99)
+                       << " p99.9=" << h.getPercentile(99.9)
+                       << " max=" << h.getMax() << std::endl;
+                }
+            }
+
+            /// Get the number of threads that made calls
+            std::size_t getShardCount() const
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                return shards_.size();
+            }
+
+        private:
+            void record(std::size_t index, uint64_t ns)
+            {
+                localShard().histograms[index].record(ns);
+            }
+
+            Shard& localShard()
+            {
+                if (void* shard = detail::findThreadShard(id_))
+                    return *static_cast<Shard*>(shard);
+                std::lock_guard<std::mutex> lock(mutex_);
+                shards_.push_back(std::unique_ptr<Shard>(new Shard));
+                detail::addThreadShard(id_, shards_.back().get());
+                return *shards_.back();
+            }
+
+            // Key of the shards in the thread local caches
+            detail::RecorderId id_;
+            // Shard of each thread
+            std::vector<std::unique_ptr<Shard> > shards_;
+            mutable std::mutex mutex_;
+        };
+    };
+
+    /// Proxy recording the calls made to a plugin
+    /**
+      * Calls go through call(), as with the other loaders of the library:
+      * @code
+      * Plugin::PluginInterceptor<IMyInterface> proxy(loader.getPluginInstance());
+      * proxy.call(&IMyInterface::compute, 42);
+      * proxy.writeReport(std::cout);
+      * @endcode
+      * With the NoInterception policy, the proxy is a plain pointer and call()
+      * compiles to a direct virtual call.
+      * @tparam T Interface type of the concrete plugin. It must be described with PLUGIN_INTERFACE_DESCRIPTION.
+      * @tparam Policy NoInterception, LatencyInterception, CounterInterception from PerfCounters.h,
+      *         MetricsInterception from PluginMetrics.h or TraceInterception from PluginTrace.h
+      */
+    template<class T, class Policy = LatencyInterception>
+    class PluginInterceptor : public Policy::template Recorder<T>
+    {
+    public:
+        /// Constructor
+        /**
+          * @param plugin Plugin facade, typically from PluginLoader::getPluginInstance()
+          */
+        explicit PluginInterceptor(T* plugin = NULL)
+            : plugin_(plugin)
+        {
+            // Empty
+        }
+
+        /// Change the intercepted plugin, keeping the recorded calls
+        void setPlugin(T* plugin)
+        {
+            plugin_ = plugin;
+        }
+
+        /// Get the intercepted plugin
+        T* get() const
+        {
+            return plugin_;
+        }
+
+        /// Call a method of the plugin
+        /**
+          * @param pmf Pointer to a member function of T
+          * @param args Arguments of the method
+          * @return The value returned by the plugin
+          */
+        template<class Pmf, class... A>
+        typename MethodTraits<Pmf>::result_type call(Pmf pmf, A&&... args)
+        {
+            typename Policy::template Recorder<T>::Scope scope(*this, pmf);
+            return (plugin_->*pmf)(std::forward<A>(args)...);
+        }
+
+    private:
+        // Intercepted plugin
+        T* plugin_;
+    };
+}
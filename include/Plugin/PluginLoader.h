@@ -10,7 +10,13 @@
 //==============
 //==  Plugin  ==
 //==============
+#include "Plugin/LoadHistory.h"
+#include "Plugin/ModuleTracker.h"
 #include "Plugin/PluginFactory.h"
+#include "Plugin/PluginHostServices.h"
+#include "Plugin/PluginLoaderPolicies.h"
+#include "Plugin/PluginTrace.h"
+#include "Plugin/StaticProbes.h"
 
 //=============
 //==  Boost  ==
@@ -20,29 +26,110 @@
 //===========
 //==  STD  ==
 //===========
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <condition_variable>
 #include <cstddef>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <sstream>
 #include <string>
-
-//=======================
-//==  OS Specific SDK  ==
-//=======================
-#ifdef _WIN32
-#include <Windows.h>
-#else
-#include <dlfcn.h>
-#endif
+#include <system_error>
+#include <thread>
+#include <vector>
 
 /// Namespace of the Plugin library
 namespace Plugin
 {
+    namespace detail
+    {
+        struct Quarantine
+        {
+            Quarantine()
+                : count(0)
+            {
+                // Empty
+            }
+
+            std::mutex mutex;
+            std::set<std::string> names;
+            // Size of names, so that loads skip the lock while nothing is quarantined
+            std::atomic<std::size_t> count;
+            // States of abandoned loads. A library loaded elsewhere keeps their host services table.
+            std::vector<std::shared_ptr<void> > abandonedLoads;
+        };
+
+        // Plugins that must not be loaded again in this process
+        inline Quarantine& quarantine()
+        {
+            static Quarantine instance;
+            return instance;
+        }
+    }
+
+    /// Prevent every PluginLoader of the process from loading a plugin
+    /**
+      * PluginLoader::load() quarantines plugins that time out.
+      * @param name Filename of the concrete plugin, as given to PluginLoader
+      */
+    inline void quarantinePlugin(const std::string& name)
+    {
+        detail::Quarantine& quarantine = detail::quarantine();
+        std::lock_guard<std::mutex> lock(quarantine.mutex);
+        quarantine.names.insert(name);
+        quarantine.count.store(quarantine.names.size(), std::memory_order_release);
+    }
+
+    /// Allow a quarantined plugin to be loaded again
+    inline void releasePluginQuarantine(const std::string& name)
+    {
+        detail::Quarantine& quarantine = detail::quarantine();
+        std::lock_guard<std::mutex> lock(quarantine.mutex);
+        quarantine.names.erase(name);
+        quarantine.count.store(quarantine.names.size(), std::memory_order_release);
+    }
+
+    /// Check whether a plugin is quarantined
+    inline bool isPluginQuarantined(const std::string& name)
+    {
+        detail::Quarantine& quarantine = detail::quarantine();
+        if (quarantine.count.load(std::memory_order_acquire) == 0)
+            return false;
+        std::lock_guard<std::mutex> lock(quarantine.mutex);
+        return quarantine.names.count(name) != 0;
+    }
+
+
     /// Loader of a concrete plugin
     /**
+      * The default policies give a loader meant for one thread, opening the library with dlopen()
+      * and sharing the facade singleton of the plugin. Other policies only add the code they need:
+      * @code
+      * // Shared by threads, each thread with its own facade, with load statistics
+      * Plugin::PluginLoader<IMyInterface, Plugin::MutexThreading, Plugin::DlopenLoad,
+      *                      Plugin::PerThreadInstance, Plugin::LoaderMetrics> loader("libMyPlugin.so");
+      * @endcode
+      * Whatever the policies, loads and unloads are recorded in the LoadHistory,
+      * and lifecycle operations are traced while the PluginTracer is enabled.
       * @tparam T Interface type of the concrete plugin
+      * @tparam ThreadingPolicy SingleThreaded, MutexThreading or AtomicThreading
+      * @tparam LoadPolicy DlopenLoad, MemfdLoad, DlmopenLoad or StaticRegistryLoad
+      * @tparam InstancePolicy SingletonInstance, PerThreadInstance or PooledInstance
+      * @tparam InstrumentationPolicy NoInstrumentation, LoaderMetrics, or SharedMetricsInstrumentation from PluginMetrics.h
       */
-    template<class T>
-    class PluginLoader : private boost::noncopyable
+    template<class T,
+             class ThreadingPolicy = SingleThreaded,
+             class LoadPolicy = DlopenLoad,
+             class InstancePolicy = SingletonInstance,
+             class InstrumentationPolicy = NoInstrumentation>
+    class PluginLoader : public InstrumentationPolicy, private ThreadingPolicy, private boost::noncopyable
     {
+        typedef typename ThreadingPolicy::Lock Lock;
+        typedef typename InstancePolicy::template Instances<T> Instances;
+        typedef typename InstrumentationPolicy::Timer Timer;
+
     public:
         /// Constructor
         /**
@@ -57,8 +144,8 @@ namespace Plugin
           */
         explicit PluginLoader(const std::string& name = "")
             : name_(name),
-              plugin_(NULL),
-              libHandle_(0)
+              libHandle_(0),
+              hostServices_(NULL)
         {
             // Empty
         }
@@ -76,40 +163,198 @@ namespace Plugin
         /**
           * This method only load the dynamic library in memory.
           * It does not instantiate the plugin facade.
+          * Plugins using PLUGIN_HOST_SERVICES_DEFINITION receive the host services here.
           * @return True on success. False otherwise.
           */
         bool load()
         {
+            TraceSpan span("load");
+            Lock lock(*this);
+            span.setPlugin(name_);
             if (isLoaded())
-                unload();
+                unloadImpl();
             if (name_.empty())
                 return false;
-            return loadLibrary();
+            if (isPluginQuarantined(name_))
+            {
+                errorMsg_ = "Plugin is quarantined: " + name_;
+                return false;
+            }
+            Timer timer;
+            bool res = loadLibrary();
+            this->onLoad(name_, timer, res);
+            if (res)
+                attachHostServices(hostServices_ ? hostServices_ : getDefaultHostServices());
+            return res;
         }
 
-        /// Unload the plugin
+        /// Load the plugin and instantiate the plugin facade, with a deadline
         /**
-          * If the plugin facade is instanciated, it is destroyed.
-          * Then the dynamic library is unloaded from memory.
+          * The library is loaded and the facade instantiated on a separate thread.
+          * If they do not complete in time, this method fails with a timeout error
+          * and the plugin is quarantined: later loads of the same filename fail immediately,
+          * from any PluginLoader of the process.
+          * If the library loads but the facade cannot be created, the library is unloaded.
+          *
+          * A thread stuck in dlopen() or in a static initializer cannot be cancelled safely,
+          * so it is abandoned. It keeps running, and if it ever completes,
+          * it destroys the facade and unloads the library.
+          * While it is stuck inside dlopen(), it holds the lock of the dynamic loader:
+          * other threads calling dlopen(), dlclose() or dlsym() may block as well.
+          * The plugin looks its host services up through a table owned by the loading thread,
+          * which stops answering once the thread is abandoned: the host may then release its services.
+          * @param timeout Maximum duration of the load
           * @return True on success. False otherwise.
           */
-        bool unload()
+        template<class Rep, class Period>
+        bool load(const std::chrono::duration<Rep, Period>& timeout)
         {
-            bool res = true;
-            if (isLoaded())
+            struct LoadState
             {
-                if (plugin_)
+                LoadState()
+                    : done(false),
+                      abandoned(false),
+                      handle(0),
+                      source(NULL)
                 {
-                    callFunction<void>(PLUGIN_FACTORY_DESTROY);
-                    plugin_ = NULL;
+                    // Empty
                 }
-                res = unloadLibrary();
-                if (res)
-                    libHandle_ = 0;
+
+                // Lookup of the table given to the plugin: forwards to the host until the load is abandoned
+                static const void* getService(void* context, uint64_t id)
+                {
+                    LoadState* state = static_cast<LoadState*>(context);
+                    std::lock_guard<std::mutex> lock(state->mutex);
+                    return state->abandoned ? NULL : getHostService<void>(state->source, id);
+                }
+
+                std::mutex mutex;
+                std::condition_variable finished;
+                bool done;
+                bool abandoned;
+                library_handle handle;
+                Instances instances;
+                std::string errorMsg;
+                // Services of the host, only read while the load is not abandoned
+                const PluginHostServices* source;
+                // Table given to the plugin during the load
+                PluginHostServices services;
+            };
+
+            TraceSpan span("load");
+            Lock lock(*this);
+            span.setPlugin(name_);
+            if (isLoaded())
+                unloadImpl();
+            if (name_.empty())
+                return false;
+            if (isPluginQuarantined(name_))
+            {
+                errorMsg_ = "Plugin is quarantined: " + name_;
+                return false;
+            }
+
+            Timer timer;
+            std::shared_ptr<LoadState> state = std::make_shared<LoadState>();
+            state->source = hostServices_ ? hostServices_ : getDefaultHostServices();
+            PluginHostServices services = { sizeof(PluginHostServices), 1, state.get(), &LoadState::getService, 0, 0, NULL };
+            state->services = services;
+            std::string name = name_;
+            try
+            {
+                std::thread([state, name]()
+                {
+                    PluginLoader loader(name);
+                    bool instantiated = false;
+                    if (loader.loadLibrary())
+                    {
+                        if (state->source)
+                            loader.attachHostServices(&state->services);
+                        T* plugin = loader.getPluginInstance();
+                        instantiated = plugin != NULL;
+                        loader.releaseInstance(plugin);
+                    }
+                    std::lock_guard<std::mutex> lock(state->mutex);
+                    state->done = true;
+                    state->errorMsg = loader.errorMsg_;
+                    if (loader.isLoaded() && !instantiated)
+                        state->errorMsg = "Failed to create the plugin facade: " + name;
+                    if (!state->abandoned && instantiated)
+                    {
+                        // Hand the library over to the waiting loader
+                        state->handle = loader.libHandle_;
+                        state->instances.swap(loader.instances_);
+                        loader.libHandle_ = 0;
+                        // The facade is counted by the waiting loader from now on
+                        loader.onInstanceDestroy(name);
+                    }
+                    else if (loader.isLoaded() && state->source)
+                    {
+                        // The library is unloaded when this loader is destroyed,
+                        // but other loaders may keep it: it must not keep a table that goes away.
+                        if (!state->abandoned)
+                        {
+                            loader.attachHostServices(state->source);
+                        }
+                        else
+                        {
+                            detail::Quarantine& quarantine = detail::quarantine();
+                            std::lock_guard<std::mutex> quarantineLock(quarantine.mutex);
+                            quarantine.abandonedLoads.push_back(state);
+                        }
+                    }
+                    state->finished.notify_all();
+                }).detach();
             }
+            catch (const std::system_error& e)
+            {
+                errorMsg_ = std::string("Failed to start loading thread: ") + e.what();
+                this->onLoad(name_, timer, false);
+                return false;
+            }
+
+            std::unique_lock<std::mutex> stateLock(state->mutex);
+            if (!state->finished.wait_for(stateLock, timeout, [&state]() { return state->done; }))
+            {
+                state->abandoned = true;
+                quarantinePlugin(name_);
+                std::ostringstream oss;
+                oss << "Timed out after "
+                    << std::chrono::duration_cast<std::chrono::milliseconds>(timeout).count()
+                    << " ms while loading plugin, plugin is now quarantined: " << name_;
+                errorMsg_ = oss.str();
+                this->onLoad(name_, timer, false);
+                return false;
+            }
+            libHandle_ = state->handle;
+            instances_.swap(state->instances);
+            bool res = isLoaded();
+            if (res)
+            {
+                this->onInstanceCreate(name_);
+                // The table of the loading thread goes away with it
+                attachHostServices(state->source);
+            }
+            else
+            {
+                errorMsg_ = state->errorMsg;
+            }
+            this->onLoad(name_, timer, res);
             return res;
         }
 
+        /// Unload the plugin
+        /**
+          * If the plugin facade is instanciated, it is destroyed.
+          * Then the dynamic library is unloaded from memory.
+          * @return True on success. False otherwise.
+          */
+        bool unload()
+        {
+            Lock lock(*this);
+            return unloadImpl();
+        }
+
         /// Check if the plugin is loaded.
         /**
           * @return True if the plugin is loaded. False otherwise.
@@ -123,15 +368,44 @@ namespace Plugin
         /**
           * Note that this method instanciate the plugin facade singleton
           * if it is not already created.
+          * With PerThreadInstance, each thread gets its own facade.
+          * With PooledInstance, the facade is lent until releaseInstance().
           * @return a valid pointer if the plugin is loaded. NULL otherwise.
           */
         T* getPluginInstance()
         {
+            TraceSpan span("getPluginInstance");
+            Lock lock(*this);
+            span.setPlugin(name_);
             if (!isLoaded())
                 return NULL;
-            if (!plugin_)
-                plugin_ = callFunction<T*>(PLUGIN_FACTORY_CREATE);
-            return plugin_;
+            this->onInstanceRequest(name_);
+            Factory factory(*this);
+            return instances_.acquire(factory);
+        }
+
+        /// Give back a facade from getPluginInstance()
+        /**
+          * Only needed with PooledInstance, where the facade returns to the pool.
+          * Does nothing with the other instance policies.
+          */
+        void releaseInstance(T* plugin)
+        {
+            Lock lock(*this);
+            Factory factory(*this);
+            instances_.release(factory, plugin);
+        }
+
+        /// Destroy the plugin facade
+        /**
+          * The dynamic library stays loaded in memory,
+          * so the facade can be created again with getPluginInstance().
+          * Every facade of the loader is destroyed, whatever the instance policy.
+          */
+        void destroyPluginInstance()
+        {
+            Lock lock(*this);
+            destroyPluginInstanceImpl();
         }
 
         /// Get error message
@@ -164,104 +438,175 @@ namespace Plugin
             name_ = name;
         }
 
+        /**
+         * @brief Set the services given to the plugin when it is loaded
+         * @param services Host services, or NULL to use the default ones, see setDefaultHostServices()
+         */
+        void setHostServices(const PluginHostServices* services)
+        {
+            hostServices_ = services;
+        }
+
+        /**
+         * @brief Get the OS specific library handle
+         * @return HMODULE on Windows, dlopen() handle otherwise. Null if not loaded.
+         */
+        void* getNativeHandle() const
+        {
+            return reinterpret_cast<void*>(libHandle_);
+        }
+
     private:
 
-#ifdef _WIN32
     // an OS specific type that represents a library handle.
-    typedef HMODULE library_handle;
-    // an OS specific type that represents a function pointer.
-    typedef FARPROC generic_function_ptr;
-#else
-    // an OS specific type that represents a library handle.
-    typedef void * library_handle;
-    // an OS specific type that represents a function pointer.
-    typedef void * generic_function_ptr;
-#endif
+    typedef typename LoadPolicy::Handle library_handle;
 
 #ifdef _MSC_VER
 # pragma warning (push)
 // 'reinterpret_cast': unsafe conversion
-// from 'Plugin::generic_function_ptr'
+// from 'void*'
 // to 'void (__decl*)(void)'
 # pragma warning (disable: 4191)
 #endif
 
+        // Creates and destroys the facades for the instance policy
+        struct Factory
+        {
+            explicit Factory(PluginLoader& loader)
+                : loader_(loader)
+            {
+                // Empty
+            }
+
+            T* create()
+            {
+                TraceSpan span("init", loader_.name_);
+                T* res = loader_.template callFunction<T*>(PLUGIN_FACTORY_CREATE);
+                PLUGIN_USDT2("plugin", "create", loader_.name_.c_str(), static_cast<void*>(res));
+                if (res)
+                    loader_.onInstanceCreate(loader_.name_);
+                return res;
+            }
+
+            void destroy()
+            {
+                TraceSpan span("destroy", loader_.name_);
+                loader_.template callFunction<void>(PLUGIN_FACTORY_DESTROY);
+                PLUGIN_USDT2("plugin", "destroy", loader_.name_.c_str(), static_cast<void*>(NULL));
+                loader_.onInstanceDestroy(loader_.name_);
+            }
+
+            T* newInstance()
+            {
+                TraceSpan span("init", loader_.name_);
+                typedef T* (*NewFunction)();
+                NewFunction function = reinterpret_cast<NewFunction>(loader_.findSymbol(PLUGIN_FACTORY_NEW, &loader_.errorMsg_));
+                T* res = function ? function() : NULL;
+                PLUGIN_USDT2("plugin", "create", loader_.name_.c_str(), static_cast<void*>(res));
+                if (res)
+                    loader_.onInstanceCreate(loader_.name_);
+                return res;
+            }
+
+            void deleteInstance(T* plugin)
+            {
+                TraceSpan span("destroy", loader_.name_);
+                typedef void (*DeleteFunction)(T*);
+                DeleteFunction function = reinterpret_cast<DeleteFunction>(loader_.findSymbol(PLUGIN_FACTORY_DELETE, &loader_.errorMsg_));
+                assert(function);
+                function(plugin);
+                PLUGIN_USDT2("plugin", "destroy", loader_.name_.c_str(), static_cast<void*>(plugin));
+                loader_.onInstanceDestroy(loader_.name_);
+            }
+
+            PluginLoader& loader_;
+        };
+
+        // Find a function of the plugin. Errors are saved only if errorMsg is not NULL.
+        void* findSymbol(const char* name, std::string* errorMsg)
+        {
+            void* res = LoadPolicy::symbol(libHandle_, name, errorMsg);
+            PLUGIN_USDT3("plugin", "dlsym", name_.c_str(), name, res);
+            return res;
+        }
+
         // Call without any argument the function "function_name"
         // that is exported by the loaded plugin.
         template<class R>
         R callFunction(const char* function_name)
         {
             R (*func)();
-            func = reinterpret_cast<R (*)()>(getFunction(function_name));
+            func = reinterpret_cast<R (*)()>(findSymbol(function_name, &errorMsg_));
             assert(func);
             return (*func)();
         }
 
+        // Give the host services to the plugin, if it asks for them
+        void attachHostServices(const PluginHostServices* services)
+        {
+            if (!services)
+                return;
+            typedef void (*AttachFunction)(const PluginHostServices*);
+            AttachFunction attach = reinterpret_cast<AttachFunction>(findSymbol(PLUGIN_HOST_SERVICES_ATTACH, NULL));
+            if (attach)
+                attach(services);
+        }
+
 #ifdef _MSC_VER
 # pragma warning (pop)
 #endif
 
-#ifdef _WIN32
         bool loadLibrary()
         {
-            libHandle_ = LoadLibraryA(name_.c_str());
-            return libHandle_ != 0;
-        }
-
-        bool unloadLibrary()
-        {
-            return FreeLibrary(libHandle_) != 0;
-        }
-
-        generic_function_ptr getFunction(const char *function_name)
-        {
-            return GetProcAddress(libHandle_, function_name);
-        }
-#else
-        bool loadLibrary()
-        {
-            libHandle_ = dlopen(name_.c_str(), RTLD_LAZY);
+            PLUGIN_USDT1("plugin", "load_begin", name_.c_str());
+            libHandle_ = LoadPolicy::open(name_, errorMsg_);
+            PLUGIN_USDT2("plugin", "load_end", name_.c_str(), static_cast<int>(libHandle_ != 0));
             if (!libHandle_)
-                saveErrorMsg();
-            return libHandle_ != NULL;
-        }
-
-        bool unloadLibrary()
-        {
-            int res = dlclose(libHandle_);
-            if (res != 0)
-                saveErrorMsg();
-            return res == 0;
+                return false;
+            LibraryInfo library;
+            if (LoadPolicy::describe(libHandle_, library))
+                LoadHistory::instance().recordLoad(name_, library, static_cast<const void*>(libHandle_));
+            notifyModulesChanged();
+            return true;
         }
 
-        generic_function_ptr getFunction(const char* function_name)
+        bool unloadImpl()
         {
-            void* result = dlsym(libHandle_, function_name);
-            if (!result)
-                saveErrorMsg();
-            return result;
+            bool res = true;
+            if (isLoaded())
+            {
+                TraceSpan span("unload", name_);
+                destroyPluginInstanceImpl();
+                res = LoadPolicy::close(libHandle_, errorMsg_);
+                PLUGIN_USDT2("plugin", "unload", name_.c_str(), static_cast<int>(res));
+                if (res)
+                {
+                    LoadHistory::instance().recordUnload(static_cast<const void*>(libHandle_));
+                    libHandle_ = 0;
+                    this->onUnload(name_);
+                    notifyModulesChanged();
+                }
+            }
+            return res;
         }
 
-        void saveErrorMsg()
+        void destroyPluginInstanceImpl()
         {
-            // Save error message
-            char* str = dlerror();
-            if (str)
-                errorMsg_ = str;
-            // dlerror() must be called twice
-            // in order to avoid memory leaks
-            str = dlerror();
-            assert(!str);
+            if (!isLoaded())
+                return;
+            Factory factory(*this);
+            instances_.destroyAll(factory);
         }
-#endif
 
         // Name or path of the plugin
         std::string name_;
-        // Pointer to the plugin facade
-        T* plugin_;
+        // Facades of the plugin
+        Instances instances_;
         // OS specific library handle
         library_handle libHandle_;
         // Error message
         std::string errorMsg_;
+        // Services given to the plugin. NULL to use the default ones.
+        const PluginHostServices* hostServices_;
     };
 }
@@ -0,0 +1,819 @@
+//          Copyright Jeremy Coulon 2012-2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+/** @file */
+
+#pragma once
+
+//==============
+//==  Plugin  ==
+//==============
+#include "Plugin/LibraryInfo.h"
+#include "Plugin/PluginFactory.h"
+
+//=============
+//==  Boost  ==
+//=============
+#include <boost/noncopyable.hpp>
+#include <boost/preprocessor/cat.hpp>
+
+//===========
+//==  STD  ==
+//===========
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <stdint.h>
+
+//=======================
+//==  OS Specific SDK  ==
+//=======================
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <dlfcn.h>
+#endif
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/// Namespace of the Plugin library
+namespace Plugin
+{
+    //=========================
+    //==  Threading policies ==
+    //=========================
+
+    /// Threading policy of a loader used by one thread at a time (default)
+    struct SingleThreaded
+    {
+        /// Scope where the loader is locked. Does nothing.
+        class Lock
+        {
+        public:
+            /// Constructor
+            explicit Lock(SingleThreaded&)
+            {
+                // Empty
+            }
+        };
+    };
+
+    /// Threading policy of a loader shared by threads, with a mutex
+    struct MutexThreading
+    {
+        /// Scope where the loader is locked
+        class Lock : private boost::noncopyable
+        {
+        public:
+            /// Constructor
+            explicit Lock(MutexThreading& policy)
+                : lock_(policy.mutex_)
+            {
+                // Empty
+            }
+
+        private:
+            std::lock_guard<std::mutex> lock_;
+        };
+
+    private:
+        std::mutex mutex_;
+    };
+
+    /// Threading policy of a loader shared by threads, with a spin lock
+    /**
+      * Cheaper than MutexThreading when the loader is mostly used to get instances,
+      * but waiting threads spin while a plugin loads.
+      */
+    struct AtomicThreading
+    {
+        /// Scope where the loader is locked
+        class Lock : private boost::noncopyable
+        {
+        public:
+            /// Constructor
+            explicit Lock(AtomicThreading& policy)
+                : flag_(policy.flag_)
+            {
+                while (flag_.test_and_set(std::memory_order_acquire))
+                    std::this_thread::yield();
+            }
+
+            /// Destructor
+            ~Lock()
+            {
+                flag_.clear(std::memory_order_release);
+            }
+
+        private:
+            std::atomic_flag& flag_;
+        };
+
+        /// Constructor
+        AtomicThreading()
+        {
+            flag_.clear();
+        }
+
+    private:
+        std::atomic_flag flag_;
+    };
+
+    //=============================
+    //==  Load strategy policies ==
+    //=============================
+
+#ifdef _MSC_VER
+# pragma warning (push)
+// 'reinterpret_cast': unsafe conversion
+# pragma warning (disable: 4191)
+#endif
+
+    /// Load strategy opening libraries with dlopen(RTLD_LAZY), or LoadLibrary on Windows (default)
+    struct DlopenLoad
+    {
+#ifdef _WIN32
+        /// OS specific library handle
+        typedef HMODULE Handle;
+
+        /// Load a library. Returns a null handle on failure.
+        static Handle open(const std::string& name, std::string&)
+        {
+            return LoadLibraryA(name.c_str());
+        }
+
+        /// Unload a library
+        static bool close(Handle handle, std::string&)
+        {
+            return FreeLibrary(handle) != 0;
+        }
+
+        /// Find a function. Errors are saved only if errorMsg is not NULL.
+        static void* symbol(Handle handle, const char* name, std::string*)
+        {
+            return reinterpret_cast<void*>(GetProcAddress(handle, name));
+        }
+
+        /// Describe a loaded library, for LoadHistory. Not supported on Windows.
+        static bool describe(Handle, LibraryInfo&)
+        {
+            return false;
+        }
+#else
+        /// OS specific library handle
+        typedef void* Handle;
+
+        /// Load a library. Returns a null handle on failure.
+        static Handle open(const std::string& name, std::string& errorMsg)
+        {
+            Handle res = dlopen(name.c_str(), RTLD_LAZY);
+            if (!res)
+                saveError(&errorMsg);
+            return res;
+        }
+
+        /// Unload a library
+        static bool close(Handle handle, std::string& errorMsg)
+        {
+            if (dlclose(handle) == 0)
+                return true;
+            saveError(&errorMsg);
+            return false;
+        }
+
+        /// Find a function. Errors are saved only if errorMsg is not NULL.
+        static void* symbol(Handle handle, const char* name, std::string* errorMsg)
+        {
+            void* res = dlsym(handle, name);
+            if (!res)
+                saveError(errorMsg);
+            return res;
+        }
+
+        /// Describe a loaded library, for LoadHistory
+        static bool describe(Handle handle, LibraryInfo& info)
+        {
+            return queryLibraryInfo(handle, info);
+        }
+
+        /// Save the last dlerror() message, and clear it
+        static void saveError(std::string* errorMsg)
+        {
+            const char* str = dlerror();
+            if (str && errorMsg)
+                *errorMsg = str;
+        }
+#endif
+    };
+
+#ifdef _MSC_VER
+# pragma warning (pop)
+#endif
+
+#ifdef __linux__
+    /// Load strategy opening libraries in a new link-map namespace with dlmopen()
+    /**
+      * The plugin and its dependencies get their own copy of every global symbol,
+      * so that two plugins linked against incompatible versions of a same library can coexist.
+      * glibc only supports a few namespaces per process. This policy is only available on Linux.
+      */
+    struct DlmopenLoad : DlopenLoad
+    {
+        /// Load a library. Returns a null handle on failure.
+        static Handle open(const std::string& name, std::string& errorMsg)
+        {
+            Handle res = dlmopen(LM_ID_NEWLM, name.c_str(), RTLD_LAZY);
+            if (!res)
+                saveError(&errorMsg);
+            return res;
+        }
+    };
+
+    /// Load strategy opening a private in-memory copy of each library
+    /**
+      * The file is read in an anonymous memory file, which is then opened.
+      * The library file can be replaced while the plugin is loaded,
+      * and every loader gets its own copy of the plugin, even for a same filename.
+      * Libraries are searched in LD_LIBRARY_PATH when the name has no directory.
+      * This policy is only available on Linux.
+      */
+    struct MemfdLoad : DlopenLoad
+    {
+        /// Load a library. Returns a null handle on failure.
+        static Handle open(const std::string& name, std::string& errorMsg)
+        {
+            std::string path = findLibrary(name);
+            int file = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (file < 0)
+            {
+                errorMsg = "Cannot open plugin file: " + name;
+                return NULL;
+            }
+            int memory = memfd_create(name.c_str(), MFD_CLOEXEC);
+            if (memory < 0)
+            {
+                ::close(file);
+                errorMsg = "Cannot create memory file for plugin: " + name;
+                return NULL;
+            }
+            char buffer[65536];
+            ssize_t n = 0;
+            bool copied = true;
+            while ((n = ::read(file, buffer, sizeof(buffer))) > 0)
+            {
+                for (ssize_t written = 0; written < n; )
+                {
+                    ssize_t w = ::write(memory, buffer + written, n - written);
+                    if (w <= 0)
+                    {
+                        copied = false;
+                        break;
+                    }
+                    written += w;
+                }
+                if (!copied)
+                    break;
+            }
+            ::close(file);
+            if (n < 0 || !copied)
+            {
+                ::close(memory);
+                errorMsg = "Cannot copy plugin file: " + name;
+                return NULL;
+            }
+            // The descriptor stays open while the library is loaded: the dynamic loader
+            // recognizes libraries by path, and a reused descriptor number would give the same path.
+            Handle res = dlopen(("/proc/self/fd/" + std::to_string(memory)).c_str(), RTLD_LAZY);
+            if (!res)
+            {
+                saveError(&errorMsg);
+                ::close(memory);
+                return NULL;
+            }
+            std::lock_guard<std::mutex> lock(descriptors().mutex);
+            descriptors().byHandle.insert(std::make_pair(res, memory));
+            return res;
+        }
+
+        /// Unload a library
+        static bool close(Handle handle, std::string& errorMsg)
+        {
+            if (!DlopenLoad::close(handle, errorMsg))
+                return false;
+            std::lock_guard<std::mutex> lock(descriptors().mutex);
+            std::map<Handle, int>::iterator it = descriptors().byHandle.find(handle);
+            if (it != descriptors().byHandle.end())
+            {
+                ::close(it->second);
+                descriptors().byHandle.erase(it);
+            }
+            return true;
+        }
+
+    private:
+        struct Descriptors
+        {
+            std::mutex mutex;
+            std::map<Handle, int> byHandle;
+        };
+
+        // Memory file of each loaded library
+        static Descriptors& descriptors()
+        {
+            static Descriptors instance;
+            return instance;
+        }
+
+        static std::string findLibrary(const std::string& name)
+        {
+            if (name.find('/') != std::string::npos)
+                return name;
+            const char* paths = std::getenv("LD_LIBRARY_PATH");
+            std::string list = paths ? paths : "";
+            std::size_t begin = 0;
+            while (begin <= list.size())
+            {
+                std::size_t end = list.find(':', begin);
+                if (end == std::string::npos)
+                    end = list.size();
+                std::string candidate = (end > begin ? list.substr(begin, end - begin) : std::string(".")) + "/" + name;
+                struct stat info;
+                if (::stat(candidate.c_str(), &info) == 0 && S_ISREG(info.st_mode))
+                    return candidate;
+                begin = end + 1;
+            }
+            return name;
+        }
+    };
+#endif
+
+    namespace detail
+    {
+        // Exported functions of the statically linked plugins, by plugin name then function name
+        typedef std::map<std::string, std::map<std::string, void*> > StaticPluginMap;
+
+        inline StaticPluginMap& staticPlugins()
+        {
+            static StaticPluginMap plugins;
+            return plugins;
+        }
+
+        // Registers a function of a statically linked plugin during static initialization
+        struct StaticPluginRegistration
+        {
+            StaticPluginRegistration(const char* plugin, const char* function, void* address)
+            {
+                staticPlugins()[plugin][function] = address;
+            }
+        };
+    }
+
+    /// Load strategy finding plugins linked in the executable, see PLUGIN_STATIC_FACTORY_DEFINITION
+    /**
+      * Nothing is loaded: the name given to the loader is the name of the registration.
+      */
+    struct StaticRegistryLoad
+    {
+        /// Registration of the plugin
+        typedef void* Handle;
+
+        /// Find a registered plugin. Returns a null handle if none has this name.
+        static Handle open(const std::string& name, std::string& errorMsg)
+        {
+            detail::StaticPluginMap::iterator it = detail::staticPlugins().find(name);
+            if (it == detail::staticPlugins().end())
+            {
+                errorMsg = "No statically linked plugin named " + name;
+                return NULL;
+            }
+            return &it->second;
+        }
+
+        /// Nothing to unload
+        static bool close(Handle, std::string&)
+        {
+            return true;
+        }
+
+        /// Find a function. Errors are saved only if errorMsg is not NULL.
+        static void* symbol(Handle handle, const char* name, std::string* errorMsg)
+        {
+            std::map<std::string, void*>& functions = *static_cast<std::map<std::string, void*>*>(handle);
+            std::map<std::string, void*>::const_iterator it = functions.find(name);
+            if (it != functions.end())
+                return it->second;
+            if (errorMsg)
+                *errorMsg = std::string("Undefined function in statically linked plugin: ") + name;
+            return NULL;
+        }
+
+        /// Nothing was loaded to describe
+        static bool describe(Handle, LibraryInfo&)
+        {
+            return false;
+        }
+    };
+
+    //=========================
+    //==  Instance policies  ==
+    //=========================
+
+    /// Instance policy where every caller shares the facade singleton of the plugin (default)
+    struct SingletonInstance
+    {
+        /// Facades created by a loader
+        template<class T>
+        class Instances
+        {
+        public:
+            /// Constructor
+            Instances()
+                : plugin_(NULL)
+            {
+                // Empty
+            }
+
+            /// Get the facade, creating it if needed
+            template<class Factory>
+            T* acquire(Factory& factory)
+            {
+                if (!plugin_)
+                    plugin_ = factory.create();
+                return plugin_;
+            }
+
+            /// Give a facade back. Nothing to do.
+            template<class Factory>
+            void release(Factory&, T*)
+            {
+                // Empty
+            }
+
+            /// Destroy the facade
+            template<class Factory>
+            void destroyAll(Factory& factory)
+            {
+                if (plugin_)
+                {
+                    factory.destroy();
+                    plugin_ = NULL;
+                }
+            }
+
+            /// Exchange the facades of two loaders
+            void swap(Instances& other)
+            {
+                std::swap(plugin_, other.plugin_);
+            }
+
+        private:
+            T* plugin_;
+        };
+    };
+
+    /// Instance policy giving each thread its own facade
+    /**
+      * Suits plugins that are not thread-safe. Facades live until destroyPluginInstance()
+      * or unload(), even when their thread exits.
+      */
+    struct PerThreadInstance
+    {
+        /// Facades created by a loader
+        template<class T>
+        class Instances : private boost::noncopyable
+        {
+        public:
+            /// Get the facade of the calling thread, creating it if needed
+            template<class Factory>
+            T* acquire(Factory& factory)
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                T*& plugin = plugins_[std::this_thread::get_id()];
+                if (!plugin)
+                    plugin = factory.newInstance();
+                return plugin;
+            }
+
+            /// Give a facade back. Nothing to do.
+            template<class Factory>
+            void release(Factory&, T*)
+            {
+                // Empty
+            }
+
+            /// Destroy the facades of every thread
+            template<class Factory>
+            void destroyAll(Factory& factory)
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                for (typename std::map<std::thread::id, T*>::iterator it = plugins_.begin(); it != plugins_.end(); ++it)
+                    if (it->second)
+                        factory.deleteInstance(it->second);
+                plugins_.clear();
+            }
+
+            /// Exchange the facades of two loaders
+            void swap(Instances& other)
+            {
+                std::lock(mutex_, other.mutex_);
+                std::lock_guard<std::mutex> lock(mutex_, std::adopt_lock);
+                std::lock_guard<std::mutex> otherLock(other.mutex_, std::adopt_lock);
+                plugins_.swap(other.plugins_);
+            }
+
+        private:
+            std::mutex mutex_;
+            std::map<std::thread::id, T*> plugins_;
+        };
+    };
+
+    /// Instance policy lending facades from a pool
+    /**
+      * Each PluginLoader::getPluginInstance() takes a facade out of the pool,
+      * until PluginLoader::releaseInstance() gives it back.
+      * Facades are created on demand, so the pool grows to the number of facades used at once.
+      */
+    struct PooledInstance
+    {
+        /// Facades created by a loader
+        template<class T>
+        class Instances : private boost::noncopyable
+        {
+        public:
+            /// Take an idle facade, or create one
+            template<class Factory>
+            T* acquire(Factory& factory)
+            {
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    if (!idle_.empty())
+                    {
+                        T* res = idle_.back();
+                        idle_.pop_back();
+                        return res;
+                    }
+                }
+                T* res = factory.newInstance();
+                if (res)
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    all_.push_back(res);
+                }
+                return res;
+            }
+
+            /// Give a facade back to the pool
+            template<class Factory>
+            void release(Factory&, T* plugin)
+            {
+                if (!plugin)
+                    return;
+                std::lock_guard<std::mutex> lock(mutex_);
+                idle_.push_back(plugin);
+            }
+
+            /// Destroy every facade, lent or not
+            template<class Factory>
+            void destroyAll(Factory& factory)
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                for (std::size_t i = 0; i < all_.size(); ++i)
+                    factory.deleteInstance(all_[i]);
+                all_.clear();
+                idle_.clear();
+            }
+
+            /// Exchange the facades of two loaders
+            void swap(Instances& other)
+            {
+                std::lock(mutex_, other.mutex_);
+                std::lock_guard<std::mutex> lock(mutex_, std::adopt_lock);
+                std::lock_guard<std::mutex> otherLock(other.mutex_, std::adopt_lock);
+                all_.swap(other.all_);
+                idle_.swap(other.idle_);
+            }
+
+        private:
+            std::mutex mutex_;
+            // Every facade created
+            std::vector<T*> all_;
+            // Facades not lent
+            std::vector<T*> idle_;
+        };
+    };
+
+    //================================
+    //==  Instrumentation policies  ==
+    //================================
+
+    /// Instrumentation policy recording nothing (default)
+    struct NoInstrumentation
+    {
+        /// Measure of a load. Does nothing.
+        struct Timer
+        {
+            // Empty
+        };
+
+    protected:
+        void onLoad(const std::string&, const Timer&, bool)
+        {
+            // Empty
+        }
+
+        void onUnload(const std::string&)
+        {
+            // Empty
+        }
+
+        void onInstanceRequest(const std::string&)
+        {
+            // Empty
+        }
+
+        void onInstanceCreate(const std::string&)
+        {
+            // Empty
+        }
+
+        void onInstanceDestroy(const std::string&)
+        {
+            // Empty
+        }
+    };
+
+    /// Instrumentation policy counting loads, unloads, instance requests and live facades
+    /**
+      * The counters are available on the loader itself.
+      * Hooks receive the name given to the loader, so that policies can publish the counters elsewhere,
+      * as SharedMetricsInstrumentation from PluginMetrics.h does.
+      */
+    struct LoaderMetrics
+    {
+        /// Measure of a load
+        struct Timer
+        {
+            Timer()
+                : start(std::chrono::steady_clock::now())
+            {
+                // Empty
+            }
+
+            std::chrono::steady_clock::time_point start;
+        };
+
+        /// Constructor
+        LoaderMetrics()
+            : loads_(0),
+              failedLoads_(0),
+              unloads_(0),
+              instanceRequests_(0),
+              instances_(0),
+              lastLoadNs_(0),
+              totalLoadNs_(0)
+        {
+            // Empty
+        }
+
+        /// Get the number of successful loads
+        uint64_t getLoadCount() const
+        {
+            return loads_.load(std::memory_order_relaxed);
+        }
+
+        /// Get the number of failed loads
+        uint64_t getFailedLoadCount() const
+        {
+            return failedLoads_.load(std::memory_order_relaxed);
+        }
+
+        /// Get the number of unloads
+        uint64_t getUnloadCount() const
+        {
+            return unloads_.load(std::memory_order_relaxed);
+        }
+
+        /// Get the number of calls to getPluginInstance() on a loaded plugin
+        uint64_t getInstanceRequestCount() const
+        {
+            return instanceRequests_.load(std::memory_order_relaxed);
+        }
+
+        /// Get the number of facades currently created by the loader
+        uint64_t getInstanceCount() const
+        {
+            return instances_.load(std::memory_order_relaxed);
+        }
+
+        /// Get the duration of the last load, successful or not, in nanoseconds
+        uint64_t getLastLoadNs() const
+        {
+            return lastLoadNs_.load(std::memory_order_relaxed);
+        }
+
+        /// Get the total duration of the loads, in nanoseconds
+        uint64_t getTotalLoadNs() const
+        {
+            return totalLoadNs_.load(std::memory_order_relaxed);
+        }
+
+    protected:
+        void onLoad(const std::string&, const Timer& timer, bool success)
+        {
+            uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - timer.start).count();
+            (success ? loads_ : failedLoads_).fetch_add(1, std::memory_order_relaxed);
+            lastLoadNs_.store(ns, std::memory_order_relaxed);
+            totalLoadNs_.fetch_add(ns, std::memory_order_relaxed);
+        }
+
+        void onUnload(const std::string&)
+        {
+            unloads_.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        void onInstanceRequest(const std::string&)
+        {
+            instanceRequests_.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        void onInstanceCreate(const std::string&)
+        {
+            instances_.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        void onInstanceDestroy(const std::string&)
+        {
+            instances_.fetch_sub(1, std::memory_order_relaxed);
+        }
+
+    private:
+        std::atomic<uint64_t> loads_;
+        std::atomic<uint64_t> failedLoads_;
+        std::atomic<uint64_t> unloads_;
+        std::atomic<uint64_t> instanceRequests_;
+        std::atomic<uint64_t> instances_;
+        std::atomic<uint64_t> lastLoadNs_;
+        std::atomic<uint64_t> totalLoadNs_;
+    };
+}
+
+//==================================
+//==  Implementation details only  ==
+//==================================
+#define PLUGIN_STATIC_FACTORY_NAMESPACE BOOST_PP_CAT(pluginStaticFactory, __LINE__)
+
+/// Define a plugin linked in the executable, to be loaded with the StaticRegistryLoad strategy
+/**
+  * Must be used in a cpp file of the executable, in the global namespace.
+  * Several plugins may be defined, on different lines.
+  * @param T It is the concrete type of your plugin facade.
+  * @param name Name of the plugin, given to PluginLoader
+  */
+#define PLUGIN_STATIC_FACTORY_DEFINITION(T, name)                                                       \
+namespace                                                                                               \
+{                                                                                                       \
+namespace PLUGIN_STATIC_FACTORY_NAMESPACE                                                               \
+{                                                                                                       \
+    T* globalInstance = NULL;                                                                           \
+    T* createPluginFacade()                                                                             \
+    {                                                                                                   \
+        if (!globalInstance)                                                                            \
+            globalInstance = new T();                                                                   \
+        return globalInstance;                                                                          \
+    }                                                                                                   \
+    void destroyPluginFacade()                                                                          \
+    {                                                                                                   \
+        delete globalInstance;                                                                          \
+        globalInstance = NULL;                                                                          \
+    }                                                                                                   \
+    T* newPluginFacade()                                                                                \
+    {                                                                                                   \
+        return new T();                                                                                 \
+    }                                                                                                   \
+    void deletePluginFacade(T* instance)                                                                \
+    {                                                                                                   \
+        delete instance;                                                                                \
+    }                                                                                                   \
+    const ::Plugin::detail::StaticPluginRegistration registrations[] = {                                \
+        ::Plugin::detail::StaticPluginRegistration(name, PLUGIN_FACTORY_CREATE, reinterpret_cast<void*>(&createPluginFacade)),   \
+        ::Plugin::detail::StaticPluginRegistration(name, PLUGIN_FACTORY_DESTROY, reinterpret_cast<void*>(&destroyPluginFacade)), \
+        ::Plugin::detail::StaticPluginRegistration(name, PLUGIN_FACTORY_NEW, reinterpret_cast<void*>(&newPluginFacade)),         \
+        ::Plugin::detail::StaticPluginRegistration(name, PLUGIN_FACTORY_DELETE, reinterpret_cast<void*>(&deletePluginFacade))    \
+    };                                                                                                  \
+}                                                                                                       \
+}
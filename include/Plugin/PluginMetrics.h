@@ -0,0 +1,697 @@
+//          Copyright Jeremy Coulon 2012-2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+/** @file */
+
+#pragma once
+
+//==============
+//==  Plugin  ==
+//==============
+#include "Plugin/AllocationTracking.h"
+#include "Plugin/SharedMemory.h"
+
+//=============
+//==  Boost  ==
+//=============
+#include <boost/noncopyable.hpp>
+
+//===========
+//==  STD  ==
+//===========
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <exception>
+#include <mutex>
+#include <new>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+//=======================
+//==  OS Specific SDK  ==
+//=======================
+#include <signal.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/// Namespace of the Plugin library
+namespace Plugin
+{
+    /// Copy of the counters of a plugin
+    struct PluginMetricsSample
+    {
+        /// Name given to the loader
+        std::string name;
+        /// Successful loads
+        uint64_t loads;
+        /// Failed loads
+        uint64_t failedLoads;
+        /// Unloads
+        uint64_t unloads;
+        /// Duration of the last load in nanoseconds
+        uint64_t lastLoadNs;
+        /// Total duration of the loads in nanoseconds
+        uint64_t totalLoadNs;
+        /// Facades currently created
+        uint64_t instances;
+        /// Completed calls, including failed ones
+        uint64_t calls;
+        /// Calls that threw
+        uint64_t errors;
+        /// Bytes currently allocated by the plugin, see MetricsSegment::publishAllocations()
+        uint64_t memoryBytes;
+    };
+
+    /// Counters of a plugin in a MetricsSegment
+    /**
+      * Lives in shared memory: its layout is part of the segment format.
+      * Call counters have a cache line of their own, so that calls do not invalidate
+      * the line a reader polls for the other counters.
+      */
+    class PluginMetrics : private boost::noncopyable
+    {
+    public:
+        /// Longest name stored. Longer names keep their end, as paths differ by their filename.
+        static const std::size_t maxNameSize = 59;
+
+        /// Constructor
+        PluginMetrics()
+            : state_(0),
+              calls_(0),
+              errors_(0),
+              loads_(0),
+              failedLoads_(0),
+              unloads_(0),
+              lastLoadNs_(0),
+              totalLoadNs_(0),
+              instances_(0),
+              memoryBytes_(0)
+        {
+            std::memset(name_, 0, sizeof(name_));
+        }
+
+        /// Record a load attempt
+        void recordLoad(uint64_t ns, bool success)
+        {
+            (success ? loads_ : failedLoads_).fetch_add(1, std::memory_order_relaxed);
+            lastLoadNs_.store(ns, std::memory_order_relaxed);
+            totalLoadNs_.fetch_add(ns, std::memory_order_relaxed);
+        }
+
+        /// Record an unload
+        void recordUnload()
+        {
+            unloads_.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        /// Record the creation of a facade
+        void addInstance()
+        {
+            instances_.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        /// Record the destruction of a facade
+        void removeInstance()
+        {
+            instances_.fetch_sub(1, std::memory_order_relaxed);
+        }
+
+        /// Record a completed call
+        /**
+          * @param failed True if the call threw
+          */
+        void recordCall(bool failed)
+        {
+            calls_.fetch_add(1, std::memory_order_relaxed);
+            if (failed)
+                errors_.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        /// Set the bytes currently allocated by the plugin
+        void setMemoryBytes(uint64_t bytes)
+        {
+            memoryBytes_.store(bytes, std::memory_order_relaxed);
+        }
+
+        /// Check whether a plugin owns this slot
+        bool isClaimed() const
+        {
+            return state_.load(std::memory_order_acquire) == stateUsed;
+        }
+
+        /// Get the name of the plugin
+        std::string getName() const
+        {
+            return std::string(name_);
+        }
+
+        /// Copy the counters
+        PluginMetricsSample read() const
+        {
+            PluginMetricsSample res;
+            res.name = getName();
+            res.loads = loads_.load(std::memory_order_relaxed);
+            res.failedLoads = failedLoads_.load(std::memory_order_relaxed);
+            res.unloads = unloads_.load(std::memory_order_relaxed);
+            res.lastLoadNs = lastLoadNs_.load(std::memory_order_relaxed);
+            res.totalLoadNs = totalLoadNs_.load(std::memory_order_relaxed);
+            res.instances = instances_.load(std::memory_order_relaxed);
+            res.calls = calls_.load(std::memory_order_relaxed);
+            res.errors = errors_.load(std::memory_order_relaxed);
+            res.memoryBytes = memoryBytes_.load(std::memory_order_relaxed);
+            return res;
+        }
+
+    private:
+        friend class MetricsSegment;
+
+        enum State
+        {
+            stateFree = 0,
+            stateUsed = 1
+        };
+
+        // Written once, before state_ is set
+        std::atomic<uint32_t> state_;
+        char name_[maxNameSize + 1];
+        // Written by every call
+        alignas(64) std::atomic<uint64_t> calls_;
+        std::atomic<uint64_t> errors_;
+        // Written rarely
+        alignas(64) std::atomic<uint64_t> loads_;
+        std::atomic<uint64_t> failedLoads_;
+        std::atomic<uint64_t> unloads_;
+        std::atomic<uint64_t> lastLoadNs_;
+        std::atomic<uint64_t> totalLoadNs_;
+        std::atomic<uint64_t> instances_;
+        std::atomic<uint64_t> memoryBytes_;
+    };
+
+    static_assert(sizeof(PluginMetrics) == 192, "PluginMetrics layout is part of the segment format");
+    static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "Counters in shared memory must be lock free");
+
+    namespace detail
+    {
+        // Beginning of a metrics segment, followed by the slots
+        struct alignas(64) MetricsSegmentHeader
+        {
+            char magic[8];
+            uint32_t version;
+            uint32_t slotSize;
+            uint32_t slotCount;
+            uint32_t reserved;
+            uint64_t pid;
+            // System clock, nanoseconds since the epoch
+            uint64_t startTimeNs;
+        };
+
+        static const char metricsMagic[8] = { 'P', 'L', 'G', 'M', 'E', 'T', 'R', 'C' };
+        static const uint32_t metricsVersion = 1;
+
+        inline PluginMetrics* metricsSlots(void* data)
+        {
+            return reinterpret_cast<PluginMetrics*>(static_cast<char*>(data) + sizeof(MetricsSegmentHeader));
+        }
+
+        // Slot count of a mapped segment, checked against the size of the mapping. 0 if it is not a valid segment.
+        inline std::size_t validSlotCount(const SharedMemoryRegion& region)
+        {
+            if (region.size() < sizeof(MetricsSegmentHeader))
+                return 0;
+            const MetricsSegmentHeader* header = static_cast<const MetricsSegmentHeader*>(region.data());
+            if (std::memcmp(header->magic, metricsMagic, sizeof(header->magic)) != 0
+                || header->version != metricsVersion
+                || header->slotSize != sizeof(PluginMetrics))
+                return 0;
+            // Divide rather than multiply, so that a huge count cannot overflow
+            if (header->slotCount > (region.size() - sizeof(MetricsSegmentHeader)) / sizeof(PluginMetrics))
+                return 0;
+            return header->slotCount;
+        }
+
+        inline void readMetrics(void* data, std::size_t slotCount, std::vector<PluginMetricsSample>& samples)
+        {
+            samples.clear();
+            const PluginMetrics* slots = metricsSlots(data);
+            for (std::size_t i = 0; i < slotCount; ++i)
+                if (slots[i].isClaimed())
+                    samples.push_back(slots[i].read());
+        }
+
+        // Check whether a segment was left by a process that died without closing it.
+        // The rest of the header is not checked: the process may have died before writing it.
+        // A null pid means the creator died before writing it, as each process uses its own names.
+        inline bool isStaleMetricsSegment(const std::string& name)
+        {
+            SharedMemoryRegion region;
+            if (!region.open(name, true) || region.size() < offsetof(MetricsSegmentHeader, pid) + sizeof(uint64_t))
+                return false;
+            pid_t pid = static_cast<pid_t>(static_cast<const MetricsSegmentHeader*>(region.data())->pid);
+            return pid == 0 || (kill(pid, 0) != 0 && errno == ESRCH);
+        }
+    }
+
+    /// Named shared memory segment publishing the counters of every plugin of the process
+    /**
+      * Other processes read it with MetricsView, without any cooperation from this process.
+      * The plugin-top tool shows it live:
+      * @code
+      * Plugin::MetricsSegment::instance().create();  // named /plugin-metrics-PID
+      * Plugin::PluginLoader<IMyInterface, Plugin::MutexThreading, Plugin::DlopenLoad,
+      *                      Plugin::SingletonInstance, Plugin::SharedMetricsInstrumentation> loader("libMyPlugin.so");
+      * Plugin::PluginInterceptor<IMyInterface, Plugin::MetricsInterception> proxy(loader.getPluginInstance());
+      * proxy.setMetrics(Plugin::MetricsSegment::instance().getPlugin("libMyPlugin.so"));
+      * @endcode
+      * Each plugin has a fixed slot, claimed on first use and kept until the segment is closed.
+      * A segment left with the same name by a process that died without closing it is replaced.
+      * This class is only available on POSIX platforms.
+      */
+    class MetricsSegment : private boost::noncopyable
+    {
+    public:
+        /// Get the segment of the process, used by SharedMetricsInstrumentation
+        /**
+          * It is only published once create() is called on it.
+          */
+        static MetricsSegment& instance()
+        {
+            static MetricsSegment segment;
+            return segment;
+        }
+
+        /// Get the default name of the segment of a process
+        static std::string defaultName(uint64_t pid)
+        {
+            std::ostringstream oss;
+            oss << "/plugin-metrics-" << pid;
+            return oss.str();
+        }
+
+        /// Constructor
+        MetricsSegment()
+            : slots_(NULL),
+              slotCount_(0)
+        {
+            // Empty
+        }
+
+        /// Create the segment
+        /**
+          * @param name Name of the segment, defaultName() of this process if empty
+          * @param slotCount Maximum number of plugins
+          * @return True on success. False otherwise.
+          */
+        bool create(const std::string& name = "", std::size_t slotCount = 64)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            slots_ = NULL;
+            slotCount_ = 0;
+            if (slotCount == 0 || slotCount > UINT32_MAX)
+            {
+                errorMsg_ = "Invalid slot count";
+                return false;
+            }
+            std::string segmentName = name.empty() ? defaultName(getpid()) : name;
+            std::size_t size = sizeof(detail::MetricsSegmentHeader) + slotCount * sizeof(PluginMetrics);
+            if (!region_.create(segmentName, size, true))
+            {
+                // Pids are reused: only a segment whose creator is gone can be replaced
+                if (errno != EEXIST || !detail::isStaleMetricsSegment(segmentName)
+                    || shm_unlink(segmentName.c_str()) != 0 || !region_.create(segmentName, size, true))
+                {
+                    errorMsg_ = region_.getErrorMsg();
+                    return false;
+                }
+            }
+            detail::MetricsSegmentHeader* header = static_cast<detail::MetricsSegmentHeader*>(region_.data());
+            // First, so that the segment can be replaced if this process dies now
+            header->pid = getpid();
+            std::memcpy(header->magic, detail::metricsMagic, sizeof(header->magic));
+            header->version = detail::metricsVersion;
+            header->slotSize = sizeof(PluginMetrics);
+            header->slotCount = static_cast<uint32_t>(slotCount);
+            header->startTimeNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
+            PluginMetrics* slots = detail::metricsSlots(region_.data());
+            for (std::size_t i = 0; i < slotCount; ++i)
+                new (&slots[i]) PluginMetrics;
+            slots_ = slots;
+            slotCount_ = slotCount;
+            return true;
+        }
+
+        /// Unpublish the segment
+        /**
+          * Counters given by getPlugin() must not be used afterwards.
+          */
+        void close()
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            slots_ = NULL;
+            slotCount_ = 0;
+            region_.close();
+        }
+
+        /// Check if the segment is published
+        bool isOpen() const
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return slots_ != NULL;
+        }
+
+        /// Get the name of the segment
+        std::string getName() const
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return region_.getName();
+        }
+
+        /// Get the counters of a plugin, claiming a slot on first use
+        /**
+          * @param name Name of the plugin, typically the name given to its loader
+          * @return NULL if the segment is not published, or full
+          */
+        PluginMetrics* getPlugin(const std::string& name)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            std::string stored = name.size() > PluginMetrics::maxNameSize ? name.substr(name.size() - PluginMetrics::maxNameSize) : name;
+            for (std::size_t i = 0; i < slotCount_; ++i)
+            {
+                PluginMetrics& slot = slots_[i];
+                if (slot.state_.load(std::memory_order_relaxed) == PluginMetrics::stateFree)
+                {
+                    std::memcpy(slot.name_, stored.c_str(), stored.size() + 1);
+                    slot.state_.store(PluginMetrics::stateUsed, std::memory_order_release);
+                    return &slot;
+                }
+                if (stored == slot.name_)
+                    return &slot;
+            }
+            return NULL;
+        }
+
+        /// Copy the counters of every plugin
+        void getSamples(std::vector<PluginMetricsSample>& samples) const
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            samples.clear();
+            if (slots_)
+                detail::readMetrics(region_.data(), slotCount_, samples);
+        }
+
+        /// Publish the live bytes of the allocation accounts
+        /**
+          * Accounts are matched to plugins by name: AccountedPluginLoader names them after the loader by default.
+          * Only accounts of plugins already in the segment are published. Call it periodically.
+          */
+        void publishAllocations()
+        {
+            std::vector<AllocationAccount*> accounts = allocationAccounts();
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (std::size_t a = 0; a < accounts.size(); ++a)
+            {
+                std::string name = accounts[a]->getName();
+                for (std::size_t i = 0; i < slotCount_; ++i)
+                    if (slots_[i].isClaimed() && slots_[i].getName() == name)
+                        slots_[i].setMemoryBytes(accounts[a]->getStats().liveBytes);
+            }
+        }
+
+        /// Get error message of the last failed create()
+        std::string getErrorMsg() const
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return errorMsg_;
+        }
+
+    private:
+        mutable std::mutex mutex_;
+        SharedMemoryRegion region_;
+        std::string errorMsg_;
+        // NULL while not published
+        PluginMetrics* slots_;
+        std::size_t slotCount_;
+    };
+
+    /// Read-only view of the MetricsSegment of another process
+    class MetricsView : private boost::noncopyable
+    {
+    public:
+        /// Constructor
+        MetricsView()
+            : slotCount_(0)
+        {
+            // Empty
+        }
+
+        /// Open a segment
+        /**
+          * @param name Name of the segment, see MetricsSegment::defaultName()
+          * @return False if the segment does not exist or has another format
+          */
+        bool open(const std::string& name)
+        {
+            slotCount_ = 0;
+            if (!region_.open(name, true))
+            {
+                errorMsg_ = region_.getErrorMsg();
+                return false;
+            }
+            // Kept, as the publishing process can still write the header
+            slotCount_ = detail::validSlotCount(region_);
+            if (slotCount_ == 0)
+            {
+                errorMsg_ = "Not a plugin metrics segment of this version: " + name;
+                region_.close();
+                return false;
+            }
+            return true;
+        }
+
+        /// Check if a segment is open
+        bool isOpen() const
+        {
+            return region_.isOpen();
+        }
+
+        /// Get the process publishing the segment
+        uint64_t getPid() const
+        {
+            return getHeader()->pid;
+        }
+
+        /// Get the creation time of the segment, in nanoseconds since the epoch
+        uint64_t getStartTimeNs() const
+        {
+            return getHeader()->startTimeNs;
+        }
+
+        /// Copy the counters of every plugin
+        void getSamples(std::vector<PluginMetricsSample>& samples) const
+        {
+            samples.clear();
+            if (region_.isOpen())
+                detail::readMetrics(region_.data(), slotCount_, samples);
+        }
+
+        /// Get error message
+        const std::string& getErrorMsg() const
+        {
+            return errorMsg_;
+        }
+
+    private:
+        const detail::MetricsSegmentHeader* getHeader() const
+        {
+            return static_cast<const detail::MetricsSegmentHeader*>(region_.data());
+        }
+
+        SharedMemoryRegion region_;
+        // Slot count validated by open()
+        std::size_t slotCount_;
+        std::string errorMsg_;
+    };
+
+    /// Instrumentation policy of PluginLoader publishing its counters in MetricsSegment::instance()
+    /**
+      * Loaders of a same plugin name share a slot. Nothing is published while the segment is closed.
+      */
+    struct SharedMetricsInstrumentation
+    {
+        /// Measure of a load
+        struct Timer
+        {
+            Timer()
+                : start(std::chrono::steady_clock::now())
+            {
+                // Empty
+            }
+
+            std::chrono::steady_clock::time_point start;
+        };
+
+    protected:
+        void onLoad(const std::string& name, const Timer& timer, bool success)
+        {
+            if (PluginMetrics* metrics = MetricsSegment::instance().getPlugin(name))
+                metrics->recordLoad(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - timer.start).count(), success);
+        }
+
+        void onUnload(const std::string& name)
+        {
+            if (PluginMetrics* metrics = MetricsSegment::instance().getPlugin(name))
+                metrics->recordUnload();
+        }
+
+        void onInstanceRequest(const std::string&)
+        {
+            // Empty
+        }
+
+        void onInstanceCreate(const std::string& name)
+        {
+            if (PluginMetrics* metrics = MetricsSegment::instance().getPlugin(name))
+                metrics->addInstance();
+        }
+
+        void onInstanceDestroy(const std::string& name)
+        {
+            if (PluginMetrics* metrics = MetricsSegment::instance().getPlugin(name))
+                metrics->removeInstance();
+        }
+    };
+
+    /// Interception policy of PluginInterceptor counting calls and calls that threw in a PluginMetrics
+    /**
+      * Nothing is counted until setMetrics() is called on the interceptor.
+      */
+    struct MetricsInterception
+    {
+        /// Recorder of the calls
+        template<class T>
+        class Recorder
+        {
+        public:
+            /// Call in progress
+            class Scope
+            {
+            public:
+                /// Constructor
+                template<class Pmf>
+                Scope(Recorder& recorder, Pmf)
+                    : metrics_(recorder.metrics_)
+#if __cplusplus >= 201703L
+                    , exceptions_(std::uncaught_exceptions())
+#endif
+                {
+                    // Empty
+                }
+
+                /// Destructor. Count the call, and whether it threw.
+                ~Scope()
+                {
+                    if (!metrics_)
+                        return;
+#if __cplusplus >= 201703L
+                    metrics_->recordCall(std::uncaught_exceptions() > exceptions_);
+#else
+                    metrics_->recordCall(std::uncaught_exception());
+#endif
+                }
+
+            private:
+                PluginMetrics* metrics_;
+#if __cplusplus >= 201703L
+                int exceptions_;
+#endif
+            };
+
+            /// Constructor
+            Recorder()
+                : metrics_(NULL)
+            {
+                // Empty
+            }
+
+            /// Set the counters of the plugin, typically from MetricsSegment::getPlugin()
+            void setMetrics(PluginMetrics* metrics)
+            {
+                metrics_ = metrics;
+            }
+
+            /// Get the counters of the plugin
+            PluginMetrics* getMetrics() const
+            {
+                return metrics_;
+            }
+
+        private:
+            PluginMetrics* metrics_;
+        };
+    };
+
+    namespace detail
+    {
+        // Escape a label value of the OpenMetrics text format
+        inline std::string escapeLabel(const std::string& value)
+        {
+            std::string res;
+            for (std::size_t i = 0; i < value.size(); ++i)
+            {
+                if (value[i] == '\\' || value[i] == '"')
+                    res += '\\';
+                if (value[i] == '\n')
+                    res += "\\n";
+                else
+                    res += value[i];
+            }
+            return res;
+        }
+
+        inline void writeMetricFamily(std::ostream& os, const std::vector<PluginMetricsSample>& samples,
+                                      const char* name, const char* type, const char* unit, const char* help,
+                                      uint64_t PluginMetricsSample::* field, double scale = 1.0)
+        {
+            bool counter = std::strcmp(type, "counter") == 0;
+            os << "# TYPE " << name << " " << type << "\n";
+            if (unit)
+                os << "# UNIT " << name << " " << unit << "\n";
+            os << "# HELP " << name << " " << help << "\n";
+            for (std::size_t i = 0; i < samples.size(); ++i)
+            {
+                os << name << (counter ? "_total" : "") << "{plugin=\"" << escapeLabel(samples[i].name) << "\"} ";
+                if (scale == 1.0)
+                    os << samples[i].*field;
+                else
+                    os << static_cast<double>(samples[i].*field) * scale;
+                os << "\n";
+            }
+        }
+    }
+
+    /// Write counters in the OpenMetrics text format, for Prometheus and compatible collectors
+    /**
+      * One metric family per counter, with a "plugin" label. The exposition ends with "# EOF".
+      */
+    inline void writeOpenMetrics(std::ostream& os, const std::vector<PluginMetricsSample>& samples)
+    {
+        detail::writeMetricFamily(os, samples, "plugin_loads", "counter", NULL, "Successful loads of the plugin library.", &PluginMetricsSample::loads);
+        detail::writeMetricFamily(os, samples, "plugin_load_failures", "counter", NULL, "Failed loads of the plugin library.", &PluginMetricsSample::failedLoads);
+        detail::writeMetricFamily(os, samples, "plugin_unloads", "counter", NULL, "Unloads of the plugin library.", &PluginMetricsSample::unloads);
+        detail::writeMetricFamily(os, samples, "plugin_last_load_seconds", "gauge", "seconds", "Duration of the last load.", &PluginMetricsSample::lastLoadNs, 1e-9);
+        detail::writeMetricFamily(os, samples, "plugin_instances", "gauge", NULL, "Plugin facades currently created.", &PluginMetricsSample::instances);
+        detail::writeMetricFamily(os, samples, "plugin_calls", "counter", NULL, "Completed calls to the plugin.", &PluginMetricsSample::calls);
+        detail::writeMetricFamily(os, samples, "plugin_call_errors", "counter", NULL, "Calls to the plugin that threw.", &PluginMetricsSample::errors);
+        detail::writeMetricFamily(os, samples, "plugin_memory_bytes", "gauge", "bytes", "Bytes currently allocated by the plugin.", &PluginMetricsSample::memoryBytes);
+        os << "# EOF\n";
+    }
+}
@@ -0,0 +1,475 @@
+//          Copyright Jeremy Coulon 2012-2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+/** @file */
+
+#pragma once
+
+//==============
+//==  Plugin  ==
+//==============
+#include "Plugin/PluginLoader.h"
+#include "Plugin/Serialization.h"
+
+//=============
+//==  Boost  ==
+//=============
+#include <boost/noncopyable.hpp>
+
+//===========
+//==  STD  ==
+//===========
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+//=======================
+//==  OS Specific SDK  ==
+//=======================
+#include <poll.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/// Namespace of the Plugin library
+namespace Plugin
+{
+    /// Outcome of a plugin probe
+    enum ProbeStatus
+    {
+        probePassed = 0,    ///< The plugin was loaded, instantiated and unloaded
+        probeFailed = 1,    ///< The plugin could not be loaded or instantiated
+        probeCrashed = 2,   ///< The probing process terminated abnormally
+        probeTimedOut = 3   ///< The probing process did not finish in time
+    };
+
+    /// Result of a plugin probe
+    struct ProbeResult
+    {
+        ProbeResult()
+            : status(probeFailed)
+        {
+            // Empty
+        }
+
+        /// Tell whether the plugin can be loaded in the host
+        bool passed() const
+        {
+            return status == probePassed;
+        }
+
+        /// Outcome of the probe
+        ProbeStatus status;
+        /// Explanation of the failure. Empty if the probe passed.
+        std::string errorMsg;
+        /// Metadata extracted from the plugin facade, see PluginProbe::setMetadataExtractor()
+        std::string metadata;
+    };
+
+    namespace detail
+    {
+        // Path of the file dlopen() would load, as far as it can be guessed. Empty if unknown.
+        inline std::string resolveLibraryPath(const std::string& name)
+        {
+            if (name.find('/') != std::string::npos)
+                return name;
+            const char* paths = std::getenv("LD_LIBRARY_PATH");
+            std::istringstream iss(paths ? paths : "");
+            std::string dir;
+            while (std::getline(iss, dir, ':'))
+            {
+                std::string candidate = (dir.empty() ? std::string(".") : dir) + "/" + name;
+                if (access(candidate.c_str(), R_OK) == 0)
+                    return candidate;
+            }
+            return std::string();
+        }
+
+        // FNV-1a hash and size of a file content, as an hexadecimal string
+        inline bool hashFileContent(const std::string& path, std::string& hash)
+        {
+            std::ifstream file(path.c_str(), std::ios::binary);
+            if (!file)
+                return false;
+            uint64_t value = 14695981039346656037ULL;
+            uint64_t size = 0;
+            char buffer[65536];
+            while (file.read(buffer, sizeof(buffer)) || file.gcount() > 0)
+            {
+                std::streamsize count = file.gcount();
+                for (std::streamsize i = 0; i < count; ++i)
+                {
+                    value ^= static_cast<unsigned char>(buffer[i]);
+                    value *= 1099511628211ULL;
+                }
+                size += static_cast<uint64_t>(count);
+            }
+            char text[40];
+            std::snprintf(text, sizeof(text), "%016llx-%llx",
+                          static_cast<unsigned long long>(value), static_cast<unsigned long long>(size));
+            hash = text;
+            return true;
+        }
+
+        // Cache file fields are separated by tabs, one entry per line
+        inline std::string escapeProbeField(const std::string& value)
+        {
+            std::string res;
+            for (std::size_t i = 0; i < value.size(); ++i)
+            {
+                switch (value[i])
+                {
+                case '\\': res += "\\\\"; break;
+                case '\t': res += "\\t"; break;
+                case '\n': res += "\\n"; break;
+                default: res += value[i]; break;
+                }
+            }
+            return res;
+        }
+
+        inline std::string unescapeProbeField(const std::string& value)
+        {
+            std::string res;
+            for (std::size_t i = 0; i < value.size(); ++i)
+            {
+                if (value[i] != '\\' || i + 1 == value.size())
+                {
+                    res += value[i];
+                    continue;
+                }
+                char c = value[++i];
+                res += c == 't' ? '\t' : c == 'n' ? '\n' : c;
+            }
+            return res;
+        }
+    }
+
+    /// Validate plugins in a child process before loading them in the host
+    /**
+      * A forked child loads the plugin, instantiates its facade, extracts metadata
+      * and unloads it, under a timeout. A plugin crashing or hanging in its static
+      * constructors or destructors only takes the child down.
+      * Results are cached by content hash, in memory and optionally in a file,
+      * so that each build of a plugin is probed once.
+      *
+      * Probing forks the calling process: prefer probing before starting threads,
+      * as locks held by other threads at fork time stay locked in the child.
+      * Every method is thread-safe.
+      * @tparam T Interface type of the concrete plugin
+      */
+    template<class T>
+    class PluginProbe : private boost::noncopyable
+    {
+    public:
+        /// Extract metadata from a plugin facade, run in the probing process
+        typedef std::function<std::string (T*)> MetadataExtractor;
+
+        /// Constructor
+        /**
+          * @param timeout Maximum duration of a probe
+          */
+        explicit PluginProbe(std::chrono::milliseconds timeout = std::chrono::milliseconds(5000))
+            : timeout_(timeout),
+              cacheLoaded_(false)
+        {
+            // Empty
+        }
+
+        /// Set the function extracting metadata from the plugin facade
+        void setMetadataExtractor(const MetadataExtractor& extractor)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            extractor_ = extractor;
+        }
+
+        /// Persist results in a file, shared between runs
+        /**
+          * Entries already in the file are reused. New results are appended.
+          * @param path Path of the cache file
+          */
+        void setCacheFile(const std::string& path)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            cacheFile_ = path;
+            cacheLoaded_ = false;
+        }
+
+        /// Probe a plugin
+        /**
+          * Plugins whose file cannot be located, e.g. found through the system
+          * search path rather than a path or LD_LIBRARY_PATH, are probed every time.
+          * @param name Filename of the concrete plugin, as given to PluginLoader
+          * @return Result of the probe, possibly from the cache
+          */
+        ProbeResult probe(const std::string& name)
+        {
+            std::string hash;
+            std::string path = detail::resolveLibraryPath(name);
+            bool cacheable = !path.empty() && detail::hashFileContent(path, hash);
+
+            MetadataExtractor extractor;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                loadCache();
+                if (cacheable)
+                {
+                    typename std::map<std::string, ProbeResult>::const_iterator it = cache_.find(hash);
+                    if (it != cache_.end())
+                        return it->second;
+                }
+                extractor = extractor_;
+            }
+
+            ProbeResult res = run(name, extractor);
+            // Timeouts may come from a loaded machine: do not remember them
+            if (cacheable && res.status != probeTimedOut)
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                cache_[hash] = res;
+                appendCache(hash, res);
+            }
+            return res;
+        }
+
+        /// Load a plugin only if its probe passed
+        /**
+          * @param loader Loader of the plugin
+          * @param result Receives the result of the probe
+          * @return True if the probe passed and the plugin was loaded. False otherwise.
+          */
+        bool load(PluginLoader<T>& loader, ProbeResult& result)
+        {
+            result = probe(loader.getPluginName());
+            return result.passed() && loader.load();
+        }
+
+        /// Forget every cached result, in memory only
+        void clearCache()
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            cache_.clear();
+        }
+
+    private:
+        // Probe a plugin in a child process
+        ProbeResult run(const std::string& name, const MetadataExtractor& extractor)
+        {
+            ProbeResult res;
+            int fds[2];
+            if (pipe(fds) != 0)
+            {
+                res.errorMsg = std::string("pipe() failed: ") + std::strerror(errno);
+                return res;
+            }
+            std::fflush(NULL);
+            pid_t pid = fork();
+            if (pid < 0)
+            {
+                res.errorMsg = std::string("fork() failed: ") + std::strerror(errno);
+                close(fds[0]);
+                close(fds[1]);
+                return res;
+            }
+            if (pid == 0)
+            {
+                close(fds[0]);
+                child(fds[1], name, extractor);
+            }
+            close(fds[1]);
+
+            // Read the report until the child closes the pipe
+            std::vector<char> report;
+            std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + timeout_;
+            bool timedOut = false;
+            while (true)
+            {
+                long long remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    deadline - std::chrono::steady_clock::now()).count();
+                if (remaining <= 0)
+                {
+                    timedOut = true;
+                    break;
+                }
+                struct pollfd pfd;
+                pfd.fd = fds[0];
+                pfd.events = POLLIN;
+                pfd.revents = 0;
+                int ready = poll(&pfd, 1, static_cast<int>(remaining));
+                if (ready < 0 && errno == EINTR)
+                    continue;
+                if (ready == 0)
+                    continue;
+                char buffer[4096];
+                ssize_t count = read(fds[0], buffer, sizeof(buffer));
+                if (count < 0 && errno == EINTR)
+                    continue;
+                if (count <= 0)
+                    break;
+                report.insert(report.end(), buffer, buffer + count);
+            }
+            close(fds[0]);
+
+            if (timedOut)
+                kill(pid, SIGKILL);
+            int status = 0;
+            while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+                continue;
+
+            if (timedOut)
+            {
+                res.status = probeTimedOut;
+                res.errorMsg = "Probe timed out";
+            }
+            else if (!WIFEXITED(status))
+            {
+                std::ostringstream oss;
+                oss << "Probe crashed";
+                if (WIFSIGNALED(status))
+                    oss << " with signal " << WTERMSIG(status) << " (" << strsignal(WTERMSIG(status)) << ")";
+                res.status = probeCrashed;
+                res.errorMsg = oss.str();
+            }
+            else
+            {
+                try
+                {
+                    MessageReader reader(report.data(), report.size());
+                    res.status = static_cast<ProbeStatus>(deserialize<uint8_t>(reader));
+                    res.errorMsg = deserialize<std::string>(reader);
+                    res.metadata = deserialize<std::string>(reader);
+                }
+                catch (const SerializationError&)
+                {
+                    res.status = probeCrashed;
+                    res.errorMsg = "Probe exited without reporting";
+                }
+            }
+            return res;
+        }
+
+        // Body of the probing process. Never returns.
+        static void child(int fd, const std::string& name, const MetadataExtractor& extractor)
+        {
+            // Crash handlers of the host must not run, nor recover, in the probing process
+            const int crashSignals[] = { SIGABRT, SIGBUS, SIGFPE, SIGILL, SIGSEGV, SIGSYS, SIGTRAP };
+            for (std::size_t i = 0; i < sizeof(crashSignals) / sizeof(crashSignals[0]); ++i)
+                signal(crashSignals[i], SIG_DFL);
+
+            uint8_t status = probePassed;
+            std::string errorMsg;
+            std::string metadata;
+            PluginLoader<T> loader(name);
+            T* plugin = loader.load() ? loader.getPluginInstance() : NULL;
+            if (!plugin)
+            {
+                status = probeFailed;
+                errorMsg = loader.getErrorMsg();
+                if (errorMsg.empty())
+                    errorMsg = "Failed to instantiate plugin";
+            }
+            else
+            {
+                try
+                {
+                    if (extractor)
+                        metadata = extractor(plugin);
+                }
+                catch (const std::exception& e)
+                {
+                    status = probeFailed;
+                    errorMsg = std::string("Metadata extraction failed: ") + e.what();
+                }
+                // Static destructors run here, and may crash as well
+                if (!loader.unload() && status == probePassed)
+                {
+                    status = probeFailed;
+                    errorMsg = loader.getErrorMsg();
+                }
+            }
+
+            std::vector<char> report;
+            MessageWriter writer(report);
+            serialize<uint8_t>(writer, status);
+            serialize<std::string>(writer, errorMsg);
+            serialize<std::string>(writer, metadata);
+            const char* cursor = report.data();
+            std::size_t size = report.size();
+            while (size > 0)
+            {
+                ssize_t count = write(fd, cursor, size);
+                if (count < 0 && errno == EINTR)
+                    continue;
+                if (count <= 0)
+                    break;
+                cursor += count;
+                size -= static_cast<std::size_t>(count);
+            }
+            // Skip the static destructors inherited from the host
+            _exit(0);
+        }
+
+        void loadCache()
+        {
+            if (cacheLoaded_ || cacheFile_.empty())
+                return;
+            cacheLoaded_ = true;
+            std::ifstream file(cacheFile_.c_str());
+            std::string line;
+            while (std::getline(file, line))
+            {
+                std::vector<std::string> fields;
+                std::istringstream iss(line);
+                std::string field;
+                while (std::getline(iss, field, '\t'))
+                    fields.push_back(field);
+                if (fields.size() < 2)
+                    continue;
+                ProbeResult res;
+                res.status = static_cast<ProbeStatus>(std::atoi(fields[1].c_str()));
+                if (fields.size() > 2)
+                    res.errorMsg = detail::unescapeProbeField(fields[2]);
+                if (fields.size() > 3)
+                    res.metadata = detail::unescapeProbeField(fields[3]);
+                cache_[fields[0]] = res;
+            }
+        }
+
+        void appendCache(const std::string& hash, const ProbeResult& res)
+        {
+            if (cacheFile_.empty())
+                return;
+            std::ofstream file(cacheFile_.c_str(), std::ios::app);
+            file << hash << '\t' << static_cast<int>(res.status)
+                 << '\t' << detail::escapeProbeField(res.errorMsg)
+                 << '\t' << detail::escapeProbeField(res.metadata) << '\n';
+        }
+
+        // Maximum duration of a probe
+        std::chrono::milliseconds timeout_;
+        // Metadata extractor
+        MetadataExtractor extractor_;
+        // Results by content hash
+        std::map<std::string, ProbeResult> cache_;
+        // Path of the persistent cache. Empty if disabled.
+        std::string cacheFile_;
+        // Whether the persistent cache was read
+        bool cacheLoaded_;
+        // Protects every member
+        std::mutex mutex_;
+    };
+}
@@ -0,0 +1,408 @@
+//          Copyright Jeremy Coulon 2012-2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+/** @file */
+
+#pragma once
+
+//==============
+//==  Plugin  ==
+//==============
+#include "Plugin/PluginLoader.h"
+#include "Plugin/WorkStealingPool.h"
+
+//=============
+//==  Boost  ==
+//=============
+#include <boost/noncopyable.hpp>
+
+//===========
+//==  STD  ==
+//===========
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/// Namespace of the Plugin library
+namespace Plugin
+{
+    /// Outcome of the call of one plugin during a parallel fan-out
+    enum CallStatus
+    {
+        callCompleted, ///< Completed before its deadline
+        callLate,      ///< Completed after its deadline. Its result is discarded.
+        callSkipped    ///< Not made: plugin not loaded, or deadline already passed
+    };
+
+    /// Result of the call of one plugin during a parallel fan-out
+    template<class R>
+    struct CallResult
+    {
+        /// Value returned by the plugin. Only meaningful if status is callCompleted.
+        R value;
+        /// Outcome of the call
+        CallStatus status;
+    };
+
+    namespace detail
+    {
+        // Count down completed chunks, waking the caller at zero
+        class FanOutLatch : private boost::noncopyable
+        {
+        public:
+            explicit FanOutLatch(std::size_t count)
+                : count_(count)
+            {
+                // Empty
+            }
+
+            void countDown()
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (--count_ == 0)
+                    done_.notify_all();
+            }
+
+            bool isDone()
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                return count_ == 0;
+            }
+
+            void wait()
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                done_.wait(lock, [this]() { return count_ == 0; });
+            }
+
+        private:
+            std::size_t count_;
+            std::mutex mutex_;
+            std::condition_variable done_;
+        };
+    }
+
+    /// Set of plugins implementing the same interface
+    /**
+      * Plugins are registered by filename, loaded and instantiated together,
+      * then looked up by filename.
+      * @tparam T Interface type of the concrete plugins
+      */
+    template<class T>
+    class PluginRegistry : private boost::noncopyable
+    {
+    public:
+        /// Register a plugin
+        /**
+          * The plugin is not loaded until loadAll() is called.
+          * @param name Filename of the concrete plugin
+          * @return False if the plugin is already registered. True otherwise.
+          */
+        bool add(const std::string& name)
+        {
+            std::unique_ptr<PluginLoader<T> >& loader = loaders_[name];
+            if (loader)
+                return false;
+            loader.reset(new PluginLoader<T>(name));
+            // Keep the entries in the order of the names, with the deadlines already set
+            std::vector<Entry> entries;
+            entries.reserve(loaders_.size());
+            std::size_t previous = 0;
+            for (typename LoaderMap::const_iterator it = loaders_.begin(); it != loaders_.end(); ++it)
+            {
+                Entry entry = { &it->first, it->second.get(), std::chrono::nanoseconds::zero() };
+                if (previous < entries_.size() && entries_[previous].loader == entry.loader)
+                    entry.deadline = entries_[previous++].deadline;
+                entries.push_back(entry);
+            }
+            entries_.swap(entries);
+            return true;
+        }
+
+        /// Set the deadline of the calls to a plugin made by forEachParallel(), mapParallel() and mapReduce()
+        /**
+          * @param name Filename of the concrete plugin
+          * @param deadline Time from the start of the fan-out. Zero means the deadline of the fan-out.
+          * @return False if the plugin is not registered. True otherwise.
+          */
+        bool setDeadline(const std::string& name, std::chrono::nanoseconds deadline)
+        {
+            for (std::size_t i = 0; i < entries_.size(); ++i)
+            {
+                if (*entries_[i].name == name)
+                {
+                    entries_[i].deadline = deadline;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        /// Load and instantiate every registered plugin
+        /**
+          * Plugins that fail to load stay registered but not loaded.
+          * @return True if all plugins were loaded. False otherwise.
+          */
+        bool loadAll()
+        {
+            bool res = true;
+            for (typename LoaderMap::iterator it = loaders_.begin(); it != loaders_.end(); ++it)
+            {
+                PluginLoader<T>& loader = *it->second;
+                if (loader.isLoaded() && loader.getPluginInstance())
+                    continue;
+                if (!loader.load() || !loader.getPluginInstance())
+                {
+                    errorMsg_ = it->first + ": " + loader.getErrorMsg();
+                    res = false;
+                }
+            }
+            return res;
+        }
+
+        /// Unload every registered plugin
+        /**
+          * @return True if all plugins were unloaded. False otherwise.
+          */
+        bool unloadAll()
+        {
+            bool res = true;
+            for (typename LoaderMap::iterator it = loaders_.begin(); it != loaders_.end(); ++it)
+            {
+                if (!it->second->unload())
+                {
+                    errorMsg_ = it->first + ": " + it->second->getErrorMsg();
+                    res = false;
+                }
+            }
+            return res;
+        }
+
+        /// Get the facade of a loaded plugin
+        /**
+          * @param name Filename of the concrete plugin
+          * @return NULL if the plugin is not registered or not loaded.
+          */
+        T* get(const std::string& name) const
+        {
+            typename LoaderMap::const_iterator it = loaders_.find(name);
+            if (it == loaders_.end() || !it->second->isLoaded())
+                return NULL;
+            return it->second->getPluginInstance();
+        }
+
+        /// Call a function on every loaded plugin
+        /**
+          * @param f Callable taking the plugin filename and a T* as arguments
+          */
+        template<class F>
+        void forEach(F f) const
+        {
+            for (typename LoaderMap::const_iterator it = loaders_.begin(); it != loaders_.end(); ++it)
+                if (it->second->isLoaded())
+                    f(it->first, it->second->getPluginInstance());
+        }
+
+        /// Call a function on every loaded plugin, in parallel
+        /**
+          * Plugins are split in chunks. At most one task per worker is submitted to the pool,
+          * and the tasks and the calling thread claim the chunks in turn, without allocating.
+          * The calling thread then waits for every call to return.
+          * @param pool Pool running the calls
+          * @param f Callable taking the plugin filename and a T* as arguments. Must not throw.
+          * @param chunkSize Number of plugins called by one task
+          */
+        template<class F>
+        void forEachParallel(WorkStealingPool& pool, F f, std::size_t chunkSize = 1) const
+        {
+            fanOut(pool, chunkSize, [this, &f](std::size_t i, T* plugin)
+            {
+                f(*entries_[i].name, plugin);
+            });
+        }
+
+        /// Call a function on every loaded plugin in parallel, and collect the results
+        /**
+          * Calls cannot be interrupted: a call still running at its deadline is waited for
+          * and marked callLate, and calls not started at their deadline are skipped.
+          * @param pool Pool running the calls
+          * @param f Callable taking a T* and returning R. Must not throw.
+          * @param results Result of each registered plugin, in the order of getPluginNames().
+          *                Resized if needed only, so that a reused vector is not reallocated.
+          * @param deadline Time from now given to each plugin without a deadline of its own,
+          *                 see setDeadline(). Zero means no deadline.
+          * @param chunkSize Number of plugins called by one task
+          * @return Number of calls completed before their deadline
+          */
+        template<class R, class F>
+        std::size_t mapParallel(WorkStealingPool& pool, F f, std::vector<CallResult<R> >& results,
+                                std::chrono::nanoseconds deadline = std::chrono::nanoseconds::zero(),
+                                std::size_t chunkSize = 1) const
+        {
+            if (results.size() != entries_.size())
+                results.resize(entries_.size());
+            for (std::size_t i = 0; i < results.size(); ++i)
+                results[i].status = callSkipped;
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            std::atomic<std::size_t> completed(0);
+            fanOut(pool, chunkSize, [&](std::size_t i, T* plugin)
+            {
+                std::chrono::nanoseconds limit = entries_[i].deadline != std::chrono::nanoseconds::zero()
+                    ? entries_[i].deadline
+                    : deadline;
+                if (limit != std::chrono::nanoseconds::zero() && std::chrono::steady_clock::now() - start >= limit)
+                    return;
+                results[i].value = f(plugin);
+                if (limit != std::chrono::nanoseconds::zero() && std::chrono::steady_clock::now() - start > limit)
+                {
+                    results[i].status = callLate;
+                    return;
+                }
+                results[i].status = callCompleted;
+                completed.fetch_add(1, std::memory_order_relaxed);
+            });
+            return completed.load();
+        }
+
+        /// Call a function on every loaded plugin in parallel, and combine the results
+        /**
+          * Results are combined on the calling thread, in the order of getPluginNames(),
+          * so that the outcome does not depend on scheduling.
+          * Late and skipped calls are left out. See mapParallel() for the other parameters.
+          * @param init Initial value of the reduction
+          * @param reduce Callable combining the reduction so far and a result into a new R
+          * @param results Scratch space, reused between calls to avoid allocations
+          * @return Reduction of the completed calls
+          */
+        template<class R, class Map, class Reduce>
+        R mapReduce(WorkStealingPool& pool, Map map, R init, Reduce reduce, std::vector<CallResult<R> >& results,
+                    std::chrono::nanoseconds deadline = std::chrono::nanoseconds::zero(),
+                    std::size_t chunkSize = 1) const
+        {
+            mapParallel(pool, map, results, deadline, chunkSize);
+            for (std::size_t i = 0; i < results.size(); ++i)
+                if (results[i].status == callCompleted)
+                    init = reduce(init, results[i].value);
+            return init;
+        }
+
+        /// Get the filenames of the registered plugins, sorted
+        std::vector<std::string> getPluginNames() const
+        {
+            std::vector<std::string> res;
+            for (typename LoaderMap::const_iterator it = loaders_.begin(); it != loaders_.end(); ++it)
+                res.push_back(it->first);
+            return res;
+        }
+
+        /// Get the number of registered plugins
+        std::size_t size() const
+        {
+            return loaders_.size();
+        }
+
+        /// Get the error message of the last plugin that failed to load or unload
+        const std::string& getErrorMsg() const
+        {
+            return errorMsg_;
+        }
+
+    private:
+        typedef std::map<std::string, std::unique_ptr<PluginLoader<T> > > LoaderMap;
+
+        // Plugin in a contiguous array, for parallel calls
+        struct Entry
+        {
+            const std::string* name;
+            PluginLoader<T>* loader;
+            std::chrono::nanoseconds deadline;
+        };
+
+        // Chunks of a fan-out, claimed in turn by the pool tasks and the calling thread
+        template<class Call>
+        struct FanOut : private boost::noncopyable
+        {
+            FanOut(const PluginRegistry& r, const Call& c, std::size_t size, std::size_t tasks)
+                : registry(r),
+                  call(c),
+                  chunkSize(size),
+                  next(0),
+                  latch(tasks)
+            {
+                // Empty
+            }
+
+            // Run chunks until none is left
+            void run()
+            {
+                const std::vector<Entry>& entries = registry.entries_;
+                while (true)
+                {
+                    std::size_t begin = next.fetch_add(chunkSize, std::memory_order_relaxed);
+                    if (begin >= entries.size())
+                        return;
+                    std::size_t end = std::min(entries.size(), begin + chunkSize);
+                    for (std::size_t i = begin; i < end; ++i)
+                        if (entries[i].loader->isLoaded())
+                            call(i, entries[i].loader->getPluginInstance());
+                }
+            }
+
+            const PluginRegistry& registry;
+            const Call& call;
+            std::size_t chunkSize;
+            // First plugin of the next chunk
+            std::atomic<std::size_t> next;
+            // Counts the pool tasks down
+            detail::FanOutLatch latch;
+        };
+
+        // Run call(index, plugin) for every loaded plugin, in chunks on the pool
+        template<class Call>
+        void fanOut(WorkStealingPool& pool, std::size_t chunkSize, const Call& call) const
+        {
+            if (entries_.empty())
+                return;
+            chunkSize = std::max<std::size_t>(chunkSize, 1);
+            std::size_t chunks = (entries_.size() + chunkSize - 1) / chunkSize;
+            // The calling thread takes chunks as well
+            std::size_t tasks = std::min(chunks - 1, pool.size());
+            FanOut<Call> fanOut(*this, call, chunkSize, tasks);
+            FanOut<Call>* state = &fanOut;
+            for (std::size_t t = 0; t < tasks; ++t)
+            {
+                // A single pointer fits in the small buffer of the task: submitting does not allocate it
+                pool.submit([state]()
+                {
+                    state->run();
+                    state->latch.countDown();
+                });
+            }
+            fanOut.run();
+            // Tasks not started yet must still run before the state goes away: help rather than block a thread
+            while (!fanOut.latch.isDone() && pool.runPendingTask())
+            {
+                // Loop
+            }
+            fanOut.latch.wait();
+        }
+
+        // Loaders by plugin filename.
+        // getPluginInstance() is not const, hence the indirection.
+        LoaderMap loaders_;
+        // Loaders in the order of the names
+        std::vector<Entry> entries_;
+        // Error message
+        std::string errorMsg_;
+    };
+}
@@ -0,0 +1,582 @@
+//          Copyright Jeremy Coulon 2012-2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+/** @file */
+
+#pragma once
+
+//==============
+//==  Plugin  ==
+//==============
+#include "Plugin/InterfaceDescription.h"
+#include "Plugin/UnaccountedScope.h"
+
+//=============
+//==  Boost  ==
+//=============
+#include <boost/noncopyable.hpp>
+
+//===========
+//==  STD  ==
+//===========
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+//=======================
+//==  OS Specific SDK  ==
+//=======================
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+/// Namespace of the Plugin library
+namespace Plugin
+{
+    /// Kind of traced span
+    enum TraceCategory
+    {
+        /// load(), getPluginInstance(), facade creation and destruction, unload()
+        traceLifecycle,
+        /// Sampled call made through a PluginInterceptor with TraceInterception
+        traceCall
+    };
+
+    namespace detail
+    {
+        // Completed span. Names are string literals or method names of InterfaceDescription.
+        struct TraceEvent
+        {
+            uint64_t beginNs;
+            uint64_t endNs;
+            const char* name;
+            uint32_t plugin;
+            uint32_t category;
+        };
+
+        // Events of one thread. Only the owner thread writes, readers hold the tracer lock.
+        class TraceBuffer : private boost::noncopyable
+        {
+        public:
+            TraceBuffer(std::size_t capacity, uint32_t thread, const std::string& threadName)
+                : events_(new TraceEvent[capacity]),
+                  capacity_(capacity),
+                  size_(0),
+                  session_(0),
+                  dropped_(0),
+                  thread_(thread),
+                  threadName_(threadName)
+            {
+                // Empty
+            }
+
+            // Owner thread only. The buffer is emptied the first time it is used in a new session.
+            // Events of a previous session, read before enable(), are dropped: resetting the buffer
+            // for them would overwrite events that a reader of the current session may be copying.
+            void record(uint64_t session, const TraceEvent& event)
+            {
+                uint64_t current = session_.load(std::memory_order_relaxed);
+                if (session < current)
+                    return;
+                if (session > current)
+                {
+                    size_.store(0, std::memory_order_relaxed);
+                    dropped_.store(0, std::memory_order_relaxed);
+                    session_.store(session, std::memory_order_release);
+                }
+                std::size_t size = size_.load(std::memory_order_relaxed);
+                if (size == capacity_)
+                {
+                    dropped_.fetch_add(1, std::memory_order_relaxed);
+                    return;
+                }
+                events_[size] = event;
+                size_.store(size + 1, std::memory_order_release);
+            }
+
+            // Events recorded in a session
+            std::size_t read(uint64_t session, std::vector<TraceEvent>& events) const
+            {
+                if (session_.load(std::memory_order_acquire) != session)
+                    return 0;
+                std::size_t size = size_.load(std::memory_order_acquire);
+                events.insert(events.end(), events_.get(), events_.get() + size);
+                return size;
+            }
+
+            uint64_t getDropped(uint64_t session) const
+            {
+                return session_.load(std::memory_order_acquire) == session ? dropped_.load(std::memory_order_relaxed) : 0;
+            }
+
+            uint32_t getThread() const
+            {
+                return thread_;
+            }
+
+            const std::string& getThreadName() const
+            {
+                return threadName_;
+            }
+
+        private:
+            std::unique_ptr<TraceEvent[]> events_;
+            std::size_t capacity_;
+            std::atomic<std::size_t> size_;
+            std::atomic<uint64_t> session_;
+            std::atomic<uint64_t> dropped_;
+            uint32_t thread_;
+            std::string threadName_;
+        };
+
+        // Write a JSON string
+        inline void writeJsonString(std::ostream& os, const std::string& value)
+        {
+            os << '"';
+            for (std::size_t i = 0; i < value.size(); ++i)
+            {
+                unsigned char c = static_cast<unsigned char>(value[i]);
+                if (c == '"' || c == '\\')
+                    os << '\\' << value[i];
+                else if (c < 0x20)
+                {
+                    char buffer[8];
+                    std::snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+                    os << buffer;
+                }
+                else
+                    os << value[i];
+            }
+            os << '"';
+        }
+
+        // Write nanoseconds as microseconds, the unit of Chrome traces
+        inline void writeMicroseconds(std::ostream& os, uint64_t ns)
+        {
+            char buffer[32];
+            std::snprintf(buffer, sizeof(buffer), "%llu.%03u",
+                          static_cast<unsigned long long>(ns / 1000), static_cast<unsigned>(ns % 1000));
+            os << buffer;
+        }
+    }
+
+    /// Tracer of plugin lifecycle spans and sampled calls, exported as a Chrome trace
+    /**
+      * Every PluginLoader, whatever its policies, records its load(), getPluginInstance(),
+      * facade creation ("init") and destruction, and unload() spans while the tracer is enabled,
+      * including the time spent waiting for the loader lock.
+      * Calls made through a PluginInterceptor with TraceInterception are recorded according to setCallSampling().
+      * @code
+      * Plugin::PluginTracer& tracer = Plugin::PluginTracer::instance();
+      * tracer.enable();
+      * startApplication();
+      * tracer.disable();
+      * std::ofstream file("startup.json");
+      * tracer.writeChromeTrace(file);  // open in https://ui.perfetto.dev or chrome://tracing
+      * @endcode
+      * Each thread records in a buffer of its own without locking. A full buffer drops the new spans.
+      * Disabled, each traced operation costs one relaxed atomic load.
+      */
+    class PluginTracer : private boost::noncopyable
+    {
+    public:
+        /// Get the tracer of the process
+        static PluginTracer& instance()
+        {
+            // Never destroyed: threads may still trace during the static destruction
+            static PluginTracer* tracer = new PluginTracer;
+            return *tracer;
+        }
+
+        /// Start a new session, forgetting the spans of the previous one
+        /**
+          * @param capacity Number of spans per thread. Only applies to threads tracing for the first time.
+          */
+        void enable(std::size_t capacity = 65536)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            capacity_ = capacity;
+            session_.fetch_add(1, std::memory_order_relaxed);
+            enabled_.store(true, std::memory_order_release);
+        }
+
+        /// Stop recording. The spans of the session are kept until the next enable().
+        void disable()
+        {
+            enabled_.store(false, std::memory_order_release);
+        }
+
+        /// Check whether spans are recorded
+        bool isEnabled() const
+        {
+            return enabled_.load(std::memory_order_relaxed);
+        }
+
+        /// Record one call out of every per thread. Zero records none (default), one records all.
+        void setCallSampling(uint32_t every)
+        {
+            sampling_.store(every, std::memory_order_relaxed);
+        }
+
+        /// Get the call sampling period
+        uint32_t getCallSampling() const
+        {
+            return sampling_.load(std::memory_order_relaxed);
+        }
+
+        /// Decide whether the current call is recorded
+        bool sampleCall()
+        {
+            if (!isEnabled())
+                return false;
+            uint32_t every = sampling_.load(std::memory_order_relaxed);
+            if (every == 0)
+                return false;
+            static thread_local uint32_t calls = 0;
+            return ++calls % every == 0;
+        }
+
+        /// Get the ID of a plugin name, for record()
+        uint32_t getPluginId(const std::string& plugin)
+        {
+            detail::UnaccountedScope unaccounted;
+            std::lock_guard<std::mutex> lock(mutex_);
+            std::map<std::string, uint32_t>::const_iterator it = pluginIds_.find(plugin);
+            if (it != pluginIds_.end())
+                return it->second;
+            plugins_.push_back(plugin);
+            uint32_t id = static_cast<uint32_t>(plugins_.size());
+            pluginIds_[plugin] = id;
+            return id;
+        }
+
+        /// Record a span of the calling thread
+        /**
+          * @param name Name of the span. It must outlive the tracer, e.g. a string literal.
+          * @param plugin Plugin ID from getPluginId(), or zero
+          * @param beginNs Start of the span, from now()
+          * @param endNs End of the span, from now()
+          * @param category Kind of span
+          */
+        void record(const char* name, uint32_t plugin, uint64_t beginNs, uint64_t endNs, TraceCategory category)
+        {
+            detail::TraceEvent event;
+            event.beginNs = beginNs;
+            event.endNs = endNs;
+            event.name = name;
+            event.plugin = plugin;
+            event.category = category;
+            localBuffer().record(session_.load(std::memory_order_relaxed), event);
+        }
+
+        /// Get the time of the trace clock, in nanoseconds
+        static uint64_t now()
+        {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        /// Get the number of spans recorded in the session
+        std::size_t getEventCount() const
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            std::vector<detail::TraceEvent> events;
+            uint64_t session = session_.load(std::memory_order_relaxed);
+            for (std::size_t i = 0; i < buffers_.size(); ++i)
+                buffers_[i]->read(session, events);
+            return events.size();
+        }
+
+        /// Get the number of spans dropped in the session because a thread buffer was full
+        uint64_t getDroppedCount() const
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            uint64_t res = 0;
+            uint64_t session = session_.load(std::memory_order_relaxed);
+            for (std::size_t i = 0; i < buffers_.size(); ++i)
+                res += buffers_[i]->getDropped(session);
+            return res;
+        }
+
+        /// Write the spans of the session in the Chrome trace event format
+        /**
+          * The process has one track per thread. Each plugin also has a process of its own,
+          * "Plugin <name>", holding its spans with one track per calling thread,
+          * so that the spans of a plugin can be followed across threads.
+          * Best called after disable(): spans still being recorded may be missing.
+          */
+        void writeChromeTrace(std::ostream& os) const
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            uint64_t session = session_.load(std::memory_order_relaxed);
+            uint64_t pid = processId();
+            bool first = true;
+            os << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+            writeProcessName(os, first, pid, "Threads", 0);
+            std::vector<std::vector<bool> > pluginThreads(plugins_.size() + 1);
+            std::vector<detail::TraceEvent> events;
+            for (std::size_t b = 0; b < buffers_.size(); ++b)
+            {
+                const detail::TraceBuffer& buffer = *buffers_[b];
+                events.clear();
+                if (buffer.read(session, events) == 0)
+                    continue;
+                writeThreadName(os, first, pid, buffer.getThread(), buffer.getThreadName());
+                for (std::size_t i = 0; i < events.size(); ++i)
+                {
+                    const detail::TraceEvent& event = events[i];
+                    writeEvent(os, first, pid, buffer.getThread(), event);
+                    if (event.plugin == 0 || event.plugin > plugins_.size())
+                        continue;
+                    std::vector<bool>& threads = pluginThreads[event.plugin];
+                    if (threads.size() <= buffer.getThread())
+                        threads.resize(buffer.getThread() + 1, false);
+                    if (!threads[buffer.getThread()])
+                    {
+                        threads[buffer.getThread()] = true;
+                        writeThreadName(os, first, pluginProcessId(event.plugin), buffer.getThread(), buffer.getThreadName());
+                    }
+                    writeEvent(os, first, pluginProcessId(event.plugin), buffer.getThread(), event);
+                }
+            }
+            for (std::size_t p = 1; p < pluginThreads.size(); ++p)
+                if (!pluginThreads[p].empty())
+                    writeProcessName(os, first, pluginProcessId(static_cast<uint32_t>(p)), "Plugin " + plugins_[p - 1], p);
+            os << "]}" << std::endl;
+        }
+
+    private:
+        PluginTracer()
+            : enabled_(false),
+              session_(0),
+              sampling_(0),
+              capacity_(65536),
+              threads_(0)
+        {
+            // Empty
+        }
+
+        detail::TraceBuffer& localBuffer()
+        {
+            static thread_local detail::TraceBuffer* buffer = NULL;
+            if (!buffer)
+            {
+                detail::UnaccountedScope unaccounted;
+                std::lock_guard<std::mutex> lock(mutex_);
+                uint32_t thread = ++threads_;
+                buffers_.push_back(std::unique_ptr<detail::TraceBuffer>(new detail::TraceBuffer(capacity_, thread, currentThreadName(thread))));
+                buffer = buffers_.back().get();
+            }
+            return *buffer;
+        }
+
+        static std::string currentThreadName(uint32_t thread)
+        {
+            std::ostringstream oss;
+#ifdef __linux__
+            char name[16] = "";
+            if (pthread_getname_np(pthread_self(), name, sizeof(name)) == 0 && name[0])
+                oss << name << " ";
+#endif
+            oss << "#" << thread;
+            return oss.str();
+        }
+
+        static uint64_t processId()
+        {
+#ifdef _WIN32
+            return _getpid();
+#else
+            return getpid();
+#endif
+        }
+
+        // Above the largest process IDs, so that plugin processes never collide with the traced one
+        static uint64_t pluginProcessId(uint32_t plugin)
+        {
+            return 0x40000000ull + plugin;
+        }
+
+        static void separate(std::ostream& os, bool& first)
+        {
+            if (!first)
+                os << ",";
+            os << "\n";
+            first = false;
+        }
+
+        static void writeProcessName(std::ostream& os, bool& first, uint64_t pid, const std::string& name, std::size_t order)
+        {
+            separate(os, first);
+            os << "{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":" << pid << ",\"tid\":0,\"args\":{\"name\":";
+            detail::writeJsonString(os, name);
+            os << "}},\n{\"ph\":\"M\",\"name\":\"process_sort_index\",\"pid\":" << pid << ",\"tid\":0,\"args\":{\"sort_index\":" << order << "}}";
+        }
+
+        static void writeThreadName(std::ostream& os, bool& first, uint64_t pid, uint32_t thread, const std::string& name)
+        {
+            separate(os, first);
+            os << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":" << pid << ",\"tid\":" << thread << ",\"args\":{\"name\":";
+            detail::writeJsonString(os, name);
+            os << "}}";
+        }
+
+        void writeEvent(std::ostream& os, bool& first, uint64_t pid, uint32_t thread, const detail::TraceEvent& event) const
+        {
+            separate(os, first);
+            os << "{\"ph\":\"X\",\"name\":";
+            detail::writeJsonString(os, event.name);
+            os << ",\"cat\":\"" << (event.category == traceCall ? "call" : "lifecycle") << "\",\"pid\":" << pid << ",\"tid\":" << thread << ",\"ts\":";
+            detail::writeMicroseconds(os, event.beginNs);
+            os << ",\"dur\":";
+            detail::writeMicroseconds(os, event.endNs > event.beginNs ? event.endNs - event.beginNs : 0);
+            if (event.plugin != 0 && event.plugin <= plugins_.size())
+            {
+                os << ",\"args\":{\"plugin\":";
+                detail::writeJsonString(os, plugins_[event.plugin - 1]);
+                os << "}";
+            }
+            os << "}";
+        }
+
+        std::atomic<bool> enabled_;
+        std::atomic<uint64_t> session_;
+        std::atomic<uint32_t> sampling_;
+        mutable std::mutex mutex_;
+        // Capacity of the next thread buffers
+        std::size_t capacity_;
+        uint32_t threads_;
+        // Buffer of every thread that traced, never released
+        std::vector<std::unique_ptr<detail::TraceBuffer> > buffers_;
+        // Plugin names, by ID minus one
+        std::vector<std::string> plugins_;
+        std::map<std::string, uint32_t> pluginIds_;
+    };
+
+    /// Span recorded on destruction, if the tracer was enabled on construction
+    class TraceSpan : private boost::noncopyable
+    {
+    public:
+        /// Constructor
+        /**
+          * @param name Name of the span. It must outlive the tracer, e.g. a string literal.
+          */
+        explicit TraceSpan(const char* name)
+            : name_(name),
+              plugin_(0),
+              beginNs_(PluginTracer::instance().isEnabled() ? PluginTracer::now() : 0)
+        {
+            // Empty
+        }
+
+        /// Constructor
+        /**
+          * @param name Name of the span. It must outlive the tracer, e.g. a string literal.
+          * @param plugin Name of the plugin
+          */
+        TraceSpan(const char* name, const std::string& plugin)
+            : name_(name),
+              plugin_(0),
+              beginNs_(PluginTracer::instance().isEnabled() ? PluginTracer::now() : 0)
+        {
+            setPlugin(plugin);
+        }
+
+        /// Destructor. Record the span.
+        ~TraceSpan()
+        {
+            if (beginNs_)
+                PluginTracer::instance().record(name_, plugin_, beginNs_, PluginTracer::now(), traceLifecycle);
+        }
+
+        /// Set the plugin of the span, once known
+        void setPlugin(const std::string& plugin)
+        {
+            if (beginNs_)
+                plugin_ = PluginTracer::instance().getPluginId(plugin);
+        }
+
+    private:
+        const char* name_;
+        uint32_t plugin_;
+        // Zero if not traced
+        uint64_t beginNs_;
+    };
+
+    /// Interception policy of PluginInterceptor recording sampled calls in the PluginTracer
+    /**
+      * Nothing is recorded until setTracedPlugin() is called on the interceptor.
+      * See PluginTracer::setCallSampling().
+      */
+    struct TraceInterception
+    {
+        /// Recorder of the calls
+        template<class T>
+        class Recorder
+        {
+        public:
+            /// Call in progress
+            class Scope
+            {
+            public:
+                /// Constructor
+                template<class Pmf>
+                Scope(Recorder& recorder, Pmf pmf)
+                    : name_(NULL),
+                      plugin_(recorder.plugin_),
+                      beginNs_(0)
+                {
+                    if (plugin_ && PluginTracer::instance().sampleCall())
+                    {
+                        name_ = methodName<T>(methodIndex<T>(pmf));
+                        if (!*name_)
+                            name_ = "(other)";
+                        beginNs_ = PluginTracer::now();
+                    }
+                }
+
+                /// Destructor. Record the call, even if it threw.
+                ~Scope()
+                {
+                    if (beginNs_)
+                        PluginTracer::instance().record(name_, plugin_, beginNs_, PluginTracer::now(), traceCall);
+                }
+
+            private:
+                const char* name_;
+                uint32_t plugin_;
+                uint64_t beginNs_;
+            };
+
+            /// Constructor
+            Recorder()
+                : plugin_(0)
+            {
+                // Empty
+            }
+
+            /// Set the name of the plugin on the calls, typically the name given to its loader
+            void setTracedPlugin(const std::string& plugin)
+            {
+                plugin_ = PluginTracer::instance().getPluginId(plugin);
+            }
+
+        private:
+            uint32_t plugin_;
+        };
+    };
+}
@@ -0,0 +1,532 @@
+//          Copyright Jeremy Coulon 2012-2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+/** @file */
+
+#pragma once
+
+//==============
+//==  Plugin  ==
+//==============
+#include "Plugin/PluginRegistry.h"
+#include "Plugin/Serialization.h"
+
+//=============
+//==  Boost  ==
+//=============
+#include <boost/noncopyable.hpp>
+
+//===========
+//==  STD  ==
+//===========
+#include <cerrno>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+//=======================
+//==  OS Specific SDK  ==
+//=======================
+#include <dirent.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/// Namespace of the Plugin library
+namespace Plugin
+{
+    namespace detail
+    {
+        // Requests sent to the template process
+        enum ZygoteRequest
+        {
+            zygoteSpawn = 0,
+            zygoteWait = 1,
+            zygoteStop = 2
+        };
+
+        // Number of threads of the calling process. Zero if unknown.
+        inline std::size_t threadCount()
+        {
+#ifdef __linux__
+            DIR* dir = opendir("/proc/self/task");
+            if (!dir)
+                return 0;
+            std::size_t res = 0;
+            while (struct dirent* entry = readdir(dir))
+                if (entry->d_name[0] != '.')
+                    ++res;
+            closedir(dir);
+            return res;
+#else
+            return 0;
+#endif
+        }
+
+        inline bool writeAll(int fd, const void* data, std::size_t size)
+        {
+            const char* cursor = static_cast<const char*>(data);
+            while (size > 0)
+            {
+                ssize_t res = ::write(fd, cursor, size);
+                if (res < 0 && errno == EINTR)
+                    continue;
+                if (res <= 0)
+                    return false;
+                cursor += res;
+                size -= static_cast<std::size_t>(res);
+            }
+            return true;
+        }
+
+        inline bool readAll(int fd, void* data, std::size_t size)
+        {
+            char* cursor = static_cast<char*>(data);
+            while (size > 0)
+            {
+                ssize_t res = ::read(fd, cursor, size);
+                if (res < 0 && errno == EINTR)
+                    continue;
+                if (res <= 0)
+                    return false;
+                cursor += res;
+                size -= static_cast<std::size_t>(res);
+            }
+            return true;
+        }
+
+        // Length-prefixed messages over a stream socket
+        inline bool sendZygoteMessage(int fd, const std::vector<char>& message)
+        {
+            uint32_t size = static_cast<uint32_t>(message.size());
+            return writeAll(fd, &size, sizeof(size)) && writeAll(fd, message.data(), message.size());
+        }
+
+        inline bool receiveZygoteMessage(int fd, std::vector<char>& message)
+        {
+            uint32_t size = 0;
+            if (!readAll(fd, &size, sizeof(size)))
+                return false;
+            message.resize(size);
+            return readAll(fd, message.data(), size);
+        }
+    }
+
+    /// Fork server sharing pre-loaded plugins with its workers
+    /**
+      * start() forks a template process which runs the warmup hooks once,
+      * typically loading a PluginRegistry with preload() and filling caches.
+      * spawn() then asks the template to fork a worker running the worker main function.
+      * Workers inherit the loaded plugins without any dlopen(), and share
+      * the pages of the template copy-on-write.
+      *
+      * Only the forking thread survives a fork(), so mutexes held by other threads
+      * would stay locked forever in the child. Therefore:
+      * - start() fails if the calling process runs more than one thread,
+      * - spawn() fails if warmup hooks left threads running in the template,
+      * - locks owned by plugins can be made consistent with setForkHandlers().
+      *
+      * spawn() and wait() are thread-safe.
+      */
+    class PluginZygote : private boost::noncopyable
+    {
+    public:
+        /// Warmup hook, run in the template process. Returns false and sets the error message on failure.
+        typedef std::function<bool (std::string& errorMsg)> WarmupHook;
+        /// Entry point of a worker, run in the worker process. Returns its exit status.
+        typedef std::function<int (const std::string& argument)> WorkerMain;
+        /// Fork handler, see pthread_atfork()
+        typedef std::function<void ()> ForkHandler;
+
+        /// Constructor
+        /**
+          * @param workerMain Entry point of the workers
+          */
+        explicit PluginZygote(const WorkerMain& workerMain)
+            : workerMain_(workerMain),
+              pid_(0),
+              fd_(-1)
+        {
+            // Empty
+        }
+
+        /// Destructor. Stop the template process and its workers.
+        ~PluginZygote()
+        {
+            stop();
+        }
+
+        /// Add a hook run once by the template process, before any worker is forked
+        /**
+          * Hooks run in the order they were added. Must be called before start().
+          */
+        void addWarmupHook(const WarmupHook& hook)
+        {
+            hooks_.push_back(hook);
+        }
+
+        /// Load every plugin of a registry in the template process
+        /**
+          * The registry must outlive the zygote. It stays unloaded in the calling process.
+          */
+        template<class T>
+        void preload(PluginRegistry<T>& registry)
+        {
+            addWarmupHook([&registry](std::string& errorMsg)
+            {
+                if (registry.loadAll())
+                    return true;
+                errorMsg = "Failed to load plugin " + registry.getErrorMsg();
+                return false;
+            });
+        }
+
+        /// Set handlers run by the template around the fork of each worker
+        /**
+          * @param prepare Run before fork(), e.g. to acquire plugin locks
+          * @param parent Run in the template after fork(), e.g. to release them
+          * @param child Run in the worker after fork(), e.g. to release or reinitialize them
+          */
+        void setForkHandlers(const ForkHandler& prepare, const ForkHandler& parent, const ForkHandler& child)
+        {
+            prepare_ = prepare;
+            parent_ = parent;
+            child_ = child;
+        }
+
+        /// Fork the template process and run the warmup hooks
+        /**
+          * @return True if the warmup hooks succeeded. False otherwise.
+          */
+        bool start()
+        {
+            if (pid_ != 0)
+                return true;
+            if (detail::threadCount() > 1)
+            {
+                errorMsg_ = "Cannot fork the template process: process is multi-threaded";
+                return false;
+            }
+
+            int fds[2];
+            if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+            {
+                errorMsg_ = std::string("socketpair() failed: ") + std::strerror(errno);
+                return false;
+            }
+            // Do not let the template flush what the caller buffered
+            std::fflush(NULL);
+            pid_t pid = fork();
+            if (pid < 0)
+            {
+                errorMsg_ = std::string("fork() failed: ") + std::strerror(errno);
+                close(fds[0]);
+                close(fds[1]);
+                return false;
+            }
+            if (pid == 0)
+            {
+                close(fds[0]);
+                serve(fds[1]);
+            }
+            close(fds[1]);
+            pid_ = pid;
+            fd_ = fds[0];
+
+            // Wait for the warmup result
+            std::vector<char> response;
+            if (!detail::receiveZygoteMessage(fd_, response))
+            {
+                errorMsg_ = "Template process terminated during warmup";
+                stop();
+                return false;
+            }
+            MessageReader reader(response.data(), response.size());
+            if (deserialize<uint8_t>(reader) == 0)
+            {
+                errorMsg_ = deserialize<std::string>(reader);
+                stop();
+                return false;
+            }
+            return true;
+        }
+
+        /// Fork a worker from the template process
+        /**
+          * @param argument Passed to the worker main function
+          * @return Process id of the worker. Zero on failure.
+          */
+        pid_t spawn(const std::string& argument = std::string())
+        {
+            std::vector<char> request;
+            MessageWriter writer(request);
+            serialize<uint32_t>(writer, detail::zygoteSpawn);
+            serialize<std::string>(writer, argument);
+            int32_t res = 0;
+            return transact(request, res) ? static_cast<pid_t>(res) : 0;
+        }
+
+        /// Wait for the termination of a worker
+        /**
+          * Waiting blocks spawns requested by other threads until the worker exits.
+          * @param worker Process id returned by spawn()
+          * @param status Receives the status of the worker, as returned by waitpid()
+          * @return True on success. False otherwise.
+          */
+        bool wait(pid_t worker, int& status)
+        {
+            std::vector<char> request;
+            MessageWriter writer(request);
+            serialize<uint32_t>(writer, detail::zygoteWait);
+            serialize<int32_t>(writer, static_cast<int32_t>(worker));
+            int32_t res = 0;
+            if (!transact(request, res))
+                return false;
+            status = static_cast<int>(res);
+            return true;
+        }
+
+        /// Stop the template process
+        /**
+          * Running workers receive SIGTERM and are waited for.
+          * @return True if the template process exited cleanly. False otherwise.
+          */
+        bool stop()
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (pid_ == 0)
+                return true;
+            std::vector<char> request;
+            MessageWriter writer(request);
+            serialize<uint32_t>(writer, detail::zygoteStop);
+            detail::sendZygoteMessage(fd_, request);
+            close(fd_);
+            fd_ = -1;
+
+            int status = 0;
+            while (waitpid(pid_, &status, 0) < 0 && errno == EINTR)
+                continue;
+            pid_ = 0;
+            return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        }
+
+        /// Tell whether the template process is running
+        bool isRunning() const
+        {
+            return pid_ != 0;
+        }
+
+        /// Get the process id of the template process. Zero if not running.
+        pid_t getTemplatePid() const
+        {
+            return pid_;
+        }
+
+        /// Get error message of the last failed operation
+        std::string getErrorMsg() const
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return errorMsg_;
+        }
+
+    private:
+        // Send a request and read a response made of a status and either an integer or an error message
+        bool transact(const std::vector<char>& request, int32_t& value)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            std::vector<char> response;
+            if (pid_ == 0)
+            {
+                errorMsg_ = "Template process is not running";
+                return false;
+            }
+            if (!detail::sendZygoteMessage(fd_, request) || !detail::receiveZygoteMessage(fd_, response))
+            {
+                errorMsg_ = "Template process terminated";
+                return false;
+            }
+            MessageReader reader(response.data(), response.size());
+            if (deserialize<uint8_t>(reader) == 0)
+            {
+                errorMsg_ = deserialize<std::string>(reader);
+                return false;
+            }
+            value = deserialize<int32_t>(reader);
+            return true;
+        }
+
+        static void writeError(std::vector<char>& response, const std::string& message)
+        {
+            response.clear();
+            MessageWriter writer(response);
+            serialize<uint8_t>(writer, 0);
+            serialize<std::string>(writer, message);
+        }
+
+        static void writeValue(std::vector<char>& response, int32_t value)
+        {
+            response.clear();
+            MessageWriter writer(response);
+            serialize<uint8_t>(writer, 1);
+            serialize<int32_t>(writer, value);
+        }
+
+        // Main loop of the template process. Never returns.
+        void serve(int fd)
+        {
+            std::vector<char> response;
+            std::string error;
+            bool ready = true;
+            for (std::size_t i = 0; i < hooks_.size() && ready; ++i)
+                ready = hooks_[i](error);
+            if (ready)
+                writeValue(response, 0);
+            else
+                writeError(response, error.empty() ? "Warmup hook failed" : error);
+            detail::sendZygoteMessage(fd, response);
+            if (!ready)
+                _exit(1);
+
+            std::set<pid_t> workers;
+            std::map<pid_t, int> exited;
+            std::vector<char> request;
+            while (true)
+            {
+                // Reap terminated workers so that they do not linger as zombies
+                int status = 0;
+                pid_t done;
+                while ((done = waitpid(-1, &status, WNOHANG)) > 0)
+                {
+                    workers.erase(done);
+                    exited[done] = status;
+                }
+
+                struct pollfd pfd;
+                pfd.fd = fd;
+                pfd.events = POLLIN;
+                pfd.revents = 0;
+                if (poll(&pfd, 1, 200) <= 0)
+                    continue;
+                // Also stop when the owner process disappeared
+                if (!detail::receiveZygoteMessage(fd, request))
+                    break;
+
+                try
+                {
+                    MessageReader reader(request.data(), request.size());
+                    uint32_t kind = deserialize<uint32_t>(reader);
+                    if (kind == detail::zygoteStop)
+                        break;
+                    if (kind == detail::zygoteSpawn)
+                    {
+                        std::string argument = deserialize<std::string>(reader);
+                        pid_t worker = forkWorker(fd, argument, error);
+                        if (worker > 0)
+                        {
+                            workers.insert(worker);
+                            writeValue(response, static_cast<int32_t>(worker));
+                        }
+                        else
+                            writeError(response, error);
+                    }
+                    else if (kind == detail::zygoteWait)
+                    {
+                        pid_t worker = static_cast<pid_t>(deserialize<int32_t>(reader));
+                        if (exited.count(worker))
+                        {
+                            writeValue(response, exited[worker]);
+                            exited.erase(worker);
+                        }
+                        else if (workers.count(worker))
+                        {
+                            while (waitpid(worker, &status, 0) < 0 && errno == EINTR)
+                                continue;
+                            workers.erase(worker);
+                            writeValue(response, status);
+                        }
+                        else
+                            writeError(response, "Unknown worker");
+                    }
+                    else
+                        writeError(response, "Unknown request");
+                }
+                catch (const SerializationError& e)
+                {
+                    writeError(response, e.what());
+                }
+                if (!detail::sendZygoteMessage(fd, response))
+                    break;
+            }
+
+            for (std::set<pid_t>::const_iterator it = workers.begin(); it != workers.end(); ++it)
+                kill(*it, SIGTERM);
+            for (std::set<pid_t>::const_iterator it = workers.begin(); it != workers.end(); ++it)
+                while (waitpid(*it, NULL, 0) < 0 && errno == EINTR)
+                    continue;
+            close(fd);
+            // Skip the static destructors inherited from the owner process
+            _exit(0);
+        }
+
+        // Fork a worker from the template process
+        pid_t forkWorker(int fd, const std::string& argument, std::string& error)
+        {
+            if (detail::threadCount() > 1)
+            {
+                error = "Cannot fork a worker: warmup hooks left threads running in the template process";
+                return 0;
+            }
+            if (prepare_)
+                prepare_();
+            std::fflush(NULL);
+            pid_t pid = fork();
+            if (pid == 0)
+            {
+                close(fd);
+                if (child_)
+                    child_();
+                int res = workerMain_(argument);
+                std::fflush(NULL);
+                _exit(res);
+            }
+            if (parent_)
+                parent_();
+            if (pid < 0)
+            {
+                error = std::string("fork() failed: ") + std::strerror(errno);
+                return 0;
+            }
+            return pid;
+        }
+
+        // Entry point of the workers
+        WorkerMain workerMain_;
+        // Warmup hooks
+        std::vector<WarmupHook> hooks_;
+        // Fork handlers
+        ForkHandler prepare_;
+        ForkHandler parent_;
+        ForkHandler child_;
+        // Process id of the template process
+        pid_t pid_;
+        // Control socket connected to the template process
+        int fd_;
+        // Error message
+        std::string errorMsg_;
+        // Serializes requests to the template process
+        mutable std::mutex mutex_;
+    };
+}
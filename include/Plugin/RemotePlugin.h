@@ -0,0 +1,535 @@
+//          Copyright Jeremy Coulon 2012-2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+/** @file */
+
+#pragma once
+
+//==============
+//==  Plugin  ==
+//==============
+#include "Plugin/InterfaceDescription.h"
+#include "Plugin/PluginLoader.h"
+#include "Plugin/Serialization.h"
+#include "Plugin/SharedMemory.h"
+#include "Plugin/SharedMemoryRing.h"
+
+//=============
+//==  Boost  ==
+//=============
+#include <boost/noncopyable.hpp>
+
+//===========
+//==  STD  ==
+//===========
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <stdint.h>
+
+//=======================
+//==  OS Specific SDK  ==
+//=======================
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char** environ;
+
+/// Namespace of the Plugin library
+namespace Plugin
+{
+    /// Error raised when a call to an out-of-process plugin fails
+    /**
+      * The call failed either because the plugin host is not running,
+      * because it terminated during the call,
+      * or because the plugin method threw an exception.
+      */
+    class RemoteCallError : public std::runtime_error
+    {
+    public:
+        /// Constructor
+        explicit RemoteCallError(const std::string& what)
+            : std::runtime_error(what)
+        {
+            // Empty
+        }
+    };
+
+    namespace detail
+    {
+        // Layout of the shared memory channel between a loader and its host:
+        // [RemoteChannelHeader][request ring][response ring]
+        struct RemoteChannelHeader
+        {
+            uint32_t magic;
+            uint32_t version;
+            uint64_t ringCapacity;
+            char padding[48];
+        };
+
+        static const uint32_t remoteChannelMagic = 0x504c4748; // "PLGH"
+        static const uint32_t remoteChannelVersion = 1;
+
+        // Request kinds sent by the loader
+        enum RemoteRequest
+        {
+            remoteCall = 0,
+            remoteShutdown = 1
+        };
+
+        // Response status sent by the host
+        enum RemoteStatus
+        {
+            remoteOk = 0,
+            remoteError = 1
+        };
+
+        inline std::size_t remoteRingOffset(std::size_t ringCapacity, unsigned int ring)
+        {
+            std::size_t ringSize = (SharedMemoryRing::requiredSize(ringCapacity) + 63) & ~static_cast<std::size_t>(63);
+            return sizeof(RemoteChannelHeader) + ring * ringSize;
+        }
+
+        inline std::size_t remoteChannelSize(std::size_t ringCapacity)
+        {
+            return remoteRingOffset(ringCapacity, 2);
+        }
+
+        // Serialize the arguments of a call as the parameter types of the method
+        template<class Arguments>
+        struct ArgumentWriter;
+
+        template<class... D>
+        struct ArgumentWriter<std::tuple<D...> >
+        {
+            template<class... A>
+            static void write(MessageWriter& writer, A&&... args)
+            {
+                static_assert(sizeof...(A) == sizeof...(D), "Wrong number of arguments");
+                int expand[] = { 0, (Serializer<D>::write(writer, args), 0)... };
+                (void)expand;
+            }
+        };
+
+        // Decode the result of a call
+        template<class R>
+        struct ResultReader
+        {
+            static R read(MessageReader& reader)
+            {
+                return Serializer<R>::read(reader);
+            }
+        };
+
+        template<>
+        struct ResultReader<void>
+        {
+            static void read(MessageReader&)
+            {
+                // Empty
+            }
+        };
+
+        inline std::string uniqueChannelName()
+        {
+            static std::atomic<unsigned int> counter(0);
+            std::ostringstream oss;
+            oss << "/plugin-host-" << getpid() << "-" << counter.fetch_add(1);
+            return oss.str();
+        }
+
+        // Environment of the host: inherited variables, replaced by the overrides of the same name,
+        // as getenv() returns the first one. Pointers refer to the arguments. Terminated by NULL.
+        inline std::vector<const char*> hostEnvironment(char** inherited, const std::vector<std::string>& overrides)
+        {
+            std::vector<const char*> res;
+            for (char** var = inherited; *var; ++var)
+            {
+                bool overridden = false;
+                for (std::size_t i = 0; i < overrides.size() && !overridden; ++i)
+                {
+                    std::size_t length = overrides[i].find('=');
+                    overridden = length != std::string::npos && std::strncmp(*var, overrides[i].c_str(), length + 1) == 0;
+                }
+                if (!overridden)
+                    res.push_back(*var);
+            }
+            for (std::size_t i = 0; i < overrides.size(); ++i)
+                res.push_back(overrides[i].c_str());
+            res.push_back(NULL);
+            return res;
+        }
+    }
+
+    /// Call a described method of an in-process plugin
+    /**
+      * This has the same syntax as Plugin::call() on out-of-process loaders and pools,
+      * so that code can switch between both modes without changes.
+      * @throw RemoteCallError if the plugin is not loaded
+      */
+    template<class T, class Pmf, class... A>
+    typename MethodTraits<Pmf>::value_type call(PluginLoader<T>& loader, Pmf pmf, A&&... args)
+    {
+        T* plugin = loader.getPluginInstance();
+        if (!plugin)
+            throw RemoteCallError("Plugin is not loaded");
+        return (plugin->*pmf)(std::forward<A>(args)...);
+    }
+
+    /// Loader of a concrete plugin running in a separate host process
+    /**
+      * The plugin is loaded by a host executable, typically built around
+      * runPluginHost<T>(), so that a crash of the plugin cannot take down the caller.
+      * Calls are serialized according to InterfaceDescription<T> and exchanged through
+      * two lock-free SPSC rings in shared memory, with futex wake-ups.
+      * Arguments and results are transferred by value with Serializer.
+      * Output parameters (non-const references) are not transferred back.
+      * This class is only available on POSIX platforms.
+      * @tparam T Interface type of the concrete plugin. It must be described with PLUGIN_INTERFACE_DESCRIPTION.
+      */
+    template<class T>
+    class RemotePluginLoader : private boost::noncopyable
+    {
+    public:
+        /// Constructor
+        /**
+          * @param name Filename of the concrete plugin, as seen by the host process
+          * @param hostPath Path of the host executable
+          * @param ringCapacity Capacity in bytes of each of the two rings
+          */
+        explicit RemotePluginLoader(const std::string& name = "",
+                                    const std::string& hostPath = "",
+                                    std::size_t ringCapacity = 1 << 20)
+            : name_(name),
+              hostPath_(hostPath),
+              ringCapacity_(ringCapacity),
+              pid_(0),
+              loadTimeoutMs_(10000)
+        {
+            // Empty
+        }
+
+        /// Destructor
+        /**
+          * Stops the host process if necessary.
+          */
+        ~RemotePluginLoader()
+        {
+            unload();
+        }
+
+        /// Start the host process and load the plugin into it
+        /**
+          * The facade is instantiated by the host before this method returns.
+          * @return True on success. False otherwise.
+          */
+        bool load()
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (pid_)
+                stopHost();
+            if (name_.empty() || hostPath_.empty())
+            {
+                errorMsg_ = "Plugin name and host path must be set";
+                return false;
+            }
+
+            std::string channelName = detail::uniqueChannelName();
+            if (!channel_.create(channelName, detail::remoteChannelSize(ringCapacity_)))
+            {
+                errorMsg_ = channel_.getErrorMsg();
+                return false;
+            }
+            detail::RemoteChannelHeader* header = static_cast<detail::RemoteChannelHeader*>(channel_.data());
+            header->magic = detail::remoteChannelMagic;
+            header->version = detail::remoteChannelVersion;
+            header->ringCapacity = ringCapacity_;
+            char* base = static_cast<char*>(channel_.data());
+            requests_.attach(base + detail::remoteRingOffset(ringCapacity_, 0), ringCapacity_, true);
+            responses_.attach(base + detail::remoteRingOffset(ringCapacity_, 1), ringCapacity_, true);
+
+            const char* argv[] = { hostPath_.c_str(), channelName.c_str(), name_.c_str(), NULL };
+            std::vector<const char*> envp = detail::hostEnvironment(environ, environment_);
+            pid_t pid = fork();
+            if (pid < 0)
+            {
+                errorMsg_ = "fork() failed";
+                channel_.close();
+                return false;
+            }
+            if (pid == 0)
+            {
+                // Child: only async-signal-safe calls until exec
+                execve(argv[0], const_cast<char* const*>(argv), const_cast<char* const*>(&envp[0]));
+                _exit(127);
+            }
+            pid_ = pid;
+
+            // Wait for the host to report the result of the load
+            if (!receive(loadTimeoutMs_))
+            {
+                stopHost();
+                return false;
+            }
+            // The host mapped the channel: its name is not needed any more.
+            // The host already removed it, unless it failed before.
+            channel_.unlink();
+            MessageReader reader(response_.data(), response_.size());
+            if (deserialize<uint8_t>(reader) != detail::remoteOk)
+            {
+                errorMsg_ = deserialize<std::string>(reader);
+                stopHost();
+                return false;
+            }
+            return true;
+        }
+
+        /// Unload the plugin and stop the host process
+        /**
+          * @return True if the host exited cleanly. False otherwise.
+          */
+        bool unload()
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return stopHost();
+        }
+
+        /// Check if the host process is running with the plugin loaded
+        bool isLoaded() const
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return pid_ != 0;
+        }
+
+        /// Call a method of the plugin facade in the host process
+        /**
+          * @param pmf Pointer to a method described in InterfaceDescription<T>
+          * @param args Arguments of the method
+          * @return The value returned by the plugin, by value
+          * @throw RemoteCallError if the call could not be completed
+          */
+        template<class Pmf, class... A>
+        typename MethodTraits<Pmf>::value_type call(Pmf pmf, A&&... args)
+        {
+            typedef typename MethodTraits<Pmf>::value_type Result;
+            std::size_t index = methodIndex<T>(pmf);
+            if (index == InterfaceDescription<T>::methodCount)
+                throw RemoteCallError("Method not described in InterfaceDescription");
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!pid_)
+                throw RemoteCallError("Plugin host is not running");
+
+            request_.clear();
+            MessageWriter writer(request_);
+            serialize<uint32_t>(writer, detail::remoteCall);
+            serialize<uint32_t>(writer, static_cast<uint32_t>(index));
+            detail::ArgumentWriter<typename MethodTraits<Pmf>::arguments_type>::write(writer, std::forward<A>(args)...);
+            if (!send())
+                throw RemoteCallError(errorMsg_);
+            if (!receive(-1))
+                throw RemoteCallError(errorMsg_);
+
+            MessageReader reader(response_.data(), response_.size());
+            if (deserialize<uint8_t>(reader) != detail::remoteOk)
+                throw RemoteCallError(deserialize<std::string>(reader));
+            return detail::ResultReader<Result>::read(reader);
+        }
+
+        /// Get error message
+        /**
+          * If load() or unload() returns false,
+          * you can call this method to get an explanation of the error.
+          */
+        std::string getErrorMsg() const
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return errorMsg_;
+        }
+
+        /// Get the plugin filename
+        const std::string& getPluginName() const
+        {
+            return name_;
+        }
+
+        /// Set the plugin filename
+        void setPluginName(const std::string& name)
+        {
+            name_ = name;
+        }
+
+        /// Get the path of the host executable
+        const std::string& getHostPath() const
+        {
+            return hostPath_;
+        }
+
+        /// Set the path of the host executable
+        void setHostPath(const std::string& hostPath)
+        {
+            hostPath_ = hostPath;
+        }
+
+        /// Add variables to the environment of the host process
+        /**
+          * Takes effect at the next load().
+          * @param variables Entries of the form "NAME=value"
+          */
+        void setHostEnvironment(const std::vector<std::string>& variables)
+        {
+            environment_ = variables;
+        }
+
+        /// Get the process id of the host. Zero if not running.
+        pid_t getHostPid() const
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return pid_;
+        }
+
+    private:
+        // Check if the host process terminated, and reap it
+        bool hostTerminated()
+        {
+            int status = 0;
+            pid_t res = waitpid(pid_, &status, WNOHANG);
+            if (res == 0)
+                return false;
+            std::ostringstream oss;
+            if (res > 0 && WIFSIGNALED(status))
+                oss << "Plugin host terminated by signal " << WTERMSIG(status);
+            else if (res > 0 && WIFEXITED(status))
+                oss << "Plugin host exited with status " << WEXITSTATUS(status);
+            else
+                oss << "Plugin host terminated";
+            errorMsg_ = oss.str();
+            pid_ = 0;
+            channel_.close();
+            return true;
+        }
+
+        bool send()
+        {
+            while (!requests_.push(request_.data(), request_.size(), 100))
+            {
+                if (request_.size() + sizeof(uint32_t) > requests_.capacity())
+                {
+                    errorMsg_ = "Request larger than the ring capacity";
+                    return false;
+                }
+                if (hostTerminated())
+                    return false;
+            }
+            return true;
+        }
+
+        bool receive(int timeoutMs)
+        {
+            typedef std::chrono::steady_clock Clock;
+            Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(timeoutMs);
+            while (!responses_.pop(response_, 100))
+            {
+                if (responses_.isBroken())
+                {
+                    // The host can no more be trusted
+                    killHost();
+                    errorMsg_ = "Plugin host sent an invalid message";
+                    return false;
+                }
+                if (hostTerminated())
+                    return false;
+                if (timeoutMs >= 0 && Clock::now() > deadline)
+                {
+                    errorMsg_ = "Plugin host did not answer in time";
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        bool stopHost()
+        {
+            if (!pid_)
+                return true;
+            bool res = true;
+            std::string previousErrorMsg = errorMsg_;
+            request_.clear();
+            MessageWriter writer(request_);
+            serialize<uint32_t>(writer, detail::remoteShutdown);
+            if (requests_.push(request_.data(), request_.size(), 100))
+            {
+                // Give the host a chance to unload the plugin cleanly
+                for (int i = 0; i < 100 && !hostTerminated(); ++i)
+                    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                if (!pid_)
+                    errorMsg_ = previousErrorMsg;
+            }
+            if (pid_)
+            {
+                killHost();
+                errorMsg_ = "Plugin host had to be killed";
+                res = false;
+            }
+            pid_ = 0;
+            channel_.close();
+            return res;
+        }
+
+        void killHost()
+        {
+            kill(pid_, SIGKILL);
+            waitpid(pid_, NULL, 0);
+            pid_ = 0;
+            channel_.close();
+        }
+
+        // Name or path of the plugin
+        std::string name_;
+        // Path of the host executable
+        std::string hostPath_;
+        // Additional environment of the host
+        std::vector<std::string> environment_;
+        // Capacity of each ring
+        std::size_t ringCapacity_;
+        // Process id of the host
+        pid_t pid_;
+        // Maximum duration of load()
+        int loadTimeoutMs_;
+        // Shared memory holding the rings
+        SharedMemoryRegion channel_;
+        // Loader to host messages
+        SharedMemoryRing requests_;
+        // Host to loader messages
+        SharedMemoryRing responses_;
+        // Reused message buffers
+        std::vector<char> request_;
+        std::vector<char> response_;
+        // Error message
+        std::string errorMsg_;
+        // Serializes calls, since each ring has a single producer
+        mutable std::mutex mutex_;
+    };
+
+    /// Call a described method of an out-of-process plugin
+    /**
+      * See RemotePluginLoader::call().
+      */
+    template<class T, class Pmf, class... A>
+    typename MethodTraits<Pmf>::value_type call(RemotePluginLoader<T>& loader, Pmf pmf, A&&... args)
+    {
+        return loader.call(pmf, std::forward<A>(args)...);
+    }
+}
@@ -0,0 +1,212 @@
+//          Copyright Jeremy Coulon 2012-2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+/** @file */
+
+#pragma once
+
+//==============
+//==  Plugin  ==
+//==============
+#include "Plugin/PluginLoader.h"
+#include "Plugin/RemotePlugin.h"
+
+//===========
+//==  STD  ==
+//===========
+#include <exception>
+#include <iostream>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+/// Namespace of the Plugin library
+namespace Plugin
+{
+    namespace detail
+    {
+        // Decode the arguments of a call, invoke the method and encode its result
+        template<class Pmf, class R, class... A>
+        struct MethodInvokerImpl
+        {
+            template<class T>
+            static void invoke(T* plugin, Pmf pmf, MessageReader& reader, MessageWriter& writer)
+            {
+                // Braced initialization guarantees left to right evaluation
+                std::tuple<typename std::decay<A>::type...> args { deserialize<typename std::decay<A>::type>(reader)... };
+                apply(plugin, pmf, args, writer, typename MakeIndexSequence<sizeof...(A)>::type(), std::is_void<R>());
+            }
+
+            template<class T, class Args, std::size_t... I>
+            static void apply(T* plugin, Pmf pmf, Args& args, MessageWriter& writer, IndexSequence<I...>, std::false_type)
+            {
+                serialize<typename std::decay<R>::type>(writer, (plugin->*pmf)(std::get<I>(args)...));
+            }
+
+            template<class T, class Args, std::size_t... I>
+            static void apply(T* plugin, Pmf pmf, Args& args, MessageWriter&, IndexSequence<I...>, std::true_type)
+            {
+                (plugin->*pmf)(std::get<I>(args)...);
+            }
+        };
+
+        template<class Pmf>
+        struct MethodInvoker;
+
+        template<class C, class R, class... A>
+        struct MethodInvoker<R (C::*)(A...)> : MethodInvokerImpl<R (C::*)(A...), R, A...>
+        {
+            // Empty
+        };
+
+        template<class C, class R, class... A>
+        struct MethodInvoker<R (C::*)(A...) const> : MethodInvokerImpl<R (C::*)(A...) const, R, A...>
+        {
+            // Empty
+        };
+
+        template<class T, std::size_t I>
+        void invokeDescribedMethod(T* plugin, MessageReader& reader, MessageWriter& writer)
+        {
+            typedef typename std::tuple_element<I, decltype(InterfaceDescription<T>::methods())>::type Pmf;
+            MethodInvoker<Pmf>::invoke(plugin, std::get<I>(InterfaceDescription<T>::methods()), reader, writer);
+        }
+
+        // Table of the invokers of every described method, indexed like the description
+        template<class T>
+        struct MethodTable
+        {
+            typedef void (*Invoker)(T*, MessageReader&, MessageWriter&);
+
+            template<std::size_t... I>
+            static const Invoker* get(IndexSequence<I...>)
+            {
+                static const Invoker table[] = { &invokeDescribedMethod<T, I>... };
+                return table;
+            }
+
+            static const Invoker* get()
+            {
+                return get(typename MakeIndexSequence<InterfaceDescription<T>::methodCount>::type());
+            }
+        };
+
+        inline void writeRemoteError(std::vector<char>& buffer, const std::string& message)
+        {
+            buffer.clear();
+            MessageWriter writer(buffer);
+            serialize<uint8_t>(writer, remoteError);
+            serialize<std::string>(writer, message);
+        }
+    }
+
+    /// Run the host side of a RemotePluginLoader
+    /**
+      * Call this function from the main() of your host executable.
+      * It loads the plugin with a PluginLoader, instantiates the facade,
+      * then serves calls until the loader asks it to stop
+      * or until the loader process disappears.
+      * Exceptions thrown by the plugin methods are reported to the caller.
+      * @tparam T Interface type of the concrete plugin. It must be described with PLUGIN_INTERFACE_DESCRIPTION.
+      * @param argc Argument count, as given to main()
+      * @param argv Arguments as given to main(): channel name and plugin filename
+      * @return Exit status of the host process
+      */
+    template<class T>
+    int runPluginHost(int argc, char** argv)
+    {
+        if (argc != 3)
+        {
+            std::cerr << "Usage: " << argv[0] << " <channel> <plugin>" << std::endl;
+            std::cerr << "This program is started by Plugin::RemotePluginLoader." << std::endl;
+            return 2;
+        }
+        pid_t parent = getppid();
+
+        SharedMemoryRegion channel;
+        if (!channel.open(argv[1]))
+        {
+            std::cerr << argv[0] << ": " << channel.getErrorMsg() << std::endl;
+            return 3;
+        }
+        // Both processes mapped the channel: do not leave its name behind if one of them crashes
+        channel.unlink();
+        detail::RemoteChannelHeader* header = static_cast<detail::RemoteChannelHeader*>(channel.data());
+        if (header->magic != detail::remoteChannelMagic || header->version != detail::remoteChannelVersion)
+        {
+            std::cerr << argv[0] << ": incompatible channel" << std::endl;
+            return 3;
+        }
+        std::size_t ringCapacity = static_cast<std::size_t>(header->ringCapacity);
+        char* base = static_cast<char*>(channel.data());
+        SharedMemoryRing requests;
+        SharedMemoryRing responses;
+        requests.attach(base + detail::remoteRingOffset(ringCapacity, 0), ringCapacity, false);
+        responses.attach(base + detail::remoteRingOffset(ringCapacity, 1), ringCapacity, false);
+
+        std::vector<char> request;
+        std::vector<char> response;
+        MessageWriter writer(response);
+
+        // Report the result of the load
+        PluginLoader<T> loader(argv[2]);
+        T* plugin = NULL;
+        if (loader.load())
+            plugin = loader.getPluginInstance();
+        if (plugin)
+            serialize<uint8_t>(writer, detail::remoteOk);
+        else
+            detail::writeRemoteError(response, "Failed to load plugin: " + loader.getErrorMsg());
+        responses.push(response.data(), response.size());
+        if (!plugin)
+            return 1;
+
+        const typename detail::MethodTable<T>::Invoker* methods = detail::MethodTable<T>::get();
+        while (true)
+        {
+            if (!requests.pop(request, 1000))
+            {
+                if (requests.isBroken())
+                {
+                    std::cerr << argv[0] << ": invalid request" << std::endl;
+                    break;
+                }
+                // Stop if the loader died without asking us to stop
+                if (getppid() != parent)
+                    break;
+                continue;
+            }
+            MessageReader reader(request.data(), request.size());
+            uint32_t kind = deserialize<uint32_t>(reader);
+            if (kind == detail::remoteShutdown)
+                break;
+
+            response.clear();
+            try
+            {
+                uint32_t index = deserialize<uint32_t>(reader);
+                if (index >= static_cast<uint32_t>(InterfaceDescription<T>::methodCount))
+                    throw SerializationError("Unknown method");
+                serialize<uint8_t>(writer, detail::remoteOk);
+                methods[index](plugin, reader, writer);
+            }
+            catch (const std::exception& e)
+            {
+                detail::writeRemoteError(response, e.what());
+            }
+            catch (...)
+            {
+                detail::writeRemoteError(response, "Unknown exception");
+            }
+            if (!responses.push(response.data(), response.size()))
+            {
+                detail::writeRemoteError(response, "Response larger than the ring capacity");
+                responses.push(response.data(), response.size());
+            }
+        }
+        return loader.unload() ? 0 : 1;
+    }
+}
@@ -0,0 +1,319 @@
+//          Copyright Jeremy Coulon 2012-2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+/** @file */
+
+#pragma once
+
+//==============
+//==  Plugin  ==
+//==============
+#include "Plugin/RemotePlugin.h"
+#include "Plugin/SharedMemory.h"
+
+//=============
+//==  Boost  ==
+//=============
+#include <boost/noncopyable.hpp>
+
+//===========
+//==  STD  ==
+//===========
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/// Name of the environment variable giving plugin hosts the prefix of the shared data regions
+#define PLUGIN_POOL_DATA_ENV "PLUGIN_POOL_DATA_PREFIX"
+
+/// Namespace of the Plugin library
+namespace Plugin
+{
+    /// Map, from a plugin host, a read-only data region published with RemotePluginPool::shareData()
+    /**
+      * Plugins running in the workers of a pool call this function to access
+      * data shared by every worker without copying it in each process.
+      * @param key Key given to RemotePluginPool::shareData()
+      * @param region Receives the read-only mapping
+      * @return True on success. False otherwise, e.g. when not running inside a pool worker.
+      */
+    inline bool openSharedPoolData(const std::string& key, SharedMemoryRegion& region)
+    {
+        const char* prefix = std::getenv(PLUGIN_POOL_DATA_ENV);
+        if (!prefix)
+            return false;
+        return region.open(prefix + key, true);
+    }
+
+    /// Pool of out-of-process hosts running the same plugin
+    /**
+      * Each call is sent to the worker with the least outstanding requests.
+      * A worker whose host process terminated is restarted on the next call that
+      * reaches it; the call that was running when it crashed fails with RemoteCallError,
+      * unless retries are enabled with setRetryCount().
+      * Every method is thread-safe.
+      * @tparam T Interface type of the concrete plugin. It must be described with PLUGIN_INTERFACE_DESCRIPTION.
+      */
+    template<class T>
+    class RemotePluginPool : private boost::noncopyable
+    {
+        struct Worker
+        {
+            Worker(const std::string& name, const std::string& hostPath, std::size_t ringCapacity)
+                : loader(name, hostPath, ringCapacity),
+                  outstanding(0),
+                  restarts(0),
+                  started(false)
+            {
+                // Empty
+            }
+
+            RemotePluginLoader<T> loader;
+            std::atomic<unsigned int> outstanding;
+            std::atomic<unsigned int> restarts;
+            bool started;
+            std::mutex restartMutex;
+        };
+
+        // Keep the outstanding count of a worker up to date during a call
+        class OutstandingGuard : private boost::noncopyable
+        {
+        public:
+            explicit OutstandingGuard(Worker& worker)
+                : worker_(worker)
+            {
+                worker_.outstanding.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            ~OutstandingGuard()
+            {
+                worker_.outstanding.fetch_sub(1, std::memory_order_relaxed);
+            }
+
+        private:
+            Worker& worker_;
+        };
+
+    public:
+        /// Constructor
+        /**
+          * @param name Filename of the concrete plugin, as seen by the host processes
+          * @param hostPath Path of the host executable
+          * @param workers Number of host processes
+          * @param ringCapacity Capacity in bytes of each ring of each worker
+          */
+        RemotePluginPool(const std::string& name,
+                         const std::string& hostPath,
+                         std::size_t workers,
+                         std::size_t ringCapacity = 1 << 20)
+            : next_(0),
+              retryCount_(0)
+        {
+            static std::atomic<unsigned int> poolCounter(0);
+            std::ostringstream oss;
+            oss << "/plugin-pool-" << getpid() << "-" << poolCounter.fetch_add(1) << "-";
+            dataPrefix_ = oss.str();
+            for (std::size_t i = 0; i < workers; ++i)
+                workers_.push_back(std::unique_ptr<Worker>(new Worker(name, hostPath, ringCapacity)));
+        }
+
+        /// Start every worker
+        /**
+          * @return True if all workers started. False otherwise.
+          */
+        bool load()
+        {
+            bool res = !workers_.empty();
+            for (std::size_t i = 0; i < workers_.size(); ++i)
+                res = start(*workers_[i]) && res;
+            return res;
+        }
+
+        /// Stop every worker
+        /**
+          * @return True if all workers exited cleanly. False otherwise.
+          */
+        bool unload()
+        {
+            bool res = true;
+            for (std::size_t i = 0; i < workers_.size(); ++i)
+                res = workers_[i]->loader.unload() && res;
+            return res;
+        }
+
+        /// Publish read-only data to the workers
+        /**
+          * The data is copied once into a shared memory region that every worker
+          * can map with openSharedPoolData(). Must be called before load().
+          * @param key Name of the data, unique within the pool
+          * @param data Content of the data
+          * @param size Size of the data in bytes
+          * @return True on success. False otherwise.
+          */
+        bool shareData(const std::string& key, const void* data, std::size_t size)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            std::unique_ptr<SharedMemoryRegion>& region = sharedData_[key];
+            region.reset(new SharedMemoryRegion);
+            if (!region->create(dataPrefix_ + key, size, true))
+            {
+                errorMsg_ = region->getErrorMsg();
+                sharedData_.erase(key);
+                return false;
+            }
+            std::memcpy(region->data(), data, size);
+            return true;
+        }
+
+        /// Get the shared memory name of data published with shareData()
+        std::string getSharedDataName(const std::string& key) const
+        {
+            return dataPrefix_ + key;
+        }
+
+        /// Call a method of the plugin facade on the least loaded worker
+        /**
+          * @param pmf Pointer to a method described in InterfaceDescription<T>
+          * @param args Arguments of the method
+          * @return The value returned by the plugin, by value
+          * @throw RemoteCallError if the call could not be completed
+          */
+        template<class Pmf, class... A>
+        typename MethodTraits<Pmf>::value_type call(Pmf pmf, const A&... args)
+        {
+            unsigned int attempt = 0;
+            while (true)
+            {
+                Worker& worker = select();
+                OutstandingGuard guard(worker);
+                try
+                {
+                    if (!worker.loader.isLoaded() && !start(worker))
+                        throw RemoteCallError(worker.loader.getErrorMsg());
+                    return worker.loader.call(pmf, args...);
+                }
+                catch (const RemoteCallError&)
+                {
+                    // An exception thrown by the plugin itself leaves the worker running
+                    if (worker.loader.isLoaded() || attempt++ >= retryCount_)
+                        throw;
+                }
+            }
+        }
+
+        /// Set how many times a call is retried on another worker after a crash
+        /**
+          * Only enable retries for idempotent methods:
+          * a crash may happen after the plugin performed part of the call.
+          */
+        void setRetryCount(unsigned int retryCount)
+        {
+            retryCount_ = retryCount;
+        }
+
+        /// Get the number of workers
+        std::size_t size() const
+        {
+            return workers_.size();
+        }
+
+        /// Get the process id of a worker. Zero if not running.
+        pid_t getWorkerPid(std::size_t index) const
+        {
+            return workers_[index]->loader.getHostPid();
+        }
+
+        /// Get the number of calls currently sent to a worker
+        unsigned int getOutstandingCalls(std::size_t index) const
+        {
+            return workers_[index]->outstanding.load(std::memory_order_relaxed);
+        }
+
+        /// Get how many times a worker was restarted
+        unsigned int getRestartCount(std::size_t index) const
+        {
+            return workers_[index]->restarts.load(std::memory_order_relaxed);
+        }
+
+        /// Get error message of the last failed load(), shareData() or worker restart
+        std::string getErrorMsg() const
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return errorMsg_;
+        }
+
+    private:
+        // Least outstanding requests, ties broken round-robin
+        Worker& select()
+        {
+            std::size_t count = workers_.size();
+            std::size_t start = next_.fetch_add(1, std::memory_order_relaxed);
+            std::size_t best = start % count;
+            unsigned int bestLoad = workers_[best]->outstanding.load(std::memory_order_relaxed);
+            for (std::size_t i = 1; i < count && bestLoad != 0; ++i)
+            {
+                std::size_t candidate = (start + i) % count;
+                unsigned int load = workers_[candidate]->outstanding.load(std::memory_order_relaxed);
+                if (load < bestLoad)
+                {
+                    best = candidate;
+                    bestLoad = load;
+                }
+            }
+            return *workers_[best];
+        }
+
+        bool start(Worker& worker)
+        {
+            std::lock_guard<std::mutex> restartLock(worker.restartMutex);
+            if (worker.loader.isLoaded())
+                return true;
+            std::vector<std::string> environment(1, std::string(PLUGIN_POOL_DATA_ENV "=") + dataPrefix_);
+            worker.loader.setHostEnvironment(environment);
+            if (!worker.loader.load())
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                errorMsg_ = worker.loader.getErrorMsg();
+                return false;
+            }
+            if (worker.started)
+                worker.restarts.fetch_add(1, std::memory_order_relaxed);
+            worker.started = true;
+            return true;
+        }
+
+        // Worker processes
+        std::vector<std::unique_ptr<Worker> > workers_;
+        // Round-robin cursor used to break ties
+        std::atomic<std::size_t> next_;
+        // Number of retries after a crash
+        unsigned int retryCount_;
+        // Prefix of the shared data region names
+        std::string dataPrefix_;
+        // Shared data regions by key
+        std::map<std::string, std::unique_ptr<SharedMemoryRegion> > sharedData_;
+        // Error message
+        std::string errorMsg_;
+        // Protects sharedData_ and errorMsg_
+        mutable std::mutex mutex_;
+    };
+
+    /// Call a described method through a pool of out-of-process plugins
+    /**
+      * See RemotePluginPool::call().
+      */
+    template<class T, class Pmf, class... A>
+    typename MethodTraits<Pmf>::value_type call(RemotePluginPool<T>& pool, Pmf pmf, const A&... args)
+    {
+        return pool.call(pmf, args...);
+    }
+}
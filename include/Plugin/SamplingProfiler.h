@@ -0,0 +1,410 @@
+//          Copyright Jeremy Coulon 2012-2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+/** @file */
+
+#pragma once
+
+//==============
+//==  Plugin  ==
+//==============
+#include "Plugin/LibraryInfo.h"
+#include "Plugin/ModuleTracker.h"
+
+//=============
+//==  Boost  ==
+//=============
+#include <boost/noncopyable.hpp>
+
+//===========
+//==  STD  ==
+//===========
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <stdint.h>
+
+//=======================
+//==  OS Specific SDK  ==
+//=======================
+#ifdef __linux__
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <ucontext.h>
+#include <unistd.h>
+#endif
+
+/// Namespace of the Plugin library
+namespace Plugin
+{
+    /// CPU share of a module in a profile
+    struct ModuleShare
+    {
+        /// Path of the module
+        std::string path;
+        /// Samples whose innermost frame is in the module
+        uint64_t selfSamples;
+        /// Samples with at least one frame in the module
+        uint64_t totalSamples;
+    };
+
+    /// Sampling profiler attributing CPU time to the loaded plugins
+    /**
+      * While running, the process receives SIGPROF at a fixed interval of consumed CPU time.
+      * The handler records the interrupted address and a few return addresses found by following
+      * frame pointers, and the module of each one according to ModuleTracker, which PluginLoader
+      * keeps up to date on each load and unload. Samples of plugins unloaded since can therefore still
+      * be attributed. Frames of code built without frame pointers are skipped or lost.
+      * Memory is read with process_vm_readv(), so that a broken frame chain cannot crash the process.
+      *
+      * Profiles are written in the folded format of flame graph tools, one stack per line,
+      * or as the self and total share of each module. Only one profiler may run at a time,
+      * and it needs SIGPROF for itself. Only available on Linux, on x86 and ARM 64 bits.
+      */
+    class SamplingProfiler : private boost::noncopyable
+    {
+    public:
+        /// Maximum number of frames per sample
+        static const std::size_t maxDepth = 16;
+
+        /// Constructor
+        /**
+          * @param capacity Maximum number of samples. Later samples are dropped.
+          */
+        explicit SamplingProfiler(std::size_t capacity = 100000)
+            : samples_(new Sample[capacity]),
+              capacity_(capacity),
+              next_(0),
+              dropped_(0),
+              running_(false)
+        {
+            // Empty
+        }
+
+        /// Destructor. Stops the profiler.
+        ~SamplingProfiler()
+        {
+            stop();
+        }
+
+        /// Start sampling
+        /**
+          * @param interval CPU time between two samples, for the whole process
+          * @return True on success. False otherwise, see getErrorMsg().
+          */
+        bool start(std::chrono::microseconds interval = std::chrono::milliseconds(10))
+        {
+            if (running_)
+                return true;
+#if defined(__linux__) && (defined(__x86_64__) || defined(__aarch64__))
+            SamplingProfiler* expected = NULL;
+            if (!active().compare_exchange_strong(expected, this))
+            {
+                errorMsg_ = "Another sampling profiler is running";
+                return false;
+            }
+            ModuleTracker::instance().startTracking();
+            struct sigaction action;
+            action.sa_sigaction = &SamplingProfiler::handler;
+            sigemptyset(&action.sa_mask);
+            action.sa_flags = SA_SIGINFO | SA_RESTART;
+            struct itimerval timer;
+            timer.it_interval.tv_sec = static_cast<time_t>(interval.count() / 1000000);
+            timer.it_interval.tv_usec = static_cast<suseconds_t>(interval.count() % 1000000);
+            timer.it_value = timer.it_interval;
+            if (sigaction(SIGPROF, &action, &previousAction_) != 0 || setitimer(ITIMER_PROF, &timer, NULL) != 0)
+            {
+                errorMsg_ = "Cannot start the SIGPROF timer";
+                ModuleTracker::instance().stopTracking();
+                active().store(NULL);
+                return false;
+            }
+            running_ = true;
+            return true;
+#else
+            (void)interval;
+            errorMsg_ = "Sampling profiler is not supported on this platform";
+            return false;
+#endif
+        }
+
+        /// Stop sampling. Samples are kept.
+        void stop()
+        {
+            if (!running_)
+                return;
+#ifdef __linux__
+            struct itimerval timer = {};
+            setitimer(ITIMER_PROF, &timer, NULL);
+            active().store(NULL);
+            // Wait for handlers still running on other threads
+            while (inHandler().load() != 0)
+                std::this_thread::yield();
+            sigaction(SIGPROF, &previousAction_, NULL);
+            ModuleTracker::instance().stopTracking();
+#endif
+            running_ = false;
+        }
+
+        /// Check whether the profiler is sampling
+        bool isRunning() const
+        {
+            return running_;
+        }
+
+        /// Get the number of recorded samples
+        uint64_t getSampleCount() const
+        {
+            return std::min<uint64_t>(next_.load(), capacity_);
+        }
+
+        /// Get the number of samples dropped because the profiler was full
+        uint64_t getDroppedCount() const
+        {
+            return dropped_.load();
+        }
+
+        /// Get the self and total share of each module, by decreasing total
+        std::vector<ModuleShare> getModuleShares() const
+        {
+            std::map<uint32_t, ModuleShare> shares;
+            std::size_t count = static_cast<std::size_t>(getSampleCount());
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                const Sample& sample = samples_[i];
+                if (!sample.ready.load(std::memory_order_acquire) || sample.depth == 0)
+                    continue;
+                std::set<uint32_t> seen(sample.modules, sample.modules + sample.depth);
+                for (std::set<uint32_t>::const_iterator it = seen.begin(); it != seen.end(); ++it)
+                    share(shares, *it).totalSamples++;
+                share(shares, sample.modules[0]).selfSamples++;
+            }
+            std::vector<ModuleShare> res;
+            for (std::map<uint32_t, ModuleShare>::const_iterator it = shares.begin(); it != shares.end(); ++it)
+                res.push_back(it->second);
+            std::sort(res.begin(), res.end(), [](const ModuleShare& a, const ModuleShare& b) { return a.totalSamples > b.totalSamples; });
+            return res;
+        }
+
+        /// Write the self and total CPU share of each module, one per line
+        void writeModuleShares(std::ostream& os) const
+        {
+            uint64_t count = getSampleCount();
+            std::vector<ModuleShare> shares = getModuleShares();
+            for (std::size_t i = 0; i < shares.size(); ++i)
+            {
+                os << shares[i].path
+                   << " self=" << 100.0 * shares[i].selfSamples / count << "%"
+                   << " total=" << 100.0 * shares[i].totalSamples / count << "%"
+                   << " samples=" << shares[i].totalSamples << std::endl;
+            }
+        }
+
+        /// Write the profile in the folded stack format: "outer;...;inner count" per line
+        /**
+          * Frames of modules still loaded are named by symbol when possible.
+          * Other frames are written as "module+0xoffset", the offset from the load bias of the module.
+          */
+        void writeFolded(std::ostream& os) const
+        {
+            std::map<std::string, uint64_t> stacks;
+            std::map<std::pair<uint32_t, std::size_t>, std::string> names;
+            ModuleTracker& tracker = ModuleTracker::instance();
+            const ModuleSnapshot* snapshot = tracker.acquire();
+            std::size_t count = static_cast<std::size_t>(getSampleCount());
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                const Sample& sample = samples_[i];
+                if (!sample.ready.load(std::memory_order_acquire) || sample.depth == 0)
+                    continue;
+                std::string stack;
+                for (std::size_t d = sample.depth; d-- > 0; )
+                {
+                    // Return addresses point after the call
+                    std::size_t address = sample.pcs[d] - (d > 0 ? 1 : 0);
+                    std::pair<uint32_t, std::size_t> key(sample.modules[d], address);
+                    std::map<std::pair<uint32_t, std::size_t>, std::string>::iterator it = names.find(key);
+                    if (it == names.end())
+                        it = names.insert(std::make_pair(key, frameName(snapshot, sample.modules[d], address))).first;
+                    if (!stack.empty())
+                        stack += ';';
+                    stack += it->second;
+                }
+                stacks[stack]++;
+            }
+            tracker.release();
+            for (std::map<std::string, uint64_t>::const_iterator it = stacks.begin(); it != stacks.end(); ++it)
+                os << it->first << " " << it->second << std::endl;
+        }
+
+        /// Forget the samples. The profiler must be stopped.
+        void clear()
+        {
+            std::size_t count = static_cast<std::size_t>(getSampleCount());
+            for (std::size_t i = 0; i < count; ++i)
+                samples_[i].ready.store(false);
+            next_.store(0);
+            dropped_.store(0);
+        }
+
+        /// Get error message
+        const std::string& getErrorMsg() const
+        {
+            return errorMsg_;
+        }
+
+    private:
+        struct Sample
+        {
+            Sample()
+                : ready(false),
+                  depth(0)
+            {
+                // Empty
+            }
+
+            std::atomic<bool> ready;
+            std::size_t depth;
+            // Innermost frame first
+            std::size_t pcs[maxDepth];
+            uint32_t modules[maxDepth];
+        };
+
+        static std::atomic<SamplingProfiler*>& active()
+        {
+            static std::atomic<SamplingProfiler*> profiler(NULL);
+            return profiler;
+        }
+
+        static std::atomic<int>& inHandler()
+        {
+            static std::atomic<int> count(0);
+            return count;
+        }
+
+        static ModuleShare& share(std::map<uint32_t, ModuleShare>& shares, uint32_t module)
+        {
+            std::map<uint32_t, ModuleShare>::iterator it = shares.find(module);
+            if (it != shares.end())
+                return it->second;
+            ModuleShare& res = shares[module];
+            LibraryInfo info;
+            res.path = ModuleTracker::instance().getModule(module, info) ? info.path : "[unknown]";
+            res.selfSamples = 0;
+            res.totalSamples = 0;
+            return res;
+        }
+
+        static std::string frameName(const ModuleSnapshot* snapshot, uint32_t module, std::size_t address)
+        {
+            LibraryInfo info;
+            if (!ModuleTracker::instance().getModule(module, info))
+                return "[unknown]";
+            std::string path = info.path.substr(info.path.find_last_of('/') + 1);
+#ifdef __linux__
+            // The module may have been replaced since the sample: only name symbols of mapped modules
+            Dl_info symbol;
+            if (snapshot && snapshot->contains(module) && dladdr(reinterpret_cast<void*>(address), &symbol) && symbol.dli_sname)
+            {
+                int status = 0;
+                char* demangled = abi::__cxa_demangle(symbol.dli_sname, NULL, NULL, &status);
+                std::string res = path + "`" + (status == 0 && demangled ? demangled : symbol.dli_sname);
+                std::free(demangled);
+                // Semicolons separate frames in the folded format
+                std::replace(res.begin(), res.end(), ';', ',');
+                return res;
+            }
+#else
+            (void)snapshot;
+#endif
+            std::ostringstream oss;
+            oss << path << "+0x" << std::hex << address - info.base;
+            return oss.str();
+        }
+
+#ifdef __linux__
+        static void handler(int, siginfo_t*, void* context)
+        {
+            int savedErrno = errno;
+            inHandler().fetch_add(1);
+            SamplingProfiler* profiler = active().load();
+            if (profiler)
+                profiler->record(static_cast<ucontext_t*>(context));
+            inHandler().fetch_sub(1);
+            errno = savedErrno;
+        }
+
+        // Read memory that may be unmapped, without faulting
+        static bool readWords(std::size_t address, std::size_t* words, std::size_t count)
+        {
+            struct iovec local = { words, count * sizeof(std::size_t) };
+            struct iovec remote = { reinterpret_cast<void*>(address), count * sizeof(std::size_t) };
+            return process_vm_readv(getpid(), &local, 1, &remote, 1, 0) == static_cast<ssize_t>(count * sizeof(std::size_t));
+        }
+
+        void record(const ucontext_t* context)
+        {
+            uint64_t index = next_.fetch_add(1);
+            if (index >= capacity_)
+            {
+                dropped_.fetch_add(1);
+                return;
+            }
+            Sample& sample = samples_[index];
+#if defined(__x86_64__)
+            std::size_t pc = static_cast<std::size_t>(context->uc_mcontext.gregs[REG_RIP]);
+            std::size_t fp = static_cast<std::size_t>(context->uc_mcontext.gregs[REG_RBP]);
+#elif defined(__aarch64__)
+            std::size_t pc = static_cast<std::size_t>(context->uc_mcontext.pc);
+            std::size_t fp = static_cast<std::size_t>(context->uc_mcontext.regs[29]);
+#endif
+            std::size_t depth = 0;
+            sample.pcs[depth++] = pc;
+            // Frame records hold the caller frame pointer, then the return address
+            while (depth < maxDepth && fp != 0 && fp % sizeof(std::size_t) == 0)
+            {
+                std::size_t record[2];
+                if (!readWords(fp, record, 2) || record[1] == 0)
+                    break;
+                sample.pcs[depth++] = record[1];
+                // Stacks grow down: callers have higher frames
+                if (record[0] <= fp)
+                    break;
+                fp = record[0];
+            }
+            ModuleTracker& tracker = ModuleTracker::instance();
+            const ModuleSnapshot* snapshot = tracker.acquire();
+            for (std::size_t d = 0; d < depth; ++d)
+                sample.modules[d] = snapshot ? snapshot->findModule(sample.pcs[d]) : 0;
+            tracker.release();
+            sample.depth = depth;
+            sample.ready.store(true, std::memory_order_release);
+        }
+
+        struct sigaction previousAction_;
+#endif
+
+        std::unique_ptr<Sample[]> samples_;
+        std::size_t capacity_;
+        std::atomic<uint64_t> next_;
+        std::atomic<uint64_t> dropped_;
+        bool running_;
+        std::string errorMsg_;
+    };
+}
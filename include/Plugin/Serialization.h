@@ -0,0 +1,203 @@
+//          Copyright Jeremy Coulon 2012-2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+/** @file */
+
+#pragma once
+
+//===========
+//==  STD  ==
+//===========
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/// Namespace of the Plugin library
+namespace Plugin
+{
+    /// Error raised when a message cannot be decoded
+    class SerializationError : public std::runtime_error
+    {
+    public:
+        /// Constructor
+        explicit SerializationError(const std::string& what)
+            : std::runtime_error(what)
+        {
+            // Empty
+        }
+    };
+
+    /// Append binary data to a message buffer
+    class MessageWriter
+    {
+    public:
+        /// Constructor
+        /**
+          * @param buffer Buffer the data is appended to
+          */
+        explicit MessageWriter(std::vector<char>& buffer)
+            : buffer_(buffer)
+        {
+            // Empty
+        }
+
+        /// Append raw bytes
+        void write(const void* data, std::size_t size)
+        {
+            const char* bytes = static_cast<const char*>(data);
+            buffer_.insert(buffer_.end(), bytes, bytes + size);
+        }
+
+    private:
+        std::vector<char>& buffer_;
+    };
+
+    /// Read binary data from a message buffer
+    class MessageReader
+    {
+    public:
+        /// Constructor
+        MessageReader(const char* data, std::size_t size)
+            : current_(data),
+              end_(data + size)
+        {
+            // Empty
+        }
+
+        /// Read raw bytes
+        /**
+          * @throw SerializationError if the message is too short
+          */
+        void read(void* data, std::size_t size)
+        {
+            if (static_cast<std::size_t>(end_ - current_) < size)
+                throw SerializationError("Truncated message");
+            std::memcpy(data, current_, size);
+            current_ += size;
+        }
+
+        /// Get the number of bytes left
+        std::size_t remaining() const
+        {
+            return static_cast<std::size_t>(end_ - current_);
+        }
+
+    private:
+        const char* current_;
+        const char* end_;
+    };
+
+    /// Binary encoding of a type
+    /**
+      * Specialize this template to transfer your own types.
+      * A specialization provides:
+      * - static void write(MessageWriter&, const T&)
+      * - static T read(MessageReader&)
+      * The library provides specializations for arithmetic types, enums,
+      * std::string, std::vector and std::pair.
+      * Pointers cannot be transferred.
+      */
+    template<class T, class Enable = void>
+    struct Serializer;
+
+    /// Encoding of arithmetic and enum types
+    template<class T>
+    struct Serializer<T, typename std::enable_if<std::is_arithmetic<T>::value || std::is_enum<T>::value>::type>
+    {
+        static void write(MessageWriter& writer, const T& value)
+        {
+            writer.write(&value, sizeof(T));
+        }
+
+        static T read(MessageReader& reader)
+        {
+            T value;
+            reader.read(&value, sizeof(T));
+            return value;
+        }
+    };
+
+    /// Encoding of strings
+    template<>
+    struct Serializer<std::string>
+    {
+        static void write(MessageWriter& writer, const std::string& value)
+        {
+            Serializer<std::size_t>::write(writer, value.size());
+            writer.write(value.data(), value.size());
+        }
+
+        static std::string read(MessageReader& reader)
+        {
+            std::size_t size = Serializer<std::size_t>::read(reader);
+            if (size > reader.remaining())
+                throw SerializationError("Truncated string");
+            std::string value(size, '\0');
+            if (size)
+                reader.read(&value[0], size);
+            return value;
+        }
+    };
+
+    /// Encoding of vectors
+    template<class T>
+    struct Serializer<std::vector<T> >
+    {
+        static void write(MessageWriter& writer, const std::vector<T>& value)
+        {
+            Serializer<std::size_t>::write(writer, value.size());
+            for (std::size_t i = 0; i < value.size(); ++i)
+                Serializer<T>::write(writer, value[i]);
+        }
+
+        static std::vector<T> read(MessageReader& reader)
+        {
+            std::size_t size = Serializer<std::size_t>::read(reader);
+            if (size > reader.remaining())
+                throw SerializationError("Truncated vector");
+            std::vector<T> value;
+            value.reserve(size);
+            for (std::size_t i = 0; i < size; ++i)
+                value.push_back(Serializer<T>::read(reader));
+            return value;
+        }
+    };
+
+    /// Encoding of pairs
+    template<class T, class U>
+    struct Serializer<std::pair<T, U> >
+    {
+        static void write(MessageWriter& writer, const std::pair<T, U>& value)
+        {
+            Serializer<T>::write(writer, value.first);
+            Serializer<U>::write(writer, value.second);
+        }
+
+        static std::pair<T, U> read(MessageReader& reader)
+        {
+            T first = Serializer<T>::read(reader);
+            U second = Serializer<U>::read(reader);
+            return std::make_pair(first, second);
+        }
+    };
+
+    /// Write a value using its Serializer
+    template<class T>
+    void serialize(MessageWriter& writer, const T& value)
+    {
+        Serializer<T>::write(writer, value);
+    }
+
+    /// Read a value using its Serializer
+    template<class T>
+    T deserialize(MessageReader& reader)
+    {
+        return Serializer<T>::read(reader);
+    }
+}
@@ -0,0 +1,211 @@
+//          Copyright Jeremy Coulon 2012-2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+/** @file */
+
+#pragma once
+
+//=============
+//==  Boost  ==
+//=============
+#include <boost/noncopyable.hpp>
+
+//===========
+//==  STD  ==
+//===========
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <string>
+
+//=======================
+//==  OS Specific SDK  ==
+//=======================
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/// Namespace of the Plugin library
+namespace Plugin
+{
+    /// Named POSIX shared memory region mapped in the current process
+    /**
+      * The process that creates the region owns its name and unlinks it on close().
+      * Other processes open it by name. A name left by a crashed process stays in /dev/shm:
+      * regions only shared with known processes should be unlinked as soon as these processes mapped them.
+      * This class is only available on POSIX platforms.
+      */
+    class SharedMemoryRegion : private boost::noncopyable
+    {
+    public:
+        /// Constructor
+        SharedMemoryRegion()
+            : data_(NULL),
+              size_(0),
+              owner_(false)
+        {
+            // Empty
+        }
+
+        /// Destructor
+        /**
+          * Unmaps the region, and unlinks it if it was created by this object.
+          */
+        ~SharedMemoryRegion()
+        {
+            close();
+        }
+
+        /// Create a new region, zero filled
+        /**
+          * @param name Name of the region. Must start with a '/'.
+          * @param size Size of the region in bytes
+          * @param readOnlyForOthers Restrict the permissions of the region so that other users can only read it
+          * @return True on success. False otherwise.
+          */
+        bool create(const std::string& name, std::size_t size, bool readOnlyForOthers = false)
+        {
+            close();
+            int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, readOnlyForOthers ? 0644 : 0600);
+            if (fd < 0)
+                return saveErrorMsg("shm_open");
+            if (ftruncate(fd, static_cast<off_t>(size)) != 0)
+            {
+                saveErrorMsg("ftruncate");
+                ::close(fd);
+                shm_unlink(name.c_str());
+                return false;
+            }
+            bool res = map(fd, size, PROT_READ | PROT_WRITE);
+            ::close(fd);
+            if (!res)
+            {
+                shm_unlink(name.c_str());
+                return false;
+            }
+            name_ = name;
+            owner_ = true;
+            return true;
+        }
+
+        /// Open an existing region
+        /**
+          * @param name Name of the region
+          * @param readOnly Map the region read-only
+          * @return True on success. False otherwise.
+          */
+        bool open(const std::string& name, bool readOnly = false)
+        {
+            close();
+            int fd = shm_open(name.c_str(), readOnly ? O_RDONLY : O_RDWR, 0);
+            if (fd < 0)
+                return saveErrorMsg("shm_open");
+            struct stat info;
+            if (fstat(fd, &info) != 0)
+            {
+                saveErrorMsg("fstat");
+                ::close(fd);
+                return false;
+            }
+            bool res = map(fd, static_cast<std::size_t>(info.st_size), readOnly ? PROT_READ : PROT_READ | PROT_WRITE);
+            ::close(fd);
+            if (res)
+                name_ = name;
+            return res;
+        }
+
+        /// Remove the name of the region
+        /**
+          * Existing mappings stay valid, but no other process can open the region any more,
+          * and the memory is released when the last mapping goes away, even if a process crashes.
+          * Call it once every process that needs the region mapped it.
+          * @return True on success. False otherwise.
+          */
+        bool unlink()
+        {
+            if (name_.empty())
+                return false;
+            owner_ = false;
+            if (shm_unlink(name_.c_str()) != 0)
+                return saveErrorMsg("shm_unlink");
+            return true;
+        }
+
+        /// Unmap the region
+        /**
+          * The region is also unlinked if this object created it.
+          */
+        void close()
+        {
+            if (data_)
+                munmap(data_, size_);
+            if (owner_)
+                shm_unlink(name_.c_str());
+            data_ = NULL;
+            size_ = 0;
+            owner_ = false;
+            name_.clear();
+        }
+
+        /// Check if a region is mapped
+        bool isOpen() const
+        {
+            return data_ != NULL;
+        }
+
+        /// Get the address of the mapping
+        void* data() const
+        {
+            return data_;
+        }
+
+        /// Get the size of the mapping in bytes
+        std::size_t size() const
+        {
+            return size_;
+        }
+
+        /// Get the name of the region
+        const std::string& getName() const
+        {
+            return name_;
+        }
+
+        /// Get error message
+        const std::string& getErrorMsg() const
+        {
+            return errorMsg_;
+        }
+
+    private:
+        bool map(int fd, std::size_t size, int protection)
+        {
+            void* data = mmap(NULL, size, protection, MAP_SHARED, fd, 0);
+            if (data == MAP_FAILED)
+                return saveErrorMsg("mmap");
+            data_ = data;
+            size_ = size;
+            return true;
+        }
+
+        bool saveErrorMsg(const char* function)
+        {
+            errorMsg_ = std::string(function) + ": " + std::strerror(errno);
+            return false;
+        }
+
+        // Address of the mapping
+        void* data_;
+        // Size of the mapping
+        std::size_t size_;
+        // True if this object created the region
+        bool owner_;
+        // Name of the region
+        std::string name_;
+        // Error message
+        std::string errorMsg_;
+    };
+}
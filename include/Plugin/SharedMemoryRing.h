@@ -0,0 +1,331 @@
+//          Copyright Jeremy Coulon 2012-2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+/** @file */
+
+#pragma once
+
+//=============
+//==  Boost  ==
+//=============
+#include <boost/noncopyable.hpp>
+
+//===========
+//==  STD  ==
+//===========
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include <thread>
+#include <vector>
+
+#include <stdint.h>
+
+//=======================
+//==  OS Specific SDK  ==
+//=======================
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+/// Namespace of the Plugin library
+namespace Plugin
+{
+    namespace detail
+    {
+        // Spin hint for busy-wait loops
+        inline void cpuRelax()
+        {
+#if defined(__x86_64__) || defined(__i386__)
+            __builtin_ia32_pause();
+#elif defined(__aarch64__)
+            asm volatile("yield");
+#endif
+        }
+
+        // Sleep until *word != expected, a wake-up or the timeout (negative means infinite).
+        // The word may live in memory shared between processes.
+        inline void futexWait(std::atomic<uint32_t>* word, uint32_t expected, int timeoutMs)
+        {
+#ifdef __linux__
+            struct timespec timeout;
+            timeout.tv_sec = timeoutMs / 1000;
+            timeout.tv_nsec = (timeoutMs % 1000) * 1000000L;
+            syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAIT, expected,
+                    timeoutMs < 0 ? NULL : &timeout, NULL, 0);
+#else
+            if (word->load() == expected)
+                std::this_thread::sleep_for(std::chrono::microseconds(50));
+            (void)timeoutMs;
+#endif
+        }
+
+        // Wake every thread sleeping on the word
+        inline void futexWake(std::atomic<uint32_t>* word)
+        {
+#ifdef __linux__
+            syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAKE, INT32_MAX, NULL, NULL, 0);
+#else
+            (void)word;
+#endif
+        }
+    }
+
+    /// Single producer, single consumer ring buffer of messages
+    /**
+      * The ring lives in memory provided by the caller, typically a SharedMemoryRegion,
+      * so that the producer and the consumer can be in different processes.
+      * Each side uses its own SharedMemoryRing object attached to the same memory.
+      * Push and pop are lock-free. When the ring is empty (resp. full),
+      * the consumer (resp. producer) spins briefly, then sleeps on a futex
+      * that the other side only wakes when it knows somebody is sleeping.
+      */
+    class SharedMemoryRing : private boost::noncopyable
+    {
+        // Control block at the beginning of the shared memory.
+        // Producer and consumer fields live on different cache lines.
+        struct Header
+        {
+            alignas(64) std::atomic<uint64_t> head;
+            std::atomic<uint32_t> pushed;
+            std::atomic<uint32_t> consumerWaiting;
+            alignas(64) std::atomic<uint64_t> tail;
+            std::atomic<uint32_t> popped;
+            std::atomic<uint32_t> producerWaiting;
+            alignas(64) uint64_t capacity;
+        };
+
+    public:
+        /// Number of bytes of memory needed for a ring of a given capacity
+        static std::size_t requiredSize(std::size_t capacity)
+        {
+            return sizeof(Header) + capacity;
+        }
+
+        /// Default number of polling iterations before sleeping
+        /**
+          * Spinning only makes sense when the other side can run at the same time,
+          * so it is disabled on uniprocessor machines.
+          */
+        static unsigned int defaultSpinCount()
+        {
+            return std::thread::hardware_concurrency() > 1 ? 4000 : 0;
+        }
+
+        /// Constructor
+        /**
+          * @param spinCount Number of polling iterations before sleeping
+          */
+        explicit SharedMemoryRing(unsigned int spinCount = defaultSpinCount())
+            : header_(NULL),
+              data_(NULL),
+              capacity_(0),
+              cachedHead_(0),
+              cachedTail_(0),
+              spinCount_(spinCount),
+              broken_(false)
+        {
+            // Empty
+        }
+
+        /// Attach the ring to its memory
+        /**
+          * @param memory Memory of at least requiredSize(capacity) bytes, aligned on 64 bytes
+          * @param capacity Capacity of the ring in bytes
+          * @param initialize True for exactly one of the two sides, before the other side attaches
+          */
+        void attach(void* memory, std::size_t capacity, bool initialize)
+        {
+            header_ = static_cast<Header*>(memory);
+            data_ = static_cast<char*>(memory) + sizeof(Header);
+            capacity_ = capacity;
+            if (initialize)
+            {
+                new (header_) Header();
+                header_->head.store(0);
+                header_->pushed.store(0);
+                header_->consumerWaiting.store(0);
+                header_->tail.store(0);
+                header_->popped.store(0);
+                header_->producerWaiting.store(0);
+                header_->capacity = capacity;
+            }
+            cachedHead_ = header_->head.load();
+            cachedTail_ = header_->tail.load();
+            broken_ = false;
+        }
+
+        /// Get the capacity of the ring in bytes
+        std::size_t capacity() const
+        {
+            return capacity_;
+        }
+
+        /// Push a message
+        /**
+          * Must only be called by the producer.
+          * @param data Message content
+          * @param size Message size in bytes
+          * @param timeoutMs Time to wait for free space. Negative means infinite.
+          * @return True on success. False on timeout or if the message can never fit.
+          */
+        bool push(const void* data, std::size_t size, int timeoutMs = -1)
+        {
+            std::size_t needed = sizeof(uint32_t) + size;
+            if (needed > capacity_)
+                return false;
+            uint64_t head = header_->head.load(std::memory_order_relaxed);
+            if (capacity_ - (head - cachedTail_) < needed)
+            {
+                if (!waitFor(header_->popped, header_->producerWaiting, timeoutMs,
+                             [&]() { cachedTail_ = header_->tail.load(std::memory_order_acquire);
+                                     return capacity_ - (head - cachedTail_) >= needed; }))
+                    return false;
+            }
+            uint32_t length = static_cast<uint32_t>(size);
+            copyIn(head, &length, sizeof(length));
+            copyIn(head + sizeof(length), data, size);
+            header_->head.store(head + needed, std::memory_order_seq_cst);
+            header_->pushed.fetch_add(1, std::memory_order_seq_cst);
+            if (header_->consumerWaiting.load(std::memory_order_seq_cst))
+                detail::futexWake(&header_->pushed);
+            return true;
+        }
+
+        /// Pop a message
+        /**
+          * Must only be called by the consumer.
+          * @param message Receives the message content
+          * The producer may be another process: a message that does not fit
+          * in the data it published breaks the ring instead of being read, see isBroken().
+          * @param timeoutMs Time to wait for a message. Negative means infinite.
+          * @return True on success. False on timeout or if the ring is broken.
+          */
+        bool pop(std::vector<char>& message, int timeoutMs = -1)
+        {
+            if (broken_)
+                return false;
+            uint64_t tail = header_->tail.load(std::memory_order_relaxed);
+            if (cachedHead_ == tail)
+            {
+                if (!waitFor(header_->pushed, header_->consumerWaiting, timeoutMs,
+                             [&]() { cachedHead_ = header_->head.load(std::memory_order_acquire);
+                                     return cachedHead_ != tail; }))
+                    return false;
+            }
+            uint64_t available = cachedHead_ - tail;
+            uint32_t length = 0;
+            if (available >= sizeof(length) && available <= capacity_)
+                copyOut(tail, &length, sizeof(length));
+            if (available < sizeof(length) || available > capacity_ || length > available - sizeof(length))
+            {
+                broken_ = true;
+                return false;
+            }
+            message.resize(length);
+            if (length)
+                copyOut(tail + sizeof(length), &message[0], length);
+            header_->tail.store(tail + sizeof(length) + length, std::memory_order_seq_cst);
+            header_->popped.fetch_add(1, std::memory_order_seq_cst);
+            if (header_->producerWaiting.load(std::memory_order_seq_cst))
+                detail::futexWake(&header_->popped);
+            return true;
+        }
+
+        /// Check if the producer corrupted the ring
+        /**
+          * A broken ring cannot be popped any more: the channel must be recreated.
+          */
+        bool isBroken() const
+        {
+            return broken_;
+        }
+
+        /// Check if a message is available, without waiting
+        /**
+          * Must only be called by the consumer.
+          */
+        bool empty()
+        {
+            cachedHead_ = header_->head.load(std::memory_order_acquire);
+            return cachedHead_ == header_->tail.load(std::memory_order_relaxed);
+        }
+
+    private:
+        // Spin then sleep on a futex until ready() returns true
+        template<class Predicate>
+        bool waitFor(std::atomic<uint32_t>& sequence, std::atomic<uint32_t>& waiting, int timeoutMs, Predicate ready)
+        {
+            for (unsigned int i = 0; i < spinCount_; ++i)
+            {
+                if (ready())
+                    return true;
+                detail::cpuRelax();
+            }
+            typedef std::chrono::steady_clock Clock;
+            Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(timeoutMs < 0 ? 0 : timeoutMs);
+            while (true)
+            {
+                uint32_t seq = sequence.load(std::memory_order_seq_cst);
+                waiting.store(1, std::memory_order_seq_cst);
+                if (ready())
+                {
+                    waiting.store(0, std::memory_order_relaxed);
+                    return true;
+                }
+                int remaining = -1;
+                if (timeoutMs >= 0)
+                {
+                    remaining = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now()).count());
+                    if (remaining <= 0)
+                    {
+                        waiting.store(0, std::memory_order_relaxed);
+                        return ready();
+                    }
+                }
+                detail::futexWait(&sequence, seq, remaining);
+                waiting.store(0, std::memory_order_relaxed);
+                if (ready())
+                    return true;
+            }
+        }
+
+        void copyIn(uint64_t position, const void* data, std::size_t size)
+        {
+            std::size_t offset = static_cast<std::size_t>(position % capacity_);
+            std::size_t first = size < capacity_ - offset ? size : capacity_ - offset;
+            std::memcpy(data_ + offset, data, first);
+            std::memcpy(data_, static_cast<const char*>(data) + first, size - first);
+        }
+
+        void copyOut(uint64_t position, void* data, std::size_t size)
+        {
+            std::size_t offset = static_cast<std::size_t>(position % capacity_);
+            std::size_t first = size < capacity_ - offset ? size : capacity_ - offset;
+            std::memcpy(data, data_ + offset, first);
+            std::memcpy(static_cast<char*>(data) + first, data_, size - first);
+        }
+
+        // Control block in shared memory
+        Header* header_;
+        // Message storage in shared memory
+        char* data_;
+        // Size of the message storage
+        std::size_t capacity_;
+        // Last head seen by the consumer
+        uint64_t cachedHead_;
+        // Last tail seen by the producer
+        uint64_t cachedTail_;
+        // Polling iterations before sleeping
+        unsigned int spinCount_;
+        // True once the producer published an invalid message
+        bool broken_;
+    };
+}
@@ -0,0 +1,396 @@
+//          Copyright Jeremy Coulon 2012-2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+/** @file */
+
+#pragma once
+
+//==============
+//==  Plugin  ==
+//==============
+#include "Plugin/PluginLoader.h"
+
+//=============
+//==  Boost  ==
+//=============
+#include <boost/noncopyable.hpp>
+
+//===========
+//==  STD  ==
+//===========
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <stdint.h>
+
+/// Namespace of the Plugin library
+namespace Plugin
+{
+    template<class T> class SnapshotRegistry;
+
+    /// Immutable set of loaded plugins, published by a SnapshotRegistry
+    /**
+      * A plugin shared by several snapshots is unloaded with the last of them.
+      * @tparam T Interface type of the concrete plugins
+      */
+    template<class T>
+    class PluginSnapshot : private boost::noncopyable
+    {
+        friend class SnapshotRegistry<T>;
+
+        struct Entry
+        {
+            std::string name;
+            std::shared_ptr<PluginLoader<T> > loader;
+            T* plugin;
+        };
+
+    public:
+        /// Get the facade of a plugin
+        /**
+          * @param name Filename of the concrete plugin
+          * @return NULL if the plugin is not in the snapshot
+          */
+        T* get(const std::string& name) const
+        {
+            typename std::vector<Entry>::const_iterator it = std::lower_bound(entries_.begin(), entries_.end(), name,
+                [](const Entry& entry, const std::string& n) { return entry.name < n; });
+            return it != entries_.end() && it->name == name ? it->plugin : NULL;
+        }
+
+        /// Call a function on every plugin, in the order of the filenames
+        /**
+          * @param f Callable taking the plugin filename and a T* as arguments
+          */
+        template<class F>
+        void forEach(F f) const
+        {
+            for (std::size_t i = 0; i < entries_.size(); ++i)
+                f(entries_[i].name, entries_[i].plugin);
+        }
+
+        /// Get the filenames of the plugins, sorted
+        std::vector<std::string> getPluginNames() const
+        {
+            std::vector<std::string> res;
+            for (std::size_t i = 0; i < entries_.size(); ++i)
+                res.push_back(entries_[i].name);
+            return res;
+        }
+
+        /// Get the number of plugins
+        std::size_t size() const
+        {
+            return entries_.size();
+        }
+
+        /// Get the version of the snapshot. Each publication increments it.
+        uint64_t getVersion() const
+        {
+            return version_;
+        }
+
+    private:
+        explicit PluginSnapshot(uint64_t version)
+            : version_(version)
+        {
+            // Empty
+        }
+
+        // Plugins sorted by filename
+        std::vector<Entry> entries_;
+        // Publication number
+        uint64_t version_;
+    };
+
+    namespace detail
+    {
+        // Slot where a reader announces the snapshot it uses
+        struct SnapshotReaderSlot
+        {
+            SnapshotReaderSlot()
+                : owned(false),
+                  snapshot(NULL)
+            {
+                // Empty
+            }
+
+            std::atomic<bool> owned;
+            std::atomic<const void*> snapshot;
+            // Keep slots on separate cache lines
+            char padding[64];
+        };
+
+        // Slot tried first by the calling thread
+        inline std::size_t snapshotSlotHint()
+        {
+            static std::atomic<std::size_t> next(0);
+            static thread_local std::size_t hint = next.fetch_add(1, std::memory_order_relaxed);
+            return hint;
+        }
+    }
+
+    /// Set of plugins read on every request and written rarely
+    /**
+      * Readers get the current PluginSnapshot without any lock: they load the
+      * published pointer and announce it in a slot of their own, so that they never
+      * write to a cache line shared with other readers.
+      * Writers build a new snapshot, reusing the plugins already loaded, and publish it.
+      * Replaced snapshots are reclaimed by the writers once no reader announces them,
+      * unloading the plugins they were the last to hold.
+      * @tparam T Interface type of the concrete plugins
+      */
+    template<class T>
+    class SnapshotRegistry : private boost::noncopyable
+    {
+    public:
+        /// Access to the current snapshot
+        /**
+          * The snapshot and its plugins stay valid as long as the reader lives.
+          * Readers are meant to be short-lived, typically one per request.
+          */
+        class Reader : private boost::noncopyable
+        {
+        public:
+            /// Constructor
+            explicit Reader(const SnapshotRegistry& registry)
+                : slot_(registry.claimSlot()),
+                  snapshot_(NULL)
+            {
+                const PluginSnapshot<T>* current = registry.current_.load(std::memory_order_seq_cst);
+                while (true)
+                {
+                    slot_->snapshot.store(current, std::memory_order_seq_cst);
+                    // Announced before a writer could reclaim it, unless it was replaced meanwhile
+                    const PluginSnapshot<T>* check = registry.current_.load(std::memory_order_seq_cst);
+                    if (check == current)
+                        break;
+                    current = check;
+                }
+                snapshot_ = current;
+            }
+
+            /// Destructor
+            ~Reader()
+            {
+                slot_->snapshot.store(NULL, std::memory_order_release);
+                slot_->owned.store(false, std::memory_order_release);
+            }
+
+            /// Get the snapshot
+            const PluginSnapshot<T>& operator*() const
+            {
+                return *snapshot_;
+            }
+
+            /// Get the snapshot
+            const PluginSnapshot<T>* operator->() const
+            {
+                return snapshot_;
+            }
+
+        private:
+            // Slot announcing the snapshot
+            detail::SnapshotReaderSlot* slot_;
+            // Snapshot in use
+            const PluginSnapshot<T>* snapshot_;
+        };
+
+        /// Constructor
+        /**
+          * @param readerSlots Maximum number of concurrent readers. Extra readers wait for a slot.
+          */
+        explicit SnapshotRegistry(std::size_t readerSlots = 256)
+            : slots_(std::max<std::size_t>(readerSlots, 1)),
+              current_(new PluginSnapshot<T>(0))
+        {
+            // Empty
+        }
+
+        /// Destructor. No reader must be alive.
+        ~SnapshotRegistry()
+        {
+            for (std::size_t i = 0; i < retired_.size(); ++i)
+                delete retired_[i];
+            delete current_.load();
+        }
+
+        /// Publish a snapshot with one more plugin
+        /**
+          * @param name Filename of the concrete plugin
+          * @return False if the plugin could not be loaded. True otherwise.
+          */
+        bool add(const std::string& name)
+        {
+            std::lock_guard<std::mutex> lock(writeMutex_);
+            std::vector<std::string> names = current_.load()->getPluginNames();
+            if (std::find(names.begin(), names.end(), name) == names.end())
+                names.push_back(name);
+            return publishLocked(names);
+        }
+
+        /// Publish a snapshot without a plugin
+        /**
+          * The plugin is unloaded once no reader uses an older snapshot.
+          * @param name Filename of the concrete plugin
+          * @return False if the plugin is not in the current snapshot. True otherwise.
+          */
+        bool remove(const std::string& name)
+        {
+            std::lock_guard<std::mutex> lock(writeMutex_);
+            std::vector<std::string> names = current_.load()->getPluginNames();
+            std::vector<std::string>::iterator it = std::find(names.begin(), names.end(), name);
+            if (it == names.end())
+                return false;
+            names.erase(it);
+            return publishLocked(names);
+        }
+
+        /// Publish a snapshot made of the given plugins
+        /**
+          * Plugins of the current snapshot are reused, the others are loaded and instantiated.
+          * Nothing is published if one of them fails to load.
+          * @param names Filenames of the concrete plugins
+          * @return True on success. False otherwise.
+          */
+        bool publish(const std::vector<std::string>& names)
+        {
+            std::lock_guard<std::mutex> lock(writeMutex_);
+            return publishLocked(names);
+        }
+
+        /// Reclaim the replaced snapshots no reader uses anymore
+        /**
+          * Called by every publication. May be called periodically to unload removed plugins sooner.
+          * @return Number of snapshots still waiting for readers
+          */
+        std::size_t reclaim()
+        {
+            std::lock_guard<std::mutex> lock(writeMutex_);
+            return reclaimLocked();
+        }
+
+        /// Get the current version, without taking a snapshot
+        uint64_t getVersion() const
+        {
+            return current_.load(std::memory_order_acquire)->getVersion();
+        }
+
+        /// Get the error message of the last failed publication
+        std::string getErrorMsg() const
+        {
+            std::lock_guard<std::mutex> lock(writeMutex_);
+            return errorMsg_;
+        }
+
+    private:
+        bool publishLocked(const std::vector<std::string>& names)
+        {
+            const PluginSnapshot<T>* current = current_.load();
+            std::unique_ptr<PluginSnapshot<T> > next(new PluginSnapshot<T>(current->getVersion() + 1));
+            std::vector<std::string> sorted(names);
+            std::sort(sorted.begin(), sorted.end());
+            sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+            for (std::size_t i = 0; i < sorted.size(); ++i)
+            {
+                typename PluginSnapshot<T>::Entry entry;
+                entry.name = sorted[i];
+                typename std::vector<typename PluginSnapshot<T>::Entry>::const_iterator it =
+                    std::lower_bound(current->entries_.begin(), current->entries_.end(), sorted[i],
+                        [](const typename PluginSnapshot<T>::Entry& e, const std::string& n) { return e.name < n; });
+                if (it != current->entries_.end() && it->name == sorted[i])
+                {
+                    entry.loader = it->loader;
+                    entry.plugin = it->plugin;
+                }
+                else if ((entry.loader = loaders_[sorted[i]].lock()))
+                {
+                    // Removed, but still held by a retired snapshot: loading it again would share its facade
+                    entry.plugin = entry.loader->getPluginInstance();
+                }
+                else
+                {
+                    entry.loader.reset(new PluginLoader<T>(sorted[i]));
+                    entry.plugin = entry.loader->load() ? entry.loader->getPluginInstance() : NULL;
+                    if (!entry.plugin)
+                    {
+                        errorMsg_ = sorted[i] + ": " + entry.loader->getErrorMsg();
+                        return false;
+                    }
+                    loaders_[sorted[i]] = entry.loader;
+                }
+                next->entries_.push_back(entry);
+            }
+            retired_.push_back(current_.exchange(next.release(), std::memory_order_seq_cst));
+            reclaimLocked();
+            return true;
+        }
+
+        std::size_t reclaimLocked()
+        {
+            std::vector<const void*> used;
+            for (std::size_t i = 0; i < slots_.size(); ++i)
+            {
+                const void* snapshot = slots_[i].snapshot.load(std::memory_order_seq_cst);
+                if (snapshot)
+                    used.push_back(snapshot);
+            }
+            std::vector<const PluginSnapshot<T>*> kept;
+            for (std::size_t i = 0; i < retired_.size(); ++i)
+            {
+                if (std::find(used.begin(), used.end(), retired_[i]) != used.end())
+                    kept.push_back(retired_[i]);
+                else
+                    delete retired_[i];
+            }
+            retired_.swap(kept);
+            for (typename std::map<std::string, std::weak_ptr<PluginLoader<T> > >::iterator it = loaders_.begin(); it != loaders_.end(); )
+            {
+                if (it->second.expired())
+                    loaders_.erase(it++);
+                else
+                    ++it;
+            }
+            return retired_.size();
+        }
+
+        detail::SnapshotReaderSlot* claimSlot() const
+        {
+            std::size_t hint = detail::snapshotSlotHint();
+            while (true)
+            {
+                for (std::size_t i = 0; i < slots_.size(); ++i)
+                {
+                    detail::SnapshotReaderSlot& slot = slots_[(hint + i) % slots_.size()];
+                    bool owned = false;
+                    if (!slot.owned.load(std::memory_order_relaxed)
+                        && slot.owned.compare_exchange_strong(owned, true, std::memory_order_acquire))
+                        return &slot;
+                }
+                std::this_thread::yield();
+            }
+        }
+
+        // Slots of the readers
+        mutable std::vector<detail::SnapshotReaderSlot> slots_;
+        // Published snapshot
+        std::atomic<const PluginSnapshot<T>*> current_;
+        // Replaced snapshots, possibly still in use
+        std::vector<const PluginSnapshot<T>*> retired_;
+        // Loaders of every snapshot, current or retired, by filename
+        std::map<std::string, std::weak_ptr<PluginLoader<T> > > loaders_;
+        // Serializes the writers
+        mutable std::mutex writeMutex_;
+        // Error message
+        std::string errorMsg_;
+    };
+}
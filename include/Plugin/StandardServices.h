@@ -0,0 +1,267 @@
+//          Copyright Jeremy Coulon 2012-2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+/** @file */
+
+#pragma once
+
+//==============
+//==  Plugin  ==
+//==============
+#include "Plugin/PluginHostServices.h"
+
+//=============
+//==  Boost  ==
+//=============
+#include <boost/noncopyable.hpp>
+
+//===========
+//==  STD  ==
+//===========
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <string>
+
+#include <stdint.h>
+
+/// Service ID of the logger, see PluginHostServices
+#define PLUGIN_LOGGER_SERVICE PLUGIN_SERVICE_ID("Plugin.Logger")
+
+/// Service ID of the clock, see PluginHostServices
+#define PLUGIN_CLOCK_SERVICE PLUGIN_SERVICE_ID("Plugin.Clock")
+
+/// Service ID of the allocator, see PluginHostServices
+#define PLUGIN_ALLOCATOR_SERVICE PLUGIN_SERVICE_ID("Plugin.Allocator")
+
+extern "C"
+{
+    /// C interface of the logger, offered to plugins through the host services
+    struct PluginLoggerApi
+    {
+        /// Size of this structure, for forward compatibility
+        uint32_t size;
+        /// Version of this structure
+        uint32_t version;
+        /// Opaque host data given back to each function
+        void* context;
+        /// Tell whether messages of a Plugin::LogLevel are kept, to skip formatting the others
+        int (*isEnabled)(void* context, int level);
+        /// Log a message of a Plugin::LogLevel
+        void (*log)(void* context, int level, const char* message);
+    };
+
+    /// C interface of the clock, offered to plugins through the host services
+    struct PluginClockApi
+    {
+        /// Size of this structure, for forward compatibility
+        uint32_t size;
+        /// Version of this structure
+        uint32_t version;
+        /// Opaque host data given back to each function
+        void* context;
+        /// Monotonic time in nanoseconds, from an unspecified origin
+        uint64_t (*monotonicNs)(void* context);
+        /// Wall clock time in nanoseconds since the Unix epoch
+        uint64_t (*wallNs)(void* context);
+    };
+
+    /// C interface of the allocator, offered to plugins through the host services
+    struct PluginAllocatorApi
+    {
+        /// Size of this structure, for forward compatibility
+        uint32_t size;
+        /// Version of this structure
+        uint32_t version;
+        /// Opaque host data given back to each function
+        void* context;
+        /// Allocate a block. Alignment must be a power of two. Returns NULL on failure.
+        void* (*allocate)(void* context, size_t size, size_t alignment);
+        /// Release a block returned by allocate. NULL is ignored.
+        void (*deallocate)(void* context, void* block);
+    };
+}
+
+/// Namespace of the Plugin library
+namespace Plugin
+{
+    /// Severity of a log message
+    enum LogLevel
+    {
+        logDebug = 0,
+        logInfo = 1,
+        logWarning = 2,
+        logError = 3
+    };
+
+    /// Default implementation of the logger, clock and allocator services
+    /**
+      * Typical use in a host:
+      * @code
+      * Plugin::HostServices services;
+      * Plugin::StandardServices standard;
+      * standard.addTo(services);
+      * services.add(PLUGIN_SCHEDULER_SERVICE, scheduler.createClient("libMyPlugin.so"));
+      * Plugin::setDefaultHostServices(services.table());
+      * @endcode
+      * and in a plugin:
+      * @code
+      * const PluginClockApi* clock = PLUGIN_HOST_SERVICE(PluginClockApi, PLUGIN_CLOCK_SERVICE);
+      * @endcode
+      */
+    class StandardServices : private boost::noncopyable
+    {
+    public:
+        /// Receiver of the log messages
+        typedef std::function<void (LogLevel level, const std::string& message)> LogSink;
+
+        /// Constructor. Messages of level logInfo and above are written to std::clog.
+        StandardServices()
+            : minimumLevel_(logInfo),
+              liveBytes_(0),
+              liveBlocks_(0)
+        {
+            logger_.size = sizeof(PluginLoggerApi);
+            logger_.version = 1;
+            logger_.context = this;
+            logger_.isEnabled = &StandardServices::isEnabledThunk;
+            logger_.log = &StandardServices::logThunk;
+
+            clock_.size = sizeof(PluginClockApi);
+            clock_.version = 1;
+            clock_.context = this;
+            clock_.monotonicNs = &StandardServices::monotonicNs;
+            clock_.wallNs = &StandardServices::wallNs;
+
+            allocator_.size = sizeof(PluginAllocatorApi);
+            allocator_.version = 1;
+            allocator_.context = this;
+            allocator_.allocate = &StandardServices::allocateThunk;
+            allocator_.deallocate = &StandardServices::deallocateThunk;
+        }
+
+        /// Offer the logger, the clock and the allocator
+        void addTo(HostServices& services) const
+        {
+            services.add(PLUGIN_LOGGER_SERVICE, &logger_);
+            services.add(PLUGIN_CLOCK_SERVICE, &clock_);
+            services.add(PLUGIN_ALLOCATOR_SERVICE, &allocator_);
+        }
+
+        /// Set the receiver of the log messages
+        /**
+          * Must be set before plugins are loaded.
+          * @param sink Receiver, or an empty function to write to std::clog
+          */
+        void setLogSink(const LogSink& sink)
+        {
+            std::lock_guard<std::mutex> lock(logMutex_);
+            sink_ = sink;
+        }
+
+        /// Set the lowest level of the kept messages
+        void setMinimumLevel(LogLevel level)
+        {
+            minimumLevel_.store(level, std::memory_order_relaxed);
+        }
+
+        /// Get the number of bytes allocated by the plugins and not released
+        std::size_t getLiveBytes() const
+        {
+            return liveBytes_.load(std::memory_order_relaxed);
+        }
+
+        /// Get the number of blocks allocated by the plugins and not released
+        std::size_t getLiveBlocks() const
+        {
+            return liveBlocks_.load(std::memory_order_relaxed);
+        }
+
+    private:
+        // Placed before each block returned by the allocator
+        struct BlockHeader
+        {
+            void* base;
+            std::size_t size;
+        };
+
+        static int isEnabledThunk(void* context, int level)
+        {
+            return level >= static_cast<StandardServices*>(context)->minimumLevel_.load(std::memory_order_relaxed) ? 1 : 0;
+        }
+
+        static void logThunk(void* context, int level, const char* message)
+        {
+            StandardServices* self = static_cast<StandardServices*>(context);
+            if (!isEnabledThunk(context, level) || !message)
+                return;
+            std::lock_guard<std::mutex> lock(self->logMutex_);
+            if (self->sink_)
+            {
+                self->sink_(static_cast<LogLevel>(level), message);
+                return;
+            }
+            static const char* const names[] = { "debug", "info", "warning", "error" };
+            std::clog << "[" << (level >= logDebug && level <= logError ? names[level] : "?") << "] " << message << std::endl;
+        }
+
+        static uint64_t monotonicNs(void*)
+        {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        static uint64_t wallNs(void*)
+        {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+        }
+
+        static void* allocateThunk(void* context, size_t size, size_t alignment)
+        {
+            if (alignment == 0 || (alignment & (alignment - 1)) != 0)
+                return NULL;
+            if (alignment < sizeof(void*))
+                alignment = sizeof(void*);
+            void* base = std::malloc(size + alignment + sizeof(BlockHeader));
+            if (!base)
+                return NULL;
+            uintptr_t address = reinterpret_cast<uintptr_t>(base) + sizeof(BlockHeader);
+            address = (address + alignment - 1) & ~static_cast<uintptr_t>(alignment - 1);
+            BlockHeader* header = reinterpret_cast<BlockHeader*>(address) - 1;
+            header->base = base;
+            header->size = size;
+            StandardServices* self = static_cast<StandardServices*>(context);
+            self->liveBytes_.fetch_add(size, std::memory_order_relaxed);
+            self->liveBlocks_.fetch_add(1, std::memory_order_relaxed);
+            return reinterpret_cast<void*>(address);
+        }
+
+        static void deallocateThunk(void* context, void* block)
+        {
+            if (!block)
+                return;
+            BlockHeader* header = static_cast<BlockHeader*>(block) - 1;
+            StandardServices* self = static_cast<StandardServices*>(context);
+            self->liveBytes_.fetch_sub(header->size, std::memory_order_relaxed);
+            self->liveBlocks_.fetch_sub(1, std::memory_order_relaxed);
+            std::free(header->base);
+        }
+
+        // C views given to the plugins
+        PluginLoggerApi logger_;
+        PluginClockApi clock_;
+        PluginAllocatorApi allocator_;
+        // Logger state
+        std::atomic<int> minimumLevel_;
+        std::mutex logMutex_;
+        LogSink sink_;
+        // Allocator counters
+        std::atomic<std::size_t> liveBytes_;
+        std::atomic<std::size_t> liveBlocks_;
+    };
+}
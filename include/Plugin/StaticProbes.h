@@ -0,0 +1,109 @@
+//          Copyright Jeremy Coulon 2012-2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+/** @file */
+
+#pragma once
+
+//===========
+//==  STD  ==
+//===========
+#include <type_traits>
+
+/// Statically defined tracing probes (USDT), compatible with SystemTap, bpftrace, perf and BCC
+/**
+  * Each probe is a single NOP instruction, described by a note in the .note.stapsdt section
+  * of the binary with its address and the location of its arguments.
+  * Tracers replace the NOP by a breakpoint while attached: nothing else is executed otherwise.
+  * This header emits the notes itself, with the layout of <sys/sdt.h>, so that SystemTap is not needed to build.
+  *
+  * PluginLoader defines these probes, under the "plugin" provider:
+  * - load_begin(const char* path)
+  * - load_end(const char* path, int success)
+  * - dlsym(const char* path, const char* symbol, void* address)
+  * - create(const char* path, void* facade)
+  * - destroy(const char* path, void* facade), facade being NULL for the singleton facade
+  * - unload(const char* path, int success)
+  *
+  * For example, to follow the loads of a running process:
+  * @code
+  * bpftrace -p PID -e 'usdt:*:plugin:load_end { printf("%s %d\n", str(arg0), arg1); }'
+  * @endcode
+  * Probes are only emitted by GCC and Clang on Linux x86-64 and AArch64.
+  * Define PLUGIN_NO_USDT to remove them.
+  */
+#if defined(__linux__) && defined(__GNUC__) && (defined(__x86_64__) || defined(__aarch64__)) && !defined(PLUGIN_NO_USDT)
+# define PLUGIN_HAS_USDT 1
+#else
+# define PLUGIN_HAS_USDT 0
+#endif
+
+#if PLUGIN_HAS_USDT
+
+/// Fire a probe without arguments
+# define PLUGIN_USDT0(provider, name) \
+    __asm__ __volatile__(PLUGIN_USDT_NOTE(provider, name, ""))
+
+/// Fire a probe with one argument
+# define PLUGIN_USDT1(provider, name, a1)                                    \
+    __asm__ __volatile__(PLUGIN_USDT_NOTE(provider, name, PLUGIN_USDT_ARG(1)) \
+                         :: PLUGIN_USDT_OPERAND(1, a1))
+
+/// Fire a probe with two arguments
+# define PLUGIN_USDT2(provider, name, a1, a2)                                                    \
+    __asm__ __volatile__(PLUGIN_USDT_NOTE(provider, name, PLUGIN_USDT_ARG(1) " " PLUGIN_USDT_ARG(2)) \
+                         :: PLUGIN_USDT_OPERAND(1, a1), PLUGIN_USDT_OPERAND(2, a2))
+
+/// Fire a probe with three arguments
+# define PLUGIN_USDT3(provider, name, a1, a2, a3)                                                                         \
+    __asm__ __volatile__(PLUGIN_USDT_NOTE(provider, name, PLUGIN_USDT_ARG(1) " " PLUGIN_USDT_ARG(2) " " PLUGIN_USDT_ARG(3)) \
+                         :: PLUGIN_USDT_OPERAND(1, a1), PLUGIN_USDT_OPERAND(2, a2), PLUGIN_USDT_OPERAND(3, a3))
+
+#else
+
+# define PLUGIN_USDT0(provider, name) do {} while (0)
+# define PLUGIN_USDT1(provider, name, a1) do {} while (0)
+# define PLUGIN_USDT2(provider, name, a1, a2) do {} while (0)
+# define PLUGIN_USDT3(provider, name, a1, a2, a3) do {} while (0)
+
+#endif
+
+//==================================
+//==  Implementation details only  ==
+//==================================
+
+// Argument description "SIZE@LOCATION": the size is negative for signed types
+#define PLUGIN_USDT_ARG(n) "%c[size" #n "]@%[arg" #n "]"
+
+#define PLUGIN_USDT_OPERAND(n, x)                                                                                  \
+    [size##n] "n" ((std::is_signed<typename std::decay<decltype(x)>::type>::value ? -1 : 1) * static_cast<int>(sizeof(x))), \
+    [arg##n] "nor" (x)
+
+// NOP at the probe address, then the note describing it, then the reference symbol
+// tracers use to relocate the address in prelinked binaries.
+// "?" puts the note in the group of the function, so that it is discarded with duplicated inline functions.
+#define PLUGIN_USDT_NOTE(provider, name, args)                                         \
+    "990: nop\n"                                                                        \
+    ".pushsection .note.stapsdt,\"?\",\"note\"\n"                                       \
+    ".balign 4\n"                                                                       \
+    ".4byte 992f-991f, 994f-993f, 3\n"                                                  \
+    "991: .asciz \"stapsdt\"\n"                                                         \
+    "992: .balign 4\n"                                                                  \
+    "993: .8byte 990b\n"                                                                \
+    ".8byte _.stapsdt.base\n"                                                           \
+    ".8byte 0\n"                                                                        \
+    ".asciz \"" provider "\"\n"                                                         \
+    ".asciz \"" name "\"\n"                                                             \
+    ".asciz \"" args "\"\n"                                                             \
+    "994: .balign 4\n"                                                                  \
+    ".popsection\n"                                                                     \
+    ".ifndef _.stapsdt.base\n"                                                          \
+    ".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n"             \
+    ".weak _.stapsdt.base\n"                                                            \
+    ".hidden _.stapsdt.base\n"                                                          \
+    "_.stapsdt.base: .space 1\n"                                                        \
+    ".size _.stapsdt.base, 1\n"                                                         \
+    ".popsection\n"                                                                     \
+    ".endif\n"
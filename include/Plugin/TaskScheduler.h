@@ -0,0 +1,531 @@
+//          Copyright Jeremy Coulon 2012-2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+/** @file */
+
+#pragma once
+
+//==============
+//==  Plugin  ==
+//==============
+#include "Plugin/PluginHostServices.h"
+#include "Plugin/WorkStealingPool.h"
+
+//=============
+//==  Boost  ==
+//=============
+#include <boost/noncopyable.hpp>
+
+//===========
+//==  STD  ==
+//===========
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <stdint.h>
+
+/// Service ID of the task scheduler, see PluginHostServices
+#define PLUGIN_SCHEDULER_SERVICE PLUGIN_SERVICE_ID("Plugin.Scheduler")
+
+extern "C"
+{
+    /// Task run by the scheduler
+    typedef void (*PluginTaskFunction)(void* argument);
+
+    /// C interface of the task scheduler, offered to plugins through the host services
+    /**
+      * Each plugin receives its own instance, bound to its priority class and quota.
+      */
+    struct PluginSchedulerApi
+    {
+        /// Size of this structure, for forward compatibility
+        uint32_t size;
+        /// Version of this structure
+        uint32_t version;
+        /// Opaque client data given back to each function
+        void* context;
+        /// Queue a task. Returns a handle to give to wait() or detach(), zero on failure.
+        uint64_t (*submit)(void* context, PluginTaskFunction function, void* argument);
+        /// Wait for a task, running it on the calling thread if it has not started.
+        /// A negative timeout means infinite. Returns non-zero if the task completed,
+        /// in which case the handle is released.
+        int (*wait)(void* context, uint64_t task, int64_t timeoutMs);
+        /// Release a handle without waiting for the task
+        void (*detach)(void* context, uint64_t task);
+        /// Number of worker threads
+        uint32_t (*concurrency)(void* context);
+    };
+}
+
+/// Namespace of the Plugin library
+namespace Plugin
+{
+    /// Priority classes of the scheduler clients
+    enum TaskPriority
+    {
+        taskPriorityHigh = 0,   ///< Latency sensitive work
+        taskPriorityNormal = 1, ///< Default
+        taskPriorityLow = 2     ///< Background work, run when nothing else is ready
+    };
+
+    /// Counters of a scheduler client
+    struct SchedulerClientStats
+    {
+        /// Number of tasks submitted
+        uint64_t submitted;
+        /// Number of tasks completed
+        uint64_t completed;
+        /// Number of tasks run by a waiting thread rather than a worker
+        uint64_t inlined;
+        /// Number of tasks currently running on workers
+        unsigned int running;
+    };
+
+    namespace detail
+    {
+        // State of a submitted task, shared by the queue and the handle
+        struct ScheduledTask
+        {
+            enum State
+            {
+                pending = 0,
+                running = 1,
+                done = 2
+            };
+
+            ScheduledTask(PluginTaskFunction f, void* a)
+                : function(f),
+                  argument(a),
+                  state(pending),
+                  references(2)
+            {
+                // Empty
+            }
+
+            void release()
+            {
+                if (references.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                    delete this;
+            }
+
+            PluginTaskFunction function;
+            void* argument;
+            std::atomic<int> state;
+            std::atomic<int> references;
+            std::mutex mutex;
+            std::condition_variable finished;
+        };
+    }
+
+    /// Work-stealing task scheduler shared by every plugin
+    /**
+      * The host owns one scheduler sized to the machine, and gives each plugin a client
+      * through the host services instead of letting it start its own threads.
+      * Each client has a priority class and a quota, the maximum number of workers
+      * running its tasks at the same time. A ready task of a higher class always runs
+      * before tasks of lower classes.
+      *
+      * The workers are those of a WorkStealingPool. Each worker also has its own queue of tasks
+      * per priority class: tasks submitted by a worker go to its queue, other tasks are spread
+      * over the queues, and a worker looking for a task steals from the others once its own
+      * queues are empty. Within a class, tasks are taken in submission order.
+      * Quotas are counted with atomics, so that no lock is shared by every worker.
+      * Waiting for a task that has not started runs it on the waiting thread, which also
+      * prevents deadlocks when tasks wait for the tasks they submitted, whatever the quota.
+      */
+    class TaskScheduler : private boost::noncopyable
+    {
+        struct Client
+        {
+            Client(TaskScheduler* s, const std::string& n, TaskPriority p, unsigned int q)
+                : scheduler(s),
+                  name(n),
+                  priority(p),
+                  quota(q),
+                  running(0),
+                  queued(0),
+                  submitted(0),
+                  completed(0),
+                  inlined(0)
+            {
+                api.size = sizeof(PluginSchedulerApi);
+                api.version = 1;
+                api.context = this;
+                api.submit = &TaskScheduler::submitThunk;
+                api.wait = &TaskScheduler::waitThunk;
+                api.detach = &TaskScheduler::detachThunk;
+                api.concurrency = &TaskScheduler::concurrencyThunk;
+            }
+
+            // Take a worker, unless the quota is reached
+            bool acquireWorker()
+            {
+                unsigned int current = running.load(std::memory_order_relaxed);
+                do
+                {
+                    if (quota != 0 && current >= quota)
+                        return false;
+                }
+                while (!running.compare_exchange_weak(current, current + 1, std::memory_order_acq_rel));
+                return true;
+            }
+
+            TaskScheduler* scheduler;
+            std::string name;
+            TaskPriority priority;
+            unsigned int quota;
+            // Number of workers running its tasks
+            std::atomic<unsigned int> running;
+            // Number of entries in the worker queues, including tasks already run by waiting threads
+            std::atomic<std::size_t> queued;
+            // Counters
+            std::atomic<uint64_t> submitted;
+            std::atomic<uint64_t> completed;
+            std::atomic<uint64_t> inlined;
+            // C interface bound to this client
+            PluginSchedulerApi api;
+        };
+
+        static const int priorityCount = 3;
+
+        // Tasks queued on a worker
+        struct WorkerQueue
+        {
+            std::mutex mutex;
+            // Tasks of each priority class, with their client
+            std::deque<std::pair<Client*, detail::ScheduledTask*> > tasks[priorityCount];
+        };
+
+    public:
+        /// Constructor
+        /**
+          * @param threads Number of workers. Zero means one per hardware thread.
+          */
+        explicit TaskScheduler(std::size_t threads = 0)
+            : next_(0),
+              pool_(threads)
+        {
+            for (std::size_t i = 0; i < pool_.size(); ++i)
+                queues_.push_back(std::unique_ptr<WorkerQueue>(new WorkerQueue));
+        }
+
+        /// Destructor. Run the queued tasks, then stop the workers.
+        ~TaskScheduler()
+        {
+            pool_.waitIdle();
+            // Only entries of tasks run by waiting threads are left
+            for (std::size_t i = 0; i < queues_.size(); ++i)
+            {
+                for (int p = 0; p < priorityCount; ++p)
+                {
+                    std::deque<std::pair<Client*, detail::ScheduledTask*> >& tasks = queues_[i]->tasks[p];
+                    for (std::size_t j = 0; j < tasks.size(); ++j)
+                        tasks[j].second->release();
+                }
+            }
+        }
+
+        /// Create the client of a plugin
+        /**
+          * @param name Name of the client, typically the plugin filename
+          * @param priority Priority class of its tasks
+          * @param quota Maximum number of workers running its tasks at once. Zero means no limit.
+          * @return C interface to offer to the plugin with HostServices::add(PLUGIN_SCHEDULER_SERVICE, ...).
+          *         It lives as long as the scheduler.
+          */
+        const PluginSchedulerApi* createClient(const std::string& name,
+                                               TaskPriority priority = taskPriorityNormal,
+                                               unsigned int quota = 0)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            clients_.push_back(std::unique_ptr<Client>(new Client(this, name, priority, quota)));
+            return &clients_.back()->api;
+        }
+
+        /// Get the counters of a client
+        /**
+          * @return False if no client has this name. True otherwise.
+          */
+        bool getClientStats(const std::string& name, SchedulerClientStats& stats) const
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (std::size_t i = 0; i < clients_.size(); ++i)
+            {
+                const Client& client = *clients_[i];
+                if (client.name != name)
+                    continue;
+                stats.submitted = client.submitted.load(std::memory_order_relaxed);
+                stats.completed = client.completed.load(std::memory_order_relaxed);
+                stats.inlined = client.inlined.load(std::memory_order_relaxed);
+                stats.running = client.running.load(std::memory_order_relaxed);
+                return true;
+            }
+            return false;
+        }
+
+        /// Get the number of workers
+        std::size_t concurrency() const
+        {
+            return pool_.size();
+        }
+
+        /// Wait until no task is queued nor running
+        void waitIdle()
+        {
+            pool_.waitIdle();
+        }
+
+    private:
+        // Queue of the calling worker, or the next queue in turn for other threads
+        std::size_t queueIndex()
+        {
+            const detail::PoolWorkerSlot& slot = detail::currentPoolWorker();
+            if (slot.pool == &pool_)
+                return slot.index;
+            return next_.fetch_add(1, std::memory_order_relaxed) % queues_.size();
+        }
+
+        uint64_t submit(Client& client, PluginTaskFunction function, void* argument)
+        {
+            if (!function)
+                return 0;
+            detail::ScheduledTask* task = new detail::ScheduledTask(function, argument);
+            client.submitted.fetch_add(1, std::memory_order_relaxed);
+            client.queued.fetch_add(1, std::memory_order_seq_cst);
+            WorkerQueue& queue = *queues_[queueIndex()];
+            {
+                std::lock_guard<std::mutex> lock(queue.mutex);
+                queue.tasks[client.priority].push_back(std::make_pair(&client, task));
+            }
+            // One wake-up per task; it runs the most urgent ready task, not necessarily this one
+            pool_.submit([this]() { runNext(); });
+            return reinterpret_cast<uintptr_t>(task);
+        }
+
+        bool wait(Client& client, uint64_t handle, int64_t timeoutMs)
+        {
+            detail::ScheduledTask* task = reinterpret_cast<detail::ScheduledTask*>(static_cast<uintptr_t>(handle));
+            if (!task)
+                return false;
+            int expected = detail::ScheduledTask::pending;
+            if (task->state.compare_exchange_strong(expected, detail::ScheduledTask::running))
+            {
+                // Not started yet: run it here. Its queue entry is skipped later.
+                client.inlined.fetch_add(1, std::memory_order_relaxed);
+                complete(client, task);
+            }
+            else
+            {
+                std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now()
+                    + std::chrono::milliseconds(timeoutMs < 0 ? 0 : timeoutMs);
+                // Workers help with other tasks instead of sleeping
+                while (task->state.load(std::memory_order_acquire) != detail::ScheduledTask::done)
+                {
+                    if (timeoutMs >= 0 && std::chrono::steady_clock::now() >= deadline)
+                        return false;
+                    if (pool_.isWorkerThread() && pool_.runPendingTask())
+                        continue;
+                    std::unique_lock<std::mutex> lock(task->mutex);
+                    if (timeoutMs < 0)
+                        task->finished.wait(lock, [task]() { return task->state.load() == detail::ScheduledTask::done; });
+                    else
+                        task->finished.wait_until(lock, deadline, [task]() { return task->state.load() == detail::ScheduledTask::done; });
+                }
+            }
+            task->release();
+            return true;
+        }
+
+        void detach(uint64_t handle)
+        {
+            detail::ScheduledTask* task = reinterpret_cast<detail::ScheduledTask*>(static_cast<uintptr_t>(handle));
+            if (task)
+                task->release();
+        }
+
+        void complete(Client& client, detail::ScheduledTask* task)
+        {
+            task->function(task->argument);
+            {
+                std::lock_guard<std::mutex> lock(task->mutex);
+                task->state.store(detail::ScheduledTask::done, std::memory_order_release);
+            }
+            task->finished.notify_all();
+            client.completed.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        // Pick the most urgent task of a client under its quota: own queue first, then the others
+        detail::ScheduledTask* pick(Client*& owner)
+        {
+            std::size_t index = queueIndex();
+            for (int p = 0; p < priorityCount; ++p)
+            {
+                for (std::size_t i = 0; i < queues_.size(); ++i)
+                {
+                    WorkerQueue& queue = *queues_[(index + i) % queues_.size()];
+                    std::lock_guard<std::mutex> lock(queue.mutex);
+                    std::deque<std::pair<Client*, detail::ScheduledTask*> >& tasks = queue.tasks[p];
+                    for (std::size_t j = 0; j < tasks.size(); )
+                    {
+                        Client* client = tasks[j].first;
+                        detail::ScheduledTask* task = tasks[j].second;
+                        bool started = task->state.load(std::memory_order_acquire) != detail::ScheduledTask::pending;
+                        if (!started && !client->acquireWorker())
+                        {
+                            ++j;
+                            continue;
+                        }
+                        tasks.erase(tasks.begin() + j);
+                        client->queued.fetch_sub(1, std::memory_order_seq_cst);
+                        int expected = detail::ScheduledTask::pending;
+                        if (!started && task->state.compare_exchange_strong(expected, detail::ScheduledTask::running))
+                        {
+                            owner = client;
+                            return task;
+                        }
+                        // Already run by a waiting thread
+                        if (!started)
+                            client->running.fetch_sub(1, std::memory_order_acq_rel);
+                        task->release();
+                    }
+                }
+            }
+            return NULL;
+        }
+
+        void runNext()
+        {
+            Client* client = NULL;
+            detail::ScheduledTask* task = pick(client);
+            if (!task)
+                return;
+            complete(*client, task);
+            task->release();
+            client->running.fetch_sub(1, std::memory_order_seq_cst);
+            // A wake-up may have been spent while this client was at its quota
+            if (client->quota != 0 && client->queued.load(std::memory_order_seq_cst) != 0)
+                pool_.submit([this]() { runNext(); });
+        }
+
+        static uint64_t submitThunk(void* context, PluginTaskFunction function, void* argument)
+        {
+            Client* client = static_cast<Client*>(context);
+            return client->scheduler->submit(*client, function, argument);
+        }
+
+        static int waitThunk(void* context, uint64_t task, int64_t timeoutMs)
+        {
+            Client* client = static_cast<Client*>(context);
+            return client->scheduler->wait(*client, task, timeoutMs) ? 1 : 0;
+        }
+
+        static void detachThunk(void* context, uint64_t task)
+        {
+            static_cast<Client*>(context)->scheduler->detach(task);
+        }
+
+        static uint32_t concurrencyThunk(void* context)
+        {
+            return static_cast<uint32_t>(static_cast<Client*>(context)->scheduler->concurrency());
+        }
+
+        // Clients, in creation order
+        std::vector<std::unique_ptr<Client> > clients_;
+        // Protects clients_
+        mutable std::mutex mutex_;
+        // Task queue of each worker
+        std::vector<std::unique_ptr<WorkerQueue> > queues_;
+        // Round-robin cursor for tasks submitted from outside the pool
+        std::atomic<std::size_t> next_;
+        // Workers. Declared last so that they stop before the clients are destroyed.
+        WorkStealingPool pool_;
+    };
+
+    /// Plugin side access to the task scheduler of the host
+    /**
+      * Wraps the C interface found in the host services.
+      */
+    class SchedulerClient
+    {
+        struct Closure
+        {
+            explicit Closure(const std::function<void ()>& f)
+                : function(f)
+            {
+                // Empty
+            }
+
+            static void run(void* argument)
+            {
+                std::unique_ptr<Closure> closure(static_cast<Closure*>(argument));
+                closure->function();
+            }
+
+            std::function<void ()> function;
+        };
+
+    public:
+        /// Constructor
+        /**
+          * @param services Host services, typically globalHostServices in a plugin
+          */
+        explicit SchedulerClient(const PluginHostServices* services)
+            : api_(getHostService<PluginSchedulerApi>(services, PLUGIN_SCHEDULER_SERVICE))
+        {
+            // Empty
+        }
+
+        /// Check whether the host offers a scheduler
+        bool isAvailable() const
+        {
+            return api_ != NULL;
+        }
+
+        /// Queue a function
+        /**
+          * The function must not throw.
+          * @return Handle to give to wait() or detach(), zero on failure
+          */
+        uint64_t submit(const std::function<void ()>& function) const
+        {
+            Closure* closure = new Closure(function);
+            uint64_t res = api_->submit(api_->context, &Closure::run, closure);
+            if (res == 0)
+                delete closure;
+            return res;
+        }
+
+        /// Wait for a task. The handle is released on success.
+        bool wait(uint64_t task, int64_t timeoutMs = -1) const
+        {
+            return api_->wait(api_->context, task, timeoutMs) != 0;
+        }
+
+        /// Release a handle without waiting for the task
+        void detach(uint64_t task) const
+        {
+            api_->detach(api_->context, task);
+        }
+
+        /// Get the number of worker threads
+        unsigned int concurrency() const
+        {
+            return api_->concurrency(api_->context);
+        }
+
+    private:
+        // C interface of the scheduler. NULL if not offered.
+        const PluginSchedulerApi* api_;
+    };
+}
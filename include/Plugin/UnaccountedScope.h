@@ -0,0 +1,49 @@
+//          Copyright Jeremy Coulon 2012-2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+/** @file */
+
+#pragma once
+
+//=============
+//==  Boost  ==
+//=============
+#include <boost/noncopyable.hpp>
+
+/// Namespace of the Plugin library
+namespace Plugin
+{
+    class AllocationAccount;
+
+    namespace detail
+    {
+        // Account of the plugin currently executing on this thread
+        inline AllocationAccount*& currentAllocationAccount()
+        {
+            static thread_local AllocationAccount* account = NULL;
+            return account;
+        }
+
+        // Stop attributing allocations of the current thread during its lifetime.
+        // Used by the library bookkeeping that runs inside plugin scopes, such as the load history.
+        class UnaccountedScope : private boost::noncopyable
+        {
+        public:
+            UnaccountedScope()
+                : previous_(currentAllocationAccount())
+            {
+                currentAllocationAccount() = NULL;
+            }
+
+            ~UnaccountedScope()
+            {
+                currentAllocationAccount() = previous_;
+            }
+
+        private:
+            AllocationAccount* previous_;
+        };
+    }
+}
@@ -0,0 +1,286 @@
+//          Copyright Jeremy Coulon 2012-2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+/** @file */
+
+#pragma once
+
+//=============
+//==  Boost  ==
+//=============
+#include <boost/noncopyable.hpp>
+
+//===========
+//==  STD  ==
+//===========
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <stdint.h>
+
+/// Namespace of the Plugin library
+namespace Plugin
+{
+    class WorkStealingPool;
+
+    namespace detail
+    {
+        // Pool and index of the worker running on the calling thread
+        struct PoolWorkerSlot
+        {
+            const WorkStealingPool* pool;
+            std::size_t index;
+        };
+
+        inline PoolWorkerSlot& currentPoolWorker()
+        {
+            static thread_local PoolWorkerSlot slot = { NULL, 0 };
+            return slot;
+        }
+    }
+
+    /// Thread pool where idle workers steal tasks from busy ones
+    /**
+      * Each worker owns a queue. Tasks submitted by a worker go to its own queue,
+      * where it takes the most recent first, for cache locality.
+      * Other tasks are spread over the queues. An idle worker steals the oldest
+      * task of another queue before going to sleep.
+      * Tasks must not throw: exceptions are caught and counted.
+      */
+    class WorkStealingPool : private boost::noncopyable
+    {
+        struct Queue
+        {
+            std::mutex mutex;
+            std::deque<std::function<void ()> > tasks;
+        };
+
+    public:
+        /// Task run by the pool
+        typedef std::function<void ()> Task;
+
+        /// Constructor
+        /**
+          * @param threads Number of workers. Zero means one per hardware thread.
+          */
+        explicit WorkStealingPool(std::size_t threads = 0)
+            : pending_(0),
+              active_(0),
+              next_(0),
+              sleepers_(0),
+              executed_(0),
+              stolen_(0),
+              failed_(0),
+              stopping_(false)
+        {
+            if (threads == 0)
+                threads = std::max(1u, std::thread::hardware_concurrency());
+            for (std::size_t i = 0; i < threads; ++i)
+                queues_.push_back(std::unique_ptr<Queue>(new Queue));
+            for (std::size_t i = 0; i < threads; ++i)
+                workers_.push_back(std::thread(&WorkStealingPool::run, this, i));
+        }
+
+        /// Destructor. Run the queued tasks, then stop the workers.
+        ~WorkStealingPool()
+        {
+            waitIdle();
+            {
+                std::lock_guard<std::mutex> lock(sleepMutex_);
+                stopping_ = true;
+            }
+            wakeUp_.notify_all();
+            for (std::size_t i = 0; i < workers_.size(); ++i)
+                workers_[i].join();
+        }
+
+        /// Queue a task
+        void submit(const Task& task)
+        {
+            detail::PoolWorkerSlot& slot = detail::currentPoolWorker();
+            std::size_t index = slot.pool == this
+                ? slot.index
+                : next_.fetch_add(1, std::memory_order_relaxed) % queues_.size();
+            // Counted pending first, so that the task never looks taken before it was queued
+            pending_.fetch_add(1, std::memory_order_seq_cst);
+            {
+                std::lock_guard<std::mutex> lock(queues_[index]->mutex);
+                queues_[index]->tasks.push_back(task);
+            }
+            // A worker going to sleep counts itself before checking pending_, so either it sees the task,
+            // or this sees it. Taking the lock then orders the wake-up after its predicate check.
+            if (sleepers_.load(std::memory_order_seq_cst) != 0)
+            {
+                {
+                    std::lock_guard<std::mutex> lock(sleepMutex_);
+                }
+                wakeUp_.notify_one();
+            }
+        }
+
+        /// Run one queued task on the calling thread, if any
+        /**
+          * Lets a thread waiting for a result help instead of blocking a worker.
+          * @return True if a task was run. False otherwise.
+          */
+        bool runPendingTask()
+        {
+            detail::PoolWorkerSlot& slot = detail::currentPoolWorker();
+            std::size_t index = slot.pool == this ? slot.index : 0;
+            Task task;
+            if (!take(index, slot.pool == this, task))
+                return false;
+            execute(task);
+            return true;
+        }
+
+        /// Wait until no task is queued nor running
+        /**
+          * Must not be called from a task.
+          */
+        void waitIdle()
+        {
+            std::unique_lock<std::mutex> lock(sleepMutex_);
+            idle_.wait(lock, [this]()
+            {
+                return pending_.load(std::memory_order_seq_cst) == 0 && active_.load(std::memory_order_seq_cst) == 0;
+            });
+        }
+
+        /// Get the number of workers
+        std::size_t size() const
+        {
+            return workers_.size();
+        }
+
+        /// Tell whether the calling thread is a worker of this pool
+        bool isWorkerThread() const
+        {
+            return detail::currentPoolWorker().pool == this;
+        }
+
+        /// Get the number of tasks run
+        uint64_t getExecutedCount() const
+        {
+            return executed_.load(std::memory_order_relaxed);
+        }
+
+        /// Get the number of tasks run by another worker than the one they were queued to
+        uint64_t getStolenCount() const
+        {
+            return stolen_.load(std::memory_order_relaxed);
+        }
+
+        /// Get the number of tasks that threw an exception
+        uint64_t getFailedCount() const
+        {
+            return failed_.load(std::memory_order_relaxed);
+        }
+
+    private:
+        // Take a task: the newest of the own queue, else the oldest of another queue
+        bool take(std::size_t index, bool owner, Task& task)
+        {
+            if (pending_.load(std::memory_order_seq_cst) == 0)
+                return false;
+            for (std::size_t i = 0; i < queues_.size(); ++i)
+            {
+                std::size_t victim = (index + i) % queues_.size();
+                Queue& queue = *queues_[victim];
+                std::lock_guard<std::mutex> lock(queue.mutex);
+                if (queue.tasks.empty())
+                    continue;
+                if (i == 0 && owner)
+                {
+                    task.swap(queue.tasks.back());
+                    queue.tasks.pop_back();
+                }
+                else
+                {
+                    task.swap(queue.tasks.front());
+                    queue.tasks.pop_front();
+                    if (i != 0)
+                        stolen_.fetch_add(1, std::memory_order_relaxed);
+                }
+                // Counted active before not pending, so that waitIdle() never sees both at zero
+                active_.fetch_add(1, std::memory_order_seq_cst);
+                pending_.fetch_sub(1, std::memory_order_seq_cst);
+                return true;
+            }
+            return false;
+        }
+
+        void execute(Task& task)
+        {
+            try
+            {
+                task();
+            }
+            catch (...)
+            {
+                failed_.fetch_add(1, std::memory_order_relaxed);
+            }
+            executed_.fetch_add(1, std::memory_order_relaxed);
+            if (active_.fetch_sub(1, std::memory_order_seq_cst) == 1 && pending_.load(std::memory_order_seq_cst) == 0)
+            {
+                std::lock_guard<std::mutex> lock(sleepMutex_);
+                idle_.notify_all();
+            }
+        }
+
+        void run(std::size_t index)
+        {
+            detail::PoolWorkerSlot& slot = detail::currentPoolWorker();
+            slot.pool = this;
+            slot.index = index;
+            Task task;
+            while (true)
+            {
+                if (take(index, true, task))
+                {
+                    execute(task);
+                    task = Task();
+                    continue;
+                }
+                std::unique_lock<std::mutex> lock(sleepMutex_);
+                sleepers_.fetch_add(1, std::memory_order_seq_cst);
+                wakeUp_.wait(lock, [this]() { return stopping_ || pending_.load(std::memory_order_seq_cst) != 0; });
+                sleepers_.fetch_sub(1, std::memory_order_seq_cst);
+                if (stopping_ && pending_.load(std::memory_order_seq_cst) == 0)
+                    break;
+            }
+        }
+
+        // Task queue of each worker
+        std::vector<std::unique_ptr<Queue> > queues_;
+        // Worker threads
+        std::vector<std::thread> workers_;
+        // Number of queued tasks
+        std::atomic<std::size_t> pending_;
+        // Number of running tasks
+        std::atomic<std::size_t> active_;
+        // Round-robin cursor for tasks submitted from outside the pool
+        std::atomic<std::size_t> next_;
+        // Number of workers sleeping or about to, so that submit() only takes sleepMutex_ to wake one up
+        std::atomic<std::size_t> sleepers_;
+        // Counters
+        std::atomic<uint64_t> executed_;
+        std::atomic<uint64_t> stolen_;
+        std::atomic<uint64_t> failed_;
+        // Sleeping workers and idle waiters
+        std::mutex sleepMutex_;
+        std::condition_variable wakeUp_;
+        std::condition_variable idle_;
+        bool stopping_;
+    };
+}
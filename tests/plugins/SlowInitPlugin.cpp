@@ -0,0 +1,83 @@
+//          Copyright Jeremy Coulon 2012-2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+// Test plugin whose static initializer blocks, and whose facade cannot be created.
+// It stands for a plugin stuck in its initialization, for PluginLoader::load(timeout).
+
+//==============
+//==  Plugin  ==
+//==============
+#include "Plugin/IPlugin.h"
+#include "Plugin/PluginFactory.h"
+
+//===========
+//==  STD  ==
+//===========
+#include <chrono>
+#include <thread>
+
+namespace SlowInit
+{
+    // Duration of the static initializer
+    const std::chrono::milliseconds initDuration(500);
+
+    struct Initializer
+    {
+        Initializer()
+        {
+            std::this_thread::sleep_for(initDuration);
+        }
+    };
+
+    Initializer initializer;
+
+    class SlowInitPlugin : public Plugin::IPlugin
+    {
+    public:
+        SlowInitPlugin()
+            : name_("SlowInit"),
+              version_(1, 0, 0, 0)
+        {
+            // Empty
+        }
+
+        virtual const std::string& iGetPluginName() const
+        {
+            return name_;
+        }
+
+        virtual const Vers::Version& iGetPluginVersion() const
+        {
+            return version_;
+        }
+
+    private:
+        std::string name_;
+        Vers::Version version_;
+    };
+}
+
+PLUGIN_FACTORY_DECLARATION( SlowInit::SlowInitPlugin )
+
+// The facade cannot be created, as if a dependency of the plugin was missing
+SlowInit::SlowInitPlugin* createPluginFacade()
+{
+    return NULL;
+}
+
+void destroyPluginFacade()
+{
+    // Empty
+}
+
+SlowInit::SlowInitPlugin* newPluginFacade()
+{
+    return NULL;
+}
+
+void deletePluginFacade(SlowInit::SlowInitPlugin*)
+{
+    // Empty
+}
@@ -18,6 +18,7 @@
 //===========
 //==  STD  ==
 //===========
+#include <chrono>
 #include <string>
 
 BOOST_AUTO_TEST_CASE(Nominal)
@@ -61,3 +62,61 @@ BOOST_AUTO_TEST_CASE(PluginNotFound)
     plugin = loader.getPluginInstance();
     BOOST_CHECK(!plugin);
 }
+
+BOOST_AUTO_TEST_CASE(LoadWithTimeout)
+{
+    boost::filesystem::path myPluginPath(MYPLUGIN_PATH);
+
+    Plugin::PluginLoader<Plugin::IPlugin> loader(myPluginPath.native());
+    BOOST_REQUIRE_MESSAGE(loader.load(std::chrono::seconds(10)), "Failed to load plugin: " << loader.getErrorMsg());
+    BOOST_REQUIRE(loader.isLoaded());
+    Plugin::IPlugin* plugin = loader.getPluginInstance();
+    BOOST_REQUIRE(plugin);
+    BOOST_CHECK_EQUAL(plugin->iGetPluginName(), "Example");
+    BOOST_CHECK(loader.unload());
+
+    Plugin::PluginLoader<Plugin::IPlugin> missing("NonExistingPath");
+    BOOST_CHECK(!missing.load(std::chrono::seconds(10)));
+    BOOST_CHECK(!missing.getErrorMsg().empty());
+    BOOST_CHECK(!Plugin::isPluginQuarantined("NonExistingPath"));
+}
+
+BOOST_AUTO_TEST_CASE(LoadTimeoutQuarantinesPlugin)
+{
+    // Its static initializer blocks for 500 ms, then its facade cannot be created
+    std::string slowPluginPath(SLOWPLUGIN_FULL_PATH);
+
+    Plugin::PluginLoader<Plugin::IPlugin> loader(slowPluginPath);
+    BOOST_CHECK(!loader.load(std::chrono::milliseconds(50)));
+    BOOST_CHECK(!loader.isLoaded());
+    BOOST_CHECK_MESSAGE(loader.getErrorMsg().find("Timed out") != std::string::npos, loader.getErrorMsg());
+    BOOST_CHECK(Plugin::isPluginQuarantined(slowPluginPath));
+
+    // Later loads fail immediately, while the abandoned thread is still in the initializer
+    Plugin::PluginLoader<Plugin::IPlugin> other(slowPluginPath);
+    BOOST_CHECK(!other.load());
+    BOOST_CHECK(!other.load(std::chrono::seconds(10)));
+    BOOST_CHECK_MESSAGE(other.getErrorMsg().find("quarantined") != std::string::npos, other.getErrorMsg());
+
+    // Once released, the library loads in time, and is unloaded since it has no facade
+    Plugin::releasePluginQuarantine(slowPluginPath);
+    BOOST_CHECK(!loader.load(std::chrono::seconds(10)));
+    BOOST_CHECK(!loader.isLoaded());
+    BOOST_CHECK_MESSAGE(loader.getErrorMsg().find("facade") != std::string::npos, loader.getErrorMsg());
+    BOOST_CHECK(!Plugin::isPluginQuarantined(slowPluginPath));
+}
+
+BOOST_AUTO_TEST_CASE(QuarantinedPluginFailsFast)
+{
+    boost::filesystem::path myPluginPath(MYPLUGIN_PATH);
+
+    Plugin::quarantinePlugin(myPluginPath.native());
+    Plugin::PluginLoader<Plugin::IPlugin> loader(myPluginPath.native());
+    BOOST_CHECK(!loader.load());
+    BOOST_CHECK(!loader.load(std::chrono::seconds(10)));
+    BOOST_CHECK(!loader.isLoaded());
+    BOOST_MESSAGE(loader.getErrorMsg());
+
+    Plugin::releasePluginQuarantine(myPluginPath.native());
+    BOOST_CHECK(loader.load());
+}
@@ -0,0 +1,109 @@
+//          Copyright Jeremy Coulon 2012-2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+//==============
+//==  Plugin  ==
+//==============
+#include "Plugin/AllocationTracking.h"
+#include "Plugin/IPlugin.h"
+
+//=============
+//==  Boost  ==
+//=============
+#include <boost/test/unit_test.hpp>
+#include <boost/filesystem.hpp>
+
+//===========
+//==  STD  ==
+//===========
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Enable allocation accounting in the test executable
+PLUGIN_ALLOCATION_TRACKING_DEFINITION()
+
+BOOST_AUTO_TEST_CASE(AllocationScopeAttributesAllocations)
+{
+    Plugin::AllocationAccount& account = Plugin::allocationAccount("AllocationScopeAttributesAllocations");
+    Plugin::AllocationStats before = account.getStats();
+    BOOST_CHECK(!Plugin::currentAllocationAccount());
+
+    std::vector<char>* buffer = NULL;
+    {
+        Plugin::AllocationScope scope(account);
+        BOOST_CHECK_EQUAL(Plugin::currentAllocationAccount(), &account);
+        buffer = new std::vector<char>(1000);
+    }
+    BOOST_CHECK(!Plugin::currentAllocationAccount());
+
+    Plugin::AllocationStats during = account.getStats();
+    BOOST_CHECK_EQUAL(during.liveBytes - before.liveBytes, 1000u + sizeof(std::vector<char>));
+    BOOST_CHECK_EQUAL(during.allocations - before.allocations, 2u);
+    BOOST_CHECK(Plugin::allocationRate(before, during) > 0.0);
+
+    // Deallocation is attributed to the allocating account, whatever the current scope
+    delete buffer;
+    Plugin::AllocationStats after = account.getStats();
+    BOOST_CHECK_EQUAL(after.liveBytes, before.liveBytes);
+    BOOST_CHECK_EQUAL(after.peakBytes, during.liveBytes);
+    BOOST_CHECK_EQUAL(after.deallocations - before.deallocations, 2u);
+}
+
+BOOST_AUTO_TEST_CASE(AccountedPluginLoaderAttributesFacade)
+{
+    boost::filesystem::path myPluginPath(MYPLUGIN_PATH);
+
+    Plugin::AccountedPluginLoader<Plugin::IPlugin> loader(myPluginPath.native(), "AccountedPluginLoaderAttributesFacade");
+    BOOST_REQUIRE_MESSAGE(loader.load(), "Failed to load plugin: " << myPluginPath);
+    Plugin::AllocationStats loaded = loader.getAccount().getStats();
+
+    BOOST_REQUIRE(loader.getPluginInstance());
+    Plugin::AllocationStats created = loader.getAccount().getStats();
+    BOOST_CHECK(created.liveBytes > loaded.liveBytes);
+
+    std::string name = loader.call([](Plugin::IPlugin* plugin) { return plugin->iGetPluginName(); });
+    BOOST_CHECK_EQUAL(name, "Example");
+
+    BOOST_CHECK(loader.unload());
+    BOOST_CHECK_EQUAL(loader.getAccount().getStats().liveBytes, loaded.liveBytes);
+}
+
+BOOST_AUTO_TEST_CASE(UnloadReportsLeakedAllocations)
+{
+    boost::filesystem::path myPluginPath(MYPLUGIN_PATH);
+
+    Plugin::AccountedPluginLoader<Plugin::IPlugin> loader(myPluginPath.native(), "UnloadReportsLeakedAllocations");
+    loader.setLeakCheck(true);
+    BOOST_REQUIRE_MESSAGE(loader.load(), "Failed to load plugin: " << myPluginPath);
+    BOOST_REQUIRE(loader.getPluginInstance());
+
+    // Simulate a plugin leaking a block that points into its own code
+    void* factory = dlsym(loader.getLoader().getNativeHandle(), PLUGIN_FACTORY_CREATE);
+    BOOST_REQUIRE(factory);
+    void** leaked = loader.call([factory](Plugin::IPlugin*) {
+        void** block = new void*[2];
+        block[0] = factory;
+        block[1] = NULL;
+        return block;
+    });
+
+    BOOST_CHECK(loader.unload());
+    const Plugin::LeakReport& report = loader.getLeakReport();
+    BOOST_CHECK_EQUAL(report.plugin, "UnloadReportsLeakedAllocations");
+    BOOST_REQUIRE_EQUAL(report.allocations.size(), 1u);
+    BOOST_CHECK_EQUAL(report.leakedBytes, 2 * sizeof(void*));
+    BOOST_CHECK_EQUAL(report.allocations[0].address, static_cast<const void*>(leaked));
+    BOOST_CHECK_EQUAL(report.allocations[0].libraryPointers, 1u);
+#ifdef __GLIBC__
+    BOOST_CHECK(!report.allocations[0].frames.empty());
+#endif
+    std::ostringstream oss;
+    Plugin::writeLeakReport(oss, report);
+    BOOST_TEST_MESSAGE(oss.str());
+
+    delete[] leaked;
+    loader.setLeakCheck(false);
+}
@@ -0,0 +1,118 @@
+//          Copyright Jeremy Coulon 2012-2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+//==============
+//==  Plugin  ==
+//==============
+#include "Plugin/CallCombiner.h"
+
+//=============
+//==  Boost  ==
+//=============
+#include <boost/test/unit_test.hpp>
+
+//===========
+//==  STD  ==
+//===========
+#include <atomic>
+#include <future>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    // Plugin that is not thread-safe, and detects concurrent calls
+    class Counter
+    {
+    public:
+        Counter()
+            : value_(0),
+              inside_(false),
+              overlaps_(0)
+        {
+            // Empty
+        }
+
+        int add(int n)
+        {
+            if (inside_.exchange(true))
+                ++overlaps_;
+            value_ += n;
+            int res = value_;
+            inside_.store(false);
+            return res;
+        }
+
+        int value() const
+        {
+            return value_;
+        }
+
+        int overlaps() const
+        {
+            return overlaps_.load();
+        }
+
+    private:
+        int value_;
+        std::atomic<bool> inside_;
+        std::atomic<int> overlaps_;
+    };
+}
+
+BOOST_AUTO_TEST_CASE(CallCombinerSerializesCalls)
+{
+    Counter counter;
+    std::atomic<int> failures(0);
+    {
+        Plugin::CallCombiner<Counter> combiner(&counter, 3);
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; ++t)
+        {
+            threads.push_back(std::thread([&combiner, &failures]()
+            {
+                std::vector<std::future<int> > results;
+                for (int i = 0; i < 1000; ++i)
+                {
+                    results.push_back(combiner.call([](Counter* c) { return c->add(1); }));
+                    combiner.post([](Counter* c) { c->add(1); });
+                }
+                int previous = 0;
+                for (std::size_t i = 0; i < results.size(); ++i)
+                {
+                    // Running totals seen by one thread only grow
+                    int value = results[i].get();
+                    if (value <= previous)
+                        ++failures;
+                    previous = value;
+                }
+            }));
+        }
+        for (std::size_t i = 0; i < threads.size(); ++i)
+            threads[i].join();
+
+        BOOST_CHECK_EQUAL(combiner.getCallCount(), 8000u);
+        BOOST_CHECK(combiner.getPassCount() >= 1u);
+        BOOST_CHECK(combiner.getPassCount() <= combiner.getCallCount());
+    }
+    BOOST_CHECK_EQUAL(failures.load(), 0);
+    BOOST_CHECK_EQUAL(counter.value(), 8000);
+    BOOST_CHECK_EQUAL(counter.overlaps(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(CallCombinerForwardsExceptions)
+{
+    Counter counter;
+    Plugin::CallCombiner<Counter> combiner(&counter);
+    std::future<void> failed = combiner.call([](Counter*) { throw std::runtime_error("failed"); });
+    BOOST_CHECK_THROW(failed.get(), std::runtime_error);
+    // Posted calls have nobody to report to
+    combiner.post([](Counter*) { throw std::runtime_error("ignored"); });
+    std::future<void> done = combiner.call([](Counter* c) { c->add(5); });
+    done.get();
+    BOOST_CHECK_EQUAL(counter.value(), 5);
+    BOOST_CHECK_EQUAL(combiner.getCallCount(), 3u);
+}
@@ -0,0 +1,129 @@
+//          Copyright Jeremy Coulon 2012-2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+//==============
+//==  Plugin  ==
+//==============
+#include "Plugin/CallWatchdog.h"
+#include "Plugin/InterfaceDescription.h"
+
+//=============
+//==  Boost  ==
+//=============
+#include <boost/test/unit_test.hpp>
+
+//===========
+//==  STD  ==
+//===========
+#include <chrono>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace WatchdogTest
+{
+    class IWorker
+    {
+    public:
+        virtual ~IWorker() {}
+        virtual int work(int ms) = 0;
+        virtual int quick(int value) = 0;
+    };
+
+    class Worker : public IWorker
+    {
+    public:
+        virtual int work(int ms)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+            return ms;
+        }
+
+        virtual int quick(int value)
+        {
+            return value + 1;
+        }
+    };
+
+    class Reports
+    {
+    public:
+        void add(const Plugin::SlowCallReport& report)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            reports_.push_back(report);
+        }
+
+        std::vector<Plugin::SlowCallReport> get() const
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return reports_;
+        }
+
+    private:
+        mutable std::mutex mutex_;
+        std::vector<Plugin::SlowCallReport> reports_;
+    };
+}
+
+PLUGIN_INTERFACE_DESCRIPTION(WatchdogTest::IWorker, (work)(quick))
+
+BOOST_AUTO_TEST_CASE(WatchdogReportsSlowCallOnce)
+{
+    WatchdogTest::Reports reports;
+    Plugin::CallWatchdog watchdog(std::chrono::milliseconds(2));
+    watchdog.setReportSink([&reports](const Plugin::SlowCallReport& report) { reports.add(report); });
+
+    WatchdogTest::Worker worker;
+    Plugin::WatchedPlugin<WatchdogTest::IWorker> plugin(watchdog, "Worker", std::chrono::milliseconds(50), &worker);
+    for (int i = 0; i < 1000; ++i)
+        BOOST_CHECK_EQUAL(plugin.call(&WatchdogTest::IWorker::quick, i), i + 1);
+    BOOST_CHECK_EQUAL(plugin.call(&WatchdogTest::IWorker::work, 5), 5);
+    BOOST_CHECK_EQUAL(plugin.call(&WatchdogTest::IWorker::work, 200), 200);
+
+    std::vector<Plugin::SlowCallReport> slow = reports.get();
+    BOOST_REQUIRE_EQUAL(slow.size(), 1u);
+    BOOST_CHECK_EQUAL(watchdog.getReportCount(), 1u);
+    BOOST_CHECK_EQUAL(slow[0].pluginName, "Worker");
+    BOOST_CHECK_EQUAL(slow[0].methodName, "work");
+    BOOST_CHECK(slow[0].elapsedNs > 50000000u);
+    BOOST_CHECK_EQUAL(slow[0].thresholdNs, 50000000u);
+#ifdef __linux__
+    BOOST_REQUIRE(watchdog.isStackCaptureEnabled());
+    BOOST_CHECK(!slow[0].stack.empty());
+#endif
+
+    std::ostringstream text;
+    Plugin::CallWatchdog::writeReport(text, slow[0]);
+    BOOST_CHECK(text.str().find("Slow plugin call: Worker::work") != std::string::npos);
+}
+
+BOOST_AUTO_TEST_CASE(WatchdogThresholdPerPlugin)
+{
+    WatchdogTest::Reports reports;
+    Plugin::CallWatchdog watchdog(std::chrono::milliseconds(2));
+    watchdog.setReportSink([&reports](const Plugin::SlowCallReport& report) { reports.add(report); });
+
+    WatchdogTest::Worker worker;
+    Plugin::WatchedPlugin<WatchdogTest::IWorker> tolerant(watchdog, "Tolerant", std::chrono::seconds(10), &worker);
+    Plugin::WatchedPlugin<WatchdogTest::IWorker> strict(watchdog, "Strict", std::chrono::milliseconds(20), &worker);
+
+    // A slow call on another thread, nested in a call of a tolerant plugin
+    std::thread([&]()
+    {
+        Plugin::CallWatchdog::Scope outer(watchdog, "Tolerant", "outer", 10000000000ull);
+        strict.call(&WatchdogTest::IWorker::work, 100);
+        tolerant.call(&WatchdogTest::IWorker::work, 40);
+    }).join();
+    strict.setThreshold(std::chrono::seconds(10));
+    strict.call(&WatchdogTest::IWorker::work, 40);
+
+    std::vector<Plugin::SlowCallReport> slow = reports.get();
+    BOOST_REQUIRE_EQUAL(slow.size(), 1u);
+    BOOST_CHECK_EQUAL(slow[0].pluginName, "Strict");
+    BOOST_CHECK_EQUAL(watchdog.getThreadCount(), 2u);
+}
@@ -0,0 +1,184 @@
+//          Copyright Jeremy Coulon 2012-2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+//==============
+//==  Plugin  ==
+//==============
+#include "Plugin/EventBus.h"
+#include "Plugin/IPlugin.h"
+#include "Plugin/PluginLoader.h"
+
+//=============
+//==  Boost  ==
+//=============
+#include <boost/test/unit_test.hpp>
+#include <boost/filesystem.hpp>
+
+//===========
+//==  STD  ==
+//===========
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include <stdint.h>
+
+namespace
+{
+    static_assert(PLUGIN_TOPIC_ID("Example.Tick") != PLUGIN_TOPIC_ID("Example.Tock"), "Topic IDs must differ");
+
+    const uint64_t tickTopic = PLUGIN_TOPIC_ID("Example.Tick");
+
+    struct Received
+    {
+        Received()
+            : sum(0),
+              count(0),
+              batches(0)
+        {
+            // Empty
+        }
+
+        std::atomic<uint64_t> sum;
+        std::atomic<uint64_t> count;
+        std::atomic<uint64_t> batches;
+    };
+
+    void onTick(void* userData, const PluginEvent* events, size_t count)
+    {
+        Received* received = static_cast<Received*>(userData);
+        for (size_t i = 0; i < count; ++i)
+        {
+            // Called from the dispatcher thread: a wrong size shows up in the sum
+            uint32_t value = 0;
+            if (events[i].size == sizeof(value))
+                std::memcpy(&value, events[i].data, sizeof(value));
+            received->sum += value;
+        }
+        received->count += count;
+        ++received->batches;
+    }
+}
+
+BOOST_AUTO_TEST_CASE(EventBusBatchesDelivery)
+{
+    Plugin::EventBus bus;
+    Received received;
+    uint64_t subscription = bus.subscribe(tickTopic, &onTick, &received);
+    BOOST_REQUIRE(subscription != 0);
+
+    for (uint32_t i = 1; i <= 10; ++i)
+        BOOST_CHECK_EQUAL(bus.publish(tickTopic, &i, sizeof(i)), Plugin::eventPublished);
+    BOOST_CHECK_EQUAL(bus.dispatch(4), 4u);
+    BOOST_CHECK_EQUAL(received.count.load(), 4u);
+    BOOST_CHECK_EQUAL(received.sum.load(), 1u + 2u + 3u + 4u);
+    while (bus.dispatch(4) != 0)
+        continue;
+    BOOST_CHECK_EQUAL(received.sum.load(), 55u);
+    BOOST_CHECK_EQUAL(received.batches.load(), 3u);
+
+    Plugin::TopicStats stats;
+    BOOST_REQUIRE(bus.getStats(tickTopic, stats));
+    BOOST_CHECK_EQUAL(stats.published, 10u);
+    BOOST_CHECK_EQUAL(stats.delivered, 10u);
+    BOOST_CHECK_EQUAL(stats.batches, 3u);
+    BOOST_CHECK_EQUAL(stats.rejected, 0u);
+
+    BOOST_CHECK(bus.unsubscribe(subscription));
+    BOOST_CHECK(!bus.unsubscribe(subscription));
+    uint32_t value = 100;
+    bus.publish(tickTopic, &value, sizeof(value));
+    bus.dispatch();
+    BOOST_CHECK_EQUAL(received.sum.load(), 55u);
+}
+
+BOOST_AUTO_TEST_CASE(EventBusBackpressure)
+{
+    Plugin::EventBus bus(1);
+    const uint64_t topic = PLUGIN_TOPIC_ID("Example.Small");
+    BOOST_REQUIRE(bus.createTopic(topic, 4, sizeof(uint32_t)));
+    BOOST_CHECK(!bus.createTopic(topic, 4, sizeof(uint32_t)));
+
+    uint32_t value = 1;
+    for (int i = 0; i < 4; ++i)
+        BOOST_CHECK_EQUAL(bus.publish(topic, &value, sizeof(value)), Plugin::eventPublished);
+    BOOST_CHECK_EQUAL(bus.publish(topic, &value, sizeof(value)), Plugin::eventQueueFull);
+    BOOST_CHECK_EQUAL(bus.publish(topic, &value, sizeof(value), std::chrono::milliseconds(10)), Plugin::eventQueueFull);
+    uint64_t big = 0;
+    BOOST_CHECK_EQUAL(bus.publish(topic, &big, sizeof(big)), Plugin::eventTooLarge);
+    BOOST_CHECK_EQUAL(bus.publish(tickTopic, &value, sizeof(value)), Plugin::eventTopicLimit);
+
+    Plugin::TopicStats stats;
+    BOOST_REQUIRE(bus.getStats(topic, stats));
+    BOOST_CHECK_EQUAL(stats.published, 4u);
+    BOOST_CHECK(stats.rejected >= 2u);
+
+    // Draining makes room again
+    bus.dispatch();
+    BOOST_CHECK_EQUAL(bus.publish(topic, &value, sizeof(value)), Plugin::eventPublished);
+}
+
+BOOST_AUTO_TEST_CASE(EventBusConcurrentPublishers)
+{
+    const uint32_t producers = 4;
+    const uint32_t eventsPerProducer = 20000;
+
+    Plugin::EventBus bus(16, 256, sizeof(uint32_t));
+    Received received;
+    bus.subscribe(tickTopic, &onTick, &received);
+    bus.startDispatcher();
+
+    // Boost.Test assertions are not thread-safe
+    std::atomic<unsigned int> failures(0);
+    std::vector<std::thread> threads;
+    for (uint32_t p = 0; p < producers; ++p)
+    {
+        threads.push_back(std::thread([&bus, &failures]()
+        {
+            for (uint32_t i = 1; i <= eventsPerProducer; ++i)
+                if (bus.publish(tickTopic, &i, sizeof(i), std::chrono::seconds(10)) != Plugin::eventPublished)
+                    ++failures;
+        }));
+    }
+    for (std::size_t i = 0; i < threads.size(); ++i)
+        threads[i].join();
+    bus.stopDispatcher();
+
+    BOOST_CHECK_EQUAL(failures.load(), 0u);
+    uint64_t expected = static_cast<uint64_t>(producers) * eventsPerProducer * (eventsPerProducer + 1) / 2;
+    BOOST_CHECK_EQUAL(received.count.load(), static_cast<uint64_t>(producers) * eventsPerProducer);
+    BOOST_CHECK_EQUAL(received.sum.load(), expected);
+}
+
+BOOST_AUTO_TEST_CASE(EventBusThroughHostServices)
+{
+    boost::filesystem::path myPluginPath(MYPLUGIN_PATH);
+
+    Plugin::EventBus bus;
+    Plugin::HostServices services;
+    services.add(PLUGIN_EVENT_BUS_SERVICE, bus.api());
+
+    // The plugin receives the services when it is loaded
+    Plugin::PluginLoader<Plugin::IPlugin> loader(myPluginPath.native());
+    loader.setHostServices(services.table());
+    BOOST_REQUIRE_MESSAGE(loader.load(), "Failed to load plugin: " << loader.getErrorMsg());
+    void* symbol = dlsym(loader.getNativeHandle(), "globalHostServices");
+    BOOST_REQUIRE(symbol);
+    BOOST_CHECK(*static_cast<const PluginHostServices**>(symbol) == services.table());
+
+    // What a plugin does with them
+    Plugin::EventBusClient client(services.table());
+    BOOST_REQUIRE(client.isAvailable());
+    Received received;
+    uint64_t subscription = client.subscribe(tickTopic, &onTick, &received);
+    BOOST_CHECK_EQUAL(client.publish(tickTopic, static_cast<uint32_t>(42)), Plugin::eventPublished);
+    bus.dispatch();
+    BOOST_CHECK_EQUAL(received.sum.load(), 42u);
+    BOOST_CHECK(client.unsubscribe(subscription));
+
+    BOOST_CHECK(!Plugin::EventBusClient(NULL).isAvailable());
+}
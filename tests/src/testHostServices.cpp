@@ -0,0 +1,111 @@
+//          Copyright Jeremy Coulon 2012-2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+//==============
+//==  Plugin  ==
+//==============
+#include "Plugin/PluginHostServices.h"
+#include "Plugin/StandardServices.h"
+
+//=============
+//==  Boost  ==
+//=============
+#include <boost/test/unit_test.hpp>
+
+//===========
+//==  STD  ==
+//===========
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+// As in the header of a plugin. globalHostServices is defined in another file, as in a plugin of several files.
+PLUGIN_HOST_SERVICES_DECLARATION()
+
+namespace
+{
+    const void* lookupFirst(void* context, uint64_t id)
+    {
+        return id == PLUGIN_SERVICE_ID("first") ? context : NULL;
+    }
+}
+
+BOOST_AUTO_TEST_CASE(HostServicesPerfectHash)
+{
+    Plugin::HostServices services;
+    BOOST_CHECK(services.get(PLUGIN_SERVICE_ID("missing")) == NULL);
+
+    std::vector<int> values(100);
+    for (std::size_t i = 0; i < values.size(); ++i)
+        services.add(Plugin::hashName(("Service" + std::to_string(i)).c_str()), &values[i]);
+    // Replacing a service does not add a slot
+    services.add(Plugin::hashName("Service0"), &values[1]);
+
+    const PluginHostServices* table = services.table();
+    BOOST_CHECK_EQUAL(table->version, 2u);
+    BOOST_CHECK_EQUAL(services.getSlotCount(), table->slotMask + 1u);
+    BOOST_CHECK(services.getSlotCount() >= values.size());
+    for (std::size_t i = 0; i < values.size(); ++i)
+    {
+        uint64_t id = Plugin::hashName(("Service" + std::to_string(i)).c_str());
+        const int* expected = &values[i == 0 ? 1 : i];
+        BOOST_CHECK(Plugin::getHostService<int>(table, id) == expected);
+        BOOST_CHECK(services.get(id) == expected);
+        BOOST_CHECK(table->getService(table->context, id) == expected);
+    }
+    BOOST_CHECK(Plugin::getHostService<int>(table, PLUGIN_SERVICE_ID("missing")) == NULL);
+    BOOST_CHECK(Plugin::getHostService<int>(NULL, PLUGIN_SERVICE_ID("missing")) == NULL);
+
+    // Tables of version 1 have no slots
+    int first = 1;
+    PluginHostServices old = { 24, 1, &first, &lookupFirst, 0, 0, NULL };
+    BOOST_CHECK(Plugin::getHostService<int>(&old, PLUGIN_SERVICE_ID("first")) == &first);
+    BOOST_CHECK(Plugin::getHostService<int>(&old, PLUGIN_SERVICE_ID("second")) == NULL);
+}
+
+BOOST_AUTO_TEST_CASE(StandardServicesThroughHostServices)
+{
+    Plugin::HostServices services;
+    Plugin::StandardServices standard;
+    standard.addTo(services);
+    attachPluginHostServices(services.table());
+    BOOST_REQUIRE(globalHostServices == services.table());
+
+    const PluginClockApi* clock = PLUGIN_HOST_SERVICE(PluginClockApi, PLUGIN_CLOCK_SERVICE);
+    BOOST_REQUIRE(clock != NULL);
+    uint64_t before = clock->monotonicNs(clock->context);
+    BOOST_CHECK(clock->monotonicNs(clock->context) >= before);
+    BOOST_CHECK(clock->wallNs(clock->context) > 1000000000ULL * 1000000000ULL);
+
+    const PluginAllocatorApi* allocator = PLUGIN_HOST_SERVICE(PluginAllocatorApi, PLUGIN_ALLOCATOR_SERVICE);
+    BOOST_REQUIRE(allocator != NULL);
+    void* block = allocator->allocate(allocator->context, 100, 64);
+    BOOST_REQUIRE(block != NULL);
+    BOOST_CHECK_EQUAL(reinterpret_cast<uintptr_t>(block) % 64, 0u);
+    BOOST_CHECK_EQUAL(standard.getLiveBytes(), 100u);
+    BOOST_CHECK_EQUAL(standard.getLiveBlocks(), 1u);
+    BOOST_CHECK(allocator->allocate(allocator->context, 8, 3) == NULL);
+    allocator->deallocate(allocator->context, block);
+    allocator->deallocate(allocator->context, NULL);
+    BOOST_CHECK_EQUAL(standard.getLiveBytes(), 0u);
+    BOOST_CHECK_EQUAL(standard.getLiveBlocks(), 0u);
+
+    std::vector<std::string> messages;
+    standard.setLogSink([&messages](Plugin::LogLevel level, const std::string& message)
+    {
+        messages.push_back(std::to_string(level) + ":" + message);
+    });
+    standard.setMinimumLevel(Plugin::logWarning);
+    const PluginLoggerApi* logger = PLUGIN_HOST_SERVICE(PluginLoggerApi, PLUGIN_LOGGER_SERVICE);
+    BOOST_REQUIRE(logger != NULL);
+    BOOST_CHECK(!logger->isEnabled(logger->context, Plugin::logInfo));
+    BOOST_CHECK(logger->isEnabled(logger->context, Plugin::logError));
+    logger->log(logger->context, Plugin::logInfo, "dropped");
+    logger->log(logger->context, Plugin::logError, "kept");
+    BOOST_REQUIRE_EQUAL(messages.size(), 1u);
+    BOOST_CHECK_EQUAL(messages[0], "3:kept");
+    attachPluginHostServices(NULL);
+}
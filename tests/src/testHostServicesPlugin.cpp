@@ -0,0 +1,23 @@
+//          Copyright Jeremy Coulon 2012-2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+// Plugin side of testHostServices.cpp: the host services are defined in this file only,
+// so that PLUGIN_HOST_SERVICE is tested from a file that only sees PLUGIN_HOST_SERVICES_DECLARATION.
+
+//==============
+//==  Plugin  ==
+//==============
+#include "Plugin/PluginHostServices.h"
+
+PLUGIN_HOST_SERVICES_DECLARATION()
+
+// Hidden: the test executable exports its symbols, and would take the place of the services of the plugins it loads
+#ifdef __GNUC__
+#pragma GCC visibility push(hidden)
+#endif
+PLUGIN_HOST_SERVICES_DEFINITION()
+#ifdef __GNUC__
+#pragma GCC visibility pop
+#endif
@@ -0,0 +1,110 @@
+//          Copyright Jeremy Coulon 2012-2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+//==============
+//==  Plugin  ==
+//==============
+#include "Plugin/IPlugin.h"
+#include "Plugin/LoadHistory.h"
+#include "Plugin/PluginLoader.h"
+
+//=============
+//==  Boost  ==
+//=============
+#include <boost/test/unit_test.hpp>
+#include <boost/filesystem.hpp>
+
+//===========
+//==  STD  ==
+//===========
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <dlfcn.h>
+#endif
+
+#ifndef _WIN32
+BOOST_AUTO_TEST_CASE(LoadHistoryRecordsLoads)
+{
+    boost::filesystem::path myPluginPath(MYPLUGIN_PATH);
+    Plugin::LoadHistory& history = Plugin::LoadHistory::instance();
+    std::size_t before = history.getRecords().size();
+
+    std::size_t address = 0;
+    {
+        Plugin::PluginLoader<Plugin::IPlugin> loader(myPluginPath.native());
+        BOOST_REQUIRE(loader.load());
+        address = reinterpret_cast<std::size_t>(dlsym(loader.getNativeHandle(), PLUGIN_FACTORY_CREATE));
+        BOOST_REQUIRE(address != 0);
+    }
+
+    std::vector<Plugin::LoadRecord> records = history.getRecords();
+    BOOST_REQUIRE_EQUAL(records.size(), before + 1);
+    const Plugin::LoadRecord& record = records.back();
+    BOOST_CHECK(record.generation > 0);
+    BOOST_CHECK_EQUAL(record.name, myPluginPath.native());
+    BOOST_CHECK(record.library.path.find(myPluginPath.filename().string()) != std::string::npos);
+    BOOST_CHECK(!record.library.buildId.empty());
+    BOOST_CHECK(record.loadTimeNs > 0);
+    BOOST_CHECK(record.unloadTimeNs >= record.loadTimeNs);
+    BOOST_CHECK(record.handle == NULL);
+
+    // Found while loaded only, even once unloaded
+    Plugin::LoadRecord found;
+    BOOST_REQUIRE(history.find(address, record.loadTimeNs, found));
+    BOOST_CHECK_EQUAL(found.generation, record.generation);
+    BOOST_CHECK(!history.find(address, record.unloadTimeNs, found) || found.generation != record.generation);
+    BOOST_CHECK(!history.find(address, record.loadTimeNs - 1, found) || found.generation != record.generation);
+
+    std::ostringstream text;
+    history.writeHistory(text);
+    BOOST_CHECK(text.str().find(record.library.buildId) != std::string::npos);
+}
+
+BOOST_AUTO_TEST_CASE(LoadHistoryWritesPerfMap)
+{
+    boost::filesystem::path myPluginPath(MYPLUGIN_PATH);
+    Plugin::LoadHistory& history = Plugin::LoadHistory::instance();
+    std::string path = (boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("perf-%%%%%%.map")).string();
+    BOOST_REQUIRE(history.enablePerfMap(path));
+    BOOST_CHECK_EQUAL(history.getPerfMapPath(), path);
+    {
+        Plugin::PluginLoader<Plugin::IPlugin> loader(myPluginPath.native());
+        BOOST_REQUIRE(loader.load());
+    }
+    history.disablePerfMap();
+    BOOST_CHECK(history.getPerfMapPath().empty());
+
+    // Entries are sorted and do not overlap within a generation
+    std::ifstream file(path.c_str());
+    std::string line;
+    bool named = false;
+    std::size_t lines = 0;
+    std::size_t end = 0;
+    std::string generation;
+    while (std::getline(file, line))
+    {
+        std::istringstream iss(line);
+        std::size_t start = 0;
+        std::size_t size = 0;
+        BOOST_REQUIRE(iss >> std::hex >> start >> size);
+        BOOST_CHECK(size > 0);
+        std::string tag = line.substr(line.rfind('['));
+        if (tag == generation)
+            BOOST_CHECK(start >= end);
+        generation = tag;
+        end = start + size;
+        named = named || line.find("createPluginFacade") != std::string::npos;
+        ++lines;
+    }
+    BOOST_CHECK(lines > 0);
+    BOOST_CHECK(named);
+    std::remove(path.c_str());
+}
+#endif
@@ -0,0 +1,110 @@
+//          Copyright Jeremy Coulon 2012-2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+//==============
+//==  Plugin  ==
+//==============
+#include "Plugin/InterfaceDescription.h"
+#include "Plugin/PerfCounters.h"
+#include "Plugin/PluginInterceptor.h"
+
+//=============
+//==  Boost  ==
+//=============
+#include <boost/test/unit_test.hpp>
+
+//===========
+//==  STD  ==
+//===========
+#include <sstream>
+#include <string>
+#include <thread>
+
+namespace PerfCountersTest
+{
+    class ISummer
+    {
+    public:
+        virtual ~ISummer() {}
+        virtual uint64_t sum(uint64_t count) = 0;
+        virtual uint64_t identity(uint64_t value) = 0;
+    };
+
+    class Summer : public ISummer
+    {
+    public:
+        virtual uint64_t sum(uint64_t count)
+        {
+            volatile uint64_t res = 0;
+            for (uint64_t i = 0; i < count; ++i)
+                res = res + i;
+            return res;
+        }
+
+        virtual uint64_t identity(uint64_t value)
+        {
+            return value;
+        }
+    };
+}
+
+PLUGIN_INTERFACE_DESCRIPTION(PerfCountersTest::ISummer, (sum))
+
+BOOST_AUTO_TEST_CASE(PerfCounterGroupCountsInstructions)
+{
+    Plugin::PerfCounterGroup group;
+    Plugin::PerfSample before;
+    Plugin::PerfSample after;
+    if (!group.isAvailable())
+    {
+        BOOST_TEST_MESSAGE("Hardware counters are unavailable");
+        BOOST_CHECK(!group.isUserRead());
+        BOOST_CHECK(!group.read(before));
+        return;
+    }
+    BOOST_REQUIRE(group.read(before));
+    PerfCountersTest::Summer().sum(100000);
+    BOOST_REQUIRE(group.read(after));
+    BOOST_CHECK(after.values[Plugin::perfInstructions] - before.values[Plugin::perfInstructions] >= 100000u);
+    BOOST_CHECK(after.values[Plugin::perfCycles] > before.values[Plugin::perfCycles]);
+}
+
+BOOST_AUTO_TEST_CASE(CounterInterceptionPerMethod)
+{
+    PerfCountersTest::Summer summer;
+    Plugin::PluginInterceptor<PerfCountersTest::ISummer, Plugin::CounterInterception> proxy(&summer);
+    bool available = Plugin::PerfCounterGroup().isAvailable();
+
+    for (int i = 0; i < 10; ++i)
+        BOOST_CHECK_EQUAL(proxy.call(&PerfCountersTest::ISummer::sum, 1000u), 499500u);
+    std::thread([&proxy]() { proxy.call(&PerfCountersTest::ISummer::identity, 7u); }).join();
+    BOOST_CHECK_EQUAL(proxy.getShardCount(), 2u);
+
+    std::vector<Plugin::CallCounters> counters = proxy.merge();
+    BOOST_REQUIRE_EQUAL(counters.size(), 2u);
+    BOOST_CHECK_EQUAL(counters[0].calls, 10u);
+    BOOST_CHECK(counters[0].wallNs > 0u);
+    BOOST_CHECK_EQUAL(counters[1].calls, 1u);
+    Plugin::CallCounters sum = proxy.getCounters(&PerfCountersTest::ISummer::sum);
+    BOOST_CHECK_EQUAL(sum.calls, 10u);
+
+    std::ostringstream report;
+    proxy.writeReport(report);
+    BOOST_CHECK(report.str().find("sum calls=10") != std::string::npos);
+    BOOST_CHECK(report.str().find("(other) calls=1") != std::string::npos);
+    if (available)
+    {
+        BOOST_CHECK_EQUAL(sum.countedCalls, 10u);
+        BOOST_CHECK(sum.getMean(Plugin::perfInstructions) >= 1000.0);
+        BOOST_CHECK(report.str().find("ipc=") != std::string::npos);
+    }
+    else
+    {
+        // Falls back to wall time
+        BOOST_CHECK_EQUAL(sum.countedCalls, 0u);
+        BOOST_CHECK_EQUAL(sum.getMean(Plugin::perfInstructions), 0.0);
+        BOOST_CHECK(report.str().find("no hardware counters") != std::string::npos);
+    }
+}
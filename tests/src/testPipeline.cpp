@@ -0,0 +1,167 @@
+//          Copyright Jeremy Coulon 2012-2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+//==============
+//==  Plugin  ==
+//==============
+#include "Plugin/Pipeline.h"
+#include "Plugin/WorkStealingPool.h"
+
+//=============
+//==  Boost  ==
+//=============
+#include <boost/test/unit_test.hpp>
+
+//===========
+//==  STD  ==
+//===========
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    // Double every item
+    class Enrich : public Plugin::IPipelineStage<int>
+    {
+    public:
+        virtual void iProcess(std::vector<int>& batch)
+        {
+            for (std::size_t i = 0; i < batch.size(); ++i)
+                batch[i] *= 2;
+        }
+    };
+
+    // Keep multiples of 4, slowly
+    class Filter : public Plugin::IPipelineStage<int>
+    {
+    public:
+        virtual void iProcess(std::vector<int>& batch)
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+            std::vector<int> kept;
+            for (std::size_t i = 0; i < batch.size(); ++i)
+                if (batch[i] % 4 == 0)
+                    kept.push_back(batch[i]);
+            batch.swap(kept);
+        }
+    };
+
+    // Reject batches holding a multiple of 100
+    class Reject : public Plugin::IPipelineStage<int>
+    {
+    public:
+        virtual void iProcess(std::vector<int>& batch)
+        {
+            for (std::size_t i = 0; i < batch.size(); ++i)
+                if (batch[i] % 100 == 0)
+                    throw std::runtime_error("rejected");
+        }
+    };
+
+    void runPipeline(Plugin::WorkStealingPool* pool)
+    {
+        Enrich enrich;
+        Filter filter;
+        Plugin::Pipeline<int> pipeline(16, 2);
+        pipeline.addStage(&enrich, "enrich");
+        pipeline.addStage(&filter, "filter");
+        std::vector<int> output;
+        pipeline.setSink([&output](std::vector<int>& batch) { output.insert(output.end(), batch.begin(), batch.end()); });
+        BOOST_REQUIRE(pipeline.start(pool));
+
+        for (int i = 0; i < 1000; ++i)
+            pipeline.push(i);
+        pipeline.close();
+        pipeline.wait();
+
+        // Order is preserved
+        BOOST_REQUIRE_EQUAL(output.size(), 500u);
+        for (std::size_t i = 0; i < output.size(); ++i)
+            BOOST_CHECK_EQUAL(output[i], static_cast<int>(4 * i));
+
+        Plugin::StageStats enrichStats = pipeline.getStageStats(0);
+        Plugin::StageStats filterStats = pipeline.getStageStats(1);
+        BOOST_CHECK_EQUAL(enrichStats.itemsIn, 1000u);
+        BOOST_CHECK_EQUAL(enrichStats.itemsOut, 1000u);
+        BOOST_CHECK_EQUAL(enrichStats.batches, 63u);
+        BOOST_CHECK_EQUAL(filterStats.itemsIn, 1000u);
+        BOOST_CHECK_EQUAL(filterStats.itemsOut, 500u);
+        BOOST_CHECK(filterStats.busyNs > 0);
+        BOOST_CHECK_EQUAL(filterStats.queueDepth, 0u);
+        // The slow stage bounded its queue
+        BOOST_CHECK(filterStats.maxQueueDepth >= 1u && filterStats.maxQueueDepth <= 2u);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(PipelineOnDedicatedThreads)
+{
+    runPipeline(NULL);
+}
+
+BOOST_AUTO_TEST_CASE(PipelineOnWorkStealingPool)
+{
+    Plugin::WorkStealingPool pool(3);
+    runPipeline(&pool);
+}
+
+BOOST_AUTO_TEST_CASE(PipelineDropsBatchesOfThrowingStage)
+{
+    Plugin::WorkStealingPool pool(2);
+    Reject reject;
+    Enrich enrich;
+    Plugin::Pipeline<int> pipeline(10, 2);
+    pipeline.addStage(&reject, "reject");
+    pipeline.addStage(&enrich, "enrich");
+    std::vector<int> output;
+    pipeline.setSink([&output](std::vector<int>& batch) { output.insert(output.end(), batch.begin(), batch.end()); });
+    BOOST_REQUIRE(pipeline.start(&pool));
+
+    for (int i = 0; i < 1000; ++i)
+        pipeline.push(i);
+    pipeline.close();
+    // Returns although 10 batches threw
+    pipeline.wait();
+
+    BOOST_CHECK_EQUAL(pipeline.getFailedBatchCount(), 10u);
+    BOOST_CHECK_EQUAL(pipeline.getErrorMsg(), "reject: rejected");
+    BOOST_REQUIRE_EQUAL(output.size(), 900u);
+    BOOST_CHECK_EQUAL(output.front(), 20);
+    BOOST_CHECK_EQUAL(pipeline.getStageStats(1).itemsIn, 900u);
+}
+
+BOOST_AUTO_TEST_CASE(PipelineRejectsMissingPlugin)
+{
+    Plugin::Pipeline<int> pipeline;
+    BOOST_CHECK(!pipeline.addStage("NonExistingPath"));
+    BOOST_CHECK(!pipeline.getErrorMsg().empty());
+    BOOST_CHECK(!pipeline.start());
+}
+
+BOOST_AUTO_TEST_CASE(WorkStealingPoolRunsNestedTasks)
+{
+    std::atomic<int> count(0);
+    {
+        Plugin::WorkStealingPool pool(4);
+        BOOST_CHECK_EQUAL(pool.size(), 4u);
+        for (int i = 0; i < 100; ++i)
+        {
+            pool.submit([&pool, &count]()
+            {
+                for (int j = 0; j < 10; ++j)
+                    pool.submit([&count]() { ++count; });
+                ++count;
+            });
+        }
+        pool.submit([]() { throw 42; });
+        pool.waitIdle();
+        BOOST_CHECK_EQUAL(count.load(), 1100);
+        BOOST_CHECK_EQUAL(pool.getExecutedCount(), 1101u);
+        BOOST_CHECK_EQUAL(pool.getFailedCount(), 1u);
+        BOOST_CHECK(!pool.isWorkerThread());
+    }
+}
@@ -0,0 +1,72 @@
+//          Copyright Jeremy Coulon 2012-2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+//==============
+//==  Plugin  ==
+//==============
+#include "Plugin/PluginCache.h"
+#include "Plugin/IPlugin.h"
+
+//=============
+//==  Boost  ==
+//=============
+#include <boost/test/unit_test.hpp>
+#include <boost/filesystem.hpp>
+
+//===========
+//==  STD  ==
+//===========
+#include <fstream>
+#include <string>
+
+BOOST_AUTO_TEST_CASE(CacheEvictsIdlePlugins)
+{
+    boost::filesystem::path myPluginPath(MYPLUGIN_PATH);
+    Plugin::PluginCache<Plugin::IPlugin> cache;
+
+    {
+        Plugin::PluginCache<Plugin::IPlugin>::Handle plugin = cache.acquire(myPluginPath.native());
+        BOOST_REQUIRE_MESSAGE(plugin, "Failed to load plugin: " << cache.getErrorMsg());
+        BOOST_CHECK_EQUAL(plugin->iGetPluginName(), std::string("Example"));
+        BOOST_CHECK(cache.isCached(myPluginPath.native()));
+
+        // A plugin in use is never evicted
+        BOOST_CHECK_EQUAL(cache.evict(0), 0u);
+        BOOST_CHECK(cache.isCached(myPluginPath.native()));
+    }
+
+#ifdef __linux__
+    BOOST_CHECK(cache.getFootprint() > 0);
+    BOOST_CHECK_EQUAL(cache.evict(0), 1u);
+    BOOST_CHECK(!cache.isCached(myPluginPath.native()));
+#endif
+}
+
+BOOST_AUTO_TEST_CASE(CacheReactsToMemoryPressure)
+{
+    boost::filesystem::path myPluginPath(MYPLUGIN_PATH);
+    boost::filesystem::path psiPath = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+    boost::filesystem::path eventsPath = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+    std::ofstream(eventsPath.c_str()) << "low 0\nhigh 0\nmax 0\noom 0\noom_kill 0\n";
+    std::ofstream(psiPath.c_str()) << "some avg10=0.00 avg60=0.00 avg300=0.00 total=0\n";
+
+    Plugin::PluginCache<Plugin::IPlugin> cache;
+    cache.setPressureSources(psiPath.native(), eventsPath.native());
+    BOOST_REQUIRE(cache.acquire(myPluginPath.native()));
+
+    // No pressure, no budget: nothing to evict
+    BOOST_CHECK_EQUAL(cache.checkMemoryPressure(), 0u);
+    BOOST_CHECK_EQUAL(cache.size(), 1u);
+
+    // The cgroup went over memory.high
+    std::ofstream(eventsPath.c_str()) << "low 0\nhigh 1\nmax 0\noom 0\noom_kill 0\n";
+#ifdef __linux__
+    BOOST_CHECK_EQUAL(cache.checkMemoryPressure(), 1u);
+    BOOST_CHECK_EQUAL(cache.size(), 0u);
+#endif
+
+    boost::filesystem::remove(psiPath);
+    boost::filesystem::remove(eventsPath);
+}
@@ -0,0 +1,116 @@
+//          Copyright Jeremy Coulon 2012-2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+//==============
+//==  Plugin  ==
+//==============
+#include "Plugin/PluginChannel.h"
+
+//=============
+//==  Boost  ==
+//=============
+#include <boost/test/unit_test.hpp>
+
+//===========
+//==  STD  ==
+//===========
+#include <thread>
+#include <vector>
+
+#include <stdint.h>
+
+BOOST_AUTO_TEST_CASE(ChannelBatchesWrapAround)
+{
+    Plugin::PluginChannel channel(sizeof(uint32_t), 6);
+    BOOST_CHECK_EQUAL(channel.descriptor()->capacity, 8u);
+
+    Plugin::ChannelWriter<uint32_t> writer(channel.descriptor());
+    Plugin::ChannelReader<uint32_t> reader(channel.descriptor());
+    BOOST_REQUIRE(writer.isValid());
+    BOOST_REQUIRE(reader.isValid());
+    BOOST_CHECK(!Plugin::ChannelWriter<uint64_t>(channel.descriptor()).isValid());
+
+    uint32_t values[12];
+    for (uint32_t i = 0; i < 12; ++i)
+        values[i] = i;
+    uint32_t out[12] = { 0 };
+
+    BOOST_CHECK_EQUAL(writer.push(values, 5), 5u);
+    BOOST_CHECK_EQUAL(reader.pop(out, 3), 3u);
+    // Only 6 free slots left, across the end of the ring
+    BOOST_CHECK_EQUAL(writer.push(values + 5, 7), 6u);
+    BOOST_CHECK(!writer.push(values[11]));
+    BOOST_CHECK_EQUAL(reader.size(), 8u);
+    BOOST_CHECK_EQUAL(reader.pop(out + 3, 12), 8u);
+    for (uint32_t i = 0; i < 11; ++i)
+        BOOST_CHECK_EQUAL(out[i], i);
+    BOOST_CHECK(!reader.pop(out[0]));
+}
+
+BOOST_AUTO_TEST_CASE(ChannelStreamsBetweenThreads)
+{
+    const uint64_t count = 200000;
+    Plugin::PluginChannel channel(sizeof(uint64_t), 1024);
+
+    std::thread producer([&channel, count]()
+    {
+        Plugin::ChannelWriter<uint64_t> writer(channel.descriptor());
+        uint64_t batch[32];
+        uint64_t next = 0;
+        while (next < count)
+        {
+            std::size_t n = 0;
+            while (n < 32 && next + n < count)
+            {
+                batch[n] = next + n;
+                ++n;
+            }
+            std::size_t pushed = writer.push(batch, n);
+            next += pushed;
+            if (pushed == 0)
+                std::this_thread::yield();
+        }
+    });
+
+    Plugin::ChannelReader<uint64_t> reader(channel.descriptor());
+    uint64_t batch[64];
+    uint64_t expected = 0;
+    bool ordered = true;
+    while (expected < count)
+    {
+        std::size_t n = reader.pop(batch, 64);
+        for (std::size_t i = 0; i < n; ++i)
+            ordered = ordered && batch[i] == expected++;
+        if (n == 0)
+            std::this_thread::yield();
+    }
+    producer.join();
+    BOOST_CHECK(ordered);
+}
+
+BOOST_AUTO_TEST_CASE(ChannelHubWiresPorts)
+{
+    const uint64_t decoderOutput = PLUGIN_SERVICE_ID("Decoder.Output");
+    const uint64_t encoderInput = PLUGIN_SERVICE_ID("Encoder.Input");
+
+    Plugin::ChannelHub hub;
+    BOOST_REQUIRE(hub.connect(decoderOutput, encoderInput, sizeof(uint32_t), 16));
+    BOOST_CHECK(!hub.connect(decoderOutput, PLUGIN_SERVICE_ID("Other.Input"), sizeof(uint32_t), 16));
+    Plugin::HostServices services;
+    services.add(PLUGIN_CHANNEL_SERVICE, hub.api());
+
+    // What each plugin does with the services it received
+    Plugin::ChannelWriter<uint32_t> writer(Plugin::getPluginChannel(services.table(), decoderOutput));
+    Plugin::ChannelReader<uint32_t> reader(Plugin::getPluginChannel(services.table(), encoderInput));
+    BOOST_REQUIRE(writer.isValid());
+    BOOST_REQUIRE(reader.isValid());
+    BOOST_CHECK(Plugin::getPluginChannel(services.table(), PLUGIN_SERVICE_ID("Other.Input")) == NULL);
+    BOOST_CHECK(Plugin::getPluginChannel(NULL, encoderInput) == NULL);
+
+    BOOST_CHECK(writer.push(42u));
+    uint32_t value = 0;
+    BOOST_CHECK(reader.pop(value));
+    BOOST_CHECK_EQUAL(value, 42u);
+}
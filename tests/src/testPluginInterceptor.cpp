@@ -0,0 +1,163 @@
+//          Copyright Jeremy Coulon 2012-2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+//==============
+//==  Plugin  ==
+//==============
+#include "Plugin/InterfaceDescription.h"
+#include "Plugin/LatencyHistogram.h"
+#include "Plugin/PluginInterceptor.h"
+
+//=============
+//==  Boost  ==
+//=============
+#include <boost/test/unit_test.hpp>
+
+//===========
+//==  STD  ==
+//===========
+#include <chrono>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace InterceptorTest
+{
+    class ICalculator
+    {
+    public:
+        virtual ~ICalculator() {}
+        virtual int add(int a, int b) = 0;
+        virtual void sleep(int ms) = 0;
+        virtual void fail() = 0;
+        virtual const std::string& name() const = 0;
+    };
+
+    class Calculator : public ICalculator
+    {
+    public:
+        Calculator()
+            : name_("calculator")
+        {
+            // Empty
+        }
+
+        virtual int add(int a, int b)
+        {
+            return a + b;
+        }
+
+        virtual void sleep(int ms)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+        }
+
+        virtual void fail()
+        {
+            throw std::runtime_error("failed");
+        }
+
+        virtual const std::string& name() const
+        {
+            return name_;
+        }
+
+    private:
+        std::string name_;
+    };
+}
+
+PLUGIN_INTERFACE_DESCRIPTION(InterceptorTest::ICalculator, (add)(sleep)(fail))
+
+BOOST_AUTO_TEST_CASE(LatencyHistogramBuckets)
+{
+    for (uint64_t value = 0; value < 100000; value = value * 3 / 2 + 1)
+    {
+        std::size_t index = Plugin::LatencyHistogram::bucketIndex(value);
+        BOOST_CHECK(Plugin::LatencyHistogram::bucketLowerBound(index) <= value);
+        BOOST_CHECK(Plugin::LatencyHistogram::bucketUpperBound(index) >= value);
+    }
+    BOOST_CHECK_EQUAL(Plugin::LatencyHistogram::bucketIndex(~uint64_t(0)), Plugin::LatencyHistogram::bucketCount - 1);
+
+    Plugin::LatencyHistogram histogram;
+    BOOST_CHECK_EQUAL(histogram.getPercentile(50), 0u);
+    for (uint64_t i = 1; i <= 1000; ++i)
+        histogram.record(i * 1000);
+    BOOST_CHECK_EQUAL(histogram.getCount(), 1000u);
+    BOOST_CHECK_EQUAL(histogram.getMax(), 1000000u);
+    BOOST_CHECK_CLOSE(histogram.getMean(), 500500.0, 0.001);
+    // Within the precision of the buckets
+    BOOST_CHECK_CLOSE(static_cast<double>(histogram.getPercentile(50)), 500000.0, 6.25);
+    BOOST_CHECK_CLOSE(static_cast<double>(histogram.getPercentile(99)), 990000.0, 6.25);
+    BOOST_CHECK_EQUAL(histogram.getPercentile(100), 1000000u);
+}
+
+BOOST_AUTO_TEST_CASE(InterceptorRecordsPerMethodLatency)
+{
+    InterceptorTest::Calculator calculator;
+    Plugin::PluginInterceptor<InterceptorTest::ICalculator> proxy(&calculator);
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 3; ++t)
+    {
+        threads.push_back(std::thread([&proxy]()
+        {
+            for (int i = 0; i < 1000; ++i)
+                proxy.call(&InterceptorTest::ICalculator::add, i, 1);
+        }));
+    }
+    for (std::size_t t = 0; t < threads.size(); ++t)
+        threads[t].join();
+    proxy.call(&InterceptorTest::ICalculator::sleep, 5);
+    BOOST_CHECK_THROW(proxy.call(&InterceptorTest::ICalculator::fail), std::runtime_error);
+    BOOST_CHECK_EQUAL(proxy.call(&InterceptorTest::ICalculator::name), "calculator");
+    BOOST_CHECK_EQUAL(proxy.call(&InterceptorTest::ICalculator::add, 2, 3), 5);
+
+    BOOST_CHECK_EQUAL(proxy.getShardCount(), 4u);
+    std::vector<Plugin::LatencyHistogram> histograms = proxy.merge();
+    BOOST_REQUIRE_EQUAL(histograms.size(), 4u);
+    BOOST_CHECK_EQUAL(histograms[0].getCount(), 3001u);
+    BOOST_CHECK_EQUAL(histograms[1].getCount(), 1u);
+    BOOST_CHECK(histograms[1].getMax() >= 5000000u);
+    // Failed calls are recorded too
+    BOOST_CHECK_EQUAL(histograms[2].getCount(), 1u);
+    // Not described
+    BOOST_CHECK_EQUAL(histograms[3].getCount(), 1u);
+    BOOST_CHECK_EQUAL(proxy.getHistogram(&InterceptorTest::ICalculator::add).getCount(), 3001u);
+
+    std::ostringstream report;
+    proxy.writeReport(report);
+    BOOST_CHECK(report.str().find("add count=3001") != std::string::npos);
+    BOOST_CHECK(report.str().find("(other) count=1") != std::string::npos);
+}
+
+BOOST_AUTO_TEST_CASE(InterceptorsPerRequestDoNotAccumulate)
+{
+    InterceptorTest::Calculator calculator;
+    Plugin::PluginInterceptor<InterceptorTest::ICalculator> kept(&calculator);
+    kept.call(&InterceptorTest::ICalculator::add, 1, 1);
+    for (int i = 0; i < 100; ++i)
+    {
+        Plugin::PluginInterceptor<InterceptorTest::ICalculator> proxy(&calculator);
+        BOOST_CHECK_EQUAL(proxy.call(&InterceptorTest::ICalculator::add, i, 1), i + 1);
+    }
+    // The entries of destroyed interceptors are forgotten by the thread
+    BOOST_CHECK(Plugin::detail::threadShards().entries.size() <= 2u);
+    BOOST_CHECK_EQUAL(kept.call(&InterceptorTest::ICalculator::add, 2, 3), 5);
+    BOOST_CHECK_EQUAL(kept.getShardCount(), 1u);
+    BOOST_CHECK_EQUAL(kept.getHistogram(&InterceptorTest::ICalculator::add).getCount(), 2u);
+}
+
+BOOST_AUTO_TEST_CASE(InterceptorCompilesAway)
+{
+    typedef Plugin::PluginInterceptor<InterceptorTest::ICalculator, Plugin::NoInterception> Proxy;
+    BOOST_CHECK_EQUAL(sizeof(Proxy), sizeof(InterceptorTest::ICalculator*));
+    InterceptorTest::Calculator calculator;
+    Proxy proxy(&calculator);
+    BOOST_CHECK_EQUAL(proxy.call(&InterceptorTest::ICalculator::add, 1, 2), 3);
+    BOOST_CHECK(proxy.get() == &calculator);
+}
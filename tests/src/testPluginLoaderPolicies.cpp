@@ -0,0 +1,180 @@
+//          Copyright Jeremy Coulon 2012-2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+//==============
+//==  Plugin  ==
+//==============
+#include "Plugin/PluginLoader.h"
+#include "Plugin/IPlugin.h"
+
+//=============
+//==  Boost  ==
+//=============
+#include <boost/test/unit_test.hpp>
+#include <boost/filesystem.hpp>
+
+//===========
+//==  STD  ==
+//===========
+#include <chrono>
+#include <string>
+#include <thread>
+
+namespace LoaderPoliciesTest
+{
+    class StaticPlugin : public Plugin::IPlugin
+    {
+    public:
+        StaticPlugin()
+            : name_("Static"),
+              version_(2, 0, 0, 0)
+        {
+            // Empty
+        }
+
+        virtual ~StaticPlugin()
+        {
+            // Empty
+        }
+
+        virtual const std::string& iGetPluginName() const
+        {
+            return name_;
+        }
+
+        virtual const Vers::Version& iGetPluginVersion() const
+        {
+            return version_;
+        }
+
+    private:
+        std::string name_;
+        Vers::Version version_;
+    };
+}
+
+PLUGIN_STATIC_FACTORY_DEFINITION(LoaderPoliciesTest::StaticPlugin, "static-plugin")
+
+BOOST_AUTO_TEST_CASE(DefaultPoliciesAreEmpty)
+{
+    // The default loader only holds what it held before policies
+    BOOST_CHECK_EQUAL(sizeof(Plugin::PluginLoader<Plugin::IPlugin>),
+                      2 * sizeof(std::string) + sizeof(Plugin::IPlugin*) + 2 * sizeof(void*));
+}
+
+BOOST_AUTO_TEST_CASE(PerThreadInstances)
+{
+    boost::filesystem::path myPluginPath(MYPLUGIN_PATH);
+    Plugin::PluginLoader<Plugin::IPlugin, Plugin::MutexThreading, Plugin::DlopenLoad, Plugin::PerThreadInstance> loader(myPluginPath.native());
+    BOOST_REQUIRE_MESSAGE(loader.load(), loader.getErrorMsg());
+
+    Plugin::IPlugin* mine = loader.getPluginInstance();
+    BOOST_REQUIRE(mine != NULL);
+    BOOST_CHECK(loader.getPluginInstance() == mine);
+
+    Plugin::IPlugin* other = NULL;
+    std::thread([&]() { other = loader.getPluginInstance(); }).join();
+    BOOST_REQUIRE(other != NULL);
+    BOOST_CHECK(other != mine);
+    BOOST_CHECK_EQUAL(other->iGetPluginName(), "Example");
+
+    loader.destroyPluginInstance();
+    BOOST_CHECK(loader.getPluginInstance() != NULL);
+    BOOST_CHECK(loader.unload());
+}
+
+BOOST_AUTO_TEST_CASE(PooledInstancesAreReused)
+{
+    boost::filesystem::path myPluginPath(MYPLUGIN_PATH);
+    Plugin::PluginLoader<Plugin::IPlugin, Plugin::AtomicThreading, Plugin::DlopenLoad, Plugin::PooledInstance, Plugin::LoaderMetrics> loader(myPluginPath.native());
+    BOOST_CHECK(loader.getPluginInstance() == NULL);
+    BOOST_REQUIRE_MESSAGE(loader.load(), loader.getErrorMsg());
+
+    Plugin::IPlugin* first = loader.getPluginInstance();
+    Plugin::IPlugin* second = loader.getPluginInstance();
+    BOOST_REQUIRE(first != NULL && second != NULL);
+    BOOST_CHECK(first != second);
+    BOOST_CHECK_EQUAL(loader.getInstanceCount(), 2u);
+    loader.releaseInstance(second);
+    BOOST_CHECK(loader.getPluginInstance() == second);
+    loader.releaseInstance(first);
+    loader.releaseInstance(second);
+
+    BOOST_CHECK(loader.unload());
+    BOOST_CHECK_EQUAL(loader.getInstanceCount(), 0u);
+    loader.setPluginName("noSuchPlugin");
+    BOOST_CHECK(!loader.load());
+
+    BOOST_CHECK_EQUAL(loader.getLoadCount(), 1u);
+    BOOST_CHECK_EQUAL(loader.getFailedLoadCount(), 1u);
+    BOOST_CHECK_EQUAL(loader.getUnloadCount(), 1u);
+    BOOST_CHECK_EQUAL(loader.getInstanceRequestCount(), 3u);
+    BOOST_CHECK(loader.getTotalLoadNs() >= loader.getLastLoadNs());
+}
+
+BOOST_AUTO_TEST_CASE(LoadWithTimeoutKeepsInstances)
+{
+    boost::filesystem::path myPluginPath(MYPLUGIN_PATH);
+    Plugin::PluginLoader<Plugin::IPlugin, Plugin::MutexThreading, Plugin::DlopenLoad, Plugin::PooledInstance, Plugin::LoaderMetrics> loader(myPluginPath.native());
+    BOOST_REQUIRE_MESSAGE(loader.load(std::chrono::seconds(10)), loader.getErrorMsg());
+    // The facade created by the loading thread was handed over to the pool
+    BOOST_CHECK_EQUAL(loader.getInstanceCount(), 1u);
+    Plugin::IPlugin* plugin = loader.getPluginInstance();
+    BOOST_REQUIRE(plugin != NULL);
+    BOOST_CHECK_EQUAL(plugin->iGetPluginName(), "Example");
+    BOOST_CHECK_EQUAL(loader.getInstanceCount(), 1u);
+    loader.releaseInstance(plugin);
+    BOOST_CHECK(loader.unload());
+    BOOST_CHECK_EQUAL(loader.getInstanceCount(), 0u);
+}
+
+BOOST_AUTO_TEST_CASE(StaticRegistryPlugin)
+{
+    Plugin::PluginLoader<Plugin::IPlugin, Plugin::SingleThreaded, Plugin::StaticRegistryLoad> loader("static-plugin");
+    BOOST_REQUIRE_MESSAGE(loader.load(), loader.getErrorMsg());
+    Plugin::IPlugin* plugin = loader.getPluginInstance();
+    BOOST_REQUIRE(plugin != NULL);
+    BOOST_CHECK_EQUAL(plugin->iGetPluginName(), "Static");
+    BOOST_CHECK(loader.unload());
+
+    Plugin::PluginLoader<Plugin::IPlugin, Plugin::SingleThreaded, Plugin::StaticRegistryLoad> missing("noSuchPlugin");
+    BOOST_CHECK(!missing.load());
+    BOOST_CHECK(!missing.getErrorMsg().empty());
+}
+
+#ifdef __linux__
+BOOST_AUTO_TEST_CASE(MemfdLoadsPrivateCopies)
+{
+    Plugin::PluginLoader<Plugin::IPlugin, Plugin::SingleThreaded, Plugin::MemfdLoad> first(MYPLUGIN_FULL_PATH);
+    Plugin::PluginLoader<Plugin::IPlugin, Plugin::SingleThreaded, Plugin::MemfdLoad> second(MYPLUGIN_FULL_PATH);
+    BOOST_REQUIRE_MESSAGE(first.load(), first.getErrorMsg());
+    BOOST_REQUIRE_MESSAGE(second.load(), second.getErrorMsg());
+    BOOST_CHECK(first.getNativeHandle() != second.getNativeHandle());
+
+    // Each copy has its own facade singleton
+    Plugin::IPlugin* a = first.getPluginInstance();
+    Plugin::IPlugin* b = second.getPluginInstance();
+    BOOST_REQUIRE(a != NULL && b != NULL);
+    BOOST_CHECK(a != b);
+    BOOST_CHECK(first.unload());
+    BOOST_CHECK_EQUAL(b->iGetPluginName(), "Example");
+    BOOST_CHECK(second.unload());
+
+    Plugin::PluginLoader<Plugin::IPlugin, Plugin::SingleThreaded, Plugin::MemfdLoad> missing("noSuchPlugin");
+    BOOST_CHECK(!missing.load());
+    BOOST_CHECK(!missing.getErrorMsg().empty());
+}
+
+BOOST_AUTO_TEST_CASE(DlmopenLoadsInNewNamespace)
+{
+    boost::filesystem::path myPluginPath(MYPLUGIN_PATH);
+    Plugin::PluginLoader<Plugin::IPlugin, Plugin::SingleThreaded, Plugin::DlmopenLoad> loader(myPluginPath.native());
+    BOOST_REQUIRE_MESSAGE(loader.load(), loader.getErrorMsg());
+    Plugin::IPlugin* plugin = loader.getPluginInstance();
+    BOOST_REQUIRE(plugin != NULL);
+    BOOST_CHECK_EQUAL(plugin->iGetPluginName(), "Example");
+    BOOST_CHECK(loader.unload());
+}
+#endif
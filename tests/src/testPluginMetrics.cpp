@@ -0,0 +1,223 @@
+//          Copyright Jeremy Coulon 2012-2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+//==============
+//==  Plugin  ==
+//==============
+#include "Plugin/IPlugin.h"
+#include "Plugin/PluginInterceptor.h"
+#include "Plugin/PluginLoader.h"
+#include "Plugin/PluginMetrics.h"
+#include "Plugin/SharedMemory.h"
+
+//=============
+//==  Boost  ==
+//=============
+#include <boost/test/unit_test.hpp>
+#include <boost/filesystem.hpp>
+
+//===========
+//==  STD  ==
+//===========
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace MetricsTest
+{
+    class IParser
+    {
+    public:
+        virtual ~IParser() {}
+        virtual int parse(const std::string& text) = 0;
+    };
+
+    class Parser : public IParser
+    {
+    public:
+        virtual int parse(const std::string& text)
+        {
+            if (text.empty())
+                throw std::invalid_argument("empty");
+            return static_cast<int>(text.size());
+        }
+    };
+
+    std::string segmentName(const char* test)
+    {
+        std::ostringstream oss;
+        oss << "/plugin-metrics-test-" << test << "-" << getpid();
+        return oss.str();
+    }
+
+    const Plugin::PluginMetricsSample* find(const std::vector<Plugin::PluginMetricsSample>& samples, const std::string& name)
+    {
+        for (std::size_t i = 0; i < samples.size(); ++i)
+            if (samples[i].name == name)
+                return &samples[i];
+        return NULL;
+    }
+}
+
+BOOST_AUTO_TEST_CASE(MetricsSegmentSharesCounters)
+{
+    Plugin::MetricsSegment segment;
+    BOOST_REQUIRE_MESSAGE(segment.create(MetricsTest::segmentName("shares"), 2), segment.getErrorMsg());
+
+    Plugin::PluginMetrics* metrics = segment.getPlugin("libFirst.so");
+    BOOST_REQUIRE(metrics != NULL);
+    BOOST_CHECK(segment.getPlugin("libFirst.so") == metrics);
+    std::string longName = "/a/very/long/path/to/a/plugin/directory/that/does/not/fit/libSecond.so";
+    Plugin::PluginMetrics* second = segment.getPlugin(longName);
+    BOOST_REQUIRE(second != NULL);
+    std::size_t maxNameSize = Plugin::PluginMetrics::maxNameSize;
+    BOOST_CHECK_EQUAL(second->getName().size(), maxNameSize);
+    BOOST_CHECK(segment.getPlugin(longName) == second);
+    // Full
+    BOOST_CHECK(segment.getPlugin("libThird.so") == NULL);
+
+    metrics->recordLoad(1000, true);
+    metrics->addInstance();
+    metrics->recordCall(false);
+    metrics->recordCall(true);
+    metrics->setMemoryBytes(4096);
+
+    Plugin::MetricsView view;
+    BOOST_REQUIRE_MESSAGE(view.open(segment.getName()), view.getErrorMsg());
+    BOOST_CHECK_EQUAL(view.getPid(), static_cast<uint64_t>(getpid()));
+    std::vector<Plugin::PluginMetricsSample> samples;
+    view.getSamples(samples);
+    BOOST_REQUIRE_EQUAL(samples.size(), 2u);
+    const Plugin::PluginMetricsSample* sample = MetricsTest::find(samples, "libFirst.so");
+    BOOST_REQUIRE(sample != NULL);
+    BOOST_CHECK_EQUAL(sample->loads, 1u);
+    BOOST_CHECK_EQUAL(sample->lastLoadNs, 1000u);
+    BOOST_CHECK_EQUAL(sample->instances, 1u);
+    BOOST_CHECK_EQUAL(sample->calls, 2u);
+    BOOST_CHECK_EQUAL(sample->errors, 1u);
+    BOOST_CHECK_EQUAL(sample->memoryBytes, 4096u);
+
+    segment.close();
+    BOOST_CHECK(!Plugin::MetricsView().open(MetricsTest::segmentName("shares")));
+}
+
+BOOST_AUTO_TEST_CASE(MetricsSegmentReplacesStaleSegment)
+{
+    std::string name = MetricsTest::segmentName("stale");
+    // A process dying without closing its segment
+    pid_t child = fork();
+    BOOST_REQUIRE(child >= 0);
+    if (child == 0)
+    {
+        Plugin::MetricsSegment dead;
+        _exit(dead.create(name, 1) ? 0 : 1);
+    }
+    int status = 0;
+    BOOST_REQUIRE_EQUAL(waitpid(child, &status, 0), child);
+    BOOST_REQUIRE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    Plugin::MetricsSegment segment;
+    BOOST_REQUIRE_MESSAGE(segment.create(name, 1), segment.getErrorMsg());
+    Plugin::MetricsView view;
+    BOOST_REQUIRE_MESSAGE(view.open(name), view.getErrorMsg());
+    BOOST_CHECK_EQUAL(view.getPid(), static_cast<uint64_t>(getpid()));
+
+    // The segment of a live process is kept
+    Plugin::MetricsSegment other;
+    BOOST_CHECK(!other.create(name, 1));
+    BOOST_CHECK(!other.getErrorMsg().empty());
+    BOOST_CHECK(segment.getPlugin("libFirst.so") != NULL);
+
+    // A slot count larger than the segment is rejected, and not reread by open views
+    Plugin::SharedMemoryRegion region;
+    BOOST_REQUIRE_MESSAGE(region.open(name), region.getErrorMsg());
+    static_cast<Plugin::detail::MetricsSegmentHeader*>(region.data())->slotCount = 0xFFFFFFFF;
+    BOOST_CHECK(!Plugin::MetricsView().open(name));
+    std::vector<Plugin::PluginMetricsSample> samples;
+    view.getSamples(samples);
+    BOOST_CHECK_EQUAL(samples.size(), 1u);
+    segment.close();
+
+    // A process dying before writing the header
+    child = fork();
+    BOOST_REQUIRE(child >= 0);
+    if (child == 0)
+    {
+        Plugin::SharedMemoryRegion unwritten;
+        _exit(unwritten.create(name, sizeof(Plugin::detail::MetricsSegmentHeader)) ? 0 : 1);
+    }
+    BOOST_REQUIRE_EQUAL(waitpid(child, &status, 0), child);
+    BOOST_REQUIRE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    BOOST_CHECK_MESSAGE(segment.create(name, 1), segment.getErrorMsg());
+    segment.close();
+}
+
+BOOST_AUTO_TEST_CASE(MetricsPoliciesPublishLoaderAndCalls)
+{
+    boost::filesystem::path myPluginPath(MYPLUGIN_PATH);
+    Plugin::MetricsSegment& segment = Plugin::MetricsSegment::instance();
+    BOOST_REQUIRE_MESSAGE(segment.create(MetricsTest::segmentName("policies")), segment.getErrorMsg());
+    Plugin::MetricsView view;
+    BOOST_REQUIRE(view.open(segment.getName()));
+    std::vector<Plugin::PluginMetricsSample> samples;
+    {
+        Plugin::PluginLoader<Plugin::IPlugin, Plugin::SingleThreaded, Plugin::DlopenLoad,
+                             Plugin::SingletonInstance, Plugin::SharedMetricsInstrumentation> loader(myPluginPath.native());
+        BOOST_REQUIRE(loader.load());
+        BOOST_REQUIRE(loader.getPluginInstance() != NULL);
+        view.getSamples(samples);
+        const Plugin::PluginMetricsSample* sample = MetricsTest::find(samples, myPluginPath.native());
+        BOOST_REQUIRE(sample != NULL);
+        BOOST_CHECK_EQUAL(sample->loads, 1u);
+        BOOST_CHECK_EQUAL(sample->instances, 1u);
+        BOOST_CHECK(sample->lastLoadNs > 0);
+    }
+    view.getSamples(samples);
+    const Plugin::PluginMetricsSample* sample = MetricsTest::find(samples, myPluginPath.native());
+    BOOST_REQUIRE(sample != NULL);
+    BOOST_CHECK_EQUAL(sample->unloads, 1u);
+    BOOST_CHECK_EQUAL(sample->instances, 0u);
+
+    MetricsTest::Parser parser;
+    Plugin::PluginInterceptor<MetricsTest::IParser, Plugin::MetricsInterception> proxy(&parser);
+    // Not counted until the counters are set
+    BOOST_CHECK_EQUAL(proxy.call(&MetricsTest::IParser::parse, std::string("abc")), 3);
+    proxy.setMetrics(segment.getPlugin("parser"));
+    BOOST_REQUIRE(proxy.getMetrics() != NULL);
+    for (int i = 0; i < 10; ++i)
+        proxy.call(&MetricsTest::IParser::parse, std::string("abc"));
+    BOOST_CHECK_THROW(proxy.call(&MetricsTest::IParser::parse, std::string()), std::invalid_argument);
+    view.getSamples(samples);
+    sample = MetricsTest::find(samples, "parser");
+    BOOST_REQUIRE(sample != NULL);
+    BOOST_CHECK_EQUAL(sample->calls, 11u);
+    BOOST_CHECK_EQUAL(sample->errors, 1u);
+
+    segment.close();
+}
+
+BOOST_AUTO_TEST_CASE(OpenMetricsExposition)
+{
+    Plugin::PluginMetricsSample sample = Plugin::PluginMetricsSample();
+    sample.name = "lib\"quoted\".so";
+    sample.calls = 42;
+    sample.lastLoadNs = 1500000000;
+    std::vector<Plugin::PluginMetricsSample> samples(1, sample);
+
+    std::ostringstream oss;
+    Plugin::writeOpenMetrics(oss, samples);
+    std::string text = oss.str();
+    BOOST_CHECK(text.find("# TYPE plugin_calls counter\n") != std::string::npos);
+    BOOST_CHECK(text.find("plugin_calls_total{plugin=\"lib\\\"quoted\\\".so\"} 42\n") != std::string::npos);
+    BOOST_CHECK(text.find("# UNIT plugin_last_load_seconds seconds\n") != std::string::npos);
+    BOOST_CHECK(text.find("plugin_last_load_seconds{plugin=\"lib\\\"quoted\\\".so\"} 1.5\n") != std::string::npos);
+    BOOST_CHECK(text.find("plugin_instances{plugin=") != std::string::npos);
+    BOOST_REQUIRE(text.size() >= 6);
+    BOOST_CHECK_EQUAL(text.substr(text.size() - 6), "# EOF\n");
+}
@@ -0,0 +1,91 @@
+//          Copyright Jeremy Coulon 2012-2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+//==============
+//==  Plugin  ==
+//==============
+#include "Plugin/IPlugin.h"
+#include "Plugin/PluginProbe.h"
+
+//=============
+//==  Boost  ==
+//=============
+#include <boost/test/unit_test.hpp>
+#include <boost/filesystem.hpp>
+
+//===========
+//==  STD  ==
+//===========
+#include <chrono>
+#include <cstdlib>
+#include <string>
+#include <thread>
+
+BOOST_AUTO_TEST_CASE(ProbeNominal)
+{
+    boost::filesystem::path myPluginPath(MYPLUGIN_PATH);
+
+    Plugin::PluginProbe<Plugin::IPlugin> probe;
+    probe.setMetadataExtractor([](Plugin::IPlugin* plugin) { return plugin->iGetPluginName(); });
+    Plugin::ProbeResult res = probe.probe(myPluginPath.native());
+    BOOST_CHECK_MESSAGE(res.passed(), "Probe failed: " << res.errorMsg);
+    BOOST_CHECK_EQUAL(res.metadata, "Example");
+
+    Plugin::PluginLoader<Plugin::IPlugin> loader(myPluginPath.native());
+    BOOST_CHECK(probe.load(loader, res));
+    BOOST_CHECK(loader.isLoaded());
+
+    Plugin::PluginLoader<Plugin::IPlugin> missing("noSuchPlugin");
+    BOOST_CHECK(!probe.load(missing, res));
+    BOOST_CHECK_EQUAL(res.status, Plugin::probeFailed);
+    BOOST_CHECK(!missing.isLoaded());
+}
+
+BOOST_AUTO_TEST_CASE(ProbeSurvivesCrashesAndHangs)
+{
+    boost::filesystem::path myPluginPath(MYPLUGIN_PATH);
+
+    Plugin::PluginProbe<Plugin::IPlugin> probe(std::chrono::milliseconds(300));
+    probe.setMetadataExtractor([](Plugin::IPlugin*) -> std::string { std::abort(); });
+    Plugin::ProbeResult res = probe.probe(myPluginPath.native());
+    BOOST_CHECK_EQUAL(res.status, Plugin::probeCrashed);
+
+    probe.clearCache();
+    probe.setMetadataExtractor([](Plugin::IPlugin*)
+    {
+        std::this_thread::sleep_for(std::chrono::seconds(10));
+        return std::string();
+    });
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    res = probe.probe(myPluginPath.native());
+    BOOST_CHECK_EQUAL(res.status, Plugin::probeTimedOut);
+    BOOST_CHECK(std::chrono::steady_clock::now() - start < std::chrono::seconds(5));
+}
+
+BOOST_AUTO_TEST_CASE(ProbeCachesByContent)
+{
+    // The cache is keyed by the content of the file: it needs the path of the library
+    boost::filesystem::path myPluginPath(MYPLUGIN_FULL_PATH);
+    BOOST_REQUIRE_MESSAGE(!Plugin::detail::resolveLibraryPath(myPluginPath.native()).empty(),
+                          "Cannot find " << myPluginPath);
+    boost::filesystem::path cacheFile = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+
+    {
+        Plugin::PluginProbe<Plugin::IPlugin> probe;
+        probe.setCacheFile(cacheFile.native());
+        probe.setMetadataExtractor([](Plugin::IPlugin* plugin) { return plugin->iGetPluginName(); });
+        BOOST_CHECK(probe.probe(myPluginPath.native()).passed());
+    }
+
+    // A crashing extractor is never run: the result comes from the file
+    Plugin::PluginProbe<Plugin::IPlugin> probe;
+    probe.setCacheFile(cacheFile.native());
+    probe.setMetadataExtractor([](Plugin::IPlugin*) -> std::string { std::abort(); });
+    Plugin::ProbeResult res = probe.probe(myPluginPath.native());
+    BOOST_CHECK(res.passed());
+    BOOST_CHECK_EQUAL(res.metadata, "Example");
+
+    boost::filesystem::remove(cacheFile);
+}
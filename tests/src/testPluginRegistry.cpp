@@ -0,0 +1,112 @@
+//          Copyright Jeremy Coulon 2012-2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+//==============
+//==  Plugin  ==
+//==============
+#include "Plugin/IPlugin.h"
+#include "Plugin/PluginRegistry.h"
+#include "Plugin/WorkStealingPool.h"
+
+//=============
+//==  Boost  ==
+//=============
+#include <boost/test/unit_test.hpp>
+#include <boost/filesystem.hpp>
+
+//===========
+//==  STD  ==
+//===========
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    // Register the example plugin under several filenames: they share one facade
+    std::vector<std::string> registerExamplePlugin(Plugin::PluginRegistry<Plugin::IPlugin>& registry)
+    {
+        boost::filesystem::path myPluginPath(MYPLUGIN_FULL_PATH);
+        boost::filesystem::path directory = myPluginPath.parent_path();
+        std::vector<std::string> names;
+        names.push_back(myPluginPath.native());
+        names.push_back((directory / "." / myPluginPath.filename()).native());
+        names.push_back((directory / ".." / directory.filename() / myPluginPath.filename()).native());
+        for (std::size_t i = 0; i < names.size(); ++i)
+            registry.add(names[i]);
+        return names;
+    }
+}
+
+BOOST_AUTO_TEST_CASE(RegistryForEachParallel)
+{
+    Plugin::PluginRegistry<Plugin::IPlugin> registry;
+    registerExamplePlugin(registry);
+    registry.add("noSuchPlugin");
+    BOOST_CHECK(!registry.loadAll());
+
+    Plugin::WorkStealingPool pool(2);
+    std::atomic<int> calls(0);
+    std::atomic<int> failures(0);
+    registry.forEachParallel(pool, [&](const std::string& name, Plugin::IPlugin* plugin)
+    {
+        if (name == "noSuchPlugin" || !plugin || plugin->iGetPluginName() != "Example")
+            ++failures;
+        ++calls;
+    }, 2);
+    BOOST_CHECK_EQUAL(calls.load(), 3);
+    BOOST_CHECK_EQUAL(failures.load(), 0);
+    BOOST_CHECK(registry.unloadAll());
+}
+
+BOOST_AUTO_TEST_CASE(RegistryMapReduceWithDeadlines)
+{
+    Plugin::PluginRegistry<Plugin::IPlugin> registry;
+    std::vector<std::string> names = registerExamplePlugin(registry);
+    // Set before the last add(), which must keep it
+    BOOST_CHECK(registry.setDeadline(names[0], std::chrono::milliseconds(10)));
+    registry.add("noSuchPlugin");
+    registry.loadAll();
+
+    Plugin::WorkStealingPool pool(2);
+    std::vector<Plugin::CallResult<std::size_t> > results;
+    std::size_t total = registry.mapReduce(pool,
+        [](Plugin::IPlugin* plugin) { return plugin->iGetPluginName().size(); },
+        std::size_t(0),
+        [](std::size_t a, std::size_t b) { return a + b; },
+        results);
+    BOOST_CHECK_EQUAL(total, 3 * std::string("Example").size());
+
+    // Results are in the order of the names, unloaded plugins are skipped
+    std::vector<std::string> sorted = registry.getPluginNames();
+    BOOST_REQUIRE_EQUAL(results.size(), sorted.size());
+    for (std::size_t i = 0; i < sorted.size(); ++i)
+        BOOST_CHECK_EQUAL(results[i].status, sorted[i] == "noSuchPlugin" ? Plugin::callSkipped : Plugin::callCompleted);
+
+    // A slow plugin overruns its own deadline, the others have none
+    BOOST_CHECK(!registry.setDeadline("unknown", std::chrono::milliseconds(5)));
+    const Plugin::CallResult<std::size_t>* before = results.data();
+    std::size_t completed = registry.mapParallel(pool, [](Plugin::IPlugin*)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        return std::size_t(1);
+    }, results);
+    BOOST_CHECK(results.data() == before);
+    BOOST_CHECK_EQUAL(completed, 2u);
+    for (std::size_t i = 0; i < sorted.size(); ++i)
+        if (sorted[i] == names[0])
+            BOOST_CHECK_EQUAL(results[i].status, Plugin::callLate);
+
+    // Calls not started before the common deadline are skipped
+    completed = registry.mapParallel(pool, [](Plugin::IPlugin*)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        return std::size_t(1);
+    }, results, std::chrono::milliseconds(1), 4);
+    BOOST_CHECK_EQUAL(completed, 0u);
+    registry.unloadAll();
+}
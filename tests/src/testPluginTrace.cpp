@@ -0,0 +1,135 @@
+//          Copyright Jeremy Coulon 2012-2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+//==============
+//==  Plugin  ==
+//==============
+#include "Plugin/IPlugin.h"
+#include "Plugin/InterfaceDescription.h"
+#include "Plugin/PluginInterceptor.h"
+#include "Plugin/PluginLoader.h"
+#include "Plugin/PluginTrace.h"
+
+//=============
+//==  Boost  ==
+//=============
+#include <boost/test/unit_test.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+//===========
+//==  STD  ==
+//===========
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+
+namespace TraceTest
+{
+    class IAdder
+    {
+    public:
+        virtual ~IAdder() {}
+        virtual int add(int a, int b) = 0;
+    };
+
+    class Adder : public IAdder
+    {
+    public:
+        virtual int add(int a, int b)
+        {
+            return a + b;
+        }
+    };
+
+    // Count the complete events of a trace by process and name
+    std::map<std::string, int> countSpans(const boost::property_tree::ptree& trace, const std::string& pid)
+    {
+        std::map<std::string, int> res;
+        for (const boost::property_tree::ptree::value_type& event : trace.get_child("traceEvents"))
+            if (event.second.get<std::string>("ph") == "X" && event.second.get<std::string>("pid") == pid)
+                ++res[event.second.get<std::string>("name")];
+        return res;
+    }
+}
+
+PLUGIN_INTERFACE_DESCRIPTION(TraceTest::IAdder, (add))
+
+BOOST_AUTO_TEST_CASE(TracerRecordsLifecycleAndSampledCalls)
+{
+    boost::filesystem::path myPluginPath(MYPLUGIN_PATH);
+    Plugin::PluginTracer& tracer = Plugin::PluginTracer::instance();
+    tracer.enable();
+    tracer.setCallSampling(2);
+    {
+        Plugin::PluginLoader<Plugin::IPlugin, Plugin::MutexThreading> loader(myPluginPath.native());
+        BOOST_REQUIRE(loader.load());
+        std::thread([&loader]() { loader.getPluginInstance(); }).join();
+        BOOST_CHECK(loader.getPluginInstance() != NULL);
+        BOOST_CHECK(loader.unload());
+    }
+    TraceTest::Adder adder;
+    Plugin::PluginInterceptor<TraceTest::IAdder, Plugin::TraceInterception> proxy(&adder);
+    proxy.setTracedPlugin("adder");
+    for (int i = 0; i < 10; ++i)
+        BOOST_CHECK_EQUAL(proxy.call(&TraceTest::IAdder::add, i, 1), i + 1);
+    tracer.disable();
+    tracer.setCallSampling(0);
+
+    // Not recorded once disabled
+    std::size_t count = tracer.getEventCount();
+    proxy.call(&TraceTest::IAdder::add, 1, 1);
+    BOOST_CHECK_EQUAL(tracer.getEventCount(), count);
+    BOOST_CHECK_EQUAL(tracer.getDroppedCount(), 0u);
+
+    std::stringstream json;
+    tracer.writeChromeTrace(json);
+    boost::property_tree::ptree trace;
+    BOOST_REQUIRE_NO_THROW(boost::property_tree::read_json(json, trace));
+
+    // One process for the threads, one per plugin
+    std::map<std::string, std::string> processes;
+    std::set<std::string> threads;
+    for (const boost::property_tree::ptree::value_type& event : trace.get_child("traceEvents"))
+    {
+        if (event.second.get<std::string>("name") == "process_name")
+            processes[event.second.get<std::string>("args.name")] = event.second.get<std::string>("pid");
+        if (event.second.get<std::string>("ph") == "X" && event.second.get<std::string>("pid") == processes["Threads"])
+            threads.insert(event.second.get<std::string>("tid"));
+    }
+    BOOST_REQUIRE(processes.count("Threads"));
+    BOOST_REQUIRE(processes.count("Plugin " + myPluginPath.native()));
+    BOOST_REQUIRE(processes.count("Plugin adder"));
+    BOOST_CHECK_EQUAL(threads.size(), 2u);
+
+    std::map<std::string, int> spans = TraceTest::countSpans(trace, processes["Plugin " + myPluginPath.native()]);
+    BOOST_CHECK_EQUAL(spans["load"], 1);
+    BOOST_CHECK_EQUAL(spans["getPluginInstance"], 2);
+    BOOST_CHECK_EQUAL(spans["init"], 1);
+    BOOST_CHECK_EQUAL(spans["destroy"], 1);
+    BOOST_CHECK_EQUAL(spans["unload"], 1);
+    BOOST_CHECK_EQUAL(TraceTest::countSpans(trace, processes["Plugin adder"])["add"], 5);
+    BOOST_CHECK_EQUAL(TraceTest::countSpans(trace, processes["Threads"]).size(), 6u);
+}
+
+BOOST_AUTO_TEST_CASE(TracerDropsSpansOfFullBuffers)
+{
+    Plugin::PluginTracer& tracer = Plugin::PluginTracer::instance();
+    tracer.enable(4);
+    BOOST_CHECK_EQUAL(tracer.getEventCount(), 0u);
+    std::thread([]()
+    {
+        for (int i = 0; i < 10; ++i)
+            Plugin::TraceSpan span("work", "dropper");
+    }).join();
+    tracer.disable();
+    BOOST_CHECK_EQUAL(tracer.getEventCount(), 4u);
+    BOOST_CHECK_EQUAL(tracer.getDroppedCount(), 6u);
+    tracer.enable();
+    tracer.disable();
+}
@@ -0,0 +1,92 @@
+//          Copyright Jeremy Coulon 2012-2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+//==============
+//==  Plugin  ==
+//==============
+#include "Plugin/IPlugin.h"
+#include "Plugin/PluginZygote.h"
+
+//=============
+//==  Boost  ==
+//=============
+#include <boost/test/unit_test.hpp>
+#include <boost/filesystem.hpp>
+
+//===========
+//==  STD  ==
+//===========
+#include <string>
+
+namespace
+{
+    int idleWorker(const std::string&)
+    {
+        return 0;
+    }
+}
+
+BOOST_AUTO_TEST_CASE(ZygoteWorkersInheritLoadedPlugins)
+{
+    boost::filesystem::path myPluginPath(MYPLUGIN_PATH);
+    std::string name = myPluginPath.native();
+
+    Plugin::PluginRegistry<Plugin::IPlugin> registry;
+    BOOST_REQUIRE(registry.add(name));
+    BOOST_CHECK(!registry.add(name));
+
+    // Exit status 0 if the plugin is already loaded in the worker
+    Plugin::PluginZygote zygote([&](const std::string& expected)
+    {
+        Plugin::IPlugin* plugin = registry.get(name);
+        return plugin && plugin->iGetPluginName() == expected ? 0 : 1;
+    });
+    zygote.preload(registry);
+    BOOST_REQUIRE_MESSAGE(zygote.start(), "Failed to start zygote: " << zygote.getErrorMsg());
+
+    // Loaded in the template process only
+    BOOST_CHECK(registry.get(name) == NULL);
+
+    pid_t good = zygote.spawn("Example");
+    pid_t bad = zygote.spawn("Unknown");
+    BOOST_REQUIRE(good != 0);
+    BOOST_REQUIRE(bad != 0);
+    int status = -1;
+    BOOST_REQUIRE(zygote.wait(good, status));
+    BOOST_CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    BOOST_REQUIRE(zygote.wait(bad, status));
+    BOOST_CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 1);
+    BOOST_CHECK(!zygote.wait(good, status));
+
+    BOOST_CHECK(zygote.stop());
+    BOOST_CHECK(!zygote.isRunning());
+    BOOST_CHECK_EQUAL(zygote.spawn(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(ZygoteReportsWarmupFailure)
+{
+    Plugin::PluginRegistry<Plugin::IPlugin> registry;
+    registry.add("noSuchPlugin");
+
+    Plugin::PluginZygote zygote(idleWorker);
+    zygote.preload(registry);
+    BOOST_CHECK(!zygote.start());
+    BOOST_CHECK(!zygote.getErrorMsg().empty());
+    BOOST_CHECK(!zygote.isRunning());
+}
+
+BOOST_AUTO_TEST_CASE(ZygoteRefusesThreadedWarmup)
+{
+    Plugin::PluginZygote zygote(idleWorker);
+    // Threads created during warmup would not survive the fork of workers
+    zygote.addWarmupHook([](std::string&)
+    {
+        pthread_t thread;
+        return pthread_create(&thread, NULL, [](void*) -> void* { pause(); return NULL; }, NULL) == 0;
+    });
+    BOOST_REQUIRE(zygote.start());
+    BOOST_CHECK_EQUAL(zygote.spawn(), 0);
+    BOOST_CHECK(!zygote.getErrorMsg().empty());
+}
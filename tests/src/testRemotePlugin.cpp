@@ -0,0 +1,131 @@
+//          Copyright Jeremy Coulon 2012-2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+//==============
+//==  Plugin  ==
+//==============
+#include "Plugin/IPluginDescription.h"
+#include "Plugin/RemotePlugin.h"
+
+//=============
+//==  Boost  ==
+//=============
+#include <boost/test/unit_test.hpp>
+#include <boost/filesystem.hpp>
+
+//===========
+//==  STD  ==
+//===========
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+namespace
+{
+    // Count the shared memory channels of this process still reachable by name
+    std::size_t countNamedChannels()
+    {
+        std::size_t res = 0;
+#ifdef __linux__
+        std::ostringstream prefix;
+        prefix << "plugin-host-" << getpid() << "-";
+        boost::filesystem::directory_iterator end;
+        for (boost::filesystem::directory_iterator it("/dev/shm"); it != end; ++it)
+            if (it->path().filename().string().compare(0, prefix.str().size(), prefix.str()) == 0)
+                ++res;
+#endif
+        return res;
+    }
+}
+
+BOOST_AUTO_TEST_CASE(RemoteNominal)
+{
+    boost::filesystem::path myPluginPath(MYPLUGIN_FULL_PATH);
+
+    Plugin::RemotePluginLoader<Plugin::IPlugin> loader(myPluginPath.native(), PLUGINHOST_PATH);
+    BOOST_REQUIRE_MESSAGE(loader.load(), "Failed to load plugin: " << loader.getErrorMsg());
+    BOOST_REQUIRE(loader.isLoaded());
+    BOOST_CHECK(loader.getHostPid() != getpid());
+    // The name of the channel is removed once both sides mapped it
+    BOOST_CHECK_EQUAL(countNamedChannels(), 0u);
+
+    BOOST_CHECK_EQUAL(loader.call(&Plugin::IPlugin::iGetPluginName), "Example");
+
+    BOOST_CHECK(loader.unload());
+    BOOST_CHECK(!loader.isLoaded());
+}
+
+BOOST_AUTO_TEST_CASE(RemotePluginNotFound)
+{
+    Plugin::RemotePluginLoader<Plugin::IPlugin> loader("NonExistingPath", PLUGINHOST_PATH);
+    BOOST_CHECK(!loader.load());
+    BOOST_MESSAGE(loader.getErrorMsg());
+    BOOST_CHECK(!loader.isLoaded());
+}
+
+BOOST_AUTO_TEST_CASE(RemoteHostCrash)
+{
+    boost::filesystem::path myPluginPath(MYPLUGIN_FULL_PATH);
+
+    Plugin::RemotePluginLoader<Plugin::IPlugin> loader(myPluginPath.native(), PLUGINHOST_PATH);
+    BOOST_REQUIRE_MESSAGE(loader.load(), "Failed to load plugin: " << loader.getErrorMsg());
+
+    // A crashing host does not take the caller down
+    kill(loader.getHostPid(), SIGSEGV);
+    BOOST_CHECK_THROW(loader.call(&Plugin::IPlugin::iGetPluginName), Plugin::RemoteCallError);
+    BOOST_CHECK(!loader.isLoaded());
+    BOOST_MESSAGE(loader.getErrorMsg());
+
+    // And it can be restarted
+    BOOST_REQUIRE(loader.load());
+    BOOST_CHECK_EQUAL(loader.call(&Plugin::IPlugin::iGetPluginName), "Example");
+}
+
+BOOST_AUTO_TEST_CASE(RingRejectsCorruptedLength)
+{
+    const std::size_t capacity = 256;
+    std::vector<uint64_t> memory((Plugin::SharedMemoryRing::requiredSize(capacity) + 64) / sizeof(uint64_t));
+    char* base = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(&memory[0]) + 63) & ~static_cast<uintptr_t>(63));
+    Plugin::SharedMemoryRing producer;
+    Plugin::SharedMemoryRing consumer;
+    producer.attach(base, capacity, true);
+    consumer.attach(base, capacity, false);
+
+    std::vector<char> message;
+    BOOST_REQUIRE(producer.push("abc", 3));
+    BOOST_REQUIRE(consumer.pop(message, 0));
+    BOOST_CHECK_EQUAL(std::string(message.begin(), message.end()), "abc");
+
+    // A length larger than what was published must not be trusted
+    BOOST_REQUIRE(producer.push("def", 3));
+    uint32_t length = 0xffffffff;
+    std::memcpy(base + Plugin::SharedMemoryRing::requiredSize(0) + 3 + sizeof(uint32_t), &length, sizeof(length));
+    BOOST_CHECK(!consumer.pop(message, 0));
+    BOOST_CHECK(consumer.isBroken());
+    BOOST_CHECK(!consumer.pop(message, 0));
+}
+
+BOOST_AUTO_TEST_CASE(HostEnvironmentReplacesInheritedVariables)
+{
+    char path[] = "PATH=/bin";
+    char home[] = "HOME=/root";
+    char homeDir[] = "HOMEDIR=/home";
+    char* inherited[] = { path, home, homeDir, NULL };
+    std::vector<std::string> overrides;
+    overrides.push_back("HOME=/tmp");
+    overrides.push_back("EXTRA=1");
+
+    std::vector<const char*> envp = Plugin::detail::hostEnvironment(inherited, overrides);
+    BOOST_REQUIRE_EQUAL(envp.size(), 5u);
+    BOOST_CHECK_EQUAL(envp[0], "PATH=/bin");
+    // Only the variable of the same name is replaced
+    BOOST_CHECK_EQUAL(envp[1], "HOMEDIR=/home");
+    BOOST_CHECK_EQUAL(envp[2], "HOME=/tmp");
+    BOOST_CHECK_EQUAL(envp[3], "EXTRA=1");
+    BOOST_CHECK(envp[4] == NULL);
+}
@@ -0,0 +1,72 @@
+//          Copyright Jeremy Coulon 2012-2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+//==============
+//==  Plugin  ==
+//==============
+#include "Plugin/IPluginDescription.h"
+#include "Plugin/RemotePluginPool.h"
+
+//=============
+//==  Boost  ==
+//=============
+#include <boost/test/unit_test.hpp>
+#include <boost/filesystem.hpp>
+
+//===========
+//==  STD  ==
+//===========
+#include <cstring>
+#include <string>
+
+BOOST_AUTO_TEST_CASE(PoolNominal)
+{
+    boost::filesystem::path myPluginPath(MYPLUGIN_FULL_PATH);
+
+    Plugin::RemotePluginPool<Plugin::IPlugin> pool(myPluginPath.native(), PLUGINHOST_PATH, 2);
+    BOOST_REQUIRE_MESSAGE(pool.load(), "Failed to load plugin: " << pool.getErrorMsg());
+    BOOST_CHECK(pool.getWorkerPid(0) != 0);
+    BOOST_CHECK(pool.getWorkerPid(1) != 0);
+    BOOST_CHECK(pool.getWorkerPid(0) != pool.getWorkerPid(1));
+
+    // Same syntax as in-process calls
+    BOOST_CHECK_EQUAL(Plugin::call(pool, &Plugin::IPlugin::iGetPluginName), "Example");
+    Plugin::PluginLoader<Plugin::IPlugin> loader(myPluginPath.native());
+    BOOST_REQUIRE(loader.load());
+    BOOST_CHECK_EQUAL(Plugin::call(loader, &Plugin::IPlugin::iGetPluginName), "Example");
+
+    BOOST_CHECK(pool.unload());
+}
+
+BOOST_AUTO_TEST_CASE(PoolRestartsCrashedWorkers)
+{
+    boost::filesystem::path myPluginPath(MYPLUGIN_FULL_PATH);
+
+    Plugin::RemotePluginPool<Plugin::IPlugin> pool(myPluginPath.native(), PLUGINHOST_PATH, 2);
+    pool.setRetryCount(2);
+    BOOST_REQUIRE_MESSAGE(pool.load(), "Failed to load plugin: " << pool.getErrorMsg());
+
+    kill(pool.getWorkerPid(0), SIGKILL);
+    kill(pool.getWorkerPid(1), SIGKILL);
+    for (int i = 0; i < 4; ++i)
+        BOOST_CHECK_EQUAL(pool.call(&Plugin::IPlugin::iGetPluginName), "Example");
+    BOOST_CHECK_EQUAL(pool.getRestartCount(0) + pool.getRestartCount(1), 2u);
+    BOOST_CHECK_EQUAL(pool.getOutstandingCalls(0) + pool.getOutstandingCalls(1), 0u);
+}
+
+BOOST_AUTO_TEST_CASE(PoolSharesReadOnlyData)
+{
+    boost::filesystem::path myPluginPath(MYPLUGIN_FULL_PATH);
+
+    Plugin::RemotePluginPool<Plugin::IPlugin> pool(myPluginPath.native(), PLUGINHOST_PATH, 1);
+    const char table[] = "shared table";
+    BOOST_REQUIRE_MESSAGE(pool.shareData("table", table, sizeof(table)), pool.getErrorMsg());
+
+    // This is what plugins do from the workers through openSharedPoolData()
+    Plugin::SharedMemoryRegion region;
+    BOOST_REQUIRE(region.open(pool.getSharedDataName("table"), true));
+    BOOST_REQUIRE_EQUAL(region.size(), sizeof(table));
+    BOOST_CHECK(std::memcmp(region.data(), table, sizeof(table)) == 0);
+}
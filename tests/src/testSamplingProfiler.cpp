@@ -0,0 +1,135 @@
+//          Copyright Jeremy Coulon 2012-2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+//==============
+//==  Plugin  ==
+//==============
+#include "Plugin/IPlugin.h"
+#include "Plugin/ModuleTracker.h"
+#include "Plugin/PluginLoader.h"
+#include "Plugin/SamplingProfiler.h"
+
+//=============
+//==  Boost  ==
+//=============
+#include <boost/test/unit_test.hpp>
+#include <boost/filesystem.hpp>
+
+//===========
+//==  STD  ==
+//===========
+#include <ctime>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <dlfcn.h>
+#endif
+
+namespace SamplingProfilerTest
+{
+    // Consume CPU time
+    uint64_t burn(double seconds)
+    {
+        volatile uint64_t res = 0;
+        std::clock_t end = std::clock() + static_cast<std::clock_t>(seconds * CLOCKS_PER_SEC);
+        while (std::clock() < end)
+            for (int i = 0; i < 100000; ++i)
+                res = res + i;
+        return res;
+    }
+}
+
+#ifndef _WIN32
+BOOST_AUTO_TEST_CASE(ModuleTrackerFollowsLoads)
+{
+    boost::filesystem::path myPluginPath(MYPLUGIN_PATH);
+    Plugin::ModuleTracker& tracker = Plugin::ModuleTracker::instance();
+    tracker.startTracking();
+    BOOST_CHECK(tracker.isTracking());
+
+    uint32_t module = 0;
+    {
+        Plugin::PluginLoader<Plugin::IPlugin> loader(myPluginPath.native());
+        BOOST_REQUIRE(loader.load());
+        void* function = dlsym(loader.getNativeHandle(), PLUGIN_FACTORY_CREATE);
+        BOOST_REQUIRE(function != NULL);
+        module = tracker.current()->findModule(reinterpret_cast<std::size_t>(function));
+        BOOST_REQUIRE(module != 0);
+        Plugin::LibraryInfo info;
+        BOOST_REQUIRE(tracker.getModule(module, info));
+        BOOST_CHECK(info.path.find(myPluginPath.filename().string()) != std::string::npos);
+        BOOST_CHECK(tracker.current()->contains(module));
+    }
+    // Unloaded, but still described
+    BOOST_CHECK(!tracker.current()->contains(module));
+    Plugin::LibraryInfo info;
+    BOOST_CHECK(tracker.getModule(module, info));
+    BOOST_CHECK(!tracker.getModule(0, info));
+
+    // Replaced snapshots are only kept while a reader holds one
+    BOOST_CHECK_EQUAL(tracker.getRetiredCount(), 0u);
+    const Plugin::ModuleSnapshot* snapshot = tracker.acquire();
+    uint64_t generation = snapshot->getGeneration();
+    tracker.refresh();
+    BOOST_CHECK_EQUAL(tracker.getRetiredCount(), 1u);
+    BOOST_CHECK_EQUAL(snapshot->getGeneration(), generation);
+    BOOST_CHECK(tracker.current() != snapshot);
+    tracker.release();
+    tracker.refresh();
+    BOOST_CHECK_EQUAL(tracker.getRetiredCount(), 0u);
+    tracker.stopTracking();
+}
+#endif
+
+#if defined(__linux__) && (defined(__x86_64__) || defined(__aarch64__))
+BOOST_AUTO_TEST_CASE(SamplingProfilerAttributesSamples)
+{
+    Plugin::SamplingProfiler profiler(10000);
+    BOOST_REQUIRE_MESSAGE(profiler.start(std::chrono::milliseconds(1)), profiler.getErrorMsg());
+    BOOST_CHECK(profiler.isRunning());
+    Plugin::SamplingProfiler other;
+    BOOST_CHECK(!other.start());
+    BOOST_CHECK(!other.getErrorMsg().empty());
+
+    // Plugins loaded by default loaders while sampling are attributed
+    {
+        Plugin::PluginLoader<Plugin::IPlugin> loader(MYPLUGIN_PATH);
+        BOOST_REQUIRE(loader.load());
+        void* function = dlsym(loader.getNativeHandle(), PLUGIN_FACTORY_CREATE);
+        BOOST_REQUIRE(function != NULL);
+        BOOST_CHECK(Plugin::ModuleTracker::instance().current()->findModule(reinterpret_cast<std::size_t>(function)) != 0);
+    }
+
+    SamplingProfilerTest::burn(0.3);
+    profiler.stop();
+    BOOST_CHECK(!profiler.isRunning());
+    BOOST_REQUIRE(profiler.getSampleCount() > 50u);
+    BOOST_CHECK_EQUAL(profiler.getDroppedCount(), 0u);
+
+    // Most of the time is spent in the test executable
+    std::vector<Plugin::ModuleShare> shares = profiler.getModuleShares();
+    BOOST_REQUIRE(!shares.empty());
+    BOOST_CHECK(shares[0].totalSamples > profiler.getSampleCount() / 2);
+    BOOST_CHECK(shares[0].selfSamples <= shares[0].totalSamples);
+
+    std::ostringstream folded;
+    profiler.writeFolded(folded);
+    std::string line;
+    std::istringstream lines(folded.str());
+    uint64_t total = 0;
+    while (std::getline(lines, line))
+        total += std::strtoull(line.substr(line.rfind(' ') + 1).c_str(), NULL, 10);
+    BOOST_CHECK_EQUAL(total, profiler.getSampleCount());
+
+    std::ostringstream text;
+    profiler.writeModuleShares(text);
+    BOOST_CHECK(text.str().find("total=") != std::string::npos);
+
+    profiler.clear();
+    BOOST_CHECK_EQUAL(profiler.getSampleCount(), 0u);
+}
+#endif
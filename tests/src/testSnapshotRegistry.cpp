@@ -0,0 +1,106 @@
+//          Copyright Jeremy Coulon 2012-2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+//==============
+//==  Plugin  ==
+//==============
+#include "Plugin/IPlugin.h"
+#include "Plugin/SnapshotRegistry.h"
+
+//=============
+//==  Boost  ==
+//=============
+#include <boost/test/unit_test.hpp>
+#include <boost/filesystem.hpp>
+
+//===========
+//==  STD  ==
+//===========
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+BOOST_AUTO_TEST_CASE(SnapshotOutlivesRemoval)
+{
+    boost::filesystem::path myPluginPath(MYPLUGIN_PATH);
+    std::string name = myPluginPath.native();
+
+    Plugin::SnapshotRegistry<Plugin::IPlugin> registry(4);
+    {
+        Plugin::SnapshotRegistry<Plugin::IPlugin>::Reader empty(registry);
+        BOOST_CHECK_EQUAL(empty->size(), 0u);
+        BOOST_CHECK_EQUAL(empty->getVersion(), 0u);
+    }
+    BOOST_CHECK(!registry.add("noSuchPlugin"));
+    BOOST_CHECK(!registry.getErrorMsg().empty());
+    BOOST_CHECK_EQUAL(registry.getVersion(), 0u);
+
+    BOOST_REQUIRE(registry.add(name));
+    BOOST_CHECK_EQUAL(registry.getVersion(), 1u);
+    {
+        Plugin::SnapshotRegistry<Plugin::IPlugin>::Reader reader(registry);
+        Plugin::IPlugin* plugin = reader->get(name);
+        BOOST_REQUIRE(plugin != NULL);
+        BOOST_CHECK(reader->get("unknown") == NULL);
+
+        // The reader keeps its snapshot, and the plugin, while newer ones are published
+        BOOST_CHECK(registry.remove(name));
+        BOOST_CHECK(!registry.remove(name));
+        BOOST_CHECK_EQUAL(registry.reclaim(), 1u);
+        BOOST_CHECK_EQUAL(reader->getVersion(), 1u);
+        BOOST_CHECK_EQUAL(plugin->iGetPluginName(), "Example");
+
+        Plugin::SnapshotRegistry<Plugin::IPlugin>::Reader latest(registry);
+        BOOST_CHECK_EQUAL(latest->getVersion(), 2u);
+        BOOST_CHECK_EQUAL(latest->size(), 0u);
+    }
+    BOOST_CHECK_EQUAL(registry.reclaim(), 0u);
+}
+
+BOOST_AUTO_TEST_CASE(SnapshotReadersDuringPublications)
+{
+    boost::filesystem::path myPluginPath(MYPLUGIN_PATH);
+    std::string name = myPluginPath.native();
+
+    Plugin::SnapshotRegistry<Plugin::IPlugin> registry;
+    BOOST_REQUIRE(registry.publish(std::vector<std::string>(1, name)));
+
+    std::atomic<bool> stop(false);
+    std::atomic<int> failures(0);
+    std::atomic<int> reads(0);
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 3; ++t)
+    {
+        readers.push_back(std::thread([&]()
+        {
+            while (!stop.load())
+            {
+                Plugin::SnapshotRegistry<Plugin::IPlugin>::Reader reader(registry);
+                Plugin::IPlugin* plugin = reader->get(name);
+                if (reader->size() > 1 || (plugin && plugin->iGetPluginName() != "Example"))
+                    ++failures;
+                ++reads;
+            }
+        }));
+    }
+    // Remove and add the plugin again while readers may still use it
+    for (int i = 0; i < 200; ++i)
+    {
+        if (!(i % 2 ? registry.add(name) : registry.remove(name)))
+            ++failures;
+        std::this_thread::yield();
+    }
+    stop.store(true);
+    for (std::size_t t = 0; t < readers.size(); ++t)
+        readers[t].join();
+
+    BOOST_CHECK_EQUAL(failures.load(), 0);
+    BOOST_CHECK(reads.load() > 0);
+    BOOST_CHECK_EQUAL(registry.reclaim(), 0u);
+    BOOST_CHECK_EQUAL(registry.getVersion(), 201u);
+    Plugin::SnapshotRegistry<Plugin::IPlugin>::Reader reader(registry);
+    BOOST_CHECK(reader->get(name) != NULL);
+}
@@ -0,0 +1,141 @@
+//          Copyright Jeremy Coulon 2012-2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+//==============
+//==  Plugin  ==
+//==============
+#include "Plugin/IPlugin.h"
+#include "Plugin/PluginLoader.h"
+#include "Plugin/StaticProbes.h"
+
+//=============
+//==  Boost  ==
+//=============
+#include <boost/test/unit_test.hpp>
+
+//===========
+//==  STD  ==
+//===========
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+#if PLUGIN_HAS_USDT
+#include <elf.h>
+
+namespace StaticProbesTest
+{
+    struct Probe
+    {
+        std::string provider;
+        std::string name;
+        std::string arguments;
+        uint64_t address;
+    };
+
+    // Read the probes of an ELF file, and whether each one points to a NOP
+    bool readProbes(const std::string& path, std::vector<Probe>& probes, std::vector<bool>& nops)
+    {
+        std::ifstream file(path.c_str(), std::ios::binary);
+        std::vector<char> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        if (data.size() < sizeof(Elf64_Ehdr))
+            return false;
+        const Elf64_Ehdr* header = reinterpret_cast<const Elf64_Ehdr*>(&data[0]);
+        const Elf64_Shdr* sections = reinterpret_cast<const Elf64_Shdr*>(&data[header->e_shoff]);
+        const char* names = &data[sections[header->e_shstrndx].sh_offset];
+        for (int s = 0; s < header->e_shnum; ++s)
+        {
+            if (sections[s].sh_type != SHT_NOTE || std::strcmp(names + sections[s].sh_name, ".note.stapsdt") != 0)
+                continue;
+            std::size_t offset = sections[s].sh_offset;
+            std::size_t end = offset + sections[s].sh_size;
+            while (offset + sizeof(Elf64_Nhdr) <= end)
+            {
+                const Elf64_Nhdr* note = reinterpret_cast<const Elf64_Nhdr*>(&data[offset]);
+                const char* owner = &data[offset + sizeof(Elf64_Nhdr)];
+                const char* desc = owner + ((note->n_namesz + 3) & ~3u);
+                if (note->n_type == 3 && std::strcmp(owner, "stapsdt") == 0)
+                {
+                    Probe probe;
+                    std::memcpy(&probe.address, desc, sizeof(probe.address));
+                    probe.provider = desc + 3 * sizeof(uint64_t);
+                    probe.name = desc + 3 * sizeof(uint64_t) + probe.provider.size() + 1;
+                    probe.arguments = desc + 3 * sizeof(uint64_t) + probe.provider.size() + probe.name.size() + 2;
+                    probes.push_back(probe);
+                }
+                offset = desc - &data[0] + ((note->n_descsz + 3) & ~3u);
+            }
+        }
+        for (std::size_t p = 0; p < probes.size(); ++p)
+        {
+            bool nop = false;
+            for (int s = 0; s < header->e_shnum; ++s)
+            {
+                const Elf64_Shdr& section = sections[s];
+                if (section.sh_type != SHT_PROGBITS || !(section.sh_flags & SHF_EXECINSTR)
+                    || probes[p].address < section.sh_addr || probes[p].address >= section.sh_addr + section.sh_size)
+                    continue;
+                const unsigned char* code = reinterpret_cast<const unsigned char*>(&data[section.sh_offset + probes[p].address - section.sh_addr]);
+#if defined(__x86_64__)
+                nop = code[0] == 0x90;
+#elif defined(__aarch64__)
+                uint32_t instruction;
+                std::memcpy(&instruction, code, sizeof(instruction));
+                nop = instruction == 0xd503201f;
+#endif
+            }
+            nops.push_back(nop);
+        }
+        return true;
+    }
+}
+
+BOOST_AUTO_TEST_CASE(PluginLoaderProbesAreInElfNotes)
+{
+    // Instantiate a loader with the default policies, so that its probes are in this executable:
+    // they must not depend on any opt-in
+    Plugin::PluginLoader<Plugin::IPlugin> loader(MYPLUGIN_PATH);
+    BOOST_REQUIRE(loader.load());
+    BOOST_REQUIRE(loader.getPluginInstance() != NULL);
+    BOOST_REQUIRE(loader.unload());
+
+    std::vector<StaticProbesTest::Probe> probes;
+    std::vector<bool> nops;
+    BOOST_REQUIRE(StaticProbesTest::readProbes("/proc/self/exe", probes, nops));
+
+    // Number of arguments of each probe
+    std::map<std::string, int> expected;
+    expected["load_begin"] = 1;
+    expected["load_end"] = 2;
+    expected["dlsym"] = 3;
+    expected["create"] = 2;
+    expected["destroy"] = 2;
+    expected["unload"] = 2;
+    std::map<std::string, int> found;
+    for (std::size_t i = 0; i < probes.size(); ++i)
+    {
+        if (probes[i].provider != "plugin")
+            continue;
+        ++found[probes[i].name];
+        BOOST_CHECK_MESSAGE(nops[i], "Probe " << probes[i].name << " is not on a NOP");
+        std::istringstream iss(probes[i].arguments);
+        std::string argument;
+        int count = 0;
+        while (iss >> argument)
+        {
+            BOOST_CHECK_MESSAGE(argument.find('@') != std::string::npos, "Bad argument " << argument);
+            ++count;
+        }
+        BOOST_CHECK_EQUAL(count, expected[probes[i].name]);
+    }
+    for (std::map<std::string, int>::const_iterator it = expected.begin(); it != expected.end(); ++it)
+        BOOST_CHECK_MESSAGE(found[it->first] > 0, "Missing probe plugin:" << it->first);
+}
+#endif
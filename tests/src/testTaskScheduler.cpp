@@ -0,0 +1,173 @@
+//          Copyright Jeremy Coulon 2012-2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+//==============
+//==  Plugin  ==
+//==============
+#include "Plugin/PluginHostServices.h"
+#include "Plugin/TaskScheduler.h"
+
+//=============
+//==  Boost  ==
+//=============
+#include <boost/test/unit_test.hpp>
+
+//===========
+//==  STD  ==
+//===========
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    // Sum [begin, end) by splitting in two tasks until small enough
+    long long parallelSum(const Plugin::SchedulerClient& client, int begin, int end, std::atomic<int>& failures)
+    {
+        if (end - begin <= 64)
+        {
+            long long sum = 0;
+            for (int i = begin; i < end; ++i)
+                sum += i;
+            return sum;
+        }
+        int middle = begin + (end - begin) / 2;
+        long long left = 0;
+        uint64_t task = client.submit([&]() { left = parallelSum(client, begin, middle, failures); });
+        if (task == 0)
+            ++failures;
+        long long right = parallelSum(client, middle, end, failures);
+        if (!client.wait(task))
+            ++failures;
+        return left + right;
+    }
+
+    // Let a task run only once opened
+    class Gate
+    {
+    public:
+        Gate()
+            : open_(false)
+        {
+            // Empty
+        }
+
+        void open()
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            open_ = true;
+            cond_.notify_all();
+        }
+
+        void pass()
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cond_.wait(lock, [this]() { return open_; });
+        }
+
+    private:
+        bool open_;
+        std::mutex mutex_;
+        std::condition_variable cond_;
+    };
+}
+
+BOOST_AUTO_TEST_CASE(SchedulerThroughHostServices)
+{
+    Plugin::TaskScheduler scheduler(3);
+    Plugin::HostServices services;
+    services.add(PLUGIN_SCHEDULER_SERVICE, scheduler.createClient("libMyPlugin.so", Plugin::taskPriorityNormal, 1));
+
+    Plugin::SchedulerClient client(services.table());
+    BOOST_REQUIRE(client.isAvailable());
+    BOOST_CHECK_EQUAL(client.concurrency(), 3u);
+
+    // Tasks waiting for their subtasks do not deadlock, even with a quota of one worker
+    std::atomic<int> failures(0);
+    BOOST_CHECK_EQUAL(parallelSum(client, 0, 10000, failures), 49995000LL);
+    BOOST_CHECK_EQUAL(failures.load(), 0);
+
+    scheduler.waitIdle();
+    Plugin::SchedulerClientStats stats;
+    BOOST_REQUIRE(scheduler.getClientStats("libMyPlugin.so", stats));
+    BOOST_CHECK(stats.submitted > 0);
+    BOOST_CHECK_EQUAL(stats.completed, stats.submitted);
+    BOOST_CHECK_EQUAL(stats.running, 0u);
+    BOOST_CHECK(!scheduler.getClientStats("unknown", stats));
+
+    Plugin::SchedulerClient missing(NULL);
+    BOOST_CHECK(!missing.isAvailable());
+}
+
+BOOST_AUTO_TEST_CASE(SchedulerEnforcesQuota)
+{
+    Plugin::TaskScheduler scheduler(4);
+    Plugin::HostServices services;
+    services.add(PLUGIN_SCHEDULER_SERVICE, scheduler.createClient("limited", Plugin::taskPriorityNormal, 2));
+    Plugin::SchedulerClient limited(services.table());
+    std::atomic<int> running(0);
+    std::atomic<int> peak(0);
+    std::vector<uint64_t> tasks;
+    for (int i = 0; i < 40; ++i)
+    {
+        tasks.push_back(limited.submit([&]()
+        {
+            int now = ++running;
+            int seen = peak.load();
+            while (now > seen && !peak.compare_exchange_weak(seen, now))
+            {
+                // Retry
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            --running;
+        }));
+    }
+    for (std::size_t i = 0; i < tasks.size(); ++i)
+        limited.detach(tasks[i]);
+    scheduler.waitIdle();
+
+    Plugin::SchedulerClientStats stats;
+    BOOST_REQUIRE(scheduler.getClientStats("limited", stats));
+    BOOST_CHECK_EQUAL(stats.completed, 40u);
+    BOOST_CHECK(peak.load() >= 1 && peak.load() <= 2);
+}
+
+BOOST_AUTO_TEST_CASE(SchedulerRunsHigherPriorityFirst)
+{
+    Plugin::TaskScheduler scheduler(1);
+    const PluginSchedulerApi* low = scheduler.createClient("low", Plugin::taskPriorityLow);
+    const PluginSchedulerApi* high = scheduler.createClient("high", Plugin::taskPriorityHigh);
+    Plugin::HostServices lowServices;
+    lowServices.add(PLUGIN_SCHEDULER_SERVICE, low);
+    Plugin::HostServices highServices;
+    highServices.add(PLUGIN_SCHEDULER_SERVICE, high);
+    Plugin::SchedulerClient lowClient(lowServices.table());
+    Plugin::SchedulerClient highClient(highServices.table());
+
+    // Keep the only worker busy while both clients queue tasks
+    Gate gate;
+    uint64_t blocker = lowClient.submit([&gate]() { gate.pass(); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    BOOST_CHECK(!lowClient.wait(blocker, 10));
+
+    std::mutex mutex;
+    std::vector<int> order;
+    for (int i = 0; i < 5; ++i)
+        lowClient.detach(lowClient.submit([&mutex, &order]() { std::lock_guard<std::mutex> lock(mutex); order.push_back(0); }));
+    for (int i = 0; i < 5; ++i)
+        highClient.detach(highClient.submit([&mutex, &order]() { std::lock_guard<std::mutex> lock(mutex); order.push_back(1); }));
+    gate.open();
+    BOOST_CHECK(lowClient.wait(blocker));
+    scheduler.waitIdle();
+
+    BOOST_REQUIRE_EQUAL(order.size(), 10u);
+    for (std::size_t i = 0; i < 5; ++i)
+        BOOST_CHECK_EQUAL(order[i], 1);
+    for (std::size_t i = 5; i < 10; ++i)
+        BOOST_CHECK_EQUAL(order[i], 0);
+}
@@ -0,0 +1,17 @@
+//          Copyright Jeremy Coulon 2012-2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+//==============
+//==  Plugin  ==
+//==============
+#include "Plugin/IPluginDescription.h"
+#include "Plugin/RemotePluginHost.h"
+
+// Host process for plugins implementing Plugin::IPlugin.
+// Write the same three lines with your own interface to host your plugins out of process.
+int main(int argc, char** argv)
+{
+    return Plugin::runPluginHost<Plugin::IPlugin>(argc, argv);
+}
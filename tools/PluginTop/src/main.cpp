@@ -0,0 +1,163 @@
+//          Copyright Jeremy Coulon 2012-2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+//==============
+//==  Plugin  ==
+//==============
+#include "Plugin/PluginMetrics.h"
+
+//===========
+//==  STD  ==
+//===========
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <stdint.h>
+
+//=======================
+//==  OS Specific SDK  ==
+//=======================
+#include <signal.h>
+#include <unistd.h>
+
+// Live view of the plugin counters a process publishes with Plugin::MetricsSegment.
+// The segment is mapped read-only: the observed process is never interrupted.
+namespace
+{
+    typedef std::chrono::steady_clock Clock;
+
+    int usage(const char* program)
+    {
+        std::cerr << "Usage: " << program << " PID|SEGMENT [--interval MS] [--count N] [--openmetrics]" << std::endl
+                  << "  PID           Process publishing /plugin-metrics-PID" << std::endl
+                  << "  SEGMENT       Name of the segment, starting with '/'" << std::endl
+                  << "  --interval MS Refresh period, 1000 ms by default" << std::endl
+                  << "  --count N     Stop after N refreshes" << std::endl
+                  << "  --openmetrics Write the counters once in the OpenMetrics text format, and exit" << std::endl;
+        return 2;
+    }
+
+    std::string formatBytes(uint64_t bytes)
+    {
+        static const char* units[] = { "B", "KiB", "MiB", "GiB", "TiB" };
+        double value = static_cast<double>(bytes);
+        std::size_t unit = 0;
+        while (value >= 1024.0 && unit + 1 < sizeof(units) / sizeof(units[0]))
+        {
+            value /= 1024.0;
+            ++unit;
+        }
+        std::ostringstream oss;
+        oss << std::fixed << std::setprecision(unit ? 1 : 0) << value << " " << units[unit];
+        return oss.str();
+    }
+
+    // Per second rate of a counter between two refreshes
+    double rate(uint64_t before, uint64_t after, double seconds)
+    {
+        return seconds > 0.0 && after >= before ? (after - before) / seconds : 0.0;
+    }
+
+    void draw(const Plugin::MetricsView& view, const std::vector<Plugin::PluginMetricsSample>& samples,
+              const std::map<std::string, Plugin::PluginMetricsSample>& previous, double seconds, bool clear)
+    {
+        if (clear)
+            std::cout << "\033[H\033[2J";
+        double uptime = (std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count() - static_cast<double>(view.getStartTimeNs())) * 1e-9;
+        std::cout << "plugin-top - pid " << view.getPid() << ", up " << std::fixed << std::setprecision(0) << uptime
+                  << " s, " << samples.size() << " plugins" << std::endl << std::endl;
+        std::cout << std::left << std::setw(32) << "PLUGIN" << std::right
+                  << std::setw(7) << "LOADS" << std::setw(6) << "FAIL" << std::setw(6) << "INST"
+                  << std::setw(12) << "CALLS/s" << std::setw(10) << "ERR/s"
+                  << std::setw(14) << "CALLS" << std::setw(10) << "ERRORS"
+                  << std::setw(12) << "MEMORY" << std::setw(10) << "LOAD ms" << std::endl;
+        for (std::size_t i = 0; i < samples.size(); ++i)
+        {
+            const Plugin::PluginMetricsSample& sample = samples[i];
+            std::map<std::string, Plugin::PluginMetricsSample>::const_iterator it = previous.find(sample.name);
+            const Plugin::PluginMetricsSample& before = it != previous.end() ? it->second : sample;
+            std::string name = sample.name.size() > 31 ? "..." + sample.name.substr(sample.name.size() - 28) : sample.name;
+            std::cout << std::left << std::setw(32) << name << std::right
+                      << std::setw(7) << sample.loads << std::setw(6) << sample.failedLoads << std::setw(6) << sample.instances
+                      << std::setw(12) << std::setprecision(1) << rate(before.calls, sample.calls, seconds)
+                      << std::setw(10) << rate(before.errors, sample.errors, seconds)
+                      << std::setw(14) << sample.calls << std::setw(10) << sample.errors
+                      << std::setw(12) << formatBytes(sample.memoryBytes)
+                      << std::setw(10) << std::setprecision(2) << sample.lastLoadNs * 1e-6 << std::endl;
+        }
+        std::cout << std::flush;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+        return usage(argv[0]);
+    std::string target = argv[1];
+    long intervalMs = 1000;
+    long count = -1;
+    bool openMetrics = false;
+    for (int i = 2; i < argc; ++i)
+    {
+        if (std::strcmp(argv[i], "--interval") == 0 && i + 1 < argc)
+            intervalMs = std::atol(argv[++i]);
+        else if (std::strcmp(argv[i], "--count") == 0 && i + 1 < argc)
+            count = std::atol(argv[++i]);
+        else if (std::strcmp(argv[i], "--openmetrics") == 0)
+            openMetrics = true;
+        else
+            return usage(argv[0]);
+    }
+    if (intervalMs <= 0)
+        return usage(argv[0]);
+
+    std::string name = target[0] == '/' ? target : Plugin::MetricsSegment::defaultName(std::strtoull(target.c_str(), NULL, 10));
+    Plugin::MetricsView view;
+    if (!view.open(name))
+    {
+        std::cerr << "Cannot attach to " << name << ": " << view.getErrorMsg() << std::endl;
+        return 1;
+    }
+
+    std::vector<Plugin::PluginMetricsSample> samples;
+    view.getSamples(samples);
+    if (openMetrics)
+    {
+        Plugin::writeOpenMetrics(std::cout, samples);
+        return 0;
+    }
+
+    bool clear = isatty(STDOUT_FILENO) != 0;
+    std::map<std::string, Plugin::PluginMetricsSample> previous;
+    Clock::time_point last = Clock::now();
+    for (long refresh = 0; count < 0 || refresh < count; ++refresh)
+    {
+        previous.clear();
+        for (std::size_t i = 0; i < samples.size(); ++i)
+            previous[samples[i].name] = samples[i];
+        std::this_thread::sleep_for(std::chrono::milliseconds(intervalMs));
+        // The segment stays mapped after the process exits: check that it is still alive
+        if (kill(static_cast<pid_t>(view.getPid()), 0) != 0 && errno == ESRCH)
+        {
+            std::cout << "Process " << view.getPid() << " exited" << std::endl;
+            return 0;
+        }
+        view.getSamples(samples);
+        Clock::time_point now = Clock::now();
+        draw(view, samples, previous, std::chrono::duration<double>(now - last).count(), clear);
+        last = now;
+    }
+    return 0;
+}